@@ -0,0 +1,421 @@
+/* Linux io_uring(7) based ae.c module
+ *
+ * Readiness is obtained with one-shot IORING_OP_POLL_ADD requests, one for
+ * every file descriptor with registered events. Requests are not submitted
+ * when the events of a file descriptor change, but queued in the submission
+ * ring, and the whole batch is submitted by the same io_uring_enter(2) call
+ * that waits for completions. So a loop iteration costs a single syscall,
+ * while with epoll every change of the registered events costs an
+ * additional epoll_ctl(2) call.
+ *
+ * One-shot requests are re-armed after they fire, so that events are level
+ * triggered like in the other backends: a new poll request completes ASAP
+ * if the file descriptor is already ready.
+ *
+ * When io_uring is not usable (old kernel, disabled via sysctl or seccomp,
+ * or disabled with aeSetIoUring()) the epoll backend is used instead.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <stdint.h>
+
+/* The epoll backend, with its functions renamed, is the fallback. */
+#define aeApiState aeEpollState
+#define aeApiCreate aeEpollCreate
+#define aeApiResize aeEpollResize
+#define aeApiFree aeEpollFree
+#define aeApiAddEvent aeEpollAddEvent
+#define aeApiDelEvent aeEpollDelEvent
+#define aeApiPoll aeEpollPoll
+#define aeApiName aeEpollName
+#include "ae_epoll.c"
+#undef aeApiState
+#undef aeApiCreate
+#undef aeApiResize
+#undef aeApiFree
+#undef aeApiAddEvent
+#undef aeApiDelEvent
+#undef aeApiPoll
+#undef aeApiName
+
+#define AE_IOURING_MAX_SQ_ENTRIES 4096
+#define AE_IOURING_MAX_CQ_ENTRIES 65536
+/* user_data of POLL_REMOVE requests, whose completions are ignored. The
+ * user_data of POLL_ADD requests is (generation << 32 | fd). */
+#define AE_IOURING_REMOVE_UDATA UINT64_MAX
+
+typedef struct aeApiState {
+    aeEpollState *epoll;    /* Not NULL if we fell back to epoll. */
+    int ringfd;
+    /* Submission queue. */
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned to_submit;     /* Queued SQEs not yet submitted. */
+    /* Completion queue. */
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* Per file descriptor state. */
+    int *armed;             /* AE mask of the armed poll request, if any. */
+    uint32_t *gen;          /* Generation of the last poll request. */
+    int *dirty;             /* Fds whose armed mask may be outdated. */
+    unsigned char *isdirty; /* True if the fd is in 'dirty'. */
+    int numdirty;
+} aeApiState;
+
+static int aeIoUringEnabled = 1;
+static char *aeIoUringApiName = "io_uring";
+
+/* Select whether event loops created from now on should use io_uring, if
+ * the kernel supports it, or just the epoll backend. */
+void aeSetIoUring(int enabled) {
+    aeIoUringEnabled = enabled;
+}
+
+/* Run a call of the epoll backend against the fallback state. */
+#define aeEpollCall(eventLoop,state,call) do { \
+    (eventLoop)->apidata = (state)->epoll; \
+    call; \
+    (eventLoop)->apidata = (state); \
+} while(0)
+
+static int aeIoUringEnter(aeApiState *state, unsigned to_submit,
+                          unsigned min_complete, unsigned flags,
+                          struct io_uring_getevents_arg *arg)
+{
+    int retval = syscall(__NR_io_uring_enter,state->ringfd,to_submit,
+                         min_complete,flags,arg,arg ? sizeof(*arg) : 0);
+    if (retval >= 0) {
+        state->to_submit -= (unsigned)retval < state->to_submit ?
+                            (unsigned)retval : state->to_submit;
+    }
+    return retval;
+}
+
+static void aeIoUringUnmap(aeApiState *state) {
+    if (state->sq_ring) munmap(state->sq_ring,state->sq_ring_size);
+    if (state->cq_ring) munmap(state->cq_ring,state->cq_ring_size);
+    if (state->sqes) munmap(state->sqes,state->sqes_size);
+}
+
+/* Setup the ring. Returns -1 if io_uring is not usable. */
+static int aeIoUringSetup(aeApiState *state, int setsize) {
+    struct io_uring_params p;
+    unsigned sq_entries = 1, cq_entries = 1;
+
+    while (sq_entries < (unsigned)setsize &&
+           sq_entries < AE_IOURING_MAX_SQ_ENTRIES) sq_entries <<= 1;
+    while (cq_entries < (unsigned)setsize*2 &&
+           cq_entries < AE_IOURING_MAX_CQ_ENTRIES) cq_entries <<= 1;
+    if (cq_entries < sq_entries) cq_entries = sq_entries;
+
+    memset(&p,0,sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    state->ringfd = syscall(__NR_io_uring_setup,sq_entries,&p);
+    if (state->ringfd == -1) return -1;
+
+    /* We need the completion queue to never drop events, and a timeout
+     * in io_uring_enter(2). */
+    if (!(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_EXT_ARG)) goto err;
+
+    state->sq_ring_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cq_ring_size = p.cq_off.cqes +
+                          p.cq_entries*sizeof(struct io_uring_cqe);
+    state->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sq_ring = mmap(NULL,state->sq_ring_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,state->ringfd,IORING_OFF_SQ_RING);
+    state->cq_ring = mmap(NULL,state->cq_ring_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,state->ringfd,IORING_OFF_CQ_RING);
+    state->sqes = mmap(NULL,state->sqes_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,state->ringfd,IORING_OFF_SQES);
+    if (state->sq_ring == MAP_FAILED) state->sq_ring = NULL;
+    if (state->cq_ring == MAP_FAILED) state->cq_ring = NULL;
+    if (state->sqes == MAP_FAILED) state->sqes = NULL;
+    if (!state->sq_ring || !state->cq_ring || !state->sqes) goto err;
+
+    state->sq_head = (unsigned*)((char*)state->sq_ring + p.sq_off.head);
+    state->sq_tail = (unsigned*)((char*)state->sq_ring + p.sq_off.tail);
+    state->sq_mask = (unsigned*)((char*)state->sq_ring + p.sq_off.ring_mask);
+    state->sq_array = (unsigned*)((char*)state->sq_ring + p.sq_off.array);
+    state->sq_entries = p.sq_entries;
+    state->cq_head = (unsigned*)((char*)state->cq_ring + p.cq_off.head);
+    state->cq_tail = (unsigned*)((char*)state->cq_ring + p.cq_off.tail);
+    state->cq_mask = (unsigned*)((char*)state->cq_ring + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)((char*)state->cq_ring +
+                                         p.cq_off.cqes);
+    return 0;
+
+err:
+    aeIoUringUnmap(state);
+    close(state->ringfd);
+    return -1;
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = zcalloc(sizeof(aeApiState));
+
+    if (!aeIoUringEnabled || aeIoUringSetup(state,eventLoop->setsize) == -1) {
+        if (aeEpollCreate(eventLoop) == -1) {
+            zfree(state);
+            return -1;
+        }
+        state->epoll = eventLoop->apidata;
+        eventLoop->apidata = state;
+        aeIoUringApiName = aeEpollName();
+        return 0;
+    }
+    state->armed = zcalloc(sizeof(int)*eventLoop->setsize);
+    state->gen = zcalloc(sizeof(uint32_t)*eventLoop->setsize);
+    state->dirty = zmalloc(sizeof(int)*eventLoop->setsize);
+    state->isdirty = zcalloc(eventLoop->setsize);
+    eventLoop->apidata = state;
+    aeIoUringApiName = "io_uring";
+    return 0;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+    int j;
+
+    if (state->epoll) {
+        aeEpollCall(eventLoop,state,aeEpollResize(eventLoop,setsize));
+        return 0;
+    }
+    /* Fds >= setsize are not registered, since ae.c checks maxfd. */
+    state->armed = zrealloc(state->armed,sizeof(int)*setsize);
+    state->gen = zrealloc(state->gen,sizeof(uint32_t)*setsize);
+    state->dirty = zrealloc(state->dirty,sizeof(int)*setsize);
+    state->isdirty = zrealloc(state->isdirty,setsize);
+    for (j = eventLoop->setsize; j < setsize; j++) {
+        state->armed[j] = 0;
+        state->gen[j] = 0;
+        state->isdirty[j] = 0;
+    }
+    /* When shrinking, the dirty fds out of range have no events at all. */
+    for (j = 0; j < state->numdirty; j++) {
+        if (state->dirty[j] >= setsize)
+            state->dirty[j--] = state->dirty[--state->numdirty];
+    }
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (state->epoll) {
+        aeEpollCall(eventLoop,state,aeEpollFree(eventLoop));
+    } else {
+        aeIoUringUnmap(state);
+        close(state->ringfd);
+        zfree(state->armed);
+        zfree(state->gen);
+        zfree(state->dirty);
+        zfree(state->isdirty);
+    }
+    zfree(state);
+}
+
+/* Return a zeroed SQE to fill, submitting the queued ones if the ring is
+ * full. Returns NULL on error. */
+static struct io_uring_sqe *aeIoUringGetSqe(aeApiState *state) {
+    unsigned tail = *state->sq_tail, head, idx;
+    struct io_uring_sqe *sqe;
+
+    head = __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+    if (tail-head == state->sq_entries) {
+        if (aeIoUringEnter(state,state->to_submit,0,0,NULL) == -1)
+            return NULL;
+        head = __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+        if (tail-head == state->sq_entries) return NULL;
+    }
+    idx = tail & *state->sq_mask;
+    sqe = &state->sqes[idx];
+    memset(sqe,0,sizeof(*sqe));
+    state->sq_array[idx] = idx;
+    __atomic_store_n(state->sq_tail,tail+1,__ATOMIC_RELEASE);
+    state->to_submit++;
+    return sqe;
+}
+
+/* Queue the removal of the poll request armed for 'fd'. Its completion, if
+ * still delivered, is then ignored because of the generation change. */
+static int aeIoUringDisarm(aeApiState *state, int fd) {
+    struct io_uring_sqe *sqe;
+
+    if (!state->armed[fd]) return 0;
+    if ((sqe = aeIoUringGetSqe(state)) == NULL) return -1;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = ((uint64_t)state->gen[fd] << 32) | (uint32_t)fd;
+    sqe->user_data = AE_IOURING_REMOVE_UDATA;
+    state->armed[fd] = 0;
+    state->gen[fd]++;
+    return 0;
+}
+
+static int aeIoUringArm(aeApiState *state, int fd, int mask) {
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = aeIoUringGetSqe(state)) == NULL) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    if (mask & AE_READABLE) sqe->poll32_events |= POLLIN;
+    if (mask & AE_WRITABLE) sqe->poll32_events |= POLLOUT;
+    sqe->user_data = ((uint64_t)state->gen[fd] << 32) | (uint32_t)fd;
+    state->armed[fd] = mask;
+    return 0;
+}
+
+static void aeIoUringMarkDirty(aeApiState *state, int fd) {
+    if (state->isdirty[fd]) return;
+    state->isdirty[fd] = 1;
+    state->dirty[state->numdirty++] = fd;
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+    int retval;
+
+    if (state->epoll) {
+        aeEpollCall(eventLoop,state,
+            retval = aeEpollAddEvent(eventLoop,fd,mask));
+        return retval;
+    }
+    /* The poll request is (re)armed by the next aeApiPoll() call. */
+    aeIoUringMarkDirty(state,fd);
+    return 0;
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+    int mask = eventLoop->events[fd].mask & (~delmask);
+
+    if (state->epoll) {
+        aeEpollCall(eventLoop,state,aeEpollDelEvent(eventLoop,fd,delmask));
+        return;
+    }
+    if (mask & (AE_READABLE|AE_WRITABLE)) {
+        aeIoUringMarkDirty(state,fd);
+    } else if (state->armed[fd]) {
+        /* A pending poll request holds a reference to the file: the
+         * removal is submitted ASAP since the caller is likely going to
+         * close the file descriptor. */
+        if (aeIoUringDisarm(state,fd) == 0)
+            aeIoUringEnter(state,state->to_submit,0,0,NULL);
+    }
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned head, tail;
+    int j, numevents = 0;
+
+    if (state->epoll) {
+        aeEpollCall(eventLoop,state,
+            numevents = aeEpollPoll(eventLoop,tvp));
+        return numevents;
+    }
+
+    /* Queue the poll requests of the file descriptors whose registered
+     * events changed, or whose one-shot request fired. */
+    for (j = 0; j < state->numdirty; j++) {
+        int fd = state->dirty[j];
+        int mask = eventLoop->events[fd].mask & (AE_READABLE|AE_WRITABLE);
+
+        state->isdirty[fd] = 0;
+        if (state->armed[fd] == mask) continue;
+        if (aeIoUringDisarm(state,fd) == -1) continue;
+        if (mask) aeIoUringArm(state,fd,mask);
+    }
+    state->numdirty = 0;
+
+    /* Submit them and wait for completions with a single call. */
+    memset(&arg,0,sizeof(arg));
+    arg.sigmask_sz = _NSIG/8;
+    if (tvp) {
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec*1000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    if (tvp && tvp->tv_sec == 0 && tvp->tv_usec == 0) {
+        aeIoUringEnter(state,state->to_submit,0,IORING_ENTER_GETEVENTS,NULL);
+    } else {
+        aeIoUringEnter(state,state->to_submit,1,
+            IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,&arg);
+    }
+
+    /* Reap the completions. Errors like ETIME or EINTR are not different
+     * from no completions at all. */
+    head = *state->cq_head;
+    tail = __atomic_load_n(state->cq_tail,__ATOMIC_ACQUIRE);
+    while (head != tail && numevents < eventLoop->setsize) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cq_mask];
+        uint64_t udata = cqe->user_data;
+        int fd = (int)(udata & 0xffffffff);
+        int mask = 0;
+
+        head++;
+        if (udata == AE_IOURING_REMOVE_UDATA) continue;
+        if (fd >= eventLoop->setsize || state->armed[fd] == 0 ||
+            state->gen[fd] != (uint32_t)(udata >> 32)) continue;
+
+        /* The request is one-shot: re-arm it the next time. */
+        state->armed[fd] = 0;
+        state->gen[fd]++;
+        aeIoUringMarkDirty(state,fd);
+        if (cqe->res < 0) continue;
+
+        if (cqe->res & POLLIN) mask |= AE_READABLE;
+        if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+        if (cqe->res & POLLERR) mask |= AE_WRITABLE;
+        if (cqe->res & POLLHUP) mask |= AE_WRITABLE;
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = mask;
+        numevents++;
+    }
+    __atomic_store_n(state->cq_head,head,__ATOMIC_RELEASE);
+    return numevents;
+}
+
+static char *aeApiName(void) {
+    return aeIoUringApiName;
+}
@@ -34,6 +34,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <sys/time.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -246,6 +247,23 @@ static int anetSetReuseAddr(char *err, int fd) {
     return ANET_OK;
 }
 
+/* Allow several sockets to bind the same address and port, so that the
+ * kernel spreads the incoming connections among their accept queues. */
+int anetSetReusePort(char *err, int fd) {
+#ifdef SO_REUSEPORT
+    int yes = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+        anetSetError(err, "setsockopt SO_REUSEPORT: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    (void) fd;
+    anetSetError(err, "setsockopt SO_REUSEPORT: not supported");
+    return ANET_ERR;
+#endif
+}
+
 static int anetCreateSocket(char *err, int domain) {
     int s;
     if ((s = socket(domain, SOCK_STREAM, 0)) == -1) {
@@ -437,6 +455,27 @@ int anetWrite(int fd, char *buf, int count)
     return totlen;
 }
 
+/* Like writev(2), but when 'more' is true tell the kernel that more data
+ * is going to follow immediately, so that a partially filled segment is
+ * held back and merged with the next write (MSG_MORE, Linux only). On
+ * other systems this is just writev(2). */
+ssize_t anetWritev(int fd, struct iovec *iov, int iovcnt, int more)
+{
+#ifdef MSG_MORE
+    if (more) {
+        struct msghdr msg;
+
+        memset(&msg,0,sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        return sendmsg(fd,&msg,MSG_MORE);
+    }
+#else
+    (void) more;
+#endif
+    return writev(fd,iov,iovcnt);
+}
+
 static int anetListen(char *err, int s, struct sockaddr *sa, socklen_t len, int backlog) {
     if (bind(s,sa,len) == -1) {
         anetSetError(err, "bind: %s", strerror(errno));
@@ -462,7 +501,7 @@ static int anetV6Only(char *err, int s) {
     return ANET_OK;
 }
 
-static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog)
+static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog, int flags)
 {
     int s = -1, rv;
     char _port[6];  /* strlen("65535") */
@@ -484,6 +523,8 @@ static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backl
 
         if (af == AF_INET6 && anetV6Only(err,s) == ANET_ERR) goto error;
         if (anetSetReuseAddr(err,s) == ANET_ERR) goto error;
+        if (flags & ANET_REUSEPORT && anetSetReusePort(err,s) == ANET_ERR)
+            goto error;
         if (anetListen(err,s,p->ai_addr,p->ai_addrlen,backlog) == ANET_ERR) s = ANET_ERR;
         goto end;
     }
@@ -502,12 +543,24 @@ end:
 
 int anetTcpServer(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, ANET_NONE);
 }
 
 int anetTcp6Server(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog, ANET_NONE);
+}
+
+/* Like anetTcpServer() / anetTcp6Server() but the socket is created with
+ * SO_REUSEPORT set, so that more listeners can share the same address. */
+int anetTcpReusePortServer(char *err, int port, char *bindaddr, int backlog)
+{
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, ANET_REUSEPORT);
+}
+
+int anetTcp6ReusePortServer(char *err, int port, char *bindaddr, int backlog)
+{
+    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog, ANET_REUSEPORT);
 }
 
 int anetUnixServer(char *err, char *path, mode_t perm, int backlog)
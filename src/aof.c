@@ -631,9 +631,12 @@ struct client *createFakeClient(void) {
     c->fd = -1;
     c->name = NULL;
     c->querybuf = sdsempty();
+    c->qb_pos = 0;
     c->querybuf_peak = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->argv_len = 0;
+    c->argv_pool = NULL;
     c->bufpos = 0;
     c->flags = 0;
     c->btype = BLOCKED_NONE;
@@ -645,7 +648,7 @@ struct client *createFakeClient(void) {
     c->obuf_soft_limit_reached_time = 0;
     c->watched_keys = listCreate();
     c->peerid = NULL;
-    listSetFreeMethod(c->reply,decrRefCountVoid);
+    listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
     initClientMultiState(c);
     return c;
@@ -1106,25 +1109,25 @@ ssize_t aofReadDiffFromParent(void) {
 }
 
 int rewriteAppendOnlyFileRio(rio *aof) {
-    dictIterator *di = NULL;
+    dbIterator dbit, *di = NULL;
     dictEntry *de;
-    size_t processed = 0;
+    size_t processed = 0, keys = 0;
     long long now = mstime();
     int j;
 
     for (j = 0; j < server.dbnum; j++) {
         char selectcmd[] = "*2\r\n$6\r\nSELECT\r\n";
         redisDb *db = server.db+j;
-        dict *d = db->dict;
-        if (dictSize(d) == 0) continue;
-        di = dictGetSafeIterator(d);
+        if (dbSize(db) == 0) continue;
+        dbIteratorInit(&dbit,db,1);
+        di = &dbit;
 
         /* SELECT the new DB */
         if (rioWrite(aof,selectcmd,sizeof(selectcmd)-1) == 0) goto werr;
         if (rioWriteBulkLongLong(aof,j) == 0) goto werr;
 
         /* Iterate this DB writing every entry */
-        while((de = dictNext(di)) != NULL) {
+        while((de = dbIteratorNext(di)) != NULL) {
             sds keystr;
             robj key, *o;
             long long expiretime;
@@ -1171,14 +1174,15 @@ int rewriteAppendOnlyFileRio(rio *aof) {
                 processed = aof->processed_bytes;
                 aofReadDiffFromParent();
             }
+            if ((++keys & 1023) == 0) sendChildInfoProgress();
         }
-        dictReleaseIterator(di);
+        dbIteratorRelease(di);
         di = NULL;
     }
     return C_OK;
 
 werr:
-    if (di) dictReleaseIterator(di);
+    if (di) dbIteratorRelease(di);
     return C_ERR;
 }
 
@@ -1390,6 +1394,7 @@ int rewriteAppendOnlyFileBackground(void) {
 
         /* Child */
         closeListeningSockets(0);
+        setChildInfoType(CHILD_INFO_TYPE_AOF);
         redisSetProcTitle("redis-aof-rewrite");
         snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof", (int) getpid());
         if (rewriteAppendOnlyFile(tmpfile) == C_OK) {
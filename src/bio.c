@@ -24,6 +24,14 @@
  * recently inserted to the most recently inserted (older jobs processed
  * first).
  *
+ * The only exception is BIO_LAZY_FREE, that can be served by multiple
+ * threads (see the lazyfree-threads option), since the order in which
+ * objects are released does not matter. Its jobs are not kept in a list
+ * but in a bounded lock free MPMC queue: submitting a job and fetching it
+ * from a worker just claim a slot of the queue with a compare and swap,
+ * and the mutex is only used to sleep when there is nothing to do. If the
+ * queue is full the job is executed by the caller.
+ *
  * Currently there is no way for the creator of the job to be notified about
  * the completion of the operation, this will only be added when/if needed.
  *
@@ -62,6 +70,8 @@
 #include "bio.h"
 
 static pthread_t bio_threads[BIO_NUM_OPS];
+static pthread_t bio_lazyfree_threads[LAZYFREE_MAX_THREADS];
+static int bio_lazyfree_numthreads;
 static pthread_mutex_t bio_mutex[BIO_NUM_OPS];
 static pthread_cond_t bio_newjob_cond[BIO_NUM_OPS];
 static pthread_cond_t bio_step_cond[BIO_NUM_OPS];
@@ -81,12 +91,84 @@ struct bio_job {
     /* Job specific arguments pointers. If we need to pass more than three
      * arguments we can just pass a pointer to a structure or alike. */
     void *arg1, *arg2, *arg3;
+    lazyFreeFn *free_fn; /* Only used by BIO_LAZY_FREE jobs. */
 };
 
 void *bioProcessBackgroundJobs(void *arg);
-void lazyfreeFreeObjectFromBioThread(robj *o);
-void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2);
-void lazyfreeFreeSlotsMapFromBioThread(zskiplist *sl);
+void *bioProcessLazyFreeJobs(void *arg);
+
+/* ------------------------- Lock free lazyfree queue ------------------------
+ * This is the bounded MPMC queue by Dmitry Vyukov: every cell has a sequence
+ * number telling if it is ready to be written (seq == pos) or read
+ * (seq == pos+1) by whoever claimed the position 'pos' incrementing the
+ * enqueue or dequeue counter. The __sync builtins imply a full barrier and
+ * are available wherever atomicvar.h is able to use them. */
+typedef struct bioQueueCell {
+    unsigned long seq;
+    struct bio_job *job;
+} bioQueueCell;
+
+static bioQueueCell bio_lazyfree_queue[BIO_LAZY_FREE_QUEUE_SIZE];
+static unsigned long bio_lazyfree_enqueue_pos, bio_lazyfree_dequeue_pos;
+static unsigned long bio_lazyfree_sleepers; /* Workers waiting for jobs. */
+static unsigned long bio_lazyfree_step_waiters; /* In bioWaitStepOfType(). */
+
+#define bioAtomicLoad(var) __sync_fetch_and_add(&(var),0)
+#define bioAtomicStore(var,value) do { \
+    __sync_synchronize(); \
+    (var) = (value); \
+} while(0)
+
+static void bioLazyFreeQueueInit(void) {
+    unsigned long j;
+
+    for (j = 0; j < BIO_LAZY_FREE_QUEUE_SIZE; j++)
+        bio_lazyfree_queue[j].seq = j;
+    bio_lazyfree_enqueue_pos = bio_lazyfree_dequeue_pos = 0;
+}
+
+/* Add a job to the queue. Returns 0 if the queue is full. */
+static int bioLazyFreeQueuePush(struct bio_job *job) {
+    unsigned long pos = bioAtomicLoad(bio_lazyfree_enqueue_pos);
+    bioQueueCell *cell;
+
+    while(1) {
+        cell = &bio_lazyfree_queue[pos & (BIO_LAZY_FREE_QUEUE_SIZE-1)];
+        long diff = (long)bioAtomicLoad(cell->seq) - (long)pos;
+        if (diff == 0) {
+            if (__sync_bool_compare_and_swap(&bio_lazyfree_enqueue_pos,
+                                             pos,pos+1)) break;
+        } else if (diff < 0) {
+            return 0;
+        }
+        pos = bioAtomicLoad(bio_lazyfree_enqueue_pos);
+    }
+    cell->job = job;
+    bioAtomicStore(cell->seq,pos+1);
+    return 1;
+}
+
+/* Fetch a job from the queue. Returns NULL if the queue is empty. */
+static struct bio_job *bioLazyFreeQueuePop(void) {
+    unsigned long pos = bioAtomicLoad(bio_lazyfree_dequeue_pos);
+    bioQueueCell *cell;
+    struct bio_job *job;
+
+    while(1) {
+        cell = &bio_lazyfree_queue[pos & (BIO_LAZY_FREE_QUEUE_SIZE-1)];
+        long diff = (long)bioAtomicLoad(cell->seq) - (long)(pos+1);
+        if (diff == 0) {
+            if (__sync_bool_compare_and_swap(&bio_lazyfree_dequeue_pos,
+                                             pos,pos+1)) break;
+        } else if (diff < 0) {
+            return NULL;
+        }
+        pos = bioAtomicLoad(bio_lazyfree_dequeue_pos);
+    }
+    job = cell->job;
+    bioAtomicStore(cell->seq,pos+BIO_LAZY_FREE_QUEUE_SIZE);
+    return job;
+}
 
 /* Make sure we have enough stack to perform all the things we do in the
  * main thread. */
@@ -107,6 +189,7 @@ void bioInit(void) {
         bio_jobs[j] = listCreate();
         bio_pending[j] = 0;
     }
+    bioLazyFreeQueueInit();
 
     /* Set the stack size as by default it may be small in some system */
     pthread_attr_init(&attr);
@@ -120,21 +203,46 @@ void bioInit(void) {
      * responsible of. */
     for (j = 0; j < BIO_NUM_OPS; j++) {
         void *arg = (void*)(unsigned long) j;
+        if (j == BIO_LAZY_FREE) continue;
         if (pthread_create(&thread,&attr,bioProcessBackgroundJobs,arg) != 0) {
             serverLog(LL_WARNING,"Fatal: Can't initialize Background Jobs.");
             exit(1);
         }
         bio_threads[j] = thread;
     }
+
+    /* The lazyfree jobs are served by a pool of threads. */
+    bio_lazyfree_numthreads = server.lazyfree_threads;
+    for (j = 0; j < bio_lazyfree_numthreads; j++) {
+        if (pthread_create(&thread,&attr,bioProcessLazyFreeJobs,NULL) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize Background Jobs.");
+            exit(1);
+        }
+        bio_lazyfree_threads[j] = thread;
+    }
+}
+
+/* Block SIGALRM so we are sure that only the main thread will receive the
+ * watchdog signal. */
+static void bioBlockSignals(void) {
+    sigset_t sigset;
+
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in bio.c thread: %s", strerror(errno));
 }
 
 void bioCreateBackgroundJob(int type, void *arg1, void *arg2, void *arg3) {
     struct bio_job *job = zmalloc(sizeof(*job));
 
+    serverAssert(type != BIO_LAZY_FREE);
     job->time = time(NULL);
     job->arg1 = arg1;
     job->arg2 = arg2;
     job->arg3 = arg3;
+    job->free_fn = NULL;
     pthread_mutex_lock(&bio_mutex[type]);
     listAddNodeTail(bio_jobs[type],job);
     bio_pending[type]++;
@@ -142,10 +250,108 @@ void bioCreateBackgroundJob(int type, void *arg1, void *arg2, void *arg3) {
     pthread_mutex_unlock(&bio_mutex[type]);
 }
 
+/* Run a lazyfree job and update the counters. */
+static void bioRunLazyFreeJob(struct bio_job *job) {
+    job->free_fn(job->arg1,job->arg2,job->arg3);
+    zfree(job);
+    __sync_sub_and_fetch(&bio_pending[BIO_LAZY_FREE],1);
+
+    /* Unblock threads blocked on bioWaitStepOfType() if any. */
+    if (bioAtomicLoad(bio_lazyfree_step_waiters)) {
+        pthread_mutex_lock(&bio_mutex[BIO_LAZY_FREE]);
+        pthread_cond_broadcast(&bio_step_cond[BIO_LAZY_FREE]);
+        pthread_mutex_unlock(&bio_mutex[BIO_LAZY_FREE]);
+    }
+}
+
+/* Submit a batch of lazyfree jobs, calling free_fn(args[j],NULL,NULL) for
+ * every argument. All the jobs are queued before waking up the workers, so
+ * that a burst of deletions costs a single wake up. */
+void bioCreateLazyFreeJobs(lazyFreeFn *free_fn, void **args, int count) {
+    time_t now = time(NULL);
+    int j, queued = 0;
+
+    __sync_add_and_fetch(&bio_pending[BIO_LAZY_FREE],count);
+    for (j = 0; j < count; j++) {
+        struct bio_job *job = zmalloc(sizeof(*job));
+
+        job->time = now;
+        job->arg1 = args[j];
+        job->arg2 = NULL;
+        job->arg3 = NULL;
+        job->free_fn = free_fn;
+        /* If the queue is full, or there are no threads at all, do the
+         * work here: this is our back pressure. */
+        if (bio_lazyfree_numthreads == 0 || !bioLazyFreeQueuePush(job))
+            bioRunLazyFreeJob(job);
+        else
+            queued++;
+    }
+
+    if (queued && bioAtomicLoad(bio_lazyfree_sleepers)) {
+        pthread_mutex_lock(&bio_mutex[BIO_LAZY_FREE]);
+        if (queued > 1)
+            pthread_cond_broadcast(&bio_newjob_cond[BIO_LAZY_FREE]);
+        else
+            pthread_cond_signal(&bio_newjob_cond[BIO_LAZY_FREE]);
+        pthread_mutex_unlock(&bio_mutex[BIO_LAZY_FREE]);
+    }
+}
+
+/* Submit a single lazyfree job calling free_fn(arg1,arg2,arg3). */
+void bioCreateLazyFreeJob(lazyFreeFn *free_fn, void *arg1, void *arg2,
+                          void *arg3)
+{
+    struct bio_job *job = zmalloc(sizeof(*job));
+
+    job->time = time(NULL);
+    job->arg1 = arg1;
+    job->arg2 = arg2;
+    job->arg3 = arg3;
+    job->free_fn = free_fn;
+    __sync_add_and_fetch(&bio_pending[BIO_LAZY_FREE],1);
+    if (bio_lazyfree_numthreads == 0 || !bioLazyFreeQueuePush(job)) {
+        bioRunLazyFreeJob(job);
+        return;
+    }
+    if (bioAtomicLoad(bio_lazyfree_sleepers)) {
+        pthread_mutex_lock(&bio_mutex[BIO_LAZY_FREE]);
+        pthread_cond_signal(&bio_newjob_cond[BIO_LAZY_FREE]);
+        pthread_mutex_unlock(&bio_mutex[BIO_LAZY_FREE]);
+    }
+}
+
+/* Main loop of the lazyfree worker threads. Workers only take the mutex
+ * when the queue looks empty, registering themselves as sleepers before
+ * checking the queue again, so that a producer that sees no sleepers after
+ * queueing a job is sure that some worker will find it. */
+void *bioProcessLazyFreeJobs(void *arg) {
+    struct bio_job *job;
+    UNUSED(arg);
+
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+    bioBlockSignals();
+
+    while(1) {
+        if ((job = bioLazyFreeQueuePop()) == NULL) {
+            pthread_mutex_lock(&bio_mutex[BIO_LAZY_FREE]);
+            __sync_add_and_fetch(&bio_lazyfree_sleepers,1);
+            if ((job = bioLazyFreeQueuePop()) == NULL)
+                pthread_cond_wait(&bio_newjob_cond[BIO_LAZY_FREE],
+                                  &bio_mutex[BIO_LAZY_FREE]);
+            __sync_sub_and_fetch(&bio_lazyfree_sleepers,1);
+            pthread_mutex_unlock(&bio_mutex[BIO_LAZY_FREE]);
+            if (job == NULL) continue;
+        }
+        bioRunLazyFreeJob(job);
+    }
+    return NULL;
+}
+
 void *bioProcessBackgroundJobs(void *arg) {
     struct bio_job *job;
     unsigned long type = (unsigned long) arg;
-    sigset_t sigset;
 
     /* Check that the type is within the right interval. */
     if (type >= BIO_NUM_OPS) {
@@ -160,13 +366,7 @@ void *bioProcessBackgroundJobs(void *arg) {
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
     pthread_mutex_lock(&bio_mutex[type]);
-    /* Block SIGALRM so we are sure that only the main thread will
-     * receive the watchdog signal. */
-    sigemptyset(&sigset);
-    sigaddset(&sigset, SIGALRM);
-    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
-        serverLog(LL_WARNING,
-            "Warning: can't mask SIGALRM in bio.c thread: %s", strerror(errno));
+    bioBlockSignals();
 
     while(1) {
         listNode *ln;
@@ -188,17 +388,6 @@ void *bioProcessBackgroundJobs(void *arg) {
             close((long)job->arg1);
         } else if (type == BIO_AOF_FSYNC) {
             aof_fsync((long)job->arg1);
-        } else if (type == BIO_LAZY_FREE) {
-            /* What we free changes depending on what arguments are set:
-             * arg1 -> free the object at pointer.
-             * arg2 & arg3 -> free two dictionaries (a Redis DB).
-             * only arg3 -> free the skiplist. */
-            if (job->arg1)
-                lazyfreeFreeObjectFromBioThread(job->arg1);
-            else if (job->arg2 && job->arg3)
-                lazyfreeFreeDatabaseFromBioThread(job->arg2,job->arg3);
-            else if (job->arg3)
-                lazyfreeFreeSlotsMapFromBioThread(job->arg3);
         } else {
             serverPanic("Wrong job type in bioProcessBackgroundJobs().");
         }
@@ -218,6 +407,8 @@ void *bioProcessBackgroundJobs(void *arg) {
 /* Return the number of pending jobs of the specified type. */
 unsigned long long bioPendingJobsOfType(int type) {
     unsigned long long val;
+    if (type == BIO_LAZY_FREE)
+        return bioAtomicLoad(bio_pending[type]);
     pthread_mutex_lock(&bio_mutex[type]);
     val = bio_pending[type];
     pthread_mutex_unlock(&bio_mutex[type]);
@@ -237,6 +428,20 @@ unsigned long long bioPendingJobsOfType(int type) {
 unsigned long long bioWaitStepOfType(int type) {
     unsigned long long val;
     pthread_mutex_lock(&bio_mutex[type]);
+    if (type == BIO_LAZY_FREE) {
+        /* The lazyfree workers update the pending count without the lock:
+         * register as a waiter before checking it, so that the worker
+         * completing the next job knows it has to wake us up. */
+        __sync_add_and_fetch(&bio_lazyfree_step_waiters,1);
+        val = bioAtomicLoad(bio_pending[type]);
+        if (val != 0) {
+            pthread_cond_wait(&bio_step_cond[type],&bio_mutex[type]);
+            val = bioAtomicLoad(bio_pending[type]);
+        }
+        __sync_sub_and_fetch(&bio_lazyfree_step_waiters,1);
+        pthread_mutex_unlock(&bio_mutex[type]);
+        return val;
+    }
     val = bio_pending[type];
     if (val != 0) {
         pthread_cond_wait(&bio_step_cond[type],&bio_mutex[type]);
@@ -253,7 +458,20 @@ unsigned long long bioWaitStepOfType(int type) {
 void bioKillThreads(void) {
     int err, j;
 
+    for (j = 0; j < bio_lazyfree_numthreads; j++) {
+        if (pthread_cancel(bio_lazyfree_threads[j]) == 0) {
+            if ((err = pthread_join(bio_lazyfree_threads[j],NULL)) != 0) {
+                serverLog(LL_WARNING,
+                    "Bio lazyfree thread #%d can be joined: %s",
+                        j, strerror(err));
+            } else {
+                serverLog(LL_WARNING,
+                    "Bio lazyfree thread #%d terminated",j);
+            }
+        }
+    }
     for (j = 0; j < BIO_NUM_OPS; j++) {
+        if (j == BIO_LAZY_FREE) continue;
         if (pthread_cancel(bio_threads[j]) == 0) {
             if ((err = pthread_join(bio_threads[j],NULL)) != 0) {
                 serverLog(LL_WARNING,
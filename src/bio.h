@@ -30,6 +30,10 @@
 /* Exported API */
 void bioInit(void);
 void bioCreateBackgroundJob(int type, void *arg1, void *arg2, void *arg3);
+typedef void lazyFreeFn(void *arg1, void *arg2, void *arg3);
+void bioCreateLazyFreeJob(lazyFreeFn *free_fn, void *arg1, void *arg2,
+                          void *arg3);
+void bioCreateLazyFreeJobs(lazyFreeFn *free_fn, void **args, int count);
 unsigned long long bioPendingJobsOfType(int type);
 unsigned long long bioWaitStepOfType(int type);
 time_t bioOlderJobOfType(int type);
@@ -40,3 +44,5 @@ void bioKillThreads(void);
 #define BIO_AOF_FSYNC     1 /* Deferred AOF fsync. */
 #define BIO_LAZY_FREE     2 /* Deferred objects freeing. */
 #define BIO_NUM_OPS       3
+
+#define BIO_LAZY_FREE_QUEUE_SIZE (1<<16) /* Must be a power of two. */
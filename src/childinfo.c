@@ -63,23 +63,62 @@ void sendChildInfo(int ptype) {
     if (server.child_info_pipe[1] == -1) return;
     server.child_info_data.magic = CHILD_INFO_MAGIC;
     server.child_info_data.process_type = ptype;
+    server.child_info_data.progress = 0;
     ssize_t wlen = sizeof(server.child_info_data);
     if (write(server.child_info_pipe[1],&server.child_info_data,wlen) != wlen) {
         /* Nothing to do on error, this will be detected by the other side. */
     }
 }
 
-/* Receive COW data from parent. */
+/* Type of the process if it is a child saving the dataset, otherwise -1. */
+static int child_info_type = -1;
+
+/* Called by the child just after the fork. */
+void setChildInfoType(int ptype) {
+    child_info_type = ptype;
+}
+
+/* Called while the dataset is saved, in order to let the parent know how
+ * much memory was copied so far. The size is computed from /proc/self/smaps,
+ * so it is sent at most once every CHILD_INFO_PERIOD milliseconds. Nothing
+ * is done if the process is not a child, like on SAVE. */
+void sendChildInfoProgress(void) {
+    static mstime_t last_report = 0;
+    mstime_t now = mstime();
+    ssize_t wlen = sizeof(server.child_info_data);
+
+    if (child_info_type == -1 || server.child_info_pipe[1] == -1 ||
+        now - last_report < CHILD_INFO_PERIOD) return;
+    last_report = now;
+    server.child_info_data.magic = CHILD_INFO_MAGIC;
+    server.child_info_data.process_type = child_info_type;
+    server.child_info_data.progress = 1;
+    server.child_info_data.cow_size = zmalloc_get_private_dirty(-1);
+    if (write(server.child_info_pipe[1],&server.child_info_data,wlen) != wlen) {
+        /* Nothing to do on error, the final report is what matters. */
+    }
+}
+
+/* Receive COW data from the child: the progress reports update the COW
+ * size of the active child, the final one the size of the last child of its
+ * type. The parent calls this function from serverCron() while the child is
+ * running, and once more when it exits. */
 void receiveChildInfo(void) {
     if (server.child_info_pipe[0] == -1) return;
     ssize_t wlen = sizeof(server.child_info_data);
-    if (read(server.child_info_pipe[0],&server.child_info_data,wlen) == wlen &&
-        server.child_info_data.magic == CHILD_INFO_MAGIC)
+    while (read(server.child_info_pipe[0],&server.child_info_data,wlen) == wlen &&
+           server.child_info_data.magic == CHILD_INFO_MAGIC)
     {
+        size_t cow = server.child_info_data.cow_size;
+
+        server.stat_current_cow_bytes = cow;
+        if (server.child_info_data.progress) continue;
         if (server.child_info_data.process_type == CHILD_INFO_TYPE_RDB) {
-            server.stat_rdb_cow_bytes = server.child_info_data.cow_size;
+            server.stat_rdb_cow_bytes = cow;
         } else if (server.child_info_data.process_type == CHILD_INFO_TYPE_AOF) {
-            server.stat_aof_cow_bytes = server.child_info_data.cow_size;
+            server.stat_aof_cow_bytes = cow;
+        } else if (server.child_info_data.process_type == CHILD_INFO_TYPE_REPL) {
+            server.stat_repl_cow_bytes = cow;
         }
     }
 }
@@ -485,7 +485,7 @@ void clusterInit(void) {
     }
 
     if (listenToPort(server.port+CLUSTER_PORT_INCR,
-        server.cfd,&server.cfd_count) == C_ERR)
+        server.cfd,&server.cfd_count,1) == C_ERR)
     {
         exit(1);
     } else {
@@ -499,11 +499,6 @@ void clusterInit(void) {
         }
     }
 
-    /* The slots -> keys map is a radix tree. Initialize it here. */
-    server.cluster->slots_to_keys = raxNew();
-    memset(server.cluster->slots_keys_count,0,
-           sizeof(server.cluster->slots_keys_count));
-
     /* Set myself->port / cport to my listening ports, we'll just need to
      * discover the IP address via MEET messages. */
     myself->port = server.port;
@@ -680,6 +675,28 @@ unsigned int keyHashSlot(char *key, int keylen) {
     return crc16(key+s+1,e-s-1) & 0x3FFF;
 }
 
+/* If all the keys matching the glob-style 'pattern' hash to the same slot,
+ * that is when the pattern starts with a literal hash tag like "{user}*",
+ * return the slot. Otherwise -1 is returned. */
+int patternHashSlot(char *pattern, int length) {
+    int s, e; /* start-end indexes of { and } */
+
+    /* The hash tag of the keys is only known if nothing before the '}' of
+     * the pattern can match more than one character sequence. */
+    for (s = 0; s < length; s++) {
+        if (strchr("*?[\\",pattern[s])) return -1;
+        if (pattern[s] == '{') break;
+    }
+    if (s == length) return -1;
+
+    for (e = s+1; e < length; e++) {
+        if (strchr("*?[\\",pattern[e])) return -1;
+        if (pattern[e] == '}') break;
+    }
+    if (e == length || e == s+1) return -1;
+    return crc16(pattern+s+1,e-s-1) & 0x3FFF;
+}
+
 /* -----------------------------------------------------------------------------
  * CLUSTER node API
  * -------------------------------------------------------------------------- */
@@ -2014,7 +2031,7 @@ int clusterProcessPacket(clusterLink *link) {
         /* Don't bother creating useless objects if there are no
          * Pub/Sub subscribers. */
         if (dictSize(server.pubsub_channels) ||
-           listLength(server.pubsub_patterns))
+           dictSize(server.pubsub_patterns))
         {
             channel_len = ntohl(hdr->data.publish.msg.channel_len);
             message_len = ntohl(hdr->data.publish.msg.message_len);
@@ -3801,7 +3818,7 @@ int verifyClusterConfigWithData(void) {
 
     /* Make sure we only have keys in DB0. */
     for (j = 1; j < server.dbnum; j++) {
-        if (dictSize(server.db[j].dict)) return C_ERR;
+        if (dbSize(server.db+j)) return C_ERR;
     }
 
     /* Check that all the slots we see populated memory have a corresponding
@@ -4149,7 +4166,7 @@ void clusterCommand(client *c) {
         clusterReplyMultiBulkSlots(c);
     } else if (!strcasecmp(c->argv[1]->ptr,"flushslots") && c->argc == 2) {
         /* CLUSTER FLUSHSLOTS */
-        if (dictSize(server.db[0].dict) != 0) {
+        if (dbSize(server.db) != 0) {
             addReplyError(c,"DB must be empty to perform CLUSTER FLUSHSLOTS.");
             return;
         }
@@ -4484,7 +4501,7 @@ void clusterCommand(client *c) {
          * slots nor keys to accept to replicate some other node.
          * Slaves can switch to another master without issues. */
         if (nodeIsMaster(myself) &&
-            (myself->numslots != 0 || dictSize(server.db[0].dict) != 0)) {
+            (myself->numslots != 0 || dbSize(server.db) != 0)) {
             addReplyError(c,
                 "To set a master the node must be empty and "
                 "without assigned slots.");
@@ -4640,7 +4657,7 @@ void clusterCommand(client *c) {
 
         /* Slaves can be reset while containing data, but not master nodes
          * that must be empty. */
-        if (nodeIsMaster(myself) && dictSize(c->db->dict) != 0) {
+        if (nodeIsMaster(myself) && dbSize(c->db) != 0) {
             addReplyError(c,"CLUSTER RESET can't be called with "
                             "master nodes containing keys");
             return;
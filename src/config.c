@@ -50,6 +50,8 @@ configEnum maxmemory_policy_enum[] = {
     {"volatile-ttl",MAXMEMORY_VOLATILE_TTL},
     {"allkeys-lru",MAXMEMORY_ALLKEYS_LRU},
     {"allkeys-lfu",MAXMEMORY_ALLKEYS_LFU},
+    {"volatile-gdsf",MAXMEMORY_VOLATILE_GDSF},
+    {"allkeys-gdsf",MAXMEMORY_ALLKEYS_GDSF},
     {"allkeys-random",MAXMEMORY_ALLKEYS_RANDOM},
     {"noeviction",MAXMEMORY_NO_EVICTION},
     {NULL, 0}
@@ -84,6 +86,12 @@ configEnum supervised_mode_enum[] = {
     {NULL, 0}
 };
 
+configEnum hash_function_enum[] = {
+    {"siphash", DICT_HASH_SIPHASH},
+    {"wyhash", DICT_HASH_WYHASH},
+    {NULL, 0}
+};
+
 configEnum aof_fsync_enum[] = {
     {"everysec", AOF_FSYNC_EVERYSEC},
     {"always", AOF_FSYNC_ALWAYS},
@@ -216,6 +224,39 @@ void loadServerConfigFromString(char *config) {
             if ((server.protected_mode = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"io-threads") && argc == 2) {
+            server.io_threads_num = atoi(argv[1]);
+            if (server.io_threads_num < 1 ||
+                server.io_threads_num > IO_THREADS_MAX_NUM)
+            {
+                err = "Invalid number of I/O threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"lazyfree-threads") && argc == 2) {
+            server.lazyfree_threads = atoi(argv[1]);
+            if (server.lazyfree_threads < 1 ||
+                server.lazyfree_threads > LAZYFREE_MAX_THREADS)
+            {
+                err = "Invalid number of lazyfree threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"keys-filter-threads") && argc == 2) {
+            server.keys_filter_threads = atoi(argv[1]);
+            if (server.keys_filter_threads < 0 ||
+                server.keys_filter_threads > KEYS_FILTER_MAX_THREADS)
+            {
+                err = "Invalid number of keys filter threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-threads-do-reads") && argc == 2) {
+            if ((server.io_threads_do_reads = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-uring") && argc == 2) {
+            if ((server.io_uring = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"zero-copy-reply-threshold") &&
+                   argc == 2)
+        {
+            server.zero_copy_reply_threshold = memtoll(argv[1],NULL);
         } else if (!strcasecmp(argv[0],"port") && argc == 2) {
             server.port = atoi(argv[1]);
             if (server.port < 0 || server.port > 65535) {
@@ -226,6 +267,23 @@ void loadServerConfigFromString(char *config) {
             if (server.tcp_backlog < 0) {
                 err = "Invalid backlog value"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"tcp-listeners") && argc == 2) {
+            server.tcp_listeners = atoi(argv[1]);
+            if (server.tcp_listeners < 1 ||
+                server.tcp_listeners > CONFIG_TCP_LISTENERS_MAX)
+            {
+                err = "Invalid number of TCP listeners"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"accept-time-budget") && argc == 2) {
+            server.accept_time_budget = strtoll(argv[1], NULL, 10);
+            if (server.accept_time_budget < 0) {
+                err = "accept-time-budget can't be negative"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"reply-flush-budget") && argc == 2) {
+            server.reply_flush_budget = strtoll(argv[1], NULL, 10);
+            if (server.reply_flush_budget < 0) {
+                err = "reply-flush-budget can't be negative"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"bind") && argc >= 2) {
             int j, addresses = argc-1;
 
@@ -328,6 +386,45 @@ void loadServerConfigFromString(char *config) {
                 err = "maxmemory-samples must be 1 or greater";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"maxmemory-eviction-pool-size") &&
+                   argc == 2)
+        {
+            server.maxmemory_eviction_pool_size = atoi(argv[1]);
+            if (server.maxmemory_eviction_pool_size <
+                    CONFIG_MIN_MAXMEMORY_EVICTION_POOL_SIZE ||
+                server.maxmemory_eviction_pool_size >
+                    CONFIG_MAX_MAXMEMORY_EVICTION_POOL_SIZE)
+            {
+                err = "Invalid maxmemory-eviction-pool-size"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"maxmemory-background-eviction") &&
+                   argc == 2)
+        {
+            if ((server.maxmemory_background_eviction =
+                 yesnotoi(argv[1])) == -1)
+            {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"maxmemory-high-watermark") &&
+                   argc == 2)
+        {
+            server.maxmemory_high_watermark = atoi(argv[1]);
+            if (server.maxmemory_high_watermark < 1 ||
+                server.maxmemory_high_watermark > 100)
+            {
+                err = "maxmemory-high-watermark must be between 1 and 100";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"maxmemory-low-watermark") &&
+                   argc == 2)
+        {
+            server.maxmemory_low_watermark = atoi(argv[1]);
+            if (server.maxmemory_low_watermark < 1 ||
+                server.maxmemory_low_watermark > 100)
+            {
+                err = "maxmemory-low-watermark must be between 1 and 100";
+                goto loaderr;
+            }
         } else if ((!strcasecmp(argv[0],"proto-max-bulk-len")) && argc == 2) {
             server.proto_max_bulk_len = memtoll(argv[1],NULL);
         } else if ((!strcasecmp(argv[0],"client-query-buffer-limit")) && argc == 2) {
@@ -407,10 +504,42 @@ void loadServerConfigFromString(char *config) {
             if ((server.rdb_checksum = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"active-expire-index") && argc == 2) {
+            if ((server.active_expire_index = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"fork-friendly") && argc == 2) {
+            if ((server.fork_friendly = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-key-save-delay") && argc == 2) {
+            server.rdb_key_save_delay = strtoll(argv[1],NULL,10);
+            if (server.rdb_key_save_delay < 0) {
+                err = "rdb-key-save-delay can't be negative";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"keyspace-open-addressing") &&
+                   argc == 2)
+        {
+            if ((server.keyspace_open_addressing = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"hash-function") && argc == 2) {
+            server.hash_function =
+                configEnumGetValue(hash_function_enum,argv[1]);
+            if (server.hash_function == INT_MIN) {
+                err = "Invalid hash function. "
+                    "Allowed values: 'siphash' or 'wyhash'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"activerehashing") && argc == 2) {
             if ((server.activerehashing = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"lazyfree-incremental") && argc == 2) {
+            if ((server.lazyfree_incremental = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"lazyfree-lazy-eviction") && argc == 2) {
             if ((server.lazyfree_lazy_eviction = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -901,6 +1030,17 @@ void configSetCommand(client *c) {
                 return;
             }
         }
+    } config_set_special_field("active-expire-index") {
+        int enable = yesnotoi(o->ptr);
+
+        if (enable == -1) goto badfmt;
+        if (enable != server.active_expire_index) {
+            for (int j = 0; j < server.dbnum; j++) {
+                if (enable) expireIndexBuild(server.db+j);
+                else expireIndexRelease(server.db+j);
+            }
+            server.active_expire_index = enable;
+        }
     } config_set_special_field("save") {
         int vlen, j;
         sds *v = sdssplitlen(o->ptr,sdslen(o->ptr)," ",1,&vlen);
@@ -999,6 +1139,8 @@ void configSetCommand(client *c) {
      * config_set_bool_field(name,var). */
     } config_set_bool_field(
       "rdbcompression", server.rdb_compression) {
+    } config_set_bool_field(
+      "fork-friendly", server.fork_friendly) {
     } config_set_bool_field(
       "repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay) {
     } config_set_bool_field(
@@ -1037,6 +1179,10 @@ void configSetCommand(client *c) {
       "stop-writes-on-bgsave-error",server.stop_writes_on_bgsave_err) {
     } config_set_bool_field(
       "lazyfree-lazy-eviction",server.lazyfree_lazy_eviction) {
+    } config_set_bool_field(
+      "maxmemory-background-eviction",server.maxmemory_background_eviction) {
+    } config_set_bool_field(
+      "lazyfree-incremental",server.lazyfree_incremental) {
     } config_set_bool_field(
       "lazyfree-lazy-expire",server.lazyfree_lazy_expire) {
     } config_set_bool_field(
@@ -1050,8 +1196,21 @@ void configSetCommand(client *c) {
      * config_set_numerical_field(name,var,min,max) */
     } config_set_numerical_field(
       "tcp-keepalive",server.tcpkeepalive,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "accept-time-budget",server.accept_time_budget,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "reply-flush-budget",server.reply_flush_budget,0,LLONG_MAX) {
     } config_set_numerical_field(
       "maxmemory-samples",server.maxmemory_samples,1,LLONG_MAX) {
+    } config_set_numerical_field(
+      "maxmemory-eviction-pool-size",server.maxmemory_eviction_pool_size,
+      CONFIG_MIN_MAXMEMORY_EVICTION_POOL_SIZE,
+      CONFIG_MAX_MAXMEMORY_EVICTION_POOL_SIZE) {
+        evictionPoolAlloc();
+    } config_set_numerical_field(
+      "maxmemory-high-watermark",server.maxmemory_high_watermark,1,100) {
+    } config_set_numerical_field(
+      "maxmemory-low-watermark",server.maxmemory_low_watermark,1,100) {
     } config_set_numerical_field(
       "lfu-log-factor",server.lfu_log_factor,0,LLONG_MAX) {
     } config_set_numerical_field(
@@ -1088,6 +1247,8 @@ void configSetCommand(client *c) {
       "hll-sparse-max-bytes",server.hll_sparse_max_bytes,0,LLONG_MAX) {
     } config_set_numerical_field(
       "lua-time-limit",server.lua_time_limit,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "rdb-key-save-delay",server.rdb_key_save_delay,0,LLONG_MAX) {
     } config_set_numerical_field(
       "slowlog-log-slower-than",server.slowlog_log_slower_than,0,LLONG_MAX) {
     } config_set_numerical_field(
@@ -1150,6 +1311,8 @@ void configSetCommand(client *c) {
       "proto-max-bulk-len",server.proto_max_bulk_len) {
     } config_set_memory_field(
       "client-query-buffer-limit",server.client_max_querybuf_len) {
+    } config_set_memory_field(
+      "zero-copy-reply-threshold",server.zero_copy_reply_threshold) {
     } config_set_memory_field("repl-backlog-size",ll) {
         resizeReplicationBacklog(ll);
     } config_set_memory_field("auto-aof-rewrite-min-size",ll) {
@@ -1240,7 +1403,14 @@ void configGetCommand(client *c) {
     config_get_numerical_field("maxmemory",server.maxmemory);
     config_get_numerical_field("proto-max-bulk-len",server.proto_max_bulk_len);
     config_get_numerical_field("client-query-buffer-limit",server.client_max_querybuf_len);
+    config_get_numerical_field("zero-copy-reply-threshold",server.zero_copy_reply_threshold);
     config_get_numerical_field("maxmemory-samples",server.maxmemory_samples);
+    config_get_numerical_field("maxmemory-eviction-pool-size",
+            server.maxmemory_eviction_pool_size);
+    config_get_numerical_field("maxmemory-high-watermark",
+            server.maxmemory_high_watermark);
+    config_get_numerical_field("maxmemory-low-watermark",
+            server.maxmemory_low_watermark);
     config_get_numerical_field("lfu-log-factor",server.lfu_log_factor);
     config_get_numerical_field("lfu-decay-time",server.lfu_decay_time);
     config_get_numerical_field("timeout",server.maxidletime);
@@ -1270,6 +1440,8 @@ void configGetCommand(client *c) {
     config_get_numerical_field("hll-sparse-max-bytes",
             server.hll_sparse_max_bytes);
     config_get_numerical_field("lua-time-limit",server.lua_time_limit);
+    config_get_numerical_field("rdb-key-save-delay",
+            server.rdb_key_save_delay);
     config_get_numerical_field("slowlog-log-slower-than",
             server.slowlog_log_slower_than);
     config_get_numerical_field("latency-monitor-threshold",
@@ -1297,6 +1469,12 @@ void configGetCommand(client *c) {
     config_get_numerical_field("cluster-slave-validity-factor",server.cluster_slave_validity_factor);
     config_get_numerical_field("repl-diskless-sync-delay",server.repl_diskless_sync_delay);
     config_get_numerical_field("tcp-keepalive",server.tcpkeepalive);
+    config_get_numerical_field("tcp-listeners",server.tcp_listeners);
+    config_get_numerical_field("accept-time-budget",server.accept_time_budget);
+    config_get_numerical_field("reply-flush-budget",server.reply_flush_budget);
+    config_get_numerical_field("io-threads",server.io_threads_num);
+    config_get_numerical_field("keys-filter-threads",server.keys_filter_threads);
+    config_get_numerical_field("lazyfree-threads",server.lazyfree_threads);
 
     /* Bool (yes/no) values */
     config_get_bool_field("cluster-require-full-coverage",
@@ -1314,9 +1492,15 @@ void configGetCommand(client *c) {
     config_get_bool_field("daemonize", server.daemonize);
     config_get_bool_field("rdbcompression", server.rdb_compression);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
+    config_get_bool_field("fork-friendly", server.fork_friendly);
+    config_get_bool_field("active-expire-index", server.active_expire_index);
     config_get_bool_field("activerehashing", server.activerehashing);
+    config_get_bool_field("keyspace-open-addressing",
+            server.keyspace_open_addressing);
     config_get_bool_field("activedefrag", server.active_defrag_enabled);
     config_get_bool_field("protected-mode", server.protected_mode);
+    config_get_bool_field("io-threads-do-reads", server.io_threads_do_reads);
+    config_get_bool_field("io-uring", server.io_uring);
     config_get_bool_field("repl-disable-tcp-nodelay",
             server.repl_disable_tcp_nodelay);
     config_get_bool_field("repl-diskless-sync",
@@ -1329,6 +1513,10 @@ void configGetCommand(client *c) {
             server.aof_use_rdb_preamble);
     config_get_bool_field("lazyfree-lazy-eviction",
             server.lazyfree_lazy_eviction);
+    config_get_bool_field("lazyfree-incremental",
+            server.lazyfree_incremental);
+    config_get_bool_field("maxmemory-background-eviction",
+            server.maxmemory_background_eviction);
     config_get_bool_field("lazyfree-lazy-expire",
             server.lazyfree_lazy_expire);
     config_get_bool_field("lazyfree-lazy-server-del",
@@ -1347,6 +1535,8 @@ void configGetCommand(client *c) {
             server.aof_fsync,aof_fsync_enum);
     config_get_enum_field("syslog-facility",
             server.syslog_facility,syslog_facility_enum);
+    config_get_enum_field("hash-function",
+            server.hash_function,hash_function_enum);
 
     /* Everything we can't handle with macros follows. */
 
@@ -1982,6 +2172,9 @@ int rewriteConfig(char *path) {
     rewriteConfigOctalOption(state,"unixsocketperm",server.unixsocketperm,CONFIG_DEFAULT_UNIX_SOCKET_PERM);
     rewriteConfigNumericalOption(state,"timeout",server.maxidletime,CONFIG_DEFAULT_CLIENT_TIMEOUT);
     rewriteConfigNumericalOption(state,"tcp-keepalive",server.tcpkeepalive,CONFIG_DEFAULT_TCP_KEEPALIVE);
+    rewriteConfigNumericalOption(state,"tcp-listeners",server.tcp_listeners,CONFIG_DEFAULT_TCP_LISTENERS);
+    rewriteConfigNumericalOption(state,"accept-time-budget",server.accept_time_budget,CONFIG_DEFAULT_ACCEPT_TIME_BUDGET);
+    rewriteConfigNumericalOption(state,"reply-flush-budget",server.reply_flush_budget,CONFIG_DEFAULT_REPLY_FLUSH_BUDGET);
     rewriteConfigNumericalOption(state,"slave-announce-port",server.slave_announce_port,CONFIG_DEFAULT_SLAVE_ANNOUNCE_PORT);
     rewriteConfigEnumOption(state,"loglevel",server.verbosity,loglevel_enum,CONFIG_DEFAULT_VERBOSITY);
     rewriteConfigStringOption(state,"logfile",server.logfile,CONFIG_DEFAULT_LOGFILE);
@@ -1993,6 +2186,8 @@ int rewriteConfig(char *path) {
     rewriteConfigYesNoOption(state,"stop-writes-on-bgsave-error",server.stop_writes_on_bgsave_err,CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR);
     rewriteConfigYesNoOption(state,"rdbcompression",server.rdb_compression,CONFIG_DEFAULT_RDB_COMPRESSION);
     rewriteConfigYesNoOption(state,"rdbchecksum",server.rdb_checksum,CONFIG_DEFAULT_RDB_CHECKSUM);
+    rewriteConfigYesNoOption(state,"fork-friendly",server.fork_friendly,CONFIG_DEFAULT_FORK_FRIENDLY);
+    rewriteConfigYesNoOption(state,"active-expire-index",server.active_expire_index,CONFIG_DEFAULT_ACTIVE_EXPIRE_INDEX);
     rewriteConfigStringOption(state,"dbfilename",server.rdb_filename,CONFIG_DEFAULT_RDB_FILENAME);
     rewriteConfigDirOption(state);
     rewriteConfigSlaveofOption(state);
@@ -2018,6 +2213,10 @@ int rewriteConfig(char *path) {
     rewriteConfigBytesOption(state,"client-query-buffer-limit",server.client_max_querybuf_len,PROTO_MAX_QUERYBUF_LEN);
     rewriteConfigEnumOption(state,"maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum,CONFIG_DEFAULT_MAXMEMORY_POLICY);
     rewriteConfigNumericalOption(state,"maxmemory-samples",server.maxmemory_samples,CONFIG_DEFAULT_MAXMEMORY_SAMPLES);
+    rewriteConfigNumericalOption(state,"maxmemory-eviction-pool-size",server.maxmemory_eviction_pool_size,CONFIG_DEFAULT_MAXMEMORY_EVICTION_POOL_SIZE);
+    rewriteConfigYesNoOption(state,"maxmemory-background-eviction",server.maxmemory_background_eviction,CONFIG_DEFAULT_MAXMEMORY_BACKGROUND_EVICTION);
+    rewriteConfigNumericalOption(state,"maxmemory-high-watermark",server.maxmemory_high_watermark,CONFIG_DEFAULT_MAXMEMORY_HIGH_WATERMARK);
+    rewriteConfigNumericalOption(state,"maxmemory-low-watermark",server.maxmemory_low_watermark,CONFIG_DEFAULT_MAXMEMORY_LOW_WATERMARK);
     rewriteConfigNumericalOption(state,"lfu-log-factor",server.lfu_log_factor,CONFIG_DEFAULT_LFU_LOG_FACTOR);
     rewriteConfigNumericalOption(state,"lfu-decay-time",server.lfu_decay_time,CONFIG_DEFAULT_LFU_DECAY_TIME);
     rewriteConfigNumericalOption(state,"active-defrag-threshold-lower",server.active_defrag_threshold_lower,CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER);
@@ -2032,6 +2231,7 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"auto-aof-rewrite-percentage",server.aof_rewrite_perc,AOF_REWRITE_PERC);
     rewriteConfigBytesOption(state,"auto-aof-rewrite-min-size",server.aof_rewrite_min_size,AOF_REWRITE_MIN_SIZE);
     rewriteConfigNumericalOption(state,"lua-time-limit",server.lua_time_limit,LUA_SCRIPT_TIME_LIMIT);
+    rewriteConfigNumericalOption(state,"rdb-key-save-delay",server.rdb_key_save_delay,CONFIG_DEFAULT_RDB_KEY_SAVE_DELAY);
     rewriteConfigYesNoOption(state,"cluster-enabled",server.cluster_enabled,0);
     rewriteConfigStringOption(state,"cluster-config-file",server.cluster_configfile,CONFIG_DEFAULT_CLUSTER_CONFIG_FILE);
     rewriteConfigYesNoOption(state,"cluster-require-full-coverage",server.cluster_require_full_coverage,CLUSTER_DEFAULT_REQUIRE_FULL_COVERAGE);
@@ -2052,6 +2252,8 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"zset-max-ziplist-value",server.zset_max_ziplist_value,OBJ_ZSET_MAX_ZIPLIST_VALUE);
     rewriteConfigNumericalOption(state,"hll-sparse-max-bytes",server.hll_sparse_max_bytes,CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES);
     rewriteConfigYesNoOption(state,"activerehashing",server.activerehashing,CONFIG_DEFAULT_ACTIVE_REHASHING);
+    rewriteConfigYesNoOption(state,"keyspace-open-addressing",server.keyspace_open_addressing,CONFIG_DEFAULT_KEYSPACE_OPEN_ADDRESSING);
+    rewriteConfigEnumOption(state,"hash-function",server.hash_function,hash_function_enum,CONFIG_DEFAULT_HASH_FUNCTION);
     rewriteConfigYesNoOption(state,"activedefrag",server.active_defrag_enabled,CONFIG_DEFAULT_ACTIVE_DEFRAG);
     rewriteConfigYesNoOption(state,"protected-mode",server.protected_mode,CONFIG_DEFAULT_PROTECTED_MODE);
     rewriteConfigClientoutputbufferlimitOption(state);
@@ -2061,9 +2263,16 @@ int rewriteConfig(char *path) {
     rewriteConfigYesNoOption(state,"aof-use-rdb-preamble",server.aof_use_rdb_preamble,CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE);
     rewriteConfigEnumOption(state,"supervised",server.supervised_mode,supervised_mode_enum,SUPERVISED_NONE);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-eviction",server.lazyfree_lazy_eviction,CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION);
+    rewriteConfigYesNoOption(state,"lazyfree-incremental",server.lazyfree_incremental,CONFIG_DEFAULT_LAZYFREE_INCREMENTAL);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-expire",server.lazyfree_lazy_expire,CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-server-del",server.lazyfree_lazy_server_del,CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL);
     rewriteConfigYesNoOption(state,"slave-lazy-flush",server.repl_slave_lazy_flush,CONFIG_DEFAULT_SLAVE_LAZY_FLUSH);
+    rewriteConfigNumericalOption(state,"io-threads",server.io_threads_num,CONFIG_DEFAULT_IO_THREADS_NUM);
+    rewriteConfigYesNoOption(state,"io-threads-do-reads",server.io_threads_do_reads,CONFIG_DEFAULT_IO_THREADS_DO_READS);
+    rewriteConfigNumericalOption(state,"keys-filter-threads",server.keys_filter_threads,CONFIG_DEFAULT_KEYS_FILTER_THREADS);
+    rewriteConfigNumericalOption(state,"lazyfree-threads",server.lazyfree_threads,CONFIG_DEFAULT_LAZYFREE_THREADS);
+    rewriteConfigYesNoOption(state,"io-uring",server.io_uring,CONFIG_DEFAULT_IO_URING);
+    rewriteConfigBytesOption(state,"zero-copy-reply-threshold",server.zero_copy_reply_threshold,CONFIG_DEFAULT_ZERO_COPY_REPLY_THRESHOLD);
 
     /* Rewrite Sentinel config if in Sentinel mode. */
     if (server.sentinel_mode) rewriteConfigSentinelOption(state);
@@ -34,6 +34,155 @@
 #include <signal.h>
 #include <ctype.h>
 
+/*-----------------------------------------------------------------------------
+ * Keyspace partitions
+ *
+ * In cluster mode the keyspace of DB 0 is partitioned in one dict per hash
+ * slot, so that the keys of a slot can be counted, listed and deleted
+ * without any additional index. Otherwise a DB has a single dict. The
+ * functions below give access to the keyspace as a whole.
+ *----------------------------------------------------------------------------*/
+
+void dbCreateKeyspace(redisDb *db, int ndicts) {
+    int j;
+
+    db->dicts = zmalloc(sizeof(dict*)*(ndicts+1));
+    for (j = 0; j < ndicts; j++) db->dicts[j] = dictCreate(&dbDictType,NULL);
+    db->dicts[ndicts] = NULL;
+    db->ndicts = ndicts;
+    db->size = 0;
+    db->resize_cursor = 0;
+    db->rehash_cursor = 0;
+    memset(&db->keysizes,0,sizeof(keysizesStats));
+}
+
+
+/* Return the dict of the keyspace the key belongs to. */
+dict *dbKeyDict(redisDb *db, sds key) {
+    if (db->ndicts == 1) return db->dicts[0];
+    return db->dicts[keyHashSlot(key,sdslen(key))];
+}
+
+dictEntry *dbFind(redisDb *db, sds key) {
+    return dictFind(dbKeyDict(db,key),key);
+}
+
+/* The number of keys is kept by dbAdd() and the delete functions, rather
+ * than summing the sizes of up to 16384 dicts. */
+unsigned long long dbSize(redisDb *db) {
+    return db->size;
+}
+
+unsigned long long dbSlots(redisDb *db) {
+    unsigned long long slots = 0;
+    int j;
+
+    for (j = 0; j < db->ndicts; j++) slots += dictSlots(db->dicts[j]);
+    return slots;
+}
+
+size_t dbTableMemUsage(redisDb *db) {
+    size_t mem = db->ndicts > 1 ? db->ndicts*sizeof(dict) : 0;
+    int j;
+
+    for (j = 0; j < db->ndicts; j++) mem += dictTableMemUsage(db->dicts[j]);
+    return mem;
+}
+
+/* Return a random non empty dict of the keyspace, or NULL if the DB is
+ * empty. The dicts are not weighted by their size: with the partitions
+ * of a cluster node, that hold similar amounts of keys, sampling a random
+ * dict and then a random key inside it is close enough to sampling a
+ * random key. */
+dict *dbRandomDict(redisDb *db) {
+    int j, didx;
+
+    if (db->ndicts == 1)
+        return dictSize(db->dicts[0]) ? db->dicts[0] : NULL;
+    for (j = 0; j < 16; j++) {
+        didx = random() % db->ndicts;
+        if (dictSize(db->dicts[didx])) return db->dicts[didx];
+    }
+    /* Sparse keyspace: look for the next non empty dict. */
+    for (j = 0; j < db->ndicts; j++) {
+        didx = (didx+1) % db->ndicts;
+        if (dictSize(db->dicts[didx])) return db->dicts[didx];
+    }
+    return NULL;
+}
+
+/* Like dictScan() across all the dicts of the keyspace. With partitions
+ * the low bits of the cursor are the index of the dict, and the others the
+ * cursor inside the dict. Empty dicts are skipped. */
+unsigned long dbScan(redisDb *db, unsigned long cursor, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata) {
+    int didx;
+
+    if (db->ndicts == 1)
+        return dictScan(db->dicts[0],cursor,fn,bucketfn,privdata);
+    didx = cursor % db->ndicts;
+    cursor /= db->ndicts;
+    while(didx < db->ndicts && dictSize(db->dicts[didx]) == 0) {
+        didx++;
+        cursor = 0;
+    }
+    if (didx == db->ndicts) return 0;
+    cursor = dictScan(db->dicts[didx],cursor,fn,bucketfn,privdata);
+    if (cursor == 0) {
+        if (++didx == db->ndicts) return 0;
+    }
+    return cursor*db->ndicts+didx;
+}
+
+/* Like dbScan() but only scanning the dict 'didx', so that the iteration
+ * is done when the dict is. The cursor has the same format of dbScan(). */
+unsigned long dbScanDict(redisDb *db, int didx, unsigned long cursor, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata) {
+    if (db->ndicts == 1)
+        return dictScan(db->dicts[0],cursor,fn,bucketfn,privdata);
+    cursor = dictScan(db->dicts[didx],cursor/db->ndicts,fn,bucketfn,privdata);
+    return cursor ? cursor*db->ndicts+didx : 0;
+}
+
+/* Iterate all the entries of the keyspace, see dictGetIterator() and
+ * dictGetSafeIterator() for the rules about modifying the keyspace. */
+void dbIteratorInit(dbIterator *it, redisDb *db, int safe) {
+    it->db = db;
+    it->didx = -1;
+    it->lastidx = db->ndicts-1;
+    it->safe = safe;
+    it->di = NULL;
+}
+
+/* Like dbIteratorInit() but only iterating the dict 'didx'. */
+void dbIteratorInitDict(dbIterator *it, redisDb *db, int didx, int safe) {
+    dbIteratorInit(it,db,safe);
+    it->didx = didx-1;
+    it->lastidx = didx;
+}
+
+dictEntry *dbIteratorNext(dbIterator *it) {
+    dictEntry *de;
+
+    while(1) {
+        if (it->di && (de = dictNext(it->di)) != NULL) return de;
+        if (it->di) {
+            dictReleaseIterator(it->di);
+            it->di = NULL;
+        }
+        /* Move to the next non empty dict. */
+        do {
+            if (it->didx == it->lastidx) return NULL;
+            it->didx++;
+        } while(dictSize(it->db->dicts[it->didx]) == 0);
+        it->di = it->safe ? dictGetSafeIterator(it->db->dicts[it->didx]) :
+                            dictGetIterator(it->db->dicts[it->didx]);
+    }
+}
+
+void dbIteratorRelease(dbIterator *it) {
+    if (it->di) dictReleaseIterator(it->di);
+    it->di = NULL;
+}
+
 /*-----------------------------------------------------------------------------
  * C-level DB API
  *----------------------------------------------------------------------------*/
@@ -47,27 +196,31 @@ void updateLFU(robj *val) {
     val->lru = (LFUGetTimeInMinutes()<<8) | counter;
 }
 
+/* Update the access time of a value for the ageing algorithm.
+ * Don't do it if we have a saving child, as this will trigger a copy
+ * on write madness. */
+static void touchValue(robj *val, int flags) {
+    if (server.rdb_child_pid == -1 &&
+        server.aof_child_pid == -1 &&
+        !(flags & LOOKUP_NOTOUCH))
+    {
+        if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+            updateLFU(val);
+        } else {
+            val->lru = LRU_CLOCK();
+        }
+    }
+}
+
 /* Low level key lookup API, not actually called directly from commands
  * implementations that should instead rely on lookupKeyRead(),
  * lookupKeyWrite() and lookupKeyReadWithFlags(). */
 robj *lookupKey(redisDb *db, robj *key, int flags) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
+    dictEntry *de = dbFind(db,key->ptr);
     if (de) {
         robj *val = dictGetVal(de);
 
-        /* Update the access time for the ageing algorithm.
-         * Don't do it if we have a saving child, as this will trigger
-         * a copy on write madness. */
-        if (server.rdb_child_pid == -1 &&
-            server.aof_child_pid == -1 &&
-            !(flags & LOOKUP_NOTOUCH))
-        {
-            if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-                updateLFU(val);
-            } else {
-                val->lru = LRU_CLOCK();
-            }
-        }
+        touchValue(val,flags);
         return val;
     } else {
         return NULL;
@@ -138,14 +291,88 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
     return lookupKeyReadWithFlags(db,key,LOOKUP_NONE);
 }
 
+/* Look up up to DICT_FIND_BATCH keys at once, see dictFindBatch(), and
+ * prefetch their values. */
+static void dbFindBatch(redisDb *db, robj **keys, int count, dictEntry **entries) {
+    const void *names[DICT_FIND_BATCH];
+    dict *dicts[DICT_FIND_BATCH];
+    int j;
+
+    for (j = 0; j < count; j++) {
+        names[j] = keys[j]->ptr;
+        dicts[j] = dbKeyDict(db,keys[j]->ptr);
+    }
+    dictFindBatchMulti(dicts,names,count,entries);
+    for (j = 0; j < count; j++)
+        if (entries[j]) dictPrefetch(dictGetVal(entries[j]));
+}
+
+/* Like calling lookupKeyReadWithFlags() for every key of 'keys', storing
+ * the value of keys[j] (or NULL) at vals[j]. The keys are looked up with
+ * dictFindBatch() and the values are prefetched before they are touched,
+ * so that the cache misses of the different keys overlap.
+ *
+ * Keys with an expire take the usual path, since they may get expired. */
+void lookupKeysReadBatch(redisDb *db, robj **keys, int count, robj **vals, int flags) {
+    dictEntry *entries[DICT_FIND_BATCH];
+    int base, n, j;
+
+    for (base = 0; base < count; base += n) {
+        long long expired = server.stat_expiredkeys;
+
+        n = count-base < DICT_FIND_BATCH ? count-base : DICT_FIND_BATCH;
+        dbFindBatch(db,keys+base,n,entries);
+        for (j = 0; j < n; j++) {
+            dictEntry *de = entries[j];
+            robj *val;
+
+            /* Once a key was expired the entries found may be gone. */
+            if (server.stat_expiredkeys != expired ||
+                (de && dbEntryGetExpire(db,de) != -1))
+            {
+                vals[base+j] = lookupKeyReadWithFlags(db,keys[base+j],flags);
+                continue;
+            }
+            if (de == NULL) {
+                server.stat_keyspace_misses++;
+                vals[base+j] = NULL;
+                continue;
+            }
+            val = dictGetVal(de);
+            touchValue(val,flags);
+            server.stat_keyspace_hits++;
+            vals[base+j] = val;
+        }
+    }
+}
+
+/* Bring the entries and the values of the specified keys in the CPU caches,
+ * for commands that are about to access many keys, or to access them with
+ * APIs other than lookupKeyRead(). */
+void dbPrefetchKeys(redisDb *db, robj **keys, int count) {
+    dictEntry *entries[DICT_FIND_BATCH];
+    int base, n;
+
+    for (base = 0; base < count; base += n) {
+        n = count-base < DICT_FIND_BATCH ? count-base : DICT_FIND_BATCH;
+        dbFindBatch(db,keys+base,n,entries);
+    }
+}
+
 /* Lookup a key for write operations, and as a side effect, if needed, expires
  * the key if its TTL is reached.
  *
  * Returns the linked value object if the key exists or NULL if the key
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
+    dictEntry *de;
+
     expireIfNeeded(db,key);
-    return lookupKey(db,key,LOOKUP_NONE);
+    de = dbFind(db,key->ptr);
+    if (de == NULL) return NULL;
+    keysizesRememberEntry(db,de);
+    touchValue(dictGetVal(de),LOOKUP_NONE);
+    return dictGetVal(de);
 }
 
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply) {
@@ -165,12 +392,25 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
  *
  * The program is aborted if the key already exists. */
 void dbAdd(redisDb *db, robj *key, robj *val) {
-    sds copy = sdsdup(key->ptr);
-    int retval = dictAdd(db->dict, copy, val);
+    dict *d = dbKeyDict(db,key->ptr);
+    int rehashing = dictIsRehashing(d);
+    long long latency;
+    dictEntry *de;
+
+    /* The key is copied inside the entry, see dbDictType. */
+    latencyStartMonitor(latency);
+    de = dictAddRaw(d, key->ptr, NULL);
+    latencyEndMonitor(latency);
+    /* Track the additions that expanded the table. */
+    if (!rehashing && dictIsRehashing(d))
+        latencyAddSampleIfNeeded("keyspace-expand",latency);
 
-    serverAssertWithInfo(NULL,key,retval == DICT_OK);
+    serverAssertWithInfo(NULL,key,de != NULL);
+    dictSetVal(d, de, val);
+    db->size++;
+    keysizesAdd(db, de);
+    keysizesRememberEntry(db, de);
     if (val->type == OBJ_LIST) signalListAsReady(db, key);
-    if (server.cluster_enabled) slotToKeyAdd(key);
  }
 
 /* Overwrite an existing key with a new value. Incrementing the reference
@@ -179,20 +419,22 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
  *
  * The program is aborted if the key was not already present. */
 void dbOverwrite(redisDb *db, robj *key, robj *val) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
+    dict *d = dbKeyDict(db,key->ptr);
+    dictEntry *de = dictFind(d,key->ptr);
 
     serverAssertWithInfo(NULL,key,de != NULL);
+    robj *old = dictGetVal(de);
+    keysizesRemove(db,de);
     if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-        robj *old = dictGetVal(de);
-        int saved_lru = old->lru;
-        dictReplace(db->dict, key->ptr, val);
-        val->lru = saved_lru;
+        val->lru = old->lru;
         /* LFU should be not only copied but also updated
          * when a key is overwritten. */
         updateLFU(val);
-    } else {
-        dictReplace(db->dict, key->ptr, val);
     }
+    dictSetVal(d, de, val);
+    /* A huge old value may be released incrementally. */
+    if (!lazyfreeIncrementalFree(old)) decrRefCount(old);
+    keysizesAdd(db,de);
 }
 
 /* High level Set operation. This function can be used in order to set
@@ -215,7 +457,7 @@ void setKey(redisDb *db, robj *key, robj *val) {
 }
 
 int dbExists(redisDb *db, robj *key) {
-    return dictFind(db->dict,key->ptr) != NULL;
+    return dbFind(db,key->ptr) != NULL;
 }
 
 /* Return a random key, in form of a Redis object.
@@ -226,11 +468,12 @@ robj *dbRandomKey(redisDb *db) {
     dictEntry *de;
 
     while(1) {
+        dict *d = dbRandomDict(db);
         sds key;
         robj *keyobj;
 
-        de = dictGetRandomKey(db->dict);
-        if (de == NULL) return NULL;
+        if (d == NULL) return NULL;
+        de = dictGetRandomKey(d);
 
         key = dictGetKey(de);
         keyobj = createStringObject(key,sdslen(key));
@@ -249,8 +492,19 @@ int dbSyncDelete(redisDb *db, robj *key) {
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
     if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-    if (dictDelete(db->dict,key->ptr) == DICT_OK) {
-        if (server.cluster_enabled) slotToKeyDel(key);
+    dict *d = dbKeyDict(db,key->ptr);
+    dictEntry *de = dictUnlink(d,key->ptr);
+    if (de) {
+        long long when = dbEntryGetExpire(db,de);
+        if (db->expires_index && when != -1)
+            expireIndexRemove(db,key->ptr,when);
+        keysizesRemove(db,de);
+        keysizesForgetEntry(de);
+        db->size--;
+        /* A huge value may be released incrementally: in this case the
+         * entry is freed without its value. */
+        if (lazyfreeIncrementalFree(dictGetVal(de))) dictSetVal(d,de,NULL);
+        dictFreeUnlinkedEntry(d,de);
         return 1;
     } else {
         return 0;
@@ -325,21 +579,30 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         return -1;
     }
 
+    /* The values handed to the lazyfree thread may still be referenced by
+     * the output buffers of clients: two threads can't update their
+     * refcount, so the clients get their own copy. */
+    if (async) copyClientsReplyObjects();
+    keysizesForgetEntry(NULL);
+    evictionPoolEmpty(dbnum);
+
     for (j = 0; j < server.dbnum; j++) {
         if (dbnum != -1 && dbnum != j) continue;
-        removed += dictSize(server.db[j].dict);
+        removed += dbSize(&server.db[j]);
         if (async) {
             emptyDbAsync(&server.db[j]);
         } else {
-            dictEmpty(server.db[j].dict,callback);
+            int k;
+
+            for (k = 0; k < server.db[j].ndicts; k++)
+                dictEmpty(server.db[j].dicts[k],callback);
             dictEmpty(server.db[j].expires,callback);
-        }
-    }
-    if (server.cluster_enabled) {
-        if (async) {
-            slotToKeyFlushAsync();
-        } else {
-            slotToKeyFlush();
+            if (server.db[j].expires_index) {
+                raxFree(server.db[j].expires_index);
+                server.db[j].expires_index = raxNew();
+            }
+            memset(&server.db[j].keysizes,0,sizeof(keysizesStats));
+            server.db[j].size = 0;
         }
     }
     if (dbnum == -1) flushSlaveKeysWithExpireList();
@@ -364,6 +627,7 @@ int selectDb(client *c, int id) {
 
 void signalModifiedKey(redisDb *db, robj *key) {
     touchWatchedKey(db,key);
+    keysizesUpdate(db,key);
 }
 
 void signalFlushedDb(int dbid) {
@@ -439,6 +703,9 @@ void delGenericCommand(client *c, int lazy) {
     int numdel = 0, j;
 
     for (j = 1; j < c->argc; j++) {
+        if (c->argc > 2 && (j-1) % DICT_FIND_BATCH == 0)
+            dbPrefetchKeys(c->db,c->argv+j,c->argc-j < DICT_FIND_BATCH ?
+                                           c->argc-j : DICT_FIND_BATCH);
         expireIfNeeded(c->db,c->argv[j]);
         int deleted  = lazy ? dbAsyncDelete(c->db,c->argv[j]) :
                               dbSyncDelete(c->db,c->argv[j]);
@@ -468,6 +735,9 @@ void existsCommand(client *c) {
     int j;
 
     for (j = 1; j < c->argc; j++) {
+        if (c->argc > 2 && (j-1) % DICT_FIND_BATCH == 0)
+            dbPrefetchKeys(c->db,c->argv+j,c->argc-j < DICT_FIND_BATCH ?
+                                           c->argc-j : DICT_FIND_BATCH);
         expireIfNeeded(c->db,c->argv[j]);
         if (dbExists(c->db,c->argv[j])) count++;
     }
@@ -504,17 +774,89 @@ void randomkeyCommand(client *c) {
     decrRefCount(key);
 }
 
+/* Initialize 'di' to iterate the keys that may match 'pattern': in cluster
+ * mode, if the pattern starts with a literal hash tag, only the dict of the
+ * slot of the hash tag is iterated. */
+static void keysIteratorInit(dbIterator *di, redisDb *db, sds pattern,
+                             int safe)
+{
+    int slot = -1;
+
+    if (db->ndicts > 1) slot = patternHashSlot(pattern,sdslen(pattern));
+    if (slot == -1) dbIteratorInit(di,db,safe);
+    else dbIteratorInitDict(di,db,slot,safe);
+}
+
+/* KEYS with the pattern matched by the helper threads, see keysfilter.c.
+ * The keys are collected in batches with a non safe iterator, since the
+ * keyspace is not modified until the iteration is done: the matching keys
+ * with an expire are put apart, and only checked with expireIfNeeded(),
+ * that may delete them, at the end. Returns the number of keys replied. */
+static unsigned long keysCommandThreaded(client *c, sds pattern) {
+    dictEntry **entries = zmalloc(sizeof(dictEntry*)*KEYS_FILTER_BATCH);
+    sds *keys = zmalloc(sizeof(sds)*KEYS_FILTER_BATCH);
+    unsigned char *match = zmalloc(KEYS_FILTER_BATCH);
+    list *volatile_keys = listCreate();
+    unsigned long numkeys = 0;
+    size_t count, j;
+    dbIterator di;
+    dictEntry *de;
+    listNode *ln;
+
+    keysIteratorInit(&di,c->db,pattern,0);
+    do {
+        for (count = 0; count < KEYS_FILTER_BATCH; count++) {
+            if ((de = dbIteratorNext(&di)) == NULL) break;
+            entries[count] = de;
+            keys[count] = dictGetKey(de);
+        }
+        keysFilterMatch(pattern,sdslen(pattern),keys,count,match);
+        for (j = 0; j < count; j++) {
+            if (!match[j]) continue;
+            if (dbEntryGetExpire(c->db,entries[j]) != -1) {
+                listAddNodeTail(volatile_keys,
+                    createStringObject(keys[j],sdslen(keys[j])));
+            } else {
+                addReplyBulkCBuffer(c,keys[j],sdslen(keys[j]));
+                numkeys++;
+            }
+        }
+    } while(count == KEYS_FILTER_BATCH);
+    dbIteratorRelease(&di);
+
+    while((ln = listFirst(volatile_keys)) != NULL) {
+        robj *keyobj = listNodeValue(ln);
+        if (expireIfNeeded(c->db,keyobj) == 0) {
+            addReplyBulk(c,keyobj);
+            numkeys++;
+        }
+        decrRefCount(keyobj);
+        listDelNode(volatile_keys,ln);
+    }
+    listRelease(volatile_keys);
+    zfree(entries);
+    zfree(keys);
+    zfree(match);
+    return numkeys;
+}
+
 void keysCommand(client *c) {
-    dictIterator *di;
+    dbIterator di;
     dictEntry *de;
     sds pattern = c->argv[1]->ptr;
     int plen = sdslen(pattern), allkeys;
     unsigned long numkeys = 0;
     void *replylen = addDeferredMultiBulkLength(c);
 
-    di = dictGetSafeIterator(c->db->dict);
     allkeys = (pattern[0] == '*' && pattern[1] == '\0');
-    while((de = dictNext(di)) != NULL) {
+    if (!allkeys && server.keys_filter_threads) {
+        numkeys = keysCommandThreaded(c,pattern);
+        setDeferredMultiBulkLength(c,replylen,numkeys);
+        return;
+    }
+
+    keysIteratorInit(&di,c->db,pattern,1);
+    while((de = dbIteratorNext(&di)) != NULL) {
         sds key = dictGetKey(de);
         robj *keyobj;
 
@@ -527,17 +869,37 @@ void keysCommand(client *c) {
             decrRefCount(keyobj);
         }
     }
-    dictReleaseIterator(di);
+    dbIteratorRelease(&di);
     setDeferredMultiBulkLength(c,replylen,numkeys);
 }
 
+/* The state of scanCallback(). The elements not matching the pattern, or
+ * the keys not of the requested type, are filtered before creating any
+ * object for them. */
+typedef struct scanData {
+    list *keys;         /* Elements collected so far. */
+    robj *o;            /* The scanned object, NULL for the keyspace. */
+    sds pat;            /* Pattern to match, or NULL. */
+    int patlen;
+    char *type;         /* Type of the keys to return, or NULL. */
+    long visited;       /* Elements visited, filtered or not. */
+} scanData;
+
 /* This callback is used by scanGenericCommand in order to collect elements
  * returned by the dictionary iterator into a list. */
 void scanCallback(void *privdata, const dictEntry *de) {
-    void **pd = (void**) privdata;
-    list *keys = pd[0];
-    robj *o = pd[1];
+    scanData *data = privdata;
+    list *keys = data->keys;
+    robj *o = data->o;
     robj *key, *val = NULL;
+    sds elesds = dictGetKey(de);
+
+    data->visited += (o && (o->type == OBJ_HASH || o->type == OBJ_ZSET)) ?
+                     2 : 1;
+    if (data->pat && !stringmatchlen(data->pat,data->patlen,
+                                     elesds,sdslen(elesds),0)) return;
+    if (data->type &&
+        strcasecmp(getObjectTypeName(dictGetVal(de)),data->type)) return;
 
     if (o == NULL) {
         sds sdskey = dictGetKey(de);
@@ -596,9 +958,10 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     int i, j;
     list *keys = listCreate();
     listNode *node, *nextnode;
-    long count = 10;
+    long count = 10, budget = 0;
     sds pat = NULL;
-    int patlen = 0, use_pattern = 0;
+    char *type = NULL;
+    int patlen = 0, use_pattern = 0, slot = -1;
     dict *ht;
 
     /* Object must be NULL (to iterate keys names), or the type of the object
@@ -633,6 +996,24 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
              * equivalent to disabling it. */
             use_pattern = !(pat[0] == '*' && patlen == 1);
 
+            i += 2;
+        } else if (!strcasecmp(c->argv[i]->ptr, "type") && o == NULL &&
+                   j >= 2)
+        {
+            type = c->argv[i+1]->ptr;
+            i += 2;
+        } else if (!strcasecmp(c->argv[i]->ptr, "budget") && j >= 2) {
+            if (getLongFromObjectOrReply(c, c->argv[i+1], &budget, NULL)
+                != C_OK)
+            {
+                goto cleanup;
+            }
+
+            if (budget < 1) {
+                addReply(c,shared.syntaxerr);
+                goto cleanup;
+            }
+
             i += 2;
         } else {
             addReply(c,shared.syntaxerr);
@@ -648,10 +1029,10 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
      * just return everything inside the object in a single call, setting the
      * cursor to zero to signal the end of the iteration. */
 
-    /* Handle the case of a hash table. */
+    /* Handle the case of a hash table, or of the keyspace. */
     ht = NULL;
     if (o == NULL) {
-        ht = c->db->dict;
+        /* The keyspace, scanned with dbScan(). */
     } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_HT) {
         ht = o->ptr;
     } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT) {
@@ -663,24 +1044,51 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         count *= 2; /* We return key / value for this type. */
     }
 
-    if (ht) {
-        void *privdata[2];
+    if (o == NULL || ht) {
+        scanData data;
         /* We set the max number of iterations to ten times the specified
          * COUNT, so if the hash table is in a pathological state (very
          * sparsely populated) we avoid to block too much time at the cost
          * of returning no or very few elements. */
-        long maxiterations = count*10;
-
-        /* We pass two pointers to the callback: the list to which it will
-         * add new elements, and the object containing the dictionary so that
-         * it is possible to fetch more data in a type-dependent way. */
-        privdata[0] = keys;
-        privdata[1] = o;
-        do {
-            cursor = dictScan(ht, cursor, scanCallback, NULL, privdata);
-        } while (cursor &&
-              maxiterations-- &&
-              listLength(keys) < (unsigned long)count);
+        long maxiterations = count*10, iterations = 0;
+        long long deadline = budget ? ustime()+budget : 0;
+
+        /* In cluster mode the keys matching a pattern that starts with a
+         * literal hash tag are all in the dict of the same slot. */
+        if (o == NULL && use_pattern && c->db->ndicts > 1)
+            slot = patternHashSlot(pat,patlen);
+
+        /* The callback adds to the list the elements passing the filters,
+         * and uses the object containing the dictionary to fetch more data
+         * in a type-dependent way. */
+        data.keys = keys;
+        data.o = o;
+        data.pat = use_pattern ? pat : NULL;
+        data.patlen = patlen;
+        data.type = type;
+        data.visited = 0;
+
+        /* By default COUNT is the amount of work: the call returns after
+         * visiting about COUNT elements, even if the filters left none of
+         * them. With a BUDGET of microseconds the call instead keeps going
+         * until COUNT elements passed the filters, or the time is over. */
+        while(1) {
+            if (ht)
+                cursor = dictScan(ht, cursor, scanCallback, NULL, &data);
+            else if (slot != -1)
+                cursor = dbScanDict(c->db, slot, cursor, scanCallback, NULL,
+                                    &data);
+            else
+                cursor = dbScan(c->db, cursor, scanCallback, NULL, &data);
+            if (cursor == 0 || listLength(keys) >= (unsigned long)count)
+                break;
+            if (budget) {
+                if ((++iterations & 15) == 0 && ustime() >= deadline) break;
+            } else {
+                if (!maxiterations-- ||
+                    data.visited >= count) break;
+            }
+        }
     } else if (o->type == OBJ_SET) {
         int pos = 0;
         int64_t ll;
@@ -713,8 +1121,9 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         nextnode = listNextNode(node);
         int filter = 0;
 
-        /* Filter element if it does not match the pattern. */
-        if (!filter && use_pattern) {
+        /* Filter element if it does not match the pattern. The elements
+         * collected from hash tables were already filtered by the callback. */
+        if (!filter && use_pattern && o != NULL && ht == NULL) {
             if (sdsEncodedObject(kobj)) {
                 if (!stringmatchlen(pat, patlen, kobj->ptr, sdslen(kobj->ptr), 0))
                     filter = 1;
@@ -777,35 +1186,34 @@ void scanCommand(client *c) {
 }
 
 void dbsizeCommand(client *c) {
-    addReplyLongLong(c,dictSize(c->db->dict));
+    addReplyLongLong(c,dbSize(c->db));
 }
 
 void lastsaveCommand(client *c) {
     addReplyLongLong(c,server.lastsave);
 }
 
+/* Return the name of the type of 'o', as reported by TYPE. */
+char *getObjectTypeName(robj *o) {
+    switch(o->type) {
+    case OBJ_STRING: return "string";
+    case OBJ_LIST: return "list";
+    case OBJ_SET: return "set";
+    case OBJ_ZSET: return "zset";
+    case OBJ_HASH: return "hash";
+    case OBJ_MODULE: {
+        moduleValue *mv = o->ptr;
+        return mv->type->name;
+    }
+    default: return "unknown";
+    }
+}
+
 void typeCommand(client *c) {
     robj *o;
-    char *type;
 
     o = lookupKeyReadWithFlags(c->db,c->argv[1],LOOKUP_NOTOUCH);
-    if (o == NULL) {
-        type = "none";
-    } else {
-        switch(o->type) {
-        case OBJ_STRING: type = "string"; break;
-        case OBJ_LIST: type = "list"; break;
-        case OBJ_SET: type = "set"; break;
-        case OBJ_ZSET: type = "zset"; break;
-        case OBJ_HASH: type = "hash"; break;
-        case OBJ_MODULE: {
-            moduleValue *mv = o->ptr;
-            type = mv->type->name;
-        }; break;
-        default: type = "unknown"; break;
-        }
-    }
-    addReplyStatus(c,type);
+    addReplyStatus(c, o ? getObjectTypeName(o) : "none");
 }
 
 void shutdownCommand(client *c) {
@@ -969,19 +1377,32 @@ int dbSwapDatabases(int id1, int id2) {
     if (id1 < 0 || id1 >= server.dbnum ||
         id2 < 0 || id2 >= server.dbnum) return C_ERR;
     if (id1 == id2) return C_OK;
+    keysizesForgetEntry(NULL);
     redisDb aux = server.db[id1];
     redisDb *db1 = &server.db[id1], *db2 = &server.db[id2];
 
     /* Swap hash tables. Note that we don't swap blocking_keys,
      * ready_keys and watched_keys, since we want clients to
      * remain in the same DB they were. */
-    db1->dict = db2->dict;
+    db1->dicts = db2->dicts;
+    db1->ndicts = db2->ndicts;
+    db1->size = db2->size;
+    db1->resize_cursor = db2->resize_cursor;
+    db1->rehash_cursor = db2->rehash_cursor;
     db1->expires = db2->expires;
+    db1->expires_index = db2->expires_index;
     db1->avg_ttl = db2->avg_ttl;
+    db1->keysizes = db2->keysizes;
 
-    db2->dict = aux.dict;
+    db2->dicts = aux.dicts;
+    db2->ndicts = aux.ndicts;
+    db2->size = aux.size;
+    db2->resize_cursor = aux.resize_cursor;
+    db2->rehash_cursor = aux.rehash_cursor;
     db2->expires = aux.expires;
+    db2->expires_index = aux.expires_index;
     db2->avg_ttl = aux.avg_ttl;
+    db2->keysizes = aux.keysizes;
 
     /* Now we need to handle clients blocked on lists: as an effect
      * of swapping the two DBs, a client that was waiting for list
@@ -1026,14 +1447,206 @@ void swapdbCommand(client *c) {
     }
 }
 
+/*-----------------------------------------------------------------------------
+ * Keysizes
+ *
+ * Every DB keeps the number of keys of each type, and an histogram of the
+ * sizes of the values with a bin per power of two: the length in bytes of
+ * strings, and the number of elements of the other types, that are the sizes
+ * known in O(1). Bin 0 counts the empty values, bin N > 0 the values with a
+ * size in the range [2^(N-1), 2^N-1]. Module values are always in bin 0.
+ *
+ * The bin the value was accounted in is stored in the byte that follows the
+ * key embedded in the keyspace entry, so the stats can be updated without
+ * knowing the old size of the value: dbAdd(), dbOverwrite() and the deletion
+ * of keys account for the whole entry, while signalModifiedKey(), called
+ * after every write, moves the key to the bin of its new size. The entry
+ * found by lookupKeyWrite() or added by dbAdd() is remembered, so that
+ * signalModifiedKey() does not have to find it again.
+ *
+ * An estimate of the memory used by the values of the DB is derived from the
+ * bins as well, so that the eviction can sample the DBs in proportion to the
+ * memory they use.
+ *----------------------------------------------------------------------------*/
+
+const char *keysizesTypeNames[OBJ_TYPES] = {
+    "strings", "lists", "sets", "zsets", "hashes", "modules"
+};
+
+/* Return a pointer to the byte holding the bin of the keyspace entry 'de'.
+ * See dictSdsEmbed(). */
+static uint8_t *dbEntryKeysizesRef(dictEntry *de) {
+    sds key = dictGetKey(de);
+    return (uint8_t*)key+sdslen(key)+1;
+}
+
+static int keysizesBin(robj *o) {
+    unsigned long long size;
+
+    switch(o->type) {
+    case OBJ_STRING: size = stringObjectLen(o); break;
+    case OBJ_LIST: size = listTypeLength(o); break;
+    case OBJ_SET: size = setTypeSize(o); break;
+    case OBJ_ZSET: size = zsetLength(o); break;
+    case OBJ_HASH: size = hashTypeLength(o); break;
+    default: size = 0; break;
+    }
+    return size ? 64-__builtin_clzll(size) : 0;
+}
+
+/* Return the smallest size counted by the specified bin. */
+unsigned long long keysizesBinStart(int bin) {
+    return bin ? 1ULL<<(bin-1) : 0;
+}
+
+/* Return the estimated memory used by a value of the specified type in the
+ * specified bin, assuming it is in the middle of the bin, and that elements
+ * use OBJ_ESTIMATE_ELE_SIZE bytes. Used by the eviction to weight the DBs. */
+static unsigned long long keysizesBinBytes(int type, int bin) {
+    unsigned long long size = keysizesBinStart(bin);
+
+    size += size/2;
+    return (type == OBJ_STRING) ? size : size*OBJ_ESTIMATE_ELE_SIZE;
+}
+
+/* Account the key of the keyspace entry 'de' in the stats of 'db'. */
+void keysizesAdd(redisDb *db, dictEntry *de) {
+    robj *val = dictGetVal(de);
+    int bin = keysizesBin(val);
+
+    *dbEntryKeysizesRef(de) = bin;
+    db->keysizes.keys[val->type]++;
+    db->keysizes.bins[val->type][bin]++;
+    db->keysizes.bytes += keysizesBinBytes(val->type,bin);
+}
+
+/* Remove the key of the keyspace entry 'de' from the stats of 'db'. Must be
+ * called while the entry still references the accounted value. */
+void keysizesRemove(redisDb *db, dictEntry *de) {
+    robj *val = dictGetVal(de);
+
+    int bin = *dbEntryKeysizesRef(de);
+
+    db->keysizes.keys[val->type]--;
+    db->keysizes.bins[val->type][bin]--;
+    db->keysizes.bytes -= keysizesBinBytes(val->type,bin);
+}
+
+/* The keyspace entry of the last key looked up for writing or added, and
+ * its DB. It is forgotten when the entry is freed or moved. */
+static redisDb *keysizes_last_db = NULL;
+static dictEntry *keysizes_last_de = NULL;
+
+void keysizesRememberEntry(redisDb *db, dictEntry *de) {
+    keysizes_last_db = db;
+    keysizes_last_de = de;
+}
+
+/* Forget the remembered entry if it is 'de', or in any case if 'de' is
+ * NULL. Must be called before the entry is freed or moved. */
+void keysizesForgetEntry(dictEntry *de) {
+    if (de == NULL || de == keysizes_last_de) {
+        keysizes_last_db = NULL;
+        keysizes_last_de = NULL;
+    }
+}
+
+/* Move 'key' to the bin of the current size of its value, if it exists. */
+void keysizesUpdate(redisDb *db, robj *key) {
+    dictEntry *de = keysizes_last_de;
+    uint8_t *ref;
+    robj *val;
+    int bin;
+
+    /* Usually the key was just looked up or added by the command. */
+    if (db != keysizes_last_db || sdscmp(dictGetKey(de),key->ptr) != 0)
+        de = dbFind(db,key->ptr);
+    if (de == NULL) return;
+    val = dictGetVal(de);
+    ref = dbEntryKeysizesRef(de);
+    bin = keysizesBin(val);
+    if (bin == *ref) return;
+    db->keysizes.bins[val->type][*ref]--;
+    db->keysizes.bins[val->type][bin]++;
+    db->keysizes.bytes += keysizesBinBytes(val->type,bin)-
+                          keysizesBinBytes(val->type,*ref);
+    *ref = bin;
+}
+
 /*-----------------------------------------------------------------------------
  * Expires API
+ *
+ * The entries of the keyspace dicts are allocated together with the key, and with the
+ * expire once the key gets one:
+ *
+ *   [dictEntry: key pointer, value][expire (optional)][key sds][size bin]
+ *
+ * so the key name, the expire and the value pointer are read from the same
+ * cache line. The expire slot is present if the key sds does not start right
+ * after the dictEntry fields. Once added the slot is never removed, it is
+ * set to -1 when the key is made persistent.
+ *
+ * db->expires is an index of the volatile keys, used to sample them: its keys
+ * are the keys embedded in the keyspace entries, and its values are the
+ * entries themselves.
  *----------------------------------------------------------------------------*/
 
+/* Return a pointer to the expire slot of the keyspace entry 'de', or NULL
+ * if the entry has no room for the expire. */
+static long long *dbEntryExpireRef(redisDb *db, dictEntry *de) {
+    char *slot = (char*)de + dictEntryMemUsage(db->dicts[0]);
+
+    if ((char*)sdsAllocPtr(dictGetKey(de)) == slot) return NULL;
+    return (long long*)slot;
+}
+
+/* Return the expire of the keyspace entry 'de', or -1 if the key is not
+ * volatile. */
+long long dbEntryGetExpire(redisDb *db, dictEntry *de) {
+    long long *when = dbEntryExpireRef(db,de);
+    return when ? *when : -1;
+}
+
+/* Return the memory used by the keyspace entry 'de', including the key and
+ * the expire, but not the value. */
+size_t dbEntryMemUsage(redisDb *db, dictEntry *de) {
+    return dictEntryMemUsage(db->dicts[0]) +
+           (dbEntryExpireRef(db,de) ? sizeof(long long) : 0) +
+           dictSdsEmbedLen(dictGetKey(de));
+}
+
+/* Replace the keyspace entry 'de', that has no expire slot, with a new
+ * entry with room for the expire, returning the new entry. The key can't be
+ * referenced by db->expires, since it was never volatile. */
+static dictEntry *dbEntryAddExpireSlot(redisDb *db, dictEntry *de) {
+    sds key = dictGetKey(de);
+    dict *d = dbKeyDict(db,key);
+    size_t hdrlen = dictEntryMemUsage(d);
+    dictEntry **ref, *newde;
+
+    ref = dictFindEntryRefByPtrAndHash(d,key,dictGetHash(d,key));
+    serverAssert(ref != NULL && *ref == de);
+    newde = zmalloc(hdrlen+sizeof(long long)+dictSdsEmbedLen(key));
+    memcpy(newde,de,hdrlen);
+    newde->key = dictSdsEmbed((char*)newde+hdrlen+sizeof(long long),key);
+    *dbEntryKeysizesRef(newde) = *dbEntryKeysizesRef(de);
+    keysizesForgetEntry(de);
+    *ref = newde;
+    zfree(de);
+    return newde;
+}
+
 int removeExpire(redisDb *db, robj *key) {
     /* An expire may only be removed if there is a corresponding entry in the
      * main dict. Otherwise, the key will never be freed. */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
+    dictEntry *kde = dbFind(db,key->ptr);
+    long long *when;
+
+    serverAssertWithInfo(NULL,key,kde != NULL);
+    if ((when = dbEntryExpireRef(db,kde)) == NULL) return 0;
+    if (db->expires_index && *when != -1)
+        expireIndexRemove(db,key->ptr,*when);
+    *when = -1;
     return dictDelete(db->expires,key->ptr) == DICT_OK;
 }
 
@@ -1043,12 +1656,22 @@ int removeExpire(redisDb *db, robj *key) {
  * after which the key will no longer be considered valid. */
 void setExpire(client *c, redisDb *db, robj *key, long long when) {
     dictEntry *kde, *de;
+    long long *slot;
 
-    /* Reuse the sds from the main dict in the expire dict */
-    kde = dictFind(db->dict,key->ptr);
+    kde = dbFind(db,key->ptr);
     serverAssertWithInfo(NULL,key,kde != NULL);
+    if ((slot = dbEntryExpireRef(db,kde)) == NULL) {
+        kde = dbEntryAddExpireSlot(db,kde);
+        slot = dbEntryExpireRef(db,kde);
+    } else if (db->expires_index && *slot != -1) {
+        expireIndexRemove(db,key->ptr,*slot);
+    }
+    if (db->expires_index) expireIndexAdd(db,key->ptr,when);
+    *slot = when;
+
+    /* Reuse the sds from the main dict in the expire dict */
     de = dictAddOrFind(db->expires,dictGetKey(kde));
-    dictSetSignedIntegerVal(de,when);
+    dictSetVal(db->expires,de,kde);
 
     int writable_slave = server.masterhost && server.repl_slave_ro == 0;
     if (c && writable_slave && !(c->flags & CLIENT_MASTER))
@@ -1062,12 +1685,8 @@ long long getExpire(redisDb *db, robj *key) {
 
     /* No expire? return ASAP */
     if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key->ptr)) == NULL) return -1;
-
-    /* The entry was found in the expire dict, this means it should also
-     * be present in the main dict (safety check). */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictGetSignedIntegerVal(de);
+       (de = dbFind(db,key->ptr)) == NULL) return -1;
+    return dbEntryGetExpire(db,de);
 }
 
 /* Propagate expires into slaves and the AOF file.
@@ -1386,84 +2005,46 @@ int *georadiusGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numk
 /* Slot to Key API. This is used by Redis Cluster in order to obtain in
  * a fast way a key that belongs to a specified hash slot. This is useful
  * while rehashing the cluster and in other conditions when we need to
- * understand if we have keys for a given hash slot. */
-void slotToKeyUpdateKey(robj *key, int add) {
-    unsigned int hashslot = keyHashSlot(key->ptr,sdslen(key->ptr));
-    unsigned char buf[64];
-    unsigned char *indexed = buf;
-    size_t keylen = sdslen(key->ptr);
-
-    server.cluster->slots_keys_count[hashslot] += add ? 1 : -1;
-    if (keylen+2 > 64) indexed = zmalloc(keylen+2);
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    memcpy(indexed+2,key->ptr,keylen);
-    if (add) {
-        raxInsert(server.cluster->slots_to_keys,indexed,keylen+2,NULL,NULL);
-    } else {
-        raxRemove(server.cluster->slots_to_keys,indexed,keylen+2,NULL);
-    }
-    if (indexed != buf) zfree(indexed);
-}
-
-void slotToKeyAdd(robj *key) {
-    slotToKeyUpdateKey(key,1);
-}
-
-void slotToKeyDel(robj *key) {
-    slotToKeyUpdateKey(key,0);
-}
-
-void slotToKeyFlush(void) {
-    raxFree(server.cluster->slots_to_keys);
-    server.cluster->slots_to_keys = raxNew();
-    memset(server.cluster->slots_keys_count,0,
-           sizeof(server.cluster->slots_keys_count));
-}
+ * understand if we have keys for a given hash slot. In cluster mode the
+ * keyspace has a dict per hash slot, so these are direct operations. */
 
 /* Pupulate the specified array of objects with keys in the specified slot.
  * New objects are returned to represent keys, it's up to the caller to
  * decrement the reference count to release the keys names. */
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count) {
-    raxIterator iter;
+    dictIterator *di;
+    dictEntry *de;
     int j = 0;
-    unsigned char indexed[2];
-
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    raxStart(&iter,server.cluster->slots_to_keys);
-    raxSeek(&iter,">=",indexed,2);
-    while(count-- && raxNext(&iter)) {
-        if (iter.key[0] != indexed[0] || iter.key[1] != indexed[1]) break;
-        keys[j++] = createStringObject((char*)iter.key+2,iter.key_len-2);
+
+    di = dictGetIterator(server.db[0].dicts[hashslot]);
+    while(count-- && (de = dictNext(di)) != NULL) {
+        sds key = dictGetKey(de);
+        keys[j++] = createStringObject(key,sdslen(key));
     }
-    raxStop(&iter);
+    dictReleaseIterator(di);
     return j;
 }
 
 /* Remove all the keys in the specified hash slot.
  * The number of removed items is returned. */
 unsigned int delKeysInSlot(unsigned int hashslot) {
-    raxIterator iter;
+    dictIterator *di;
+    dictEntry *de;
     int j = 0;
-    unsigned char indexed[2];
-
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    raxStart(&iter,server.cluster->slots_to_keys);
-    while(server.cluster->slots_keys_count[hashslot]) {
-        raxSeek(&iter,">=",indexed,2);
-        raxNext(&iter);
-
-        robj *key = createStringObject((char*)iter.key+2,iter.key_len-2);
-        dbDelete(&server.db[0],key);
-        decrRefCount(key);
+
+    di = dictGetSafeIterator(server.db[0].dicts[hashslot]);
+    while((de = dictNext(di)) != NULL) {
+        sds key = dictGetKey(de);
+        robj *keyobj = createStringObject(key,sdslen(key));
+
+        dbDelete(&server.db[0],keyobj);
+        decrRefCount(keyobj);
         j++;
     }
-    raxStop(&iter);
+    dictReleaseIterator(di);
     return j;
 }
 
 unsigned int countKeysInSlot(unsigned int hashslot) {
-    return server.cluster->slots_keys_count[hashslot];
+    return dictSize(server.db[0].dicts[hashslot]);
 }
@@ -115,7 +115,7 @@ void mixObjectDigest(unsigned char *digest, robj *o) {
 void computeDatasetDigest(unsigned char *final) {
     unsigned char digest[20];
     char buf[128];
-    dictIterator *di = NULL;
+    dbIterator di;
     dictEntry *de;
     int j;
     uint32_t aux;
@@ -125,8 +125,8 @@ void computeDatasetDigest(unsigned char *final) {
     for (j = 0; j < server.dbnum; j++) {
         redisDb *db = server.db+j;
 
-        if (dictSize(db->dict) == 0) continue;
-        di = dictGetSafeIterator(db->dict);
+        if (dbSize(db) == 0) continue;
+        dbIteratorInit(&di,db,1);
 
         /* hash the DB id, so the same dataset moved in a different
          * DB will lead to a different digest */
@@ -134,7 +134,7 @@ void computeDatasetDigest(unsigned char *final) {
         mixDigest(final,&aux,sizeof(aux));
 
         /* Iterate this DB writing every entry */
-        while((de = dictNext(di)) != NULL) {
+        while((de = dbIteratorNext(&di)) != NULL) {
             sds key;
             robj *keyobj, *o;
             long long expiretime;
@@ -257,7 +257,7 @@ void computeDatasetDigest(unsigned char *final) {
             xorDigest(final,digest,20);
             decrRefCount(keyobj);
         }
-        dictReleaseIterator(di);
+        dbIteratorRelease(&di);
     }
 }
 
@@ -365,7 +365,7 @@ void debugCommand(client *c) {
         robj *val;
         char *strenc;
 
-        if ((de = dictFind(c->db->dict,c->argv[2]->ptr)) == NULL) {
+        if ((de = dbFind(c->db,c->argv[2]->ptr)) == NULL) {
             addReply(c,shared.nokeyerr);
             return;
         }
@@ -417,7 +417,7 @@ void debugCommand(client *c) {
         robj *val;
         sds key;
 
-        if ((de = dictFind(c->db->dict,c->argv[2]->ptr)) == NULL) {
+        if ((de = dbFind(c->db,c->argv[2]->ptr)) == NULL) {
             addReply(c,shared.nokeyerr);
             return;
         }
@@ -457,7 +457,7 @@ void debugCommand(client *c) {
 
         if (getLongFromObjectOrReply(c, c->argv[2], &keys, NULL) != C_OK)
             return;
-        dictExpand(c->db->dict,keys);
+        if (c->db->ndicts == 1) dictExpand(c->db->dicts[0],keys);
         for (j = 0; j < keys; j++) {
             long valsize = 0;
             snprintf(buf,sizeof(buf),"%s:%lu",
@@ -543,8 +543,15 @@ void debugCommand(client *c) {
         }
 
         stats = sdscatprintf(stats,"[Dictionary HT]\n");
-        dictGetStats(buf,sizeof(buf),server.db[dbid].dict);
-        stats = sdscat(stats,buf);
+        if (server.db[dbid].ndicts == 1) {
+            dictGetStats(buf,sizeof(buf),server.db[dbid].dicts[0]);
+            stats = sdscat(stats,buf);
+        } else {
+            stats = sdscatprintf(stats,
+                "Keyspace partitioned in %d dicts: %llu keys, %llu buckets\n",
+                server.db[dbid].ndicts, dbSize(server.db+dbid),
+                dbSlots(server.db+dbid));
+        }
 
         stats = sdscatprintf(stats,"[Expires HT]\n");
         dictGetStats(buf,sizeof(buf),server.db[dbid].expires);
@@ -915,7 +922,7 @@ void logCurrentClient(void) {
         dictEntry *de;
 
         key = getDecodedObject(cc->argv[1]);
-        de = dictFind(cc->db->dict, key->ptr);
+        de = dbFind(cc->db, key->ptr);
         if (de) {
             val = dictGetVal(de);
             serverLog(LL_WARNING,"key '%s' found in DB containing the following object:", (char*)key->ptr);
@@ -152,11 +152,11 @@ int dictIterDefragEntry(dictIterator *iter) {
     }
     /* handle the case of the first entry in the hash bucket. */
     ht = &iter->d->ht[iter->table];
-    if (ht->table[iter->index] == iter->entry) {
+    if (*dictHtChain(ht,iter->index) == iter->entry) {
         dictEntry *newde = activeDefragAlloc(iter->entry);
         if (newde) {
             iter->entry = newde;
-            ht->table[iter->index] = newde;
+            *dictHtChain(ht,iter->index) = newde;
             defragged++;
         }
     }
@@ -168,22 +168,13 @@ int dictIterDefragEntry(dictIterator *iter) {
  * struct itself was moved. Returns a stat of how many pointers were moved. */
 int dictDefragTables(dict** dictRef) {
     dict *d = *dictRef;
-    dictEntry **newtable;
     int defragged = 0;
     /* handle the dict struct */
     dict *newd = activeDefragAlloc(d);
     if (newd)
         defragged++, *dictRef = d = newd;
-    /* handle the first hash table */
-    newtable = activeDefragAlloc(d->ht[0].table);
-    if (newtable)
-        defragged++, d->ht[0].table = newtable;
-    /* handle the second hash table */
-    if (d->ht[1].table) {
-        newtable = activeDefragAlloc(d->ht[1].table);
-        if (newtable)
-            defragged++, d->ht[1].table = newtable;
-    }
+    /* handle the segments of both hash tables */
+    defragged += dictReallocTables(d, activeDefragAlloc);
     return defragged;
 }
 
@@ -273,7 +264,6 @@ dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sd
  * all the various pointers it has. Returns a stat of how many pointers were
  * moved. */
 int defragKey(redisDb *db, dictEntry *de) {
-    sds keysds = dictGetKey(de);
     robj *newob, *ob;
     unsigned char *newzl;
     dict *d;
@@ -281,17 +271,9 @@ int defragKey(redisDb *db, dictEntry *de) {
     int defragged = 0;
     sds newsds;
 
-    /* Try to defrag the key name. */
-    newsds = activeDefragSds(keysds);
-    if (newsds)
-        defragged++, de->key = newsds;
-    if (dictSize(db->expires)) {
-         /* Dirty code:
-          * I can't search in db->expires for that key after i already released
-          * the pointer it holds it won't be able to do the string compare */
-        uint64_t hash = dictGetHash(db->dict, de->key);
-        replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->expires, keysds, newsds, hash, &defragged);
-    }
+    /* The key name is embedded in the entry, that was already moved by
+     * defragDictBucketCallback() if needed. */
+    UNUSED(db);
 
     /* Try to defrag robj and / or string value. */
     ob = dictGetVal(de);
@@ -425,17 +407,34 @@ void defragScanCallback(void *privdata, const dictEntry *de) {
         server.stat_active_defrag_key_misses++;
 }
 
-/* Defrag scan callback for for each hash table bicket,
- * used in order to defrag the dictEntry allocations. */
-void defragDictBucketCallback(void *privdata, dictEntry **bucketref) {
-    UNUSED(privdata);
-    while(*bucketref) {
-        dictEntry *de = *bucketref, *newde;
-        if ((newde = activeDefragAlloc(de))) {
-            *bucketref = newde;
-        }
-        bucketref = &(*bucketref)->next;
+/* Defrag scan callback for each entry of the main dict of a db, used in
+ * order to defrag the dictEntry allocations. The key and the expire are
+ * embedded in the entry, so when the entry is moved the key pointer and the
+ * entry of the key in db->expires must be updated too. */
+void defragDictBucketCallback(void *privdata, dictEntry **entryref) {
+    redisDb *db = privdata;
+    dictEntry *de = *entryref, *newde, *expirede;
+    sds oldkey = dictGetKey(de), newkey = NULL;
+    int isvolatile = dbEntryGetExpire(db,de) != -1;
+    uint64_t hash = isvolatile ? dictGetHash(dbKeyDict(db,oldkey),oldkey) : 0;
+    int defragged = 0;
+
+    if ((newde = activeDefragAlloc(de))) {
+        keysizesForgetEntry(de);
+        newkey = (sds)((char*)newde + ((char*)oldkey - (char*)de));
+        newde->key = newkey;
+        *entryref = de = newde;
+        defragged++;
+    }
+    if (isvolatile) {
+        /* Dirty code:
+         * I can't search in db->expires for that key after i already released
+         * the pointer it holds it won't be able to do the string compare */
+        expirede = replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->expires,
+            oldkey, newkey, hash, &defragged);
+        if (expirede) dictSetVal(db->expires, expirede, de);
     }
+    server.stat_active_defrag_hits += defragged;
 }
 
 /* Utility function to get the fragmentation ratio from jemalloc.
@@ -555,7 +554,7 @@ void activeDefragCycle(void) {
         }
 
         do {
-            cursor = dictScan(db->dict, cursor, defragScanCallback, defragDictBucketCallback, db);
+            cursor = dbScan(db, cursor, defragScanCallback, defragDictBucketCallback, db);
             /* Once in 16 scan iterations, or 1000 pointer reallocations
              * (if we have a lot of pointers in one hash bucket), check if we
              * reached the tiem limit. */
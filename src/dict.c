@@ -3,7 +3,8 @@
  * This file implements in memory hash tables with insert/del/replace/find/
  * get-random-element operations. Hash tables will auto resize if needed
  * tables of power of two in size are used, collisions are handled by
- * chaining. See the source code for more information... :)
+ * chaining, or by chains of cache line sized buckets for dictionaries using
+ * the bucketed layout. See the source code for more information... :)
  *
  * Copyright (c) 2006-2012, Salvatore Sanfilippo <antirez at gmail dot com>
  * All rights reserved.
@@ -45,6 +46,7 @@
 
 #include "dict.h"
 #include "zmalloc.h"
+#include "wyhash.h"
 #ifndef DICT_BENCHMARK_MAIN
 #include "redisassert.h"
 #else
@@ -69,6 +71,256 @@ static unsigned long _dictNextPower(unsigned long size);
 static long _dictKeyIndex(dict *ht, const void *key, uint64_t hash, dictEntry **existing);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
 
+/* ------------------------- bucketed layout -------------------------------
+ *
+ * With DICT_LAYOUT_BUCKETS the table is an array of dictBucket structures.
+ * The bucket selected by the hash of a key, together with its child buckets
+ * if any, plays the same role of the chain of entries of the chained layout:
+ * incremental rehashing moves whole chains of buckets, and dictScan() emits
+ * whole chains of buckets, so all the guarantees are the same. However a
+ * lookup touches the bucket, that is a single cache line, and only follows
+ * the pointers of the entries whose hash byte (tag) matches, that with one
+ * byte of tag is, on average, less than 0.03 entries per lookup of a
+ * missing key, instead of following a linked list. The entries don't need
+ * the 'next' pointer and are 8 bytes smaller.
+ *
+ * When a bucket is full, its last entry is moved to a new child bucket and
+ * the last slot points to it. Deleting entries compacts the chain again,
+ * but never while safe iterators are running, since they may be visiting
+ * the chain. */
+
+#define bucketIsChained(b) ((b)->presence & DICT_BUCKET_CHAINED)
+#define bucketChild(b) ((dictBucket*)(b)->slots[DICT_BUCKET_SLOTS-1])
+#define bucketNumSlots(b) \
+    (bucketIsChained(b) ? DICT_BUCKET_SLOTS-1 : DICT_BUCKET_SLOTS)
+#define bucketFreeSlots(b) (~(b)->presence & ((1<<bucketNumSlots(b))-1))
+#define hashTag(h) ((uint8_t)((h) >> 56))
+
+static int _dictFirstBit(unsigned int bits) {
+    int j = 0;
+
+    while (!(bits & (1<<j))) j++;
+    return j;
+}
+
+/* Search the chain of buckets starting at 'b' for 'key'. Returns the bucket
+ * holding the entry, setting '*slot' to its slot, or NULL if not found. */
+static dictBucket *_dictBucketFind(dict *d, dictBucket *b, const void *key,
+                                   uint64_t hash, int *slot)
+{
+    uint8_t tag = hashTag(hash);
+
+    while(1) {
+        int j, slots = bucketNumSlots(b);
+
+        for (j = 0; j < slots; j++) {
+            dictEntry *he;
+
+            if (!(b->presence & (1<<j)) || b->tags[j] != tag) continue;
+            he = b->slots[j];
+            if (key==he->key || dictCompareKeys(d, key, he->key)) {
+                *slot = j;
+                return b;
+            }
+        }
+        if (!bucketIsChained(b)) return NULL;
+        b = bucketChild(b);
+    }
+}
+
+/* Return a reference to a free slot for an entry with the specified hash in
+ * the chain of buckets starting at 'b', adding a child bucket to the chain
+ * if all the buckets are full. */
+static void **_dictBucketInsertSlot(dictBucket *b, uint64_t hash) {
+    while(1) {
+        unsigned int free = bucketFreeSlots(b);
+
+        if (free) {
+            int j = _dictFirstBit(free);
+
+            b->presence |= 1<<j;
+            b->tags[j] = hashTag(hash);
+            return &b->slots[j];
+        }
+        if (!bucketIsChained(b)) {
+            /* Move the last entry to a new child bucket. */
+            dictBucket *child = zcalloc(sizeof(*child));
+
+            child->presence = 1;
+            child->tags[0] = b->tags[DICT_BUCKET_SLOTS-1];
+            child->slots[0] = b->slots[DICT_BUCKET_SLOTS-1];
+            b->slots[DICT_BUCKET_SLOTS-1] = child;
+            b->presence &= ~(1<<(DICT_BUCKET_SLOTS-1));
+            b->presence |= DICT_BUCKET_CHAINED;
+        }
+        b = bucketChild(b);
+    }
+}
+
+/* Release the child buckets of 'b', that must not hold entries. */
+static void _dictBucketFreeChildren(dictBucket *b) {
+    dictBucket *child;
+
+    if (!bucketIsChained(b)) return;
+    child = bucketChild(b);
+    b->presence &= ~DICT_BUCKET_CHAINED;
+    b->slots[DICT_BUCKET_SLOTS-1] = NULL;
+    while(child) {
+        dictBucket *next = bucketIsChained(child) ? bucketChild(child) : NULL;
+
+        zfree(child);
+        child = next;
+    }
+}
+
+/* Move the entries of the last bucket of the chain starting at 'head' to the
+ * free slots of the previous buckets, releasing the last bucket when it gets
+ * empty, as long as possible. */
+static void _dictBucketCompact(dictBucket *head) {
+    while(bucketIsChained(head)) {
+        dictBucket *parent = head, *last = bucketChild(head), *b;
+        int j;
+
+        while(bucketIsChained(last)) {
+            parent = last;
+            last = bucketChild(last);
+        }
+        for (j = 0; j < DICT_BUCKET_SLOTS; j++) {
+            int k;
+
+            if (!(last->presence & (1<<j))) continue;
+            for (b = head; b != last; b = bucketChild(b))
+                if (bucketFreeSlots(b)) break;
+            if (b == last) return; /* No room in the previous buckets. */
+            k = _dictFirstBit(bucketFreeSlots(b));
+            b->presence |= 1<<k;
+            b->tags[k] = last->tags[j];
+            b->slots[k] = last->slots[j];
+            last->presence &= ~(1<<j);
+        }
+        zfree(last);
+        parent->presence &= ~DICT_BUCKET_CHAINED;
+        parent->slots[DICT_BUCKET_SLOTS-1] = NULL;
+    }
+}
+
+/* Return a random entry of the chain of buckets starting at 'b', or NULL
+ * if the chain is empty. */
+static dictEntry *_dictBucketRandomEntry(dictBucket *b) {
+    dictBucket *head = b;
+    int count = 0, j;
+
+    for (; b; b = bucketIsChained(b) ? bucketChild(b) : NULL)
+        for (j = 0; j < bucketNumSlots(b); j++)
+            if (b->presence & (1<<j)) count++;
+    if (count == 0) return NULL;
+    count = random() % count;
+    for (b = head; b; b = bucketIsChained(b) ? bucketChild(b) : NULL) {
+        for (j = 0; j < bucketNumSlots(b); j++) {
+            if (!(b->presence & (1<<j))) continue;
+            if (count-- == 0) return b->slots[j];
+        }
+    }
+    return NULL; /* Unreachable. */
+}
+
+/* ------------------------------ table segments ----------------------------
+ *
+ * See the dictht comment in dict.h. While rehashing, the segments of ht[0]
+ * are also released as soon as the rehashing index moves past them, so the
+ * memory used by the two tables grows with the rehashing progress instead of
+ * doubling at once. */
+
+#define DICT_SEGMENT_BYTES (1<<16)
+
+/* Segments never written. They are only read, as empty slots: being const
+ * the array is in read only memory, so a write through it would crash
+ * instead of silently corrupting all the empty segments. */
+static const char dict_empty_segment[DICT_SEGMENT_BYTES];
+
+static unsigned int _dictSegmentShift(dict *d) {
+    return dictIsBucketed(d) ? DICT_BUCKETS_SEGMENT_SHIFT :
+                               DICT_CHAINED_SEGMENT_SHIFT;
+}
+
+static unsigned long _dictNumSegments(dict *d, dictht *ht) {
+    unsigned long segments = ht->size >> _dictSegmentShift(d);
+    return segments ? segments : 1;
+}
+
+static size_t _dictSegmentBytes(dict *d, dictht *ht) {
+    unsigned long slots = 1UL << _dictSegmentShift(d);
+
+    if (ht->size < slots) slots = ht->size;
+    return slots * (dictIsBucketed(d) ? sizeof(dictBucket) : sizeof(dictEntry*));
+}
+
+/* Make sure the segment holding the slot 'idx' of 'ht' can be written. */
+static void _dictSegmentAlloc(dict *d, dictht *ht, unsigned long idx) {
+    void **seg = &ht->segments[idx >> _dictSegmentShift(d)];
+
+    if (*seg != dict_empty_segment) return;
+    *seg = zcalloc(_dictSegmentBytes(d, ht));
+    ht->allocated++;
+}
+
+static void _dictSegmentFree(dictht *ht, unsigned long segidx) {
+    void **seg = &ht->segments[segidx];
+
+    if (*seg == dict_empty_segment) return;
+    zfree(*seg);
+    *seg = (void*)dict_empty_segment;
+    ht->allocated--;
+}
+
+/* Release all the segments of 'ht', that must not hold entries anymore. */
+static void _dictFreeSegments(dict *d, dictht *ht) {
+    unsigned long j, segments;
+
+    if (ht->segments == NULL) return;
+    segments = _dictNumSegments(d, ht);
+    for (j = 0; j < segments; j++) _dictSegmentFree(ht, j);
+    zfree(ht->segments);
+}
+
+/* Return the memory used by the tables of the dictionary. */
+size_t dictTableMemUsage(dict *d) {
+    size_t mem = 0;
+    int j;
+
+    for (j = 0; j <= 1; j++) {
+        dictht *ht = &d->ht[j];
+
+        if (ht->segments == NULL) continue;
+        mem += _dictNumSegments(d, ht) * sizeof(void*) +
+               ht->allocated * _dictSegmentBytes(d, ht);
+    }
+    return mem;
+}
+
+/* Call 'reallocfn' on every allocation of the tables of the dictionary, that
+ * may return a new pointer for it, or NULL if the allocation was not moved.
+ * Returns the number of allocations moved. Used by the active defrag. */
+int dictReallocTables(dict *d, void *(*reallocfn)(void *ptr)) {
+    int j, moved = 0;
+    unsigned long k;
+    void *newptr;
+
+    for (j = 0; j <= 1; j++) {
+        dictht *ht = &d->ht[j];
+
+        if (ht->segments == NULL) continue;
+        if ((newptr = reallocfn(ht->segments)) != NULL)
+            ht->segments = newptr, moved++;
+        for (k = 0; k < _dictNumSegments(d, ht); k++) {
+            if (ht->segments[k] == dict_empty_segment) continue;
+            if ((newptr = reallocfn(ht->segments[k])) != NULL)
+                ht->segments[k] = newptr, moved++;
+        }
+    }
+    return moved;
+}
+
 /* -------------------------- hash functions -------------------------------- */
 
 static uint8_t dict_hash_function_seed[16];
@@ -82,17 +334,42 @@ uint8_t *dictGetHashFunctionSeed(void) {
 }
 
 /* The default hashing function uses SipHash implementation
- * in siphash.c. */
+ * in siphash.c. The faster wyhash in wyhash.c can be selected with
+ * dictSetHashFunction(). */
 
 uint64_t siphash(const uint8_t *in, const size_t inlen, const uint8_t *k);
 uint64_t siphash_nocase(const uint8_t *in, const size_t inlen, const uint8_t *k);
 
+typedef uint64_t dictKeyedHash(const uint8_t *in, const size_t inlen, const uint8_t *k);
+
+static int dict_hash_function = DICT_HASH_SIPHASH;
+static dictKeyedHash *dict_hash = siphash;
+static dictKeyedHash *dict_case_hash = siphash_nocase;
+
+/* Select the function used by dictGenHashFunction() and
+ * dictGenCaseHashFunction(). The hash of the keys already in a dict changes,
+ * so the dicts created before must be passed to dictRehashEntries(). */
+void dictSetHashFunction(int fn) {
+    dict_hash_function = fn;
+    if (fn == DICT_HASH_WYHASH) {
+        dict_hash = wyhash;
+        dict_case_hash = wyhash_nocase;
+    } else {
+        dict_hash = siphash;
+        dict_case_hash = siphash_nocase;
+    }
+}
+
+int dictGetHashFunction(void) {
+    return dict_hash_function;
+}
+
 uint64_t dictGenHashFunction(const void *key, int len) {
-    return siphash(key,len,dict_hash_function_seed);
+    return dict_hash(key,len,dict_hash_function_seed);
 }
 
 uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len) {
-    return siphash_nocase(buf,len,dict_hash_function_seed);
+    return dict_case_hash(buf,len,dict_hash_function_seed);
 }
 
 /* ----------------------------- API implementation ------------------------- */
@@ -101,10 +378,11 @@ uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len) {
  * NOTE: This function should only be called by ht_destroy(). */ //重置hash table
 static void _dictReset(dictht *ht)
 {
-    ht->table = NULL;
+    ht->segments = NULL;
     ht->size = 0;
     ht->sizemask = 0;
     ht->used = 0;
+    ht->allocated = 0;
 }
 
 /* Create a new hash table */ //创建null的hash table
@@ -147,7 +425,10 @@ int dictResize(dict *d)
 int dictExpand(dict *d, unsigned long size)
 {
     dictht n; /* the new hash table */
-    unsigned long realsize = _dictNextPower(size);
+    unsigned long j, segments;
+    unsigned long realsize = dictIsBucketed(d) ?
+        _dictNextPower((size+DICT_BUCKET_FILL-1)/DICT_BUCKET_FILL) :
+        _dictNextPower(size);
 
     /* the size is invalid if it is smaller than the number of
      * elements already inside the hash table */ //判断是否重新定位hash下表，已用空间大于size，扩展无效
@@ -157,15 +438,19 @@ int dictExpand(dict *d, unsigned long size)
     /* Rehashing to the same table size is not useful. */ //需要大小与与原大小相同，无效
     if (realsize == d->ht[0].size) return DICT_ERR;
 
-    /* Allocate the new hash table and initialize all pointers to NULL */
+    /* Allocate the new hash table. The segments are allocated when the
+     * first entry is stored in them. */
     n.size = realsize;
     n.sizemask = realsize-1;
-    n.table = zcalloc(realsize*sizeof(dictEntry*)); //分配空间
     n.used = 0;
+    n.allocated = 0;
+    segments = _dictNumSegments(d, &n);
+    n.segments = zmalloc(segments*sizeof(void*));
+    for (j = 0; j < segments; j++) n.segments[j] = (void*)dict_empty_segment;
 
     /* Is this the first initialization? If so it's not really a rehashing
      * we just set the first hash table so that it can accept keys. */ //第一次初始化直接设置扩展地址
-    if (d->ht[0].table == NULL) {
+    if (d->ht[0].segments == NULL) {
         d->ht[0] = n;
         return DICT_OK;
     }
@@ -176,6 +461,63 @@ int dictExpand(dict *d, unsigned long size)
     return DICT_OK;
 }
 
+/* Move the entries of a chain of buckets from ht[0] to ht[1]. */
+static void _dictRehashBucket(dict *d, dictBucket *head) {
+    dictBucket *b = head;
+
+    while(1) {
+        int j;
+
+        for (j = 0; j < bucketNumSlots(b); j++) {
+            dictEntry *de;
+            uint64_t h;
+
+            if (!(b->presence & (1<<j))) continue;
+            de = b->slots[j];
+            h = dictHashKey(d, de->key);
+            _dictSegmentAlloc(d, &d->ht[1], h & d->ht[1].sizemask);
+            *_dictBucketInsertSlot(dictHtBucket(&d->ht[1],h & d->ht[1].sizemask),
+                                   h) = de;
+            d->ht[0].used--;
+            d->ht[1].used++;
+        }
+        if (!bucketIsChained(b)) break;
+        b = bucketChild(b);
+    }
+    _dictBucketFreeChildren(head);
+    head->presence = 0;
+}
+
+/* Move the rehashing index to the slot 'idx' of ht[0], releasing the
+ * segments of ht[0] left behind, that are empty at this point. The
+ * iterators may still reference them, so they are kept while there are
+ * iterators around, until the rehashing completes. */
+static void _dictRehashAdvance(dict *d, unsigned long idx) {
+    unsigned int shift = _dictSegmentShift(d);
+    unsigned long seg = (unsigned long)d->rehashidx >> shift;
+
+    if (d->iterators == 0) {
+        for (; seg < (idx >> shift); seg++) _dictSegmentFree(&d->ht[0], seg);
+    }
+    d->rehashidx = idx;
+}
+
+/* Number of elements 'ht' holds at its nominal load factor. Bucketed
+ * tables are full at DICT_BUCKET_FILL elements per bucket. */
+static unsigned long _dictHtCapacity(dict *d, dictht *ht) {
+    return ht->size * (dictIsBucketed(d) ? DICT_BUCKET_FILL : 1);
+}
+
+/* While resizing is disabled the rehashing is paused, but since the new
+ * keys are added to ht[1], that can't be expanded before the rehashing
+ * completes, it goes on when ht[1] is loaded over dict_force_resize_ratio
+ * times its capacity, like an expansion would. */
+int dictRehashPaused(dict *d) {
+    return dictIsRehashing(d) && !dict_can_resize &&
+           d->ht[1].used / _dictHtCapacity(d,&d->ht[1]) <=
+           dict_force_resize_ratio;
+}
+
 /* Performs N steps of incremental rehashing. Returns 1 if there are still
  * keys to move from the old to the new hash table, otherwise 0 is returned.
  *
@@ -184,22 +526,60 @@ int dictExpand(dict *d, unsigned long size)
  * since part of the hash table may be composed of empty spaces, it is not
  * guaranteed that this function will rehash even a single bucket, since it
  * will visit at max N*10 empty buckets in total, otherwise the amount of
- * work it does would be unbound and the function may block for a long time. */
+ * work it does would be unbound and the function may block for a long time.
+ * A segment never written counts as a single empty bucket.
+ *
+ * With the bucketed layout a step moves a bucket together with its child
+ * buckets.
+ *
+ * While resizing is disabled, that is, while there is a child process
+ * sharing the memory with copy on write, the rehashing is paused: moving
+ * the entries would touch (and copy) every page of both tables. It goes on
+ * only if the new table holds dict_force_resize_ratio times more elements
+ * than its capacity, when the lookups in it got too slow. */
 int dictRehash(dict *d, int n) {
     int empty_visits = n*10; /* Max number of empty buckets to visit. */
+    unsigned int shift = _dictSegmentShift(d);
     if (!dictIsRehashing(d)) return 0;
+    if (dictRehashPaused(d)) return 1;
 
     while(n-- && d->ht[0].used != 0) {
         dictEntry *de, *nextde;
+        unsigned long idx = d->rehashidx;
 
         /* Note that rehashidx can't overflow as we are sure there are more
          * elements because ht[0].used != 0 */
-        assert(d->ht[0].size > (unsigned long)d->rehashidx);
-        while(d->ht[0].table[d->rehashidx] == NULL) { //当超过设置的空桶阀值时自动退出
-            d->rehashidx++;
-            if (--empty_visits == 0) return 1;
+        assert(d->ht[0].size > idx);
+        while(d->ht[0].segments[idx >> shift] == dict_empty_segment) {
+            idx = ((idx >> shift) + 1) << shift;
+            if (--empty_visits == 0) {
+                _dictRehashAdvance(d, idx);
+                return 1;
+            }
+        }
+        if (dictIsBucketed(d)) {
+            dictBucket *b = dictHtBucket(&d->ht[0],idx);
+
+            while(b->presence == 0) {
+                idx++;
+                if (--empty_visits == 0) {
+                    _dictRehashAdvance(d, idx);
+                    return 1;
+                }
+                b = dictHtBucket(&d->ht[0],idx);
+            }
+            _dictRehashBucket(d, b);
+            _dictRehashAdvance(d, idx+1);
+            continue;
+        }
+        while(*dictHtChain(&d->ht[0],idx) == NULL) { //当超过设置的空桶阀值时自动退出
+            idx++;
+            if (--empty_visits == 0) {
+                _dictRehashAdvance(d, idx);
+                return 1;
+            }
         }
-        de = d->ht[0].table[d->rehashidx];
+        de = *dictHtChain(&d->ht[0],idx);
         /* Move all the keys in this bucket from the old to the new hash HT */ //将桶内的key转移到新的桶内
         while(de) {
             uint64_t h;
@@ -207,19 +587,32 @@ int dictRehash(dict *d, int n) {
             nextde = de->next;
             /* Get the index in the new hash table */ //获取新的hash table索引位置
             h = dictHashKey(d, de->key) & d->ht[1].sizemask;
-            de->next = d->ht[1].table[h];//插入节点
-            d->ht[1].table[h] = de; //头插入
+            _dictSegmentAlloc(d, &d->ht[1], h);
+            de->next = *dictHtChain(&d->ht[1],h);//插入节点
+            *dictHtChain(&d->ht[1],h) = de; //头插入
             d->ht[0].used--;
             d->ht[1].used++;
             de = nextde;
         }
-        d->ht[0].table[d->rehashidx] = NULL; //将ht[0]桶置 null
-        d->rehashidx++;  //下个桶data转移
+        *dictHtChain(&d->ht[0],idx) = NULL; //将ht[0]桶置 null
+        _dictRehashAdvance(d, idx+1);  //下个桶data转移
     }
 
     /* Check if we already rehashed the whole table... */ //检查整个表是否转移完成，将ht[1]置为ht[0];
     if (d->ht[0].used == 0) {
-        zfree(d->ht[0].table);
+        if (dictIsBucketed(d)) {
+            /* Deleting entries may leave empty child buckets behind. */
+            unsigned long j;
+
+            for (j = d->rehashidx; j < d->ht[0].size; j++) {
+                if (d->ht[0].segments[j >> shift] == dict_empty_segment) {
+                    j = (((j >> shift) + 1) << shift) - 1;
+                    continue;
+                }
+                _dictBucketFreeChildren(dictHtBucket(&d->ht[0],j));
+            }
+        }
+        _dictFreeSegments(d, &d->ht[0]);
         d->ht[0] = d->ht[1];
         _dictReset(&d->ht[1]); //重置ht[1]
         d->rehashidx = -1; //重置rehashidx
@@ -237,18 +630,44 @@ long long timeInMilliseconds(void) {
     return (((long long)tv.tv_sec)*1000)+(tv.tv_usec/1000);
 }
 
-/* Rehash for an amount of time between ms milliseconds and ms+1 milliseconds */ //在一个时间内rehash执行的次数
-int dictRehashMilliseconds(dict *d, int ms) {
-    long long start = timeInMilliseconds();
+static long long timeInMicroseconds(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* Rehash for an amount of time between us and us plus the time of 100
+ * rehashing steps. Returns the number of steps performed, that is zero
+ * if there is nothing to rehash or the rehashing is paused. */
+int dictRehashMicroseconds(dict *d, long long us) {
+    long long start = timeInMicroseconds();
     int rehashes = 0;
 
+    if (dictRehashPaused(d)) return 0;
     while(dictRehash(d,100)) {
         rehashes += 100;
-        if (timeInMilliseconds()-start > ms) break;
+        if (timeInMicroseconds()-start > us) break;
     }
     return rehashes;
 }
 
+/* Rehash for an amount of time between ms milliseconds and ms+1 milliseconds */ //在一个时间内rehash执行的次数
+int dictRehashMilliseconds(dict *d, int ms) {
+    return dictRehashMicroseconds(d,(long long)ms*1000);
+}
+
+/* Move all the entries to a new table, computing their hash again. This is
+ * needed when the hash function is changed and the dict is not empty. The
+ * resize must not be disabled, see dictDisableResize(). */
+void dictRehashEntries(dict *d) {
+    while(dictIsRehashing(d)) dictRehash(d,100);
+    if (d->ht[0].used == 0) return;
+    if (dictExpand(d,d->ht[0].used) == DICT_ERR)
+        dictExpand(d,d->ht[0].used*2);
+    while(dictIsRehashing(d)) dictRehash(d,100);
+}
+
 /* This function performs just a step of rehashing, and only if there are
  * no safe iterators bound to our hash table. When we have iterators in the
  * middle of a rehashing we can't mess with the two hash tables otherwise
@@ -295,12 +714,14 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
     long index;
     dictEntry *entry;
     dictht *ht;
+    uint64_t hash;
 
     if (dictIsRehashing(d)) _dictRehashStep(d);
 
     /* Get the index of the new element, or -1 if
      * the element already exists. */
-    if ((index = _dictKeyIndex(d, key, dictHashKey(d,key), existing)) == -1)
+    hash = dictHashKey(d,key);
+    if ((index = _dictKeyIndex(d, key, hash, existing)) == -1)
         return NULL;
 
     /* Allocate the memory and store the new entry.
@@ -308,13 +729,28 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
      * system it is more likely that recently added entries are accessed
      * more frequently. */
     ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
-    entry = zmalloc(sizeof(*entry));
-    entry->next = ht->table[index]; //头写入节点
-    ht->table[index] = entry;
+    if (d->type->keyEmbedLen) {
+        size_t hdrlen = dictEntryMemUsage(d);
+
+        entry = zmalloc(hdrlen+d->type->keyEmbedLen(key));
+        key = d->type->keyEmbed((char*)entry+hdrlen,key);
+    } else {
+        entry = zmalloc(dictEntryMemUsage(d));
+    }
+    _dictSegmentAlloc(d, ht, index);
+    if (dictIsBucketed(d)) {
+        *_dictBucketInsertSlot(dictHtBucket(ht,index),hash) = entry;
+    } else {
+        entry->next = *dictHtChain(ht,index); //头写入节点
+        *dictHtChain(ht,index) = entry;
+    }
     ht->used++;
 
     /* Set the hash entry fields. */
-    dictSetKey(d, entry, key);
+    if (d->type->keyEmbedLen)
+        entry->key = key;
+    else
+        dictSetKey(d, entry, key);
     return entry;
 }
 
@@ -340,7 +776,7 @@ int dictReplace(dict *d, void *key, void *val)
      * as the previous one. In this context, think to reference counting,
      * you want to increment (set), and then decrement (free), and not the
      * reverse. */
-    auxentry = *existing;
+    auxentry.v = existing->v; /* Bucketed entries have no 'next' field. */
     dictSetVal(d, existing, val);
     dictFreeVal(d, &auxentry);
     return 0;
@@ -374,7 +810,26 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
 
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
-        he = d->ht[table].table[idx];
+        if (dictIsBucketed(d)) {
+            dictBucket *head = dictHtBucket(&d->ht[table],idx), *b;
+            int slot;
+
+            if ((b = _dictBucketFind(d, head, key, h, &slot)) != NULL) {
+                he = b->slots[slot];
+                b->presence &= ~(1<<slot);
+                if (!nofree) {
+                    dictFreeKey(d, he);
+                    dictFreeVal(d, he);
+                    zfree(he);
+                }
+                d->ht[table].used--;
+                if (d->iterators == 0) _dictBucketCompact(head);
+                return he;
+            }
+            if (!dictIsRehashing(d)) break;
+            continue;
+        }
+        he = *dictHtChain(&d->ht[table],idx);
         prevHe = NULL;
         while(he) {
             if (key==he->key || dictCompareKeys(d, key, he->key)) {
@@ -382,7 +837,7 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
                 if (prevHe)
                     prevHe->next = he->next;
                 else
-                    d->ht[table].table[idx] = he->next;
+                    *dictHtChain(&d->ht[table],idx) = he->next;
                 if (!nofree) {
                     dictFreeKey(d, he);
                     dictFreeVal(d, he);
@@ -440,16 +895,55 @@ void dictFreeUnlinkedEntry(dict *d, dictEntry *he) {
 }
 
 /* Destroy an entire dictionary */ //删除整本词典
-int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
+/* Free the entries stored in the chains or buckets from 'start' to 'end'
+ * (excluded) of the hash table. */
+static void _dictClearRange(dict *d, dictht *ht, unsigned long start,
+                            unsigned long end, void(callback)(void *))
+{
     unsigned long i;
+    unsigned int shift = _dictSegmentShift(d);
+
+    if (dictIsBucketed(d)) {
+        /* Visit every bucket, since even empty ones may have children. */
+        for (i = start; i < end; i++) {
+            dictBucket *b;
+            int j;
+
+            if (callback && (i & 65535) == 0) callback(d->privdata);
+            if (ht->segments[i >> shift] == dict_empty_segment) {
+                i = (((i >> shift) + 1) << shift) - 1;
+                continue;
+            }
+            b = dictHtBucket(ht,i);
+            for (; b; b = bucketIsChained(b) ? bucketChild(b) : NULL) {
+                for (j = 0; j < bucketNumSlots(b); j++) {
+                    dictEntry *he = b->slots[j];
+
+                    if (!(b->presence & (1<<j))) continue;
+                    dictFreeKey(d, he);
+                    dictFreeVal(d, he);
+                    zfree(he);
+                    ht->used--;
+                }
+            }
+            b = dictHtBucket(ht,i);
+            _dictBucketFreeChildren(b);
+            b->presence = 0;
+        }
+        return;
+    }
 
     /* Free all the elements */
-    for (i = 0; i < ht->size && ht->used > 0; i++) {
+    for (i = start; i < end && ht->used > 0; i++) {
         dictEntry *he, *nextHe;
 
         if (callback && (i & 65535) == 0) callback(d->privdata); //删除私有数据
 
-        if ((he = ht->table[i]) == NULL) continue;
+        if (ht->segments[i >> shift] == dict_empty_segment) {
+            i = (((i >> shift) + 1) << shift) - 1;
+            continue;
+        }
+        if ((he = *dictHtChain(ht,i)) == NULL) continue;
         while(he) { //释放element
             nextHe = he->next;
             dictFreeKey(d, he);
@@ -459,13 +953,44 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
             he = nextHe;
         }
     }
+}
+
+int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
+    _dictClearRange(d, ht, 0, ht->size, callback);
     /* Free the table and the allocated cache structure */
-    zfree(ht->table); //释放表和缓存结构
+    _dictFreeSegments(d, ht); //释放表和缓存结构
     /* Re-initialize the table */
     _dictReset(ht);
     return DICT_OK; /* never fails */
 }
 
+/* Release the dictionary a few chains (or buckets) at a time: every call
+ * frees the entries of up to 'count' chains starting from '*cursor', that
+ * must be zero on the first call, and returns 0. When the last chain was
+ * processed the dictionary itself is released and 1 is returned.
+ *
+ * This is used to free huge dictionaries incrementally: the dictionary
+ * must not be accessed in any other way until it is released. */
+int dictReleaseStep(dict *d, unsigned long *cursor, unsigned long count) {
+    dictht *ht = d->ht[0].size ? &d->ht[0] : &d->ht[1];
+
+    if (ht->size) {
+        unsigned long end = *cursor+count;
+
+        if (end > ht->size || end < *cursor) end = ht->size;
+        _dictClearRange(d, ht, *cursor, end, NULL);
+        *cursor = end;
+        if (end == ht->size) {
+            _dictFreeSegments(d, ht);
+            _dictReset(ht);
+            *cursor = 0;
+        }
+    }
+    if (d->ht[0].size || d->ht[1].size) return 0;
+    zfree(d);
+    return 1;
+}
+
 /* Clear & Release the hash table */ //清理释放hash table
 void dictRelease(dict *d)
 {
@@ -474,17 +999,23 @@ void dictRelease(dict *d)
     zfree(d);
 }
 
-dictEntry *dictFind(dict *d, const void *key)
-{
+static dictEntry *_dictFindWithHash(dict *d, const void *key, uint64_t h) {
     dictEntry *he;
-    uint64_t h, idx, table;
+    uint64_t idx, table;
 
-    if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
-    if (dictIsRehashing(d)) _dictRehashStep(d);
-    h = dictHashKey(d, key);
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
-        he = d->ht[table].table[idx];
+        if (dictIsBucketed(d)) {
+            dictBucket *b;
+            int slot;
+
+            b = _dictBucketFind(d, dictHtBucket(&d->ht[table],idx), key, h,
+                                &slot);
+            if (b) return b->slots[slot];
+            if (!dictIsRehashing(d)) return NULL;
+            continue;
+        }
+        he = *dictHtChain(&d->ht[table],idx);
         while(he) {
             if (key==he->key || dictCompareKeys(d, key, he->key))
                 return he;
@@ -495,6 +1026,105 @@ dictEntry *dictFind(dict *d, const void *key)
     return NULL;
 }
 
+dictEntry *dictFind(dict *d, const void *key)
+{
+    if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    return _dictFindWithHash(d, key, dictHashKey(d, key));
+}
+
+/* Return the entry of the slot of 'ht' for the hash 'h' that is the most
+ * likely to hold the key, without comparing the keys, or NULL. */
+static dictEntry *_dictFirstCandidate(dict *d, dictht *ht, uint64_t h) {
+    unsigned long idx = h & ht->sizemask;
+
+    if (dictIsBucketed(d)) {
+        dictBucket *b = dictHtBucket(ht,idx);
+        uint8_t tag = hashTag(h);
+        int j;
+
+        for (j = 0; j < bucketNumSlots(b); j++) {
+            if ((b->presence & (1<<j)) && b->tags[j] == tag)
+                return b->slots[j];
+        }
+        return NULL;
+    }
+    return *dictHtChain(ht,idx);
+}
+
+/* Like calling dictFind() for every key of 'keys', storing the entry of
+ * keys[j] (or NULL) at entries[j].
+ *
+ * Every lookup is a chain of dependent memory accesses: the slot of the
+ * table, the entry, and the key to compare. Here the keys are processed in
+ * groups of DICT_FIND_BATCH, one stage at a time: all the keys are hashed
+ * and the slots prefetched, then the first entry of every slot is
+ * prefetched, then the keys of those entries, and only then the keys are
+ * compared. With tables that don't fit in the CPU caches the cache misses
+ * of the different keys overlap instead of being paid one after the other. */
+void dictFindBatch(dict *d, const void **keys, unsigned long count, dictEntry **entries) {
+    dict *dicts[DICT_FIND_BATCH];
+    unsigned long base, n, j;
+
+    for (base = 0; base < count; base += n) {
+        n = count-base < DICT_FIND_BATCH ? count-base : DICT_FIND_BATCH;
+        for (j = 0; j < n; j++) dicts[j] = d;
+        dictFindBatchMulti(dicts, keys+base, n, entries+base);
+    }
+}
+
+/* Like dictFindBatch(), but keys[j] is looked up in dicts[j], that must all
+ * have the same type. */
+void dictFindBatchMulti(dict **dicts, const void **keys, unsigned long count, dictEntry **entries) {
+    uint64_t hashes[DICT_FIND_BATCH];
+    dictEntry *first[DICT_FIND_BATCH*2];
+    unsigned long base, n, j;
+    int t;
+
+    for (base = 0; base < count;
+         base += n, dicts += n, keys += n, entries += n)
+    {
+        n = count-base < DICT_FIND_BATCH ? count-base : DICT_FIND_BATCH;
+        /* Perform the rehashing steps the lookups would perform. */
+        for (j = 0; j < n; j++)
+            if (dictIsRehashing(dicts[j])) _dictRehashStep(dicts[j]);
+
+        for (j = 0; j < n; j++) {
+            dict *d = dicts[j];
+
+            if (dictSize(d) == 0) continue;
+            hashes[j] = dictHashKey(d, keys[j]);
+            for (t = 0; t < (dictIsRehashing(d) ? 2 : 1); t++) {
+                unsigned long idx = hashes[j] & d->ht[t].sizemask;
+
+                if (dictIsBucketed(d))
+                    dictPrefetch(dictHtBucket(&d->ht[t],idx));
+                else
+                    dictPrefetch(dictHtChain(&d->ht[t],idx));
+            }
+        }
+        for (j = 0; j < n; j++) {
+            dict *d = dicts[j];
+
+            first[j*2] = first[j*2+1] = NULL;
+            if (dictSize(d) == 0) continue;
+            for (t = 0; t < (dictIsRehashing(d) ? 2 : 1); t++) {
+                first[j*2+t] = _dictFirstCandidate(d, &d->ht[t], hashes[j]);
+                if (first[j*2+t]) dictPrefetch(first[j*2+t]);
+            }
+        }
+        /* Embedded keys are next to their entry header. */
+        if (!dicts[0]->type->keyEmbedLen) {
+            for (j = 0; j < n*2; j++)
+                if (first[j]) dictPrefetch(first[j]->key);
+        }
+        for (j = 0; j < n; j++) {
+            entries[j] = dictSize(dicts[j]) == 0 ? NULL :
+                _dictFindWithHash(dicts[j], keys[j], hashes[j]);
+        }
+    }
+}
+
 void *dictFetchValue(dict *d, const void *key) {
     dictEntry *he;
 
@@ -512,10 +1142,10 @@ long long dictFingerprint(dict *d) {
     long long integers[6], hash = 0;
     int j;
 
-    integers[0] = (long) d->ht[0].table;
+    integers[0] = (long) d->ht[0].segments;
     integers[1] = d->ht[0].size;
     integers[2] = d->ht[0].used;
-    integers[3] = (long) d->ht[1].table;
+    integers[3] = (long) d->ht[1].segments;
     integers[4] = d->ht[1].size;
     integers[5] = d->ht[1].used;
 
@@ -550,6 +1180,8 @@ dictIterator *dictGetIterator(dict *d) //获取dict 迭代器
     iter->safe = 0;
     iter->entry = NULL;
     iter->nextEntry = NULL;
+    iter->bucket = NULL;
+    iter->slot = 0;
     return iter;
 }
 
@@ -560,8 +1192,63 @@ dictIterator *dictGetSafeIterator(dict *d) { //获取安全的dict迭代器
     return i;
 }
 
+/* Move the iterator of a bucketed dictionary to the next used slot of the
+ * current bucket, or to its child bucket, or to the end of the chain. The
+ * position is always computed before returning an entry, so that an entry
+ * moved to a new child bucket by an insertion is not returned twice. */
+static void _dictBucketIterAdvance(dictIterator *iter) {
+    while (iter->bucket) {
+        dictBucket *b = iter->bucket;
+        int slots = bucketNumSlots(b);
+
+        while (iter->slot < slots && !(b->presence & (1<<iter->slot)))
+            iter->slot++;
+        if (iter->slot < slots) return;
+        iter->bucket = bucketIsChained(b) ? bucketChild(b) : NULL;
+        iter->slot = 0;
+    }
+}
+
 dictEntry *dictNext(dictIterator *iter) //通过迭代器获取下一个节点
 {
+    if (dictIsBucketed(iter->d)) {
+        while (1) {
+            /* Since the last call the slot we point to may have been
+             * emptied, or, if the bucket got full, its entry may have been
+             * moved to a new child bucket, and the slot now points to the
+             * child: check the position again before using it. */
+            _dictBucketIterAdvance(iter);
+            if (iter->bucket == NULL) {
+                dictht *ht = &iter->d->ht[iter->table];
+                if (iter->index == -1 && iter->table == 0) {
+                    if (iter->safe)
+                        iter->d->iterators++;
+                    else
+                        iter->fingerprint = dictFingerprint(iter->d);
+                }
+                iter->index++;
+                if (iter->index >= (long) ht->size) {
+                    if (dictIsRehashing(iter->d) && iter->table == 0) {
+                        iter->table++;
+                        iter->index = 0;
+                        ht = &iter->d->ht[1];
+                    } else {
+                        break;
+                    }
+                }
+                iter->bucket = dictHtBucket(ht,iter->index);
+                iter->slot = 0;
+                _dictBucketIterAdvance(iter);
+            }
+            if (iter->bucket) {
+                iter->entry = iter->bucket->slots[iter->slot++];
+                _dictBucketIterAdvance(iter);
+                return iter->entry;
+            }
+        }
+        return NULL;
+    }
+
     while (1) {
         if (iter->entry == NULL) { //初始化iter传入
             dictht *ht = &iter->d->ht[iter->table];
@@ -581,7 +1268,7 @@ dictEntry *dictNext(dictIterator *iter) //通过迭代器获取下一个节点
                     break;
                 }
             }
-            iter->entry = ht->table[iter->index];
+            iter->entry = *dictHtChain(ht,iter->index);
         } else {
             iter->entry = iter->nextEntry;
         }
@@ -616,20 +1303,36 @@ dictEntry *dictGetRandomKey(dict *d)
 
     if (dictSize(d) == 0) return NULL;
     if (dictIsRehashing(d)) _dictRehashStep(d);
-    if (dictIsRehashing(d)) {kk
+    if (dictIsBucketed(d)) {
+        do {
+            if (dictIsRehashing(d)) {
+                h = d->rehashidx + (random() % (d->ht[0].size +
+                                                d->ht[1].size -
+                                                d->rehashidx));
+                he = (h >= d->ht[0].size) ?
+                    _dictBucketRandomEntry(dictHtBucket(&d->ht[1],h - d->ht[0].size)) :
+                    _dictBucketRandomEntry(dictHtBucket(&d->ht[0],h));
+            } else {
+                h = random() & d->ht[0].sizemask;
+                he = _dictBucketRandomEntry(dictHtBucket(&d->ht[0],h));
+            }
+        } while(he == NULL);
+        return he;
+    }
+    if (dictIsRehashing(d)) {
         do {
             /* We are sure there are no elements in indexes from 0
              * to rehashidx-1 */
             h = d->rehashidx + (random() % (d->ht[0].size +
                                             d->ht[1].size -
                                             d->rehashidx));
-            he = (h >= d->ht[0].size) ? d->ht[1].table[h - d->ht[0].size] :
-                                      d->ht[0].table[h];
+            he = (h >= d->ht[0].size) ? *dictHtChain(&d->ht[1],h - d->ht[0].size) :
+                                      *dictHtChain(&d->ht[0],h);
         } while(he == NULL);
     } else {
         do {
             h = random() & d->ht[0].sizemask;
-            he = d->ht[0].table[h];
+            he = *dictHtChain(&d->ht[0],h);
         } while(he == NULL);
     }
 
@@ -710,7 +1413,27 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
                 continue;
             }
             if (i >= d->ht[j].size) continue; /* Out of range for this table. */
-            dictEntry *he = d->ht[j].table[i];
+            if (dictIsBucketed(d)) {
+                dictBucket *b = dictHtBucket(&d->ht[j],i);
+                int found = 0, k;
+
+                for (; b; b = bucketIsChained(b) ? bucketChild(b) : NULL) {
+                    for (k = 0; k < bucketNumSlots(b); k++) {
+                        if (!(b->presence & (1<<k))) continue;
+                        *des++ = b->slots[k];
+                        found = 1;
+                        if (++stored == count) return stored;
+                    }
+                }
+                if (found) {
+                    emptylen = 0;
+                } else if (++emptylen >= 5 && emptylen > count) {
+                    i = random() & maxsizemask;
+                    emptylen = 0;
+                }
+                continue;
+            }
+            dictEntry *he = *dictHtChain(&d->ht[j],i);
 
             /* Count contiguous empty buckets, and jump to other
              * locations if they reach 'count' (with a minimum of 5). */
@@ -834,6 +1557,40 @@ static unsigned long rev(unsigned long v) {
  * 3) The reverse cursor is somewhat hard to understand at first, but this
  *    comment is supposed to help.
  */
+/* Emit the entries of the bucket 'idx' of the table 'ht' for dictScan(). */
+static void _dictScanBucket(dict *d, dictht *ht, unsigned long idx,
+                            dictScanFunction *fn,
+                            dictScanBucketFunction *bucketfn,
+                            void *privdata)
+{
+    if (dictIsBucketed(d)) {
+        dictBucket *b = dictHtBucket(ht,idx);
+        int j;
+
+        for (; b; b = bucketIsChained(b) ? bucketChild(b) : NULL) {
+            for (j = 0; j < bucketNumSlots(b); j++) {
+                if (!(b->presence & (1<<j))) continue;
+                if (bucketfn) bucketfn(privdata, (dictEntry**)&b->slots[j]);
+                fn(privdata, b->slots[j]);
+            }
+        }
+    } else {
+        dictEntry **ref;
+        const dictEntry *de, *next;
+
+        if (bucketfn) {
+            for (ref = dictHtChain(ht,idx); *ref; ref = &(*ref)->next)
+                bucketfn(privdata, ref);
+        }
+        de = *dictHtChain(ht,idx);
+        while (de) {
+            next = de->next;
+            fn(privdata, de);
+            de = next;
+        }
+    }
+}
+
 unsigned long dictScan(dict *d,
                        unsigned long v,
                        dictScanFunction *fn,
@@ -841,7 +1598,6 @@ unsigned long dictScan(dict *d,
                        void *privdata)
 {
     dictht *t0, *t1;
-    const dictEntry *de, *next;
     unsigned long m0, m1;
 
     if (dictSize(d) == 0) return 0;
@@ -851,13 +1607,7 @@ unsigned long dictScan(dict *d,
         m0 = t0->sizemask;
 
         /* Emit entries at cursor */
-        if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
-        de = t0->table[v & m0];
-        while (de) {
-            next = de->next;
-            fn(privdata, de);
-            de = next;
-        }
+        _dictScanBucket(d, t0, v & m0, fn, bucketfn, privdata);
 
     } else {
         t0 = &d->ht[0];
@@ -873,25 +1623,13 @@ unsigned long dictScan(dict *d,
         m1 = t1->sizemask;
 
         /* Emit entries at cursor */
-        if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
-        de = t0->table[v & m0];
-        while (de) {
-            next = de->next;
-            fn(privdata, de);
-            de = next;
-        }
+        _dictScanBucket(d, t0, v & m0, fn, bucketfn, privdata);
 
         /* Iterate over indices in larger table that are the expansion
          * of the index pointed to by the cursor in the smaller table */
         do {
             /* Emit entries at cursor */
-            if (bucketfn) bucketfn(privdata, &t1->table[v & m1]);
-            de = t1->table[v & m1];
-            while (de) {
-                next = de->next;
-                fn(privdata, de);
-                de = next;
-            }
+            _dictScanBucket(d, t1, v & m1, fn, bucketfn, privdata);
 
             /* Increment bits not covered by the smaller mask */
             v = (((v | m0) + 1) & ~m0) | (v & m0);
@@ -926,10 +1664,12 @@ static int _dictExpandIfNeeded(dict *d)
     /* If we reached the 1:1 ratio, and we are allowed to resize the hash
      * table (global setting) or we should avoid it but the ratio between
      * elements/buckets is over the "safe" threshold, we resize doubling
-     * the number of buckets. */
-    if (d->ht[0].used >= d->ht[0].size &&
+     * the number of buckets. Bucketed tables are full at DICT_BUCKET_FILL
+     * elements per bucket. */
+    unsigned long capacity = _dictHtCapacity(d,&d->ht[0]);
+    if (d->ht[0].used >= capacity &&
         (dict_can_resize ||
-         d->ht[0].used/d->ht[0].size > dict_force_resize_ratio))
+         d->ht[0].used/capacity > dict_force_resize_ratio))
     {
         return dictExpand(d, d->ht[0].used*2); //内存扩展2*n次幂
     }
@@ -967,8 +1707,21 @@ static long _dictKeyIndex(dict *d, const void *key, uint64_t hash, dictEntry **e
         return -1;
     for (table = 0; table <= 1; table++) {
         idx = hash & d->ht[table].sizemask;
+        if (dictIsBucketed(d)) {
+            dictBucket *b;
+            int slot;
+
+            b = _dictBucketFind(d, dictHtBucket(&d->ht[table],idx), key, hash,
+                                &slot);
+            if (b) {
+                if (existing) *existing = b->slots[slot];
+                return -1;
+            }
+            if (!dictIsRehashing(d)) break;
+            continue;
+        }
         /* Search if this slot does not already contain the given key */
-        he = d->ht[table].table[idx];
+        he = *dictHtChain(&d->ht[table],idx);
         while(he) {
             if (key==he->key || dictCompareKeys(d, key, he->key)) {
                 if (existing) *existing = he;
@@ -1012,7 +1765,21 @@ dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t h
     if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
     for (table = 0; table <= 1; table++) {
         idx = hash & d->ht[table].sizemask;
-        heref = &d->ht[table].table[idx];
+        if (dictIsBucketed(d)) {
+            dictBucket *b = dictHtBucket(&d->ht[table],idx);
+            int j;
+
+            for (; b; b = bucketIsChained(b) ? bucketChild(b) : NULL) {
+                for (j = 0; j < bucketNumSlots(b); j++) {
+                    if (!(b->presence & (1<<j))) continue;
+                    he = b->slots[j];
+                    if (oldptr==he->key) return (dictEntry**)&b->slots[j];
+                }
+            }
+            if (!dictIsRehashing(d)) return NULL;
+            continue;
+        }
+        heref = dictHtChain(&d->ht[table],idx);
         he = *heref;
         while(he) {
             if (oldptr==he->key)
@@ -1028,9 +1795,10 @@ dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t h
 /* ------------------------------- Debugging ---------------------------------*/
 
 #define DICT_STATS_VECTLEN 50
-size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
+size_t _dictGetStatsHt(char *buf, size_t bufsize, dict *d, int tableid) {
+    dictht *ht = &d->ht[tableid];
     unsigned long i, slots = 0, chainlen, maxchainlen = 0;
-    unsigned long totchainlen = 0;
+    unsigned long totchainlen = 0, children = 0;
     unsigned long clvector[DICT_STATS_VECTLEN];
     size_t l = 0;
 
@@ -1044,14 +1812,36 @@ size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
     for (i = 0; i < ht->size; i++) {
         dictEntry *he;
 
-        if (ht->table[i] == NULL) {
+        if (dictIsBucketed(d)) {
+            /* The chain length is the number of entries of the bucket and
+             * of its children. */
+            dictBucket *b = dictHtBucket(ht,i);
+            int j;
+
+            chainlen = 0;
+            for (; b; b = bucketIsChained(b) ? bucketChild(b) : NULL) {
+                if (b != dictHtBucket(ht,i)) children++;
+                for (j = 0; j < bucketNumSlots(b); j++)
+                    if (b->presence & (1<<j)) chainlen++;
+            }
+            if (chainlen == 0) {
+                clvector[0]++;
+                continue;
+            }
+            slots++;
+            clvector[(chainlen < DICT_STATS_VECTLEN) ? chainlen : (DICT_STATS_VECTLEN-1)]++;
+            if (chainlen > maxchainlen) maxchainlen = chainlen;
+            totchainlen += chainlen;
+            continue;
+        }
+        if (*dictHtChain(ht,i) == NULL) {
             clvector[0]++;
             continue;
         }
         slots++;
         /* For each hash entry on this slot... */
         chainlen = 0;
-        he = ht->table[i];
+        he = *dictHtChain(ht,i);
         while(he) {
             chainlen++;
             he = he->next;
@@ -1069,11 +1859,23 @@ size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
         " different slots: %ld\n"
         " max chain length: %ld\n"
         " avg chain length (counted): %.02f\n"
-        " avg chain length (computed): %.02f\n"
-        " Chain length distribution:\n",
+        " avg chain length (computed): %.02f\n",
         tableid, (tableid == 0) ? "main hash table" : "rehashing target",
         ht->size, ht->used, slots, maxchainlen,
         (float)totchainlen/slots, (float)ht->used/slots);
+    if (dictIsBucketed(d) && l < bufsize) {
+        l += snprintf(buf+l,bufsize-l,
+            " bucket slots: %d\n"
+            " child buckets: %ld\n",
+            DICT_BUCKET_SLOTS, children);
+    }
+    if (l < bufsize) {
+        l += snprintf(buf+l,bufsize-l,
+            " allocated segments: %ld of %ld\n",
+            ht->allocated, _dictNumSegments(d,ht));
+    }
+    if (l < bufsize)
+        l += snprintf(buf+l,bufsize-l," Chain length distribution:\n");
 
     for (i = 0; i < DICT_STATS_VECTLEN-1; i++) {
         if (clvector[i] == 0) continue;
@@ -1094,16 +1896,105 @@ void dictGetStats(char *buf, size_t bufsize, dict *d) {
     char *orig_buf = buf;
     size_t orig_bufsize = bufsize;
 
-    l = _dictGetStatsHt(buf,bufsize,&d->ht[0],0);
+    l = _dictGetStatsHt(buf,bufsize,d,0);
     buf += l;
     bufsize -= l;
     if (dictIsRehashing(d) && bufsize > 0) {
-        _dictGetStatsHt(buf,bufsize,&d->ht[1],1);
+        _dictGetStatsHt(buf,bufsize,d,1);
     }
     /* Make sure there is a NULL term at the end. */
     if (orig_bufsize) orig_buf[orig_bufsize-1] = '\0';
 }
 
+/* ------------------------------- Tests -------------------------------------*/
+
+#ifdef REDIS_TEST
+#define UNUSED(x) (void)(x)
+
+/* Keys are small integers, hashed so that they all land in the first bucket
+ * of the table, with the key itself as tag. */
+static uint64_t testSameBucketHash(const void *key) {
+    return (uint64_t)(uintptr_t)key << 56;
+}
+
+static dictType testBucketsDictType = {
+    testSameBucketHash, NULL, NULL, NULL, NULL, NULL, DICT_LAYOUT_BUCKETS,
+    NULL, NULL
+};
+
+static uint64_t testIntegerHash(const void *key) {
+    return dictGenHashFunction(&key,sizeof(key));
+}
+
+/* Count the values released, to check every entry is freed exactly once. */
+static long testFreedValues;
+
+static void testValDestructor(void *privdata, void *val) {
+    UNUSED(privdata);
+    UNUSED(val);
+    testFreedValues++;
+}
+
+static dictType testReleaseDictType = {
+    testIntegerHash, NULL, NULL, NULL, NULL, testValDestructor,
+    DICT_LAYOUT_BUCKETS, NULL, NULL
+};
+
+int dictTest(int argc, char *argv[]) {
+    int seen[DICT_BUCKET_SLOTS+2] = {0};
+    dictIterator *di;
+    dictEntry *de;
+    dict *d;
+    long j;
+    UNUSED(argc);
+    UNUSED(argv);
+
+    printf("Insertion during safe iteration on a full bucket: ");
+    d = dictCreate(&testBucketsDictType,NULL);
+    for (j = 1; j <= DICT_BUCKET_SLOTS; j++)
+        assert(dictAdd(d,(void*)j,NULL) == DICT_OK);
+    while (dictIsRehashing(d)) dictRehash(d,100);
+    di = dictGetSafeIterator(d);
+    for (j = 0; j < DICT_BUCKET_SLOTS-1; j++) {
+        de = dictNext(di);
+        assert(de != NULL);
+        seen[(long)dictGetKey(de)]++;
+    }
+    /* The iterator now points to the last slot of the full bucket, whose
+     * entry is moved to a new child bucket by the insertion. */
+    assert(dictAdd(d,(void*)(long)(DICT_BUCKET_SLOTS+1),NULL) == DICT_OK);
+    assert(!dictIsRehashing(d));
+    while ((de = dictNext(di)) != NULL) {
+        long key = (long)dictGetKey(de);
+        assert(key >= 1 && key <= DICT_BUCKET_SLOTS+1);
+        seen[key]++;
+    }
+    dictReleaseIterator(di);
+    for (j = 1; j <= DICT_BUCKET_SLOTS; j++) assert(seen[j] == 1);
+    assert(seen[DICT_BUCKET_SLOTS+1] <= 1);
+    dictRelease(d);
+    printf("ok\n");
+
+    for (j = 0; j < 2; j++) {
+        unsigned long cursor = 0;
+        long count = 100000, k;
+
+        testReleaseDictType.layout = j ? DICT_LAYOUT_BUCKETS :
+                                         DICT_LAYOUT_CHAINED;
+        printf("dictReleaseStep() with the %s layout: ",
+            j ? "buckets" : "chained");
+        d = dictCreate(&testReleaseDictType,NULL);
+        for (k = 1; k <= count; k++)
+            assert(dictAdd(d,(void*)k,(void*)k) == DICT_OK);
+        testFreedValues = 0;
+        while (!dictReleaseStep(d,&cursor,64));
+        assert(testFreedValues == count);
+        printf("ok\n");
+    }
+    return 0;
+}
+#endif
+
 /* ------------------------------- Benchmark ---------------------------------*/
 
 #ifdef DICT_BENCHMARK_MAIN
@@ -1145,18 +2036,24 @@ dictType BenchmarkDictType = {
     printf(msg ": %ld items in %lld ms\n", count, elapsed); \
 } while(0);
 
-/* dict-benchmark [count] */
+/* dict-benchmark [count] [chained|buckets] */
 int main(int argc, char **argv) {
     long j;
     long long start, elapsed;
-    dict *dict = dictCreate(&BenchmarkDictType,NULL);
+    dict *dict;
+    dictIterator *di;
     long count = 0;
 
-    if (argc == 2) {
+    if (argc >= 2) {
         count = strtol(argv[1],NULL,10);
     } else {
         count = 5000000;
     }
+    if (argc >= 3 && !strcmp(argv[2],"buckets"))
+        BenchmarkDictType.layout = DICT_LAYOUT_BUCKETS;
+    printf("Using the %s layout\n",
+        BenchmarkDictType.layout == DICT_LAYOUT_BUCKETS ? "buckets" : "chained");
+    dict = dictCreate(&BenchmarkDictType,NULL);
 
     start_benchmark();
     for (j = 0; j < count; j++) {
@@ -1198,6 +2095,21 @@ int main(int argc, char **argv) {
     }
     end_benchmark("Random access of existing elements");
 
+    start_benchmark();
+    for (j = 0; j < count; j += DICT_FIND_BATCH) {
+        sds keys[DICT_FIND_BATCH];
+        dictEntry *entries[DICT_FIND_BATCH];
+        long k, n = count-j < DICT_FIND_BATCH ? count-j : DICT_FIND_BATCH;
+
+        for (k = 0; k < n; k++) keys[k] = sdsfromlonglong(rand() % count);
+        dictFindBatch(dict,(const void**)keys,n,entries);
+        for (k = 0; k < n; k++) {
+            assert(entries[k] != NULL);
+            sdsfree(keys[k]);
+        }
+    }
+    end_benchmark("Random access of existing elements (batched)");
+
     start_benchmark();
     for (j = 0; j < count; j++) {
         sds key = sdsfromlonglong(rand() % count);
@@ -1208,6 +2120,13 @@ int main(int argc, char **argv) {
     }
     end_benchmark("Accessing missing");
 
+    start_benchmark();
+    di = dictGetIterator(dict);
+    for (j = 0; dictNext(di) != NULL; j++);
+    dictReleaseIterator(di);
+    assert(j == count);
+    end_benchmark("Iterating");
+
     start_benchmark();
     for (j = 0; j < count; j++) {
         sds key = sdsfromlonglong(j);
@@ -1218,5 +2137,6 @@ int main(int argc, char **argv) {
         assert(retval == DICT_OK);
     }
     end_benchmark("Removing and adding");
+    dictRelease(dict);
 }
 #endif
@@ -34,6 +34,7 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifndef __DICT_H
 #define __DICT_H
@@ -44,6 +45,9 @@
 /* Unused arguments generate annoying warnings... */
 #define DICT_NOTUSED(V) ((void) V)
 
+/* Entries of dictionaries using the bucketed layout are allocated without
+ * the 'next' field, that is only used to chain the entries of the chained
+ * layout. */
 typedef struct dictEntry {
     void *key;
     union {
@@ -55,6 +59,18 @@ typedef struct dictEntry {
     struct dictEntry *next;
 } dictEntry;
 
+/* Hash table layouts. The chained layout is an array of lists of entries.
+ * The bucketed layout is an open addressing table of cache line sized
+ * buckets, each holding up to DICT_BUCKET_SLOTS entry pointers together with
+ * one byte of the hash of every entry, so that a lookup only dereferences
+ * the entries whose hash byte matches. When a bucket is full its last slot
+ * is used to point to a child bucket, so that every key is always in the
+ * chain of buckets selected by its hash, exactly like in the chained layout:
+ * this is what keeps the incremental rehashing and the dictScan() cursor
+ * working the same way. */
+#define DICT_LAYOUT_CHAINED 0
+#define DICT_LAYOUT_BUCKETS 1
+
 typedef struct dictType {
     uint64_t (*hashFunction)(const void *key);
     void *(*keyDup)(void *privdata, const void *key);
@@ -62,15 +78,44 @@ typedef struct dictType {
     int (*keyCompare)(void *privdata, const void *key1, const void *key2);
     void (*keyDestructor)(void *privdata, void *key);
     void (*valDestructor)(void *privdata, void *obj);
+    int layout; /* DICT_LAYOUT_*, chained if not specified. */
+    /* If keyEmbedLen is set, dictAdd() copies the key inside the entry
+     * allocation, after dictEntryMemUsage() bytes, calling keyEmbed() to
+     * write it and to return the key pointer to store in the entry. The
+     * key passed by the caller is not retained, and keyDup/keyDestructor
+     * are not used. */
+    size_t (*keyEmbedLen)(const void *key);
+    void *(*keyEmbed)(void *buf, const void *key);
 } dictType;
 
+#define DICT_BUCKET_SLOTS 7
+#define DICT_BUCKET_CHAINED (1<<DICT_BUCKET_SLOTS) /* In 'presence'. */
+#define DICT_BUCKET_FILL 5 /* Average entries per bucket before growing. */
+
+typedef struct dictBucket {
+    uint8_t presence;   /* Bit N set if slot N is used, plus CHAINED flag. */
+    uint8_t tags[DICT_BUCKET_SLOTS]; /* Highest byte of the entries hash. */
+    void *slots[DICT_BUCKET_SLOTS];  /* Entries, or the child bucket in the
+                                        last slot if the bucket is chained. */
+} dictBucket;
+
 /* This is our hash table structure. Every dictionary has two of this as we
- * implement incremental rehashing, for the old to the new table. */
+ * implement incremental rehashing, for the old to the new table.
+ *
+ * The table is split in segments of 2^DICT_CHAINED_SEGMENT_SHIFT chain heads
+ * or 2^DICT_BUCKETS_SEGMENT_SHIFT buckets (64k bytes), or a single smaller
+ * segment for small tables, so that big tables are never allocated at once.
+ * Segments that never held an entry point to a shared read only segment of
+ * zeroes and are only allocated when the first entry is stored there. */
+#define DICT_CHAINED_SEGMENT_SHIFT 13
+#define DICT_BUCKETS_SEGMENT_SHIFT 10
+
 typedef struct dictht {
-    dictEntry **table;
+    void **segments;
     unsigned long size;
     unsigned long sizemask;
     unsigned long used;
+    unsigned long allocated; /* Number of segments allocated. */
 } dictht;
 
 typedef struct dict {
@@ -90,16 +135,26 @@ typedef struct dictIterator {
     long index;
     int table, safe;
     dictEntry *entry, *nextEntry;
+    dictBucket *bucket; /* Bucketed layout: bucket of the next entry, */
+    int slot;           /* and its slot. */
     /* unsafe iterator fingerprint for misuse detection. */
     long long fingerprint;
 } dictIterator;
 
+/* The bucket function of dictScan() is called with a reference to every
+ * entry pointer of the buckets visited, before calling the scan function
+ * for them, so that the entries can be reallocated. */
 typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
-typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
+typedef void (dictScanBucketFunction)(void *privdata, dictEntry **entryref);
 
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     4
 
+/* Hash functions used by dictGenHashFunction() and dictGenCaseHashFunction(),
+ * see dictSetHashFunction(). */
+#define DICT_HASH_SIPHASH 0
+#define DICT_HASH_WYHASH 1
+
 /* ------------------------------- Macros ------------------------------------*/
 #define dictFreeVal(d, entry) \
     if ((d)->type->valDestructor) \
@@ -143,9 +198,29 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 #define dictGetSignedIntegerVal(he) ((he)->v.s64)
 #define dictGetUnsignedIntegerVal(he) ((he)->v.u64)
 #define dictGetDoubleVal(he) ((he)->v.d)
-#define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size) //获取hash数量
+#define dictIsBucketed(d) ((d)->type->layout == DICT_LAYOUT_BUCKETS)
+#define dictSlots(d) (((d)->ht[0].size+(d)->ht[1].size)* \
+    (dictIsBucketed(d) ? DICT_BUCKET_FILL : 1)) //获取hash数量
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used) //获取hash使用数量
 #define dictIsRehashing(d) ((d)->rehashidx != -1) //获取hash下标是否被重新定位
+#define dictEntryMemUsage(d) \
+    (dictIsBucketed(d) ? offsetof(dictEntry,next) : sizeof(dictEntry))
+#define dictHtChain(ht,idx) \
+    (&((dictEntry**)(ht)->segments[(idx)>>DICT_CHAINED_SEGMENT_SHIFT]) \
+        [(idx)&((1UL<<DICT_CHAINED_SEGMENT_SHIFT)-1)])
+#define dictHtBucket(ht,idx) \
+    (&((dictBucket*)(ht)->segments[(idx)>>DICT_BUCKETS_SEGMENT_SHIFT]) \
+        [(idx)&((1UL<<DICT_BUCKETS_SEGMENT_SHIFT)-1)])
+
+/* Max number of keys dictFindBatch() looks up at the same time. */
+#define DICT_FIND_BATCH 16
+
+/* Hint the CPU to bring the memory at 'addr' in its caches. */
+#if defined(__GNUC__) || defined(__clang__)
+#define dictPrefetch(addr) __builtin_prefetch(addr)
+#else
+#define dictPrefetch(addr) ((void)(addr))
+#endif
 
 /* API */
 dict *dictCreate(dictType *type, void *privDataPtr);
@@ -158,7 +233,10 @@ int dictDelete(dict *d, const void *key);
 dictEntry *dictUnlink(dict *ht, const void *key);
 void dictFreeUnlinkedEntry(dict *d, dictEntry *he);
 void dictRelease(dict *d);
+int dictReleaseStep(dict *d, unsigned long *cursor, unsigned long count);
 dictEntry * dictFind(dict *d, const void *key);
+void dictFindBatch(dict *d, const void **keys, unsigned long count, dictEntry **entries);
+void dictFindBatchMulti(dict **dicts, const void **keys, unsigned long count, dictEntry **entries);
 void *dictFetchValue(dict *d, const void *key);
 int dictResize(dict *d);
 dictIterator *dictGetIterator(dict *d);
@@ -174,9 +252,16 @@ void dictEmpty(dict *d, void(callback)(void*));
 void dictEnableResize(void);
 void dictDisableResize(void);
 int dictRehash(dict *d, int n);
+int dictRehashPaused(dict *d);
 int dictRehashMilliseconds(dict *d, int ms);
+int dictRehashMicroseconds(dict *d, long long us);
+size_t dictTableMemUsage(dict *d);
+int dictReallocTables(dict *d, void *(*reallocfn)(void *ptr));
 void dictSetHashFunctionSeed(uint8_t *seed);
 uint8_t *dictGetHashFunctionSeed(void);
+void dictSetHashFunction(int fn);
+int dictGetHashFunction(void);
+void dictRehashEntries(dict *d);
 unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata);
 uint64_t dictGetHash(dict *d, const void *key);
 dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t hash);
@@ -186,4 +271,8 @@ extern dictType dictTypeHeapStringCopyKey;
 extern dictType dictTypeHeapStrings;
 extern dictType dictTypeHeapStringCopyKeyValue;
 
+#ifdef REDIS_TEST
+int dictTest(int argc, char *argv[]);
+#endif
+
 #endif /* __DICT_H */
@@ -48,8 +48,10 @@
  * instead of the idle time, so that we still evict by larger value (larger
  * inverse frequency means to evict keys with the least frequent accesses).
  *
+ * The pool is shared by all the DBs and its size is set by the
+ * maxmemory-eviction-pool-size option.
+ *
  * Empty entries have the key pointer set to NULL. */
-#define EVPOOL_SIZE 16
 #define EVPOOL_CACHED_SDS_SIZE 255
 struct evictionPoolEntry {
     unsigned long long idle;    /* Object idle time (inverse frequency for LFU) */
@@ -59,6 +61,21 @@ struct evictionPoolEntry {
 };
 
 static struct evictionPoolEntry *EvictionPoolLRU;
+static int EvictionPoolSize;
+
+/* The samples taken to refresh the pool are distributed among the DBs
+ * proportionally to the memory used by their candidate keys, estimated as
+ * the number of candidate keys multiplied by the average size of the keys of
+ * the DB, that is derived from the keysizes stats. */
+#define EVICTION_KEY_OVERHEAD 64    /* dictEntry, object and key name. */
+static double *EvictionDbWeight;    /* Weight of every DB in the sampling. */
+static int *EvictionDbSamples;      /* Samples to take from every DB. */
+
+/* Keys sampled to estimate the idle time of the key a perfect LRU would
+ * evict, at most once every EVICTION_QUALITY_PERIOD milliseconds. See
+ * evictionQualityCheck(). */
+#define EVICTION_QUALITY_SAMPLES 64
+#define EVICTION_QUALITY_PERIOD 1000
 
 /* ----------------------------------------------------------------------------
  * Implementation of eviction, aging and LRU
@@ -120,7 +137,11 @@ unsigned long long estimateObjectIdleTime(robj *o) {
  * Redis uses an approximation of the LRU algorithm that runs in constant
  * memory. Every time there is a key to expire, we sample N keys (with
  * N very small, usually in around 5) to populate a pool of best keys to
- * evict of M keys (the pool size is defined by EVPOOL_SIZE).
+ * evict of M keys (the pool size is maxmemory-eviction-pool-size). If more
+ * than N entries of the pool are empty, as many keys as the empty entries
+ * are sampled instead. The samples are distributed among the DBs according
+ * to the memory they use, so that small or empty DBs don't waste the
+ * sampling effort.
  *
  * The N keys sampled are added in the pool of good keys to expire (the one
  * with an old access time) if they are better than one of the current keys
@@ -135,13 +156,28 @@ unsigned long long estimateObjectIdleTime(robj *o) {
  * one key that can be evicted, if there is at least one key that can be
  * evicted in the whole database. */
 
-/* Create a new eviction pool. */
+/* Create a new eviction pool of maxmemory-eviction-pool-size entries. When
+ * called again, because the size was changed with CONFIG SET, the old pool
+ * and the candidates it contains are discarded. */
 void evictionPoolAlloc(void) {
     struct evictionPoolEntry *ep;
     int j;
 
-    ep = zmalloc(sizeof(*ep)*EVPOOL_SIZE);
-    for (j = 0; j < EVPOOL_SIZE; j++) {
+    if (EvictionPoolLRU) {
+        for (j = 0; j < EvictionPoolSize; j++) {
+            ep = EvictionPoolLRU+j;
+            if (ep->key && ep->key != ep->cached) sdsfree(ep->key);
+            sdsfree(ep->cached);
+        }
+        zfree(EvictionPoolLRU);
+    } else {
+        EvictionDbWeight = zcalloc(sizeof(double)*server.dbnum);
+        EvictionDbSamples = zcalloc(sizeof(int)*server.dbnum);
+    }
+
+    EvictionPoolSize = server.maxmemory_eviction_pool_size;
+    ep = zmalloc(sizeof(*ep)*EvictionPoolSize);
+    for (j = 0; j < EvictionPoolSize; j++) {
         ep[j].idle = 0;
         ep[j].key = NULL;
         ep[j].cached = sdsnewlen(NULL,EVPOOL_CACHED_SDS_SIZE);
@@ -150,6 +186,91 @@ void evictionPoolAlloc(void) {
     EvictionPoolLRU = ep;
 }
 
+/* Discard the candidates of the DB 'dbid', or of every DB if 'dbid' is -1,
+ * when the DB is emptied: they would otherwise fill the pool, and if keys
+ * with the same names are created again, they would be picked with the
+ * scores of the old keys. */
+void evictionPoolEmpty(int dbid) {
+    struct evictionPoolEntry *ep;
+    int j;
+
+    for (j = 0; j < EvictionPoolSize; j++) {
+        ep = EvictionPoolLRU+j;
+        if (ep->key == NULL || (dbid != -1 && ep->dbid != dbid)) continue;
+        if (ep->key != ep->cached) sdsfree(ep->key);
+        ep->key = NULL;
+        ep->idle = 0;
+    }
+}
+
+/* Distribute 'count' samples among the DBs proportionally to the memory used
+ * by their candidate keys, that is, all the keys if 'allkeys' is true, or
+ * just the volatile ones. The number of samples to take from every DB is
+ * stored in EvictionDbSamples. If there are no candidate keys at all, zero
+ * is returned, otherwise one. */
+static int evictionDistributeSamples(int allkeys, int count) {
+    double total = 0, r;
+    int j, pick = 0;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+        unsigned long long dbkeys = dbSize(db);
+        unsigned long keys = allkeys ? dbkeys : dictSize(db->expires);
+
+        EvictionDbWeight[j] = keys ? keys*(EVICTION_KEY_OVERHEAD+
+            (double)db->keysizes.bytes/dbkeys) : 0;
+        EvictionDbSamples[j] = 0;
+        total += EvictionDbWeight[j];
+    }
+    if (total == 0) return 0;
+
+    while(count--) {
+        r = total*((double)random()/((double)RAND_MAX+1));
+        for (j = 0; j < server.dbnum; j++) {
+            if (EvictionDbWeight[j] == 0) continue;
+            pick = j;
+            if (r < EvictionDbWeight[j]) break;
+            r -= EvictionDbWeight[j];
+        }
+        EvictionDbSamples[pick]++;
+    }
+    return 1;
+}
+
+/* Return the score of the key stored at the keyspace entry 'de' of the DB
+ * 'dbid' according to the maxmemory policy. This is called idle just because
+ * the code initially handled LRU, but is in fact just a score where an higher
+ * score means better candidate. */
+static unsigned long long evictionScore(int dbid, dictEntry *de) {
+    robj *o = dictGetVal(de);
+
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_LRU) {
+        return estimateObjectIdleTime(o);
+    } else if (server.maxmemory_policy & MAXMEMORY_FLAG_SIZE) {
+        /* GDSF policies rank keys by the memory they use divided
+         * by their access frequency, so that freeing a big cold value
+         * is preferred to freeing many small cold ones, while small
+         * hot keys are retained. The size is a constant time estimate
+         * and the frequency is reconstructed from the LFU counter. */
+        return (unsigned long long) (objectEstimateSize(o) /
+               LFUEstimateAccesses(LFUDecrAndReturn(o)));
+    } else if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+        /* When we use an LRU policy, we sort the keys by idle time
+         * so that we expire keys starting from greater idle time.
+         * However when the policy is an LFU one, we have a frequency
+         * estimation, and we want to evict keys with lower frequency
+         * first. So inside the pool we put objects using the inverted
+         * frequency subtracting the actual frequency to the maximum
+         * frequency of 255. */
+        return 255-LFUDecrAndReturn(o);
+    } else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
+        /* In this case the sooner the expire the better. */
+        return ULLONG_MAX - dbEntryGetExpire(server.db+dbid,de);
+    }
+    serverPanic("Unknown eviction policy in evictionScore()");
+    return 0; /* Avoid warning. */
+}
+
 /* This is an helper function for freeMemoryIfNeeded(), it is used in order
  * to populate the evictionPool with a few entries every time we want to
  * expire a key. Keys with idle time smaller than one of the current
@@ -159,73 +280,49 @@ void evictionPoolAlloc(void) {
  * idle time are on the left, and keys with the higher idle time on the
  * right. */
 
-void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
-    int j, k, count;
-    dictEntry *samples[server.maxmemory_samples];
+void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, int count, struct evictionPoolEntry *pool) {
+    int j, k;
+    dictEntry *samples[count];
 
-    count = dictGetSomeKeys(sampledict,samples,server.maxmemory_samples);
+    count = dictGetSomeKeys(sampledict,samples,count);
     for (j = 0; j < count; j++) {
         unsigned long long idle;
         sds key;
-        robj *o;
         dictEntry *de;
 
         de = samples[j];
         key = dictGetKey(de);
 
         /* If the dictionary we are sampling from is not the main
-         * dictionary (but the expires one) we need to lookup the key
-         * again in the key dictionary to obtain the value object. */
-        if (server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
-            if (sampledict != keydict) de = dictFind(keydict, key);
-            o = dictGetVal(de);
-        }
-
-        /* Calculate the idle time according to the policy. This is called
-         * idle just because the code initially handled LRU, but is in fact
-         * just a score where an higher score means better candidate. */
-        if (server.maxmemory_policy & MAXMEMORY_FLAG_LRU) {
-            idle = estimateObjectIdleTime(o);
-        } else if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-            /* When we use an LRU policy, we sort the keys by idle time
-             * so that we expire keys starting from greater idle time.
-             * However when the policy is an LFU one, we have a frequency
-             * estimation, and we want to evict keys with lower frequency
-             * first. So inside the pool we put objects using the inverted
-             * frequency subtracting the actual frequency to the maximum
-             * frequency of 255. */
-            idle = 255-LFUDecrAndReturn(o);
-        } else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
-            /* In this case the sooner the expire the better. */
-            idle = ULLONG_MAX - (long)dictGetVal(de);
-        } else {
-            serverPanic("Unknown eviction policy in evictionPoolPopulate()");
-        }
+         * dictionary (but the expires one) its values are the entries of
+         * the key dictionary, that hold the value object. */
+        if (sampledict != keydict) de = dictGetVal(de);
+        idle = evictionScore(dbid,de);
 
         /* Insert the element inside the pool.
          * First, find the first empty bucket or the first populated
          * bucket that has an idle time smaller than our idle time. */
         k = 0;
-        while (k < EVPOOL_SIZE &&
+        while (k < EvictionPoolSize &&
                pool[k].key &&
                pool[k].idle < idle) k++;
-        if (k == 0 && pool[EVPOOL_SIZE-1].key != NULL) {
+        if (k == 0 && pool[EvictionPoolSize-1].key != NULL) {
             /* Can't insert if the element is < the worst element we have
              * and there are no empty buckets. */
             continue;
-        } else if (k < EVPOOL_SIZE && pool[k].key == NULL) {
+        } else if (k < EvictionPoolSize && pool[k].key == NULL) {
             /* Inserting into empty position. No setup needed before insert. */
         } else {
             /* Inserting in the middle. Now k points to the first element
              * greater than the element to insert.  */
-            if (pool[EVPOOL_SIZE-1].key == NULL) {
+            if (pool[EvictionPoolSize-1].key == NULL) {
                 /* Free space on the right? Insert at k shifting
                  * all the elements from k to end to the right. */
 
                 /* Save SDS before overwriting. */
-                sds cached = pool[EVPOOL_SIZE-1].cached;
+                sds cached = pool[EvictionPoolSize-1].cached;
                 memmove(pool+k+1,pool+k,
-                    sizeof(pool[0])*(EVPOOL_SIZE-k-1));
+                    sizeof(pool[0])*(EvictionPoolSize-k-1));
                 pool[k].cached = cached;
             } else {
                 /* No free space on right? Insert at k-1 */
@@ -341,6 +438,19 @@ unsigned long LFUDecrAndReturn(robj *o) {
     return counter;
 }
 
+/* Return an estimate of the number of accesses needed for a new key to
+ * reach the specified counter value, that is, the inverse of LFULogIncr().
+ * Counters below LFU_INIT_VAL belong to keys that were not accessed for some
+ * time, those are reported as a fraction of a single access. */
+double LFUEstimateAccesses(unsigned long counter) {
+    double n;
+
+    if (counter < LFU_INIT_VAL)
+        return (double)(counter+1)/(LFU_INIT_VAL+1);
+    n = counter-LFU_INIT_VAL;
+    return 1+n+server.lfu_log_factor*n*(n-1)/2;
+}
+
 /* ----------------------------------------------------------------------------
  * The external API for eviction: freeMemroyIfNeeded() is called by the
  * server when there is data to add in order to make space if needed.
@@ -348,7 +458,8 @@ unsigned long LFUDecrAndReturn(robj *o) {
 
 /* We don't want to count AOF buffers and slaves output buffers as
  * used memory: the eviction should use mostly data size. This function
- * returns the sum of AOF and slaves buffer. */
+ * returns the sum of AOF and slaves buffer, plus the memory that the
+ * lazyfree threads are going to release. */
 size_t freeMemoryGetNotCountedMemory(void) {
     size_t overhead = 0;
     int slaves = listLength(server.slaves);
@@ -366,14 +477,226 @@ size_t freeMemoryGetNotCountedMemory(void) {
     if (server.aof_state != AOF_OFF) {
         overhead += sdslen(server.aof_buf)+aofRewriteBufferSize();
     }
+    overhead += lazyfreeGetPendingBytes();
     return overhead;
 }
 
+/* A perfect LRU would always evict the key with the greatest idle time. To
+ * know how far the sampled approximation is from it, at most once every
+ * EVICTION_QUALITY_PERIOD milliseconds the idle time of the key about to be
+ * evicted is compared with the greatest idle time among
+ * EVICTION_QUALITY_SAMPLES keys sampled across the DBs, as an estimate of the
+ * idle time of the key a perfect LRU would evict. */
+static void evictionQualityCheck(int allkeys, unsigned long long idle) {
+    static long long last_check = 0;
+    unsigned long long maxidle = idle;
+    dictEntry *samples[EVICTION_QUALITY_SAMPLES];
+    int j, k, count;
+
+    if (server.mstime-last_check < EVICTION_QUALITY_PERIOD) return;
+    last_check = server.mstime;
+    if (!evictionDistributeSamples(allkeys,EVICTION_QUALITY_SAMPLES))
+        return;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+        dict *d;
+
+        if (EvictionDbSamples[j] == 0) continue;
+        d = allkeys ? dbRandomDict(db) : db->expires;
+        if (d == NULL) continue;
+        count = dictGetSomeKeys(d,samples,EvictionDbSamples[j]);
+        for (k = 0; k < count; k++) {
+            dictEntry *de = samples[k];
+            unsigned long long sampled;
+
+            if (!allkeys) de = dictGetVal(de);
+            sampled = estimateObjectIdleTime(dictGetVal(de));
+            if (sampled > maxidle) maxidle = sampled;
+        }
+    }
+    server.stat_eviction_checks++;
+    server.stat_eviction_check_idle_sum += idle;
+    server.stat_eviction_check_ideal_sum += maxidle;
+}
+
+/* Select a key according to the maxmemory policy and delete it, either
+ * synchronously or handing the value to the lazyfree thread if 'lazy' is
+ * true. On success 1 is returned and the amount of memory released is
+ * stored in '*freed', counting what was handed to the lazyfree threads,
+ * otherwise, if there is no key that can be evicted, 0 is returned. The time
+ * spent deleting the key is removed from the 'latency' monitor of the
+ * caller. */
+static int evictOneKey(int lazy, long long *freed, mstime_t *latency) {
+    int j, k, i;
+    static int next_db = 0;
+    sds bestkey = NULL;
+    robj *bestval = NULL;
+    int bestdbid;
+    int allkeys = server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS;
+    redisDb *db;
+    dict *dict;
+    dictEntry *de;
+    mstime_t eviction_latency;
+    long long delta;
+    unsigned long long submitted;
+
+    if (server.maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU) ||
+        server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL)
+    {
+        struct evictionPoolEntry *pool = EvictionPoolLRU;
+
+        while(bestkey == NULL) {
+            int samples = server.maxmemory_samples, empty = 0;
+
+            /* Sample enough keys to fill the empty entries of the pool, so
+             * that the key evicted is the best of a whole pool of
+             * candidates, and not of the few keys sampled after the pool
+             * was drained. Once the pool is full the samples just replace
+             * its worst candidates. */
+            for (k = 0; k < EvictionPoolSize; k++)
+                if (pool[k].key == NULL) empty++;
+            if (empty > samples) samples = empty;
+
+            /* We don't want to make local-db choices when expiring keys,
+             * so to start populate the eviction pool sampling keys from
+             * every DB, in proportion to the memory its keys use. */
+            if (!evictionDistributeSamples(allkeys,samples))
+                break; /* No keys to evict. */
+            for (i = 0; i < server.dbnum; i++) {
+                if (EvictionDbSamples[i] == 0) continue;
+                db = server.db+i;
+                /* With a partitioned keyspace every DB contributes the
+                 * samples of one of its dicts, picked at random. */
+                if (allkeys) {
+                    dict = dbRandomDict(db);
+                    if (dict) evictionPoolPopulate(i, dict, dict,
+                                  EvictionDbSamples[i], pool);
+                } else {
+                    evictionPoolPopulate(i, db->expires, NULL,
+                        EvictionDbSamples[i], pool);
+                }
+            }
+
+            /* Go backward from best to worst element to evict. */
+            for (k = EvictionPoolSize-1; k >= 0; k--) {
+                unsigned long long idle = pool[k].idle;
+
+                if (pool[k].key == NULL) continue;
+                bestdbid = pool[k].dbid;
+
+                if (allkeys) {
+                    de = dbFind(server.db+pool[k].dbid,pool[k].key);
+                } else {
+                    de = dictFind(server.db[pool[k].dbid].expires,
+                        pool[k].key);
+                    if (de) de = dictGetVal(de);
+                }
+
+                /* Remove the entry from the pool. */
+                if (pool[k].key != pool[k].cached)
+                    sdsfree(pool[k].key);
+                pool[k].key = NULL;
+                pool[k].idle = 0;
+
+                /* If the key exists, is our pick. Otherwise it is
+                 * a ghost and we need to try the next element. Since the
+                 * pool survives across calls, the key may also have been
+                 * accessed after it was sampled: in that case its score is
+                 * stale and it is discarded as well. It will enter the pool
+                 * again with its current score if it is sampled. */
+                if (de && evictionScore(bestdbid,de) >= idle) {
+                    bestkey = dictGetKey(de);
+                    bestval = dictGetVal(de);
+                    break;
+                } else {
+                    /* Ghost... Iterate again. */
+                }
+            }
+        }
+    }
+
+    /* volatile-random and allkeys-random policy */
+    else if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
+             server.maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM)
+    {
+        /* When evicting a random key, we try to evict a key for
+         * each DB, so we use the static 'next_db' variable to
+         * incrementally visit all DBs. */
+        for (i = 0; i < server.dbnum; i++) {
+            j = (++next_db) % server.dbnum;
+            db = server.db+j;
+            dict = allkeys ? dbRandomDict(db) : db->expires;
+            if (dict && dictSize(dict) != 0) {
+                de = dictGetRandomKey(dict);
+                bestkey = dictGetKey(de);
+                if (!allkeys) de = dictGetVal(de);
+                bestval = dictGetVal(de);
+                bestdbid = j;
+                break;
+            }
+        }
+    }
+
+    if (!bestkey) return 0;
+
+    /* Track the idle time of the evicted keys, and from time to time
+     * compare it with the one of a perfect LRU. This is pointless with the
+     * LFU policies, since the objects don't track the access time. */
+    if (!(server.maxmemory_policy & MAXMEMORY_FLAG_LFU)) {
+        unsigned long long idle = estimateObjectIdleTime(bestval);
+
+        server.stat_eviction_idle_sum += idle;
+        server.stat_eviction_idle_keys++;
+        evictionQualityCheck(allkeys,idle);
+    }
+
+    /* Finally remove the selected key. */
+    db = server.db+bestdbid;
+    robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
+    propagateExpire(db,keyobj,lazy);
+    /* We compute the amount of memory freed by db*Delete() alone.
+     * It is possible that actually the memory needed to propagate
+     * the DEL in AOF and replication link is greater than the one
+     * we are freeing removing the key, but we can't account for
+     * that otherwise we would never exit the loop.
+     *
+     * AOF and Output buffer memory will be freed eventually so
+     * we only care about memory used by the key space. */
+    delta = (long long) zmalloc_used_memory();
+    submitted = lazyfreeGetSubmittedBytes();
+    latencyStartMonitor(eviction_latency);
+    if (lazy)
+        dbAsyncDelete(db,keyobj);
+    else
+        dbSyncDelete(db,keyobj);
+    latencyEndMonitor(eviction_latency);
+    latencyAddSampleIfNeeded("eviction-del",eviction_latency);
+    latencyRemoveNestedEvent(*latency,eviction_latency);
+    delta -= (long long) zmalloc_used_memory();
+    delta += (long long) (lazyfreeGetSubmittedBytes()-submitted);
+    *freed = delta;
+    server.stat_evictedkeys++;
+    notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
+        keyobj, db->id);
+    decrRefCount(keyobj);
+    return 1;
+}
+
+/* Return the used memory as considered by the eviction, that is, not
+ * counting the slaves output buffers and the AOF buffers. */
+static size_t evictionGetUsedMemory(void) {
+    size_t mem_used = zmalloc_used_memory();
+    size_t overhead = freeMemoryGetNotCountedMemory();
+    return (mem_used > overhead) ? mem_used-overhead : 0;
+}
+
 int freeMemoryIfNeeded(void) {
     size_t mem_reported, mem_used, mem_tofree, mem_freed;
-    mstime_t latency, eviction_latency;
+    mstime_t latency;
     long long delta;
     int slaves = listLength(server.slaves);
+    int keys_freed = 0;
 
     /* When clients are paused the dataset should be static not just from the
      * POV of clients not being able to write, but also from the POV of
@@ -403,146 +726,32 @@ int freeMemoryIfNeeded(void) {
 
     latencyStartMonitor(latency);
     while (mem_freed < mem_tofree) {
-        int j, k, i, keys_freed = 0;
-        static int next_db = 0;
-        sds bestkey = NULL;
-        int bestdbid;
-        redisDb *db;
-        dict *dict;
-        dictEntry *de;
-
-        if (server.maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU) ||
-            server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL)
-        {
-            struct evictionPoolEntry *pool = EvictionPoolLRU;
-
-            while(bestkey == NULL) {
-                unsigned long total_keys = 0, keys;
-
-                /* We don't want to make local-db choices when expiring keys,
-                 * so to start populate the eviction pool sampling keys from
-                 * every DB. */
-                for (i = 0; i < server.dbnum; i++) {
-                    db = server.db+i;
-                    dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
-                            db->dict : db->expires;
-                    if ((keys = dictSize(dict)) != 0) {
-                        evictionPoolPopulate(i, dict, db->dict, pool);
-                        total_keys += keys;
-                    }
-                }
-                if (!total_keys) break; /* No keys to evict. */
-
-                /* Go backward from best to worst element to evict. */
-                for (k = EVPOOL_SIZE-1; k >= 0; k--) {
-                    if (pool[k].key == NULL) continue;
-                    bestdbid = pool[k].dbid;
-
-                    if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) {
-                        de = dictFind(server.db[pool[k].dbid].dict,
-                            pool[k].key);
-                    } else {
-                        de = dictFind(server.db[pool[k].dbid].expires,
-                            pool[k].key);
-                    }
-
-                    /* Remove the entry from the pool. */
-                    if (pool[k].key != pool[k].cached)
-                        sdsfree(pool[k].key);
-                    pool[k].key = NULL;
-                    pool[k].idle = 0;
-
-                    /* If the key exists, is our pick. Otherwise it is
-                     * a ghost and we need to try the next element. */
-                    if (de) {
-                        bestkey = dictGetKey(de);
-                        break;
-                    } else {
-                        /* Ghost... Iterate again. */
-                    }
-                }
-            }
-        }
-
-        /* volatile-random and allkeys-random policy */
-        else if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
-                 server.maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM)
-        {
-            /* When evicting a random key, we try to evict a key for
-             * each DB, so we use the static 'next_db' variable to
-             * incrementally visit all DBs. */
-            for (i = 0; i < server.dbnum; i++) {
-                j = (++next_db) % server.dbnum;
-                db = server.db+j;
-                dict = (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ?
-                        db->dict : db->expires;
-                if (dictSize(dict) != 0) {
-                    de = dictGetRandomKey(dict);
-                    bestkey = dictGetKey(de);
-                    bestdbid = j;
-                    break;
-                }
-            }
-        }
-
-        /* Finally remove the selected key. */
-        if (bestkey) {
-            db = server.db+bestdbid;
-            robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
-            propagateExpire(db,keyobj,server.lazyfree_lazy_eviction);
-            /* We compute the amount of memory freed by db*Delete() alone.
-             * It is possible that actually the memory needed to propagate
-             * the DEL in AOF and replication link is greater than the one
-             * we are freeing removing the key, but we can't account for
-             * that otherwise we would never exit the loop.
-             *
-             * AOF and Output buffer memory will be freed eventually so
-             * we only care about memory used by the key space. */
-            delta = (long long) zmalloc_used_memory();
-            latencyStartMonitor(eviction_latency);
-            if (server.lazyfree_lazy_eviction)
-                dbAsyncDelete(db,keyobj);
-            else
-                dbSyncDelete(db,keyobj);
-            latencyEndMonitor(eviction_latency);
-            latencyAddSampleIfNeeded("eviction-del",eviction_latency);
-            latencyRemoveNestedEvent(latency,eviction_latency);
-            delta -= (long long) zmalloc_used_memory();
-            mem_freed += delta;
-            server.stat_evictedkeys++;
-            notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
-                keyobj, db->id);
-            decrRefCount(keyobj);
-            keys_freed++;
-
-            /* When the memory to free starts to be big enough, we may
-             * start spending so much time here that is impossible to
-             * deliver data to the slaves fast enough, so we force the
-             * transmission here inside the loop. */
-            if (slaves) flushSlavesOutputBuffers();
-
-            /* Normally our stop condition is the ability to release
-             * a fixed, pre-computed amount of memory. However when we
-             * are deleting objects in another thread, it's better to
-             * check, from time to time, if we already reached our target
-             * memory, since the "mem_freed" amount is computed only
-             * across the dbAsyncDelete() call, while the thread can
-             * release the memory all the time. */
-            if (server.lazyfree_lazy_eviction && !(keys_freed % 16)) {
-                overhead = freeMemoryGetNotCountedMemory();
-                mem_used = zmalloc_used_memory();
-                mem_used = (mem_used > overhead) ? mem_used-overhead : 0;
-                if (mem_used <= server.maxmemory) {
-                    mem_freed = mem_tofree;
-                }
-            }
-        }
-
-        if (!keys_freed) {
+        if (!evictOneKey(server.lazyfree_lazy_eviction,&delta,&latency)) {
             latencyEndMonitor(latency);
             latencyAddSampleIfNeeded("eviction-cycle",latency);
             goto cant_free; /* nothing to free... */
         }
+        mem_freed += delta;
+        keys_freed++;
+
+        /* When the memory to free starts to be big enough, we may
+         * start spending so much time here that is impossible to
+         * deliver data to the slaves fast enough, so we force the
+         * transmission here inside the loop. */
+        if (slaves) flushSlavesOutputBuffers();
+
+        /* Normally our stop condition is the ability to release
+         * a fixed, pre-computed amount of memory. However when we
+         * are deleting objects in another thread, it's better to
+         * check, from time to time, if we already reached our target
+         * memory, since the "mem_freed" amount is computed only
+         * across the dbAsyncDelete() call, while the thread can
+         * release the memory all the time. */
+        if (server.lazyfree_lazy_eviction && !(keys_freed % 16)) {
+            if (evictionGetUsedMemory() <= server.maxmemory) {
+                mem_freed = mem_tofree;
+            }
+        }
     }
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("eviction-cycle",latency);
@@ -552,6 +761,7 @@ cant_free:
     /* We are here if we are not able to reclaim memory. There is only one
      * last thing we can try: check if the lazyfree thread has jobs in queue
      * and wait... */
+    lazyfreeFlush();
     while(bioPendingJobsOfType(BIO_LAZY_FREE)) {
         if (((mem_reported - zmalloc_used_memory()) + mem_freed) >= mem_tofree)
             break;
@@ -560,3 +770,68 @@ cant_free:
     return C_ERR;
 }
 
+/* ----------------------------------------------------------------------------
+ * Background eviction.
+ *
+ * When maxmemory-background-eviction is enabled, keys are evicted before the
+ * maxmemory limit is reached, so that write commands rarely need to evict
+ * inline. Once the used memory crosses the high watermark, a small amount of
+ * keys is evicted every time the server is about to sleep, until the used
+ * memory goes back under the low watermark. The values are always released
+ * by the lazyfree thread.
+ * --------------------------------------------------------------------------*/
+
+/* Return the used memory, computed as in evictionGetUsedMemory(), where
+ * the background eviction starts (high watermark) or stops (low watermark).
+ * A low watermark greater than the high one is capped to the latter. */
+static size_t evictionWatermark(int high) {
+    int perc = high ? server.maxmemory_high_watermark :
+                      server.maxmemory_low_watermark;
+    if (!high && perc > server.maxmemory_high_watermark)
+        perc = server.maxmemory_high_watermark;
+    return (size_t)((double)server.maxmemory*perc/100);
+}
+
+/* Called by beforeSleep() to run a time limited background eviction cycle,
+ * when the used memory is over the high watermark or we did not reach the
+ * low watermark yet. */
+void evictionBackgroundCycle(void) {
+    long long start, delta;
+    size_t mem_used;
+    int keys_freed = 0;
+    mstime_t latency;
+
+    if (!server.maxmemory_background_eviction || !server.maxmemory ||
+        server.maxmemory_policy == MAXMEMORY_NO_EVICTION ||
+        clientsArePaused())
+    {
+        server.eviction_background_active = 0;
+        return;
+    }
+
+    mem_used = evictionGetUsedMemory();
+    if (mem_used > evictionWatermark(1)) {
+        server.eviction_background_active = 1;
+    } else if (mem_used <= evictionWatermark(0)) {
+        server.eviction_background_active = 0;
+    }
+    if (!server.eviction_background_active) return;
+
+    start = ustime();
+    latencyStartMonitor(latency);
+    while (mem_used > evictionWatermark(0)) {
+        if (!evictOneKey(1,&delta,&latency)) break;
+        server.stat_evictedkeys_background++;
+        mem_used = (delta > 0 && (size_t)delta < mem_used) ?
+                   mem_used-delta : evictionGetUsedMemory();
+        /* Check the time and the memory really used every 16 keys: the
+         * lazyfree thread may have released more than what we see. */
+        if (!(++keys_freed % 16)) {
+            if (ustime()-start > EVICTION_BACKGROUND_DURATION) break;
+            mem_used = evictionGetUsedMemory();
+        }
+    }
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("eviction-background",latency);
+    if (keys_freed && listLength(server.slaves)) flushSlavesOutputBuffers();
+}
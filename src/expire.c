@@ -32,6 +32,145 @@
 
 #include "server.h"
 
+/*-----------------------------------------------------------------------------
+ * Expires index
+ *
+ * When "active-expire-index" is enabled every DB has a radix tree of its
+ * volatile keys sorted by expire time: the elements are the expire in
+ * milliseconds, as a 64 bit big endian number, followed by the key name.
+ * The expire cycle then deletes the due keys in expire time order, instead
+ * of looking for them by sampling random keys.
+ *
+ * The index is updated by setExpire(), removeExpire() and the deletion of
+ * keys, that know the old expire of the key from the keyspace entry.
+ *----------------------------------------------------------------------------*/
+
+#define EXPIRE_INDEX_STATIC_KEY 128
+
+/* Negative expires, only possible for keys loaded by slaves, are indexed
+ * as already due at time zero. */
+static long long expireIndexTime(long long when) {
+    return when < 0 ? 0 : when;
+}
+
+/* Encode the index element of 'key' expiring at 'when' in 'buf' if it is
+ * big enough, otherwise in a new allocation that the caller should free if
+ * the returned pointer is not 'buf'. */
+static unsigned char *expireIndexElement(unsigned char *buf, sds key,
+                                         long long when, size_t *len)
+{
+    uint64_t t = expireIndexTime(when);
+    unsigned char *ele;
+    int j;
+
+    *len = sizeof(t)+sdslen(key);
+    ele = (*len <= EXPIRE_INDEX_STATIC_KEY) ? buf : zmalloc(*len);
+    for (j = 0; j < 8; j++) ele[j] = (t >> (56-j*8)) & 0xff;
+    memcpy(ele+sizeof(t),key,sdslen(key));
+    return ele;
+}
+
+static long long expireIndexElementTime(unsigned char *ele) {
+    uint64_t t = 0;
+    int j;
+
+    for (j = 0; j < 8; j++) t = (t << 8) | ele[j];
+    return (long long)t;
+}
+
+void expireIndexAdd(redisDb *db, sds key, long long when) {
+    unsigned char buf[EXPIRE_INDEX_STATIC_KEY], *ele;
+    size_t len;
+
+    ele = expireIndexElement(buf,key,when,&len);
+    raxInsert(db->expires_index,ele,len,NULL,NULL);
+    if (ele != buf) zfree(ele);
+}
+
+void expireIndexRemove(redisDb *db, sds key, long long when) {
+    unsigned char buf[EXPIRE_INDEX_STATIC_KEY], *ele;
+    size_t len;
+
+    ele = expireIndexElement(buf,key,when,&len);
+    raxRemove(db->expires_index,ele,len,NULL);
+    if (ele != buf) zfree(ele);
+}
+
+/* Create the index of 'db' from the volatile keys it already has. */
+void expireIndexBuild(redisDb *db) {
+    dictIterator *di = dictGetIterator(db->expires);
+    dictEntry *de;
+
+    db->expires_index = raxNew();
+    while((de = dictNext(di)) != NULL)
+        expireIndexAdd(db,dictGetKey(de),dbEntryGetExpire(db,dictGetVal(de)));
+    dictReleaseIterator(di);
+}
+
+void expireIndexRelease(redisDb *db) {
+    raxFree(db->expires_index);
+    db->expires_index = NULL;
+}
+
+/* Return the number of keys of 'db' already expired at 'now', but not yet
+ * reclaimed, up to 'max' (that must be at least 1), and set *oldest to the
+ * expire of the first of them. The cost is proportional to the number of
+ * keys returned. */
+unsigned long long expireIndexDueKeys(redisDb *db, long long now,
+                                      long long *oldest,
+                                      unsigned long long max)
+{
+    unsigned long long due = 0;
+    raxIterator ri;
+
+    raxStart(&ri,db->expires_index);
+    raxSeek(&ri,"^",NULL,0);
+    while(due < max && raxNext(&ri)) {
+        long long when = expireIndexElementTime(ri.key);
+        if (when >= now) break;
+        if (due++ == 0) *oldest = when;
+    }
+    raxStop(&ri);
+    return due;
+}
+
+/* Return the number of keys already expired but not yet reclaimed, and in
+ * *lag the milliseconds elapsed since the oldest of them expired. For the
+ * DBs with the expires index the keys are counted walking the index, so
+ * at most EXPIRE_STALE_KEYS_MAX_WALK are counted overall and the result is
+ * a lower bound when there are more: this happens when the expire cycle
+ * can't keep up, or on slaves, that don't expire keys but wait for the
+ * master DELs. The lag is always exact. For the other DBs the count is an
+ * estimate from the sampling of the expire cycle, with no lag reported. */
+#define EXPIRE_STALE_KEYS_MAX_WALK 10000
+unsigned long long getExpiredStaleKeys(long long *lag) {
+    unsigned long long stale = 0, walked = 0;
+    long long now = mstime();
+    int j;
+
+    *lag = 0;
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+
+        if (db->expires_index) {
+            long long oldest;
+            unsigned long long due, max;
+
+            /* Once the budget is exhausted, still look at the first key
+             * of every DB to report the lag. */
+            max = walked < EXPIRE_STALE_KEYS_MAX_WALK ?
+                  EXPIRE_STALE_KEYS_MAX_WALK-walked : 1;
+            due = expireIndexDueKeys(db,now,&oldest,max);
+            walked += due;
+            stale += due;
+            if (due && now-oldest > *lag) *lag = now-oldest;
+        } else {
+            stale += server.stat_expired_stale_perc*dictSize(db->expires);
+        }
+    }
+    return stale;
+}
+
 /*-----------------------------------------------------------------------------
  * Incremental collection of expired keys.
  *
@@ -40,6 +179,18 @@
  * if no access is performed on them.
  *----------------------------------------------------------------------------*/
 
+/* Delete the expired key 'keyobj', propagating the deletion. */
+static void activeExpireDeleteKey(redisDb *db, robj *keyobj) {
+    propagateExpire(db,keyobj,server.lazyfree_lazy_expire);
+    if (server.lazyfree_lazy_expire)
+        dbAsyncDelete(db,keyobj);
+    else
+        dbSyncDelete(db,keyobj);
+    notifyKeyspaceEvent(NOTIFY_EXPIRED,
+        "expired",keyobj,db->id);
+    server.stat_expiredkeys++;
+}
+
 /* Helper function for the activeExpireCycle() function.
  * This function will try to expire the key that is stored in the hash table
  * entry 'de' of the 'expires' hash table of a Redis database.
@@ -52,26 +203,60 @@
  * The parameter 'now' is the current time in milliseconds as is passed
  * to the function to avoid too many gettimeofday() syscalls. */
 int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
-    long long t = dictGetSignedIntegerVal(de);
+    long long t = dbEntryGetExpire(db,dictGetVal(de));
     if (now > t) {
         sds key = dictGetKey(de);
         robj *keyobj = createStringObject(key,sdslen(key));
 
-        propagateExpire(db,keyobj,server.lazyfree_lazy_expire);
-        if (server.lazyfree_lazy_expire)
-            dbAsyncDelete(db,keyobj);
-        else
-            dbSyncDelete(db,keyobj);
-        notifyKeyspaceEvent(NOTIFY_EXPIRED,
-            "expired",keyobj,db->id);
+        activeExpireDeleteKey(db,keyobj);
         decrRefCount(keyobj);
-        server.stat_expiredkeys++;
         return 1;
     } else {
         return 0;
     }
 }
 
+/* Helper function for the activeExpireCycle() function when the expires
+ * index is enabled: delete the due keys of 'db' in expire time order, until
+ * there are no more or the cycle runs out of time. Since the check of the
+ * time is performed every 16 keys, it returns 1 if the time limit was
+ * reached, 0 otherwise. */
+int activeExpireCycleFromIndex(redisDb *db, long long start,
+                               long long timelimit)
+{
+    long long now = mstime();
+    unsigned long expired = 0;
+    raxIterator ri;
+    int timeout = 0;
+
+    raxStart(&ri,db->expires_index);
+    while(1) {
+        long long when;
+        robj *keyobj;
+        dictEntry *de;
+
+        /* The deletion modifies the tree, so seek again every time. */
+        raxSeek(&ri,"^",NULL,0);
+        if (!raxNext(&ri)) break;
+        when = expireIndexElementTime(ri.key);
+        if (when >= now) break;
+
+        keyobj = createStringObject((char*)ri.key+8,ri.key_len-8);
+        de = dbFind(db,keyobj->ptr);
+        serverAssertWithInfo(NULL,keyobj,
+            de != NULL && expireIndexTime(dbEntryGetExpire(db,de)) == when);
+        activeExpireDeleteKey(db,keyobj);
+        decrRefCount(keyobj);
+
+        if ((++expired & 0xf) == 0 && ustime()-start > timelimit) {
+            timeout = 1;
+            break;
+        }
+    }
+    raxStop(&ri);
+    return timeout;
+}
+
 /* Try to expire a few timed out keys. The algorithm used is adaptive and
  * will use few CPU cycles if there are few expiring keys, otherwise
  * it will get more aggressive to avoid that too much memory is used by
@@ -110,6 +295,16 @@ void activeExpireCycle(int type) {
      * expires and evictions of keys not being performed. */
     if (clientsArePaused()) return;
 
+    /* With a child saving the dataset in the fork friendly mode the expired
+     * keys are not reclaimed, but they are still deleted when accessed.
+     * Once the child is gone the first cycles scan all the DBs and the fast
+     * cycle is enabled, as if the previous cycle hit the time limit, in
+     * order to delete in a batch the keys expired in the meantime. */
+    if (forkFriendlyActive()) {
+        timelimit_exit = 1;
+        return;
+    }
+
     if (type == ACTIVE_EXPIRE_CYCLE_FAST) {
         /* Don't start a fast cycle if the previous cycle did not exit
          * for time limt. Also don't repeat a fast cycle for the same period
@@ -163,6 +358,17 @@ void activeExpireCycle(int type) {
             int ttl_samples;
             iteration++;
 
+            /* With the expires index the due keys are deleted directly,
+             * in expire time order. Then just a few keys are sampled, in
+             * order to update the average TTL. */
+            if (db->expires_index &&
+                activeExpireCycleFromIndex(db,start,timelimit))
+            {
+                timelimit_exit = 1;
+                server.stat_expired_time_cap_reached_count++;
+                break;
+            }
+
             /* If there is nothing to expire try next DB ASAP. */
             if ((num = dictSize(db->expires)) == 0) {
                 db->avg_ttl = 0;
@@ -183,6 +389,8 @@ void activeExpireCycle(int type) {
             ttl_sum = 0;
             ttl_samples = 0;
 
+            if (db->expires_index && num > ACTIVE_EXPIRE_INDEX_TTL_SAMPLES)
+                num = ACTIVE_EXPIRE_INDEX_TTL_SAMPLES;
             if (num > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP)
                 num = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
 
@@ -191,7 +399,7 @@ void activeExpireCycle(int type) {
                 long long ttl;
 
                 if ((de = dictGetRandomKey(db->expires)) == NULL) break;
-                ttl = dictGetSignedIntegerVal(de)-now;
+                ttl = dbEntryGetExpire(db,dictGetVal(de))-now;
                 if (activeExpireCycleTryExpire(db,de,now)) expired++;
                 if (ttl > 0) {
                     /* We want the average TTL of keys yet not expired. */
@@ -0,0 +1,154 @@
+/* Parallel pattern matching for the KEYS command.
+ *
+ * KEYS spends most of its time in stringmatchlen(), called for every key of
+ * the database. When "keys-filter-threads" is greater than zero KEYS collects
+ * the keys in batches, and every batch is matched against the pattern by the
+ * helper threads and the main thread at the same time, each one taking a
+ * slice of the batch.
+ *
+ * The main thread waits for the whole batch to be matched before touching
+ * the keyspace again, so the helper threads only read keys that can't be
+ * modified or freed while they are working. The helpers only run the pure
+ * stringmatchlen() function, everything else is left to the main thread.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+static pthread_t keys_filter_threads[KEYS_FILTER_MAX_THREADS];
+static pthread_mutex_t keys_filter_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t keys_filter_newjob_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t keys_filter_done_cond = PTHREAD_COND_INITIALIZER;
+
+/* The batch being matched. The fields are set by the main thread while
+ * holding the mutex, and 'jobid' is incremented for every new batch. */
+static struct {
+    unsigned long jobid;
+    int pending;            /* Helper threads still matching their slice. */
+    const char *pattern;
+    int patlen;
+    sds *keys;
+    unsigned char *match;
+    size_t count;
+} keys_filter_job;
+
+/* Match the slice 'id' of the batch, out of one slice for every helper
+ * thread plus the slice 0 of the main thread. */
+static void keysFilterMatchSlice(int id) {
+    size_t slices = server.keys_filter_threads+1;
+    size_t start = keys_filter_job.count*id/slices;
+    size_t end = keys_filter_job.count*(id+1)/slices;
+    size_t j;
+
+    for (j = start; j < end; j++) {
+        sds key = keys_filter_job.keys[j];
+        keys_filter_job.match[j] = stringmatchlen(keys_filter_job.pattern,
+            keys_filter_job.patlen,key,sdslen(key),0);
+    }
+}
+
+static void *keysFilterThreadMain(void *arg) {
+    int id = (unsigned long) arg;
+    unsigned long jobid = 0;
+    sigset_t sigset;
+
+    /* Make sure SIGALRM signal is delivered to the main thread, like the
+     * other threads of Redis do, see bioProcessBackgroundJobs(). */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in keys filter thread: %s",
+            strerror(errno));
+
+    pthread_mutex_lock(&keys_filter_mutex);
+    while(1) {
+        while (keys_filter_job.jobid == jobid)
+            pthread_cond_wait(&keys_filter_newjob_cond,&keys_filter_mutex);
+        jobid = keys_filter_job.jobid;
+        pthread_mutex_unlock(&keys_filter_mutex);
+
+        keysFilterMatchSlice(id);
+
+        pthread_mutex_lock(&keys_filter_mutex);
+        if (--keys_filter_job.pending == 0)
+            pthread_cond_signal(&keys_filter_done_cond);
+    }
+    return NULL;
+}
+
+/* Spawn the helper threads configured with "keys-filter-threads". */
+void keysFilterInit(void) {
+    int j;
+
+    for (j = 0; j < server.keys_filter_threads; j++) {
+        void *arg = (void*)(unsigned long) (j+1);
+        if (pthread_create(&keys_filter_threads[j],NULL,
+                           keysFilterThreadMain,arg) != 0)
+        {
+            serverLog(LL_WARNING,"Fatal: Can't initialize keys filter threads.");
+            exit(1);
+        }
+    }
+}
+
+/* Set match[j] to 1 if keys[j] matches the glob-style pattern, otherwise
+ * to 0, for the 'count' keys of the array. Small batches are not worth the
+ * synchronization with the helper threads and are matched by the caller
+ * alone. */
+void keysFilterMatch(const char *pattern, int patlen, sds *keys,
+                     size_t count, unsigned char *match)
+{
+    size_t j;
+
+    if (server.keys_filter_threads == 0 || count < KEYS_FILTER_MIN_BATCH) {
+        for (j = 0; j < count; j++)
+            match[j] = stringmatchlen(pattern,patlen,keys[j],
+                                      sdslen(keys[j]),0);
+        return;
+    }
+
+    pthread_mutex_lock(&keys_filter_mutex);
+    keys_filter_job.pattern = pattern;
+    keys_filter_job.patlen = patlen;
+    keys_filter_job.keys = keys;
+    keys_filter_job.match = match;
+    keys_filter_job.count = count;
+    keys_filter_job.pending = server.keys_filter_threads;
+    keys_filter_job.jobid++;
+    pthread_cond_broadcast(&keys_filter_newjob_cond);
+    pthread_mutex_unlock(&keys_filter_mutex);
+
+    keysFilterMatchSlice(0);
+
+    pthread_mutex_lock(&keys_filter_mutex);
+    while (keys_filter_job.pending)
+        pthread_cond_wait(&keys_filter_done_cond,&keys_filter_mutex);
+    pthread_mutex_unlock(&keys_filter_mutex);
+}
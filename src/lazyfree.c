@@ -3,8 +3,29 @@
 #include "atomicvar.h"
 #include "cluster.h"
 
+static void lazyfreeFreeObjectFromBioThread(void *o, void *unused1,
+                                            void *unused2);
+static void lazyfreeFreeDatabaseFromBioThread(void *dicts, void *expires,
+                                              void *bytes);
+static void lazyfreeFreeExpiresIndexFromBioThread(void *index, void *unused1,
+                                                  void *unused2);
+
 static size_t lazyfree_objects = 0;
 pthread_mutex_t lazyfree_objects_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t lazyfree_pending_bytes = 0;
+pthread_mutex_t lazyfree_pending_bytes_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Total bytes ever handed to the lazyfree threads. Only accessed by the
+ * main thread, so that the difference between two calls is exactly what
+ * was submitted in between, regardless of what the threads freed. */
+static unsigned long long lazyfree_submitted_bytes = 0;
+
+/* Objects deleted by dbAsyncDelete() are not submitted one by one, but
+ * collected here and submitted together when the batch is full, or before
+ * the event loop sleeps. */
+#define LAZYFREE_BATCH_SIZE 64
+static void *lazyfree_batch[LAZYFREE_BATCH_SIZE];
+static int lazyfree_batch_len = 0;
 
 /* Return the number of currently pending objects to free. */
 size_t lazyfreeGetPendingObjectsCount(void) {
@@ -13,6 +34,43 @@ size_t lazyfreeGetPendingObjectsCount(void) {
     return aux;
 }
 
+/* Return an estimate of the memory that will be reclaimed by the lazyfree
+ * threads once they complete the pending jobs. */
+size_t lazyfreeGetPendingBytes(void) {
+    size_t aux;
+    atomicGet(lazyfree_pending_bytes,aux);
+    return aux;
+}
+
+/* Return the total amount of bytes submitted to the lazyfree threads
+ * since the server started. */
+unsigned long long lazyfreeGetSubmittedBytes(void) {
+    return lazyfree_submitted_bytes;
+}
+
+/* Account 'bytes' as going to be freed in background. */
+static void lazyfreeAddPendingBytes(size_t bytes) {
+    atomicIncr(lazyfree_pending_bytes,bytes);
+    lazyfree_submitted_bytes += bytes;
+}
+
+/* Estimate the memory used by the keys of a database, as its share of
+ * keys of the memory used by the dataset. The memory already handed to the
+ * lazyfree threads is not part of the dataset anymore: when FLUSHALL ASYNC
+ * empties the databases one after the other, the ones already emptied have
+ * no keys but still hold their memory, that must not be charged to the
+ * remaining ones. */
+static size_t lazyfreeEstimateDbBytes(redisDb *db) {
+    size_t used = zmalloc_used_memory(), keys = 0;
+    size_t overhead = server.initial_memory_usage+lazyfreeGetPendingBytes();
+    int j;
+
+    if (used <= overhead) return 0;
+    for (j = 0; j < server.dbnum; j++) keys += dbSize(server.db+j);
+    if (keys == 0) return 0;
+    return (size_t)((double)(used-overhead)*dbSize(db)/keys);
+}
+
 /* Return the amount of work needed in order to free an object.
  * The return value is not always the actual number of allocations the
  * object is compoesd of, but a number proportional to it.
@@ -59,11 +117,18 @@ int dbAsyncDelete(redisDb *db, robj *key) {
     /* If the value is composed of a few allocations, to free in a lazy way
      * is actually just slower... So under a certain limit we just free
      * the object synchronously. */
-    dictEntry *de = dictUnlink(db->dict,key->ptr);
+    dict *d = dbKeyDict(db,key->ptr);
+    dictEntry *de = dictUnlink(d,key->ptr);
     if (de) {
         robj *val = dictGetVal(de);
         size_t free_effort = lazyfreeGetFreeEffort(val);
 
+        long long when = dbEntryGetExpire(db,de);
+        if (db->expires_index && when != -1)
+            expireIndexRemove(db,key->ptr,when);
+        keysizesRemove(db,de);
+        keysizesForgetEntry(de);
+        db->size--;
         /* If releasing the object is too much work, do it in the background
          * by adding the object to the lazy free list.
          * Note that if the object is shared, to reclaim it now it is not
@@ -74,16 +139,17 @@ int dbAsyncDelete(redisDb *db, robj *key) {
          * equivalent to just calling decrRefCount(). */
         if (free_effort > LAZYFREE_THRESHOLD && val->refcount == 1) {
             atomicIncr(lazyfree_objects,1);
-            bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
-            dictSetVal(db->dict,de,NULL);
+            lazyfreeAddPendingBytes(objectEstimateSize(val));
+            lazyfree_batch[lazyfree_batch_len++] = val;
+            if (lazyfree_batch_len == LAZYFREE_BATCH_SIZE) lazyfreeFlush();
+            dictSetVal(d,de,NULL);
         }
     }
 
     /* Release the key-val pair, or just the key if we set the val
      * field to NULL in order to lazy free it later. */
     if (de) {
-        dictFreeUnlinkedEntry(db->dict,de);
-        if (server.cluster_enabled) slotToKeyDel(key);
+        dictFreeUnlinkedEntry(d,de);
         return 1;
     } else {
         return 0;
@@ -94,48 +160,255 @@ int dbAsyncDelete(redisDb *db, robj *key) {
  * create a new empty set of hash tables and scheduling the old ones for
  * lazy freeing. */
 void emptyDbAsync(redisDb *db) {
-    dict *oldht1 = db->dict, *oldht2 = db->expires;
-    db->dict = dictCreate(&dbDictType,NULL);
+    dict **olddicts = db->dicts, *oldexpires = db->expires;
+    size_t numkeys = dbSize(db);
+    size_t bytes = lazyfreeEstimateDbBytes(db);
+
+    dbCreateKeyspace(db,db->ndicts);
     db->expires = dictCreate(&keyptrDictType,NULL);
-    atomicIncr(lazyfree_objects,dictSize(oldht1));
-    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,oldht2);
+    atomicIncr(lazyfree_objects,numkeys);
+    lazyfreeAddPendingBytes(bytes);
+    bioCreateLazyFreeJob(lazyfreeFreeDatabaseFromBioThread,olddicts,
+                         oldexpires,(void*)bytes);
+    if (db->expires_index) {
+        bioCreateLazyFreeJob(lazyfreeFreeExpiresIndexFromBioThread,
+                             db->expires_index,NULL,NULL);
+        db->expires_index = raxNew();
+    }
 }
 
-/* Empty the slots-keys map of Redis CLuster by creating a new empty one
- * and scheduiling the old for lazy freeing. */
-void slotToKeyFlushAsync(void) {
-    rax *old = server.cluster->slots_to_keys;
-
-    server.cluster->slots_to_keys = raxNew();
-    memset(server.cluster->slots_keys_count,0,
-           sizeof(server.cluster->slots_keys_count));
-    atomicIncr(lazyfree_objects,old->numele);
-    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,old);
+/* Submit the objects collected by dbAsyncDelete() to the lazyfree threads.
+ * Called when the batch is full and before the event loop sleeps. */
+void lazyfreeFlush(void) {
+    if (lazyfree_batch_len == 0) return;
+    bioCreateLazyFreeJobs(lazyfreeFreeObjectFromBioThread,lazyfree_batch,
+                          lazyfree_batch_len);
+    lazyfree_batch_len = 0;
 }
 
 /* Release objects from the lazyfree thread. It's just decrRefCount()
- * updating the count of objects to release. */
-void lazyfreeFreeObjectFromBioThread(robj *o) {
+ * updating the count of objects and bytes to release. The size estimate
+ * is the same computed when the object was submitted, since nobody else
+ * can touch the object in the meantime. */
+static void lazyfreeFreeObjectFromBioThread(void *o, void *unused1, void *unused2) {
+    size_t bytes = objectEstimateSize(o);
+    UNUSED(unused1);
+    UNUSED(unused2);
+
     decrRefCount(o);
     atomicDecr(lazyfree_objects,1);
+    atomicDecr(lazyfree_pending_bytes,bytes);
+}
+
+/* Release a database from the lazyfree thread. 'dicts' is the NULL
+ * terminated array of dicts of the keyspace, and 'expires' the expires
+ * dict, of the database which was substitutied with a fresh one in the
+ * main thread when the database was logically deleted. 'bytes' is the
+ * estimate of the memory used, accounted as pending by emptyDbAsync().
+ *
+ * The keyspace is released a few chains at a time, and the pending bytes
+ * are decremented by the share of the keys freed so far, so that they
+ * follow the memory actually returned instead of dropping all at once
+ * when the whole database is gone. */
+#define LAZYFREE_DB_RELEASE_STEP 1024 /* Chains freed between two updates. */
+static void lazyfreeFreeDatabaseFromBioThread(void *dicts, void *expires,
+                                              void *bytes)
+{
+    size_t numkeys = 0, pending = (size_t)bytes;
+    dict **d;
+
+    for (d = dicts; *d; d++) numkeys += dictSize(*d);
+    dictRelease(expires);
+    for (d = dicts; *d; d++) {
+        unsigned long cursor = 0;
+        size_t size, freed, charged;
+        int done;
+
+        do {
+            size = dictSize(*d);
+            done = dictReleaseStep(*d,&cursor,LAZYFREE_DB_RELEASE_STEP);
+            freed = done ? size : size-dictSize(*d);
+            if (freed == 0) continue;
+            charged = (size_t)((double)pending*freed/numkeys);
+            pending -= charged;
+            numkeys -= freed;
+            atomicDecr(lazyfree_objects,freed);
+            atomicDecr(lazyfree_pending_bytes,charged);
+        } while(!done);
+    }
+    zfree(dicts);
+    atomicDecr(lazyfree_pending_bytes,pending);
+}
+
+/* Release the expires index of a database from the lazyfree thread. */
+static void lazyfreeFreeExpiresIndexFromBioThread(void *index, void *unused1,
+                                                  void *unused2)
+{
+    UNUSED(unused1);
+    UNUSED(unused2);
+    raxFree(index);
 }
 
-/* Release a database from the lazyfree thread. The 'db' pointer is the
- * database which was substitutied with a fresh one in the main thread
- * when the database was logically deleted. 'sl' is a skiplist used by
- * Redis Cluster in order to take the hash slots -> keys mapping. This
- * may be NULL if Redis Cluster is disabled. */
-void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2) {
-    size_t numkeys = dictSize(ht1);
-    dictRelease(ht1);
-    dictRelease(ht2);
-    atomicDecr(lazyfree_objects,numkeys);
-}
-
-/* Release the skiplist mapping Redis Cluster keys to slots in the
- * lazyfree thread. */
-void lazyfreeFreeSlotsMapFromBioThread(rax *rt) {
-    size_t len = rt->numele;
-    raxFree(rt);
-    atomicDecr(lazyfree_objects,len);
+/* ----------------------------------------------------------------------------
+ * Incremental freeing.
+ *
+ * With lazyfree-incremental enabled, the huge values that would be released
+ * synchronously, because they are deleted with DEL or overwritten, are
+ * unlinked from the keyspace and then released by serverCron() a chunk at
+ * a time, without using threads: the quicklist nodes of lists, the hash
+ * table chains of sets and hashes, and the dict and then the skiplist
+ * nodes of sorted sets. Values being freed are counted in the lazyfree
+ * pending objects and bytes.
+ *
+ * If the cycle of serverCron() can't keep up, beforeSleep() runs fast cycles
+ * as well, and once LAZYFREE_INCREMENTAL_MAX_JOBS values or
+ * LAZYFREE_INCREMENTAL_MAX_BYTES bytes are pending, the writer that deletes
+ * another huge value releases the oldest ones first, so that the backlog
+ * can't grow without bounds.
+ * --------------------------------------------------------------------------*/
+
+#define LAZYFREE_INCREMENTAL_STEP 64 /* Nodes or chains freed per step. */
+
+typedef struct lazyfreeIncrementalJob {
+    robj *o;                /* The value to release. */
+    size_t bytes;           /* Accounted as pending bytes. */
+    unsigned long cursor;   /* Next hash table chain to release. */
+    zskiplistNode *next;    /* Next skiplist node to release. */
+    int stage;              /* Sorted sets: 0 = the dict, 1 = the skiplist. */
+} lazyfreeIncrementalJob;
+
+static list *lazyfree_incremental_jobs = NULL;
+static size_t lazyfree_incremental_bytes = 0; /* Pending in the jobs. */
+
+static int lazyfreeIncrementalStep(lazyfreeIncrementalJob *job);
+
+/* Perform a step of the oldest job, removing it once its object is
+ * released. */
+static void lazyfreeIncrementalStepFirst(void) {
+    listNode *ln = listFirst(lazyfree_incremental_jobs);
+    lazyfreeIncrementalJob *job = listNodeValue(ln);
+
+    if (lazyfreeIncrementalStep(job)) {
+        atomicDecr(lazyfree_objects,1);
+        atomicDecr(lazyfree_pending_bytes,job->bytes);
+        lazyfree_incremental_bytes -= job->bytes;
+        zfree(job);
+        listDelNode(lazyfree_incremental_jobs,ln);
+    }
+}
+
+/* If incremental freeing is enabled and 'o' is big enough, take ownership
+ * of the object and schedule it to be released incrementally, returning 1.
+ * Otherwise 0 is returned and the caller should release it as usual. */
+int lazyfreeIncrementalFree(robj *o) {
+    lazyfreeIncrementalJob *job;
+
+    if (!server.lazyfree_incremental || o->refcount != 1 ||
+        lazyfreeGetFreeEffort(o) <= LAZYFREE_THRESHOLD) return 0;
+
+    if (lazyfree_incremental_jobs == NULL)
+        lazyfree_incremental_jobs = listCreate();
+    /* Back pressure: release the oldest values while too many are pending. */
+    while (listLength(lazyfree_incremental_jobs) >=
+           LAZYFREE_INCREMENTAL_MAX_JOBS ||
+           lazyfree_incremental_bytes >= LAZYFREE_INCREMENTAL_MAX_BYTES)
+        lazyfreeIncrementalStepFirst();
+    job = zmalloc(sizeof(*job));
+    job->o = o;
+    job->bytes = objectEstimateSize(o);
+    job->cursor = 0;
+    job->next = NULL;
+    job->stage = 0;
+    listAddNodeTail(lazyfree_incremental_jobs,job);
+    atomicIncr(lazyfree_objects,1);
+    atomicIncr(lazyfree_pending_bytes,job->bytes);
+    lazyfree_submitted_bytes += job->bytes;
+    lazyfree_incremental_bytes += job->bytes;
+    return 1;
+}
+
+/* Release a chunk of the object of the job. Returns 1 once the object,
+ * including the robj itself, was completely released. */
+static int lazyfreeIncrementalStep(lazyfreeIncrementalJob *job) {
+    robj *o = job->o;
+    int j;
+
+    if (o->type == OBJ_LIST) {
+        quicklist *ql = o->ptr;
+        for (j = 0; j < LAZYFREE_INCREMENTAL_STEP && ql->head; j++) {
+            quicklistNode *node = ql->head;
+            ql->head = node->next;
+            zfree(node->zl);
+            zfree(node);
+            ql->len--;
+        }
+        if (ql->head) return 0;
+        zfree(ql);
+    } else if (o->type == OBJ_SET || o->type == OBJ_HASH) {
+        if (!dictReleaseStep(o->ptr,&job->cursor,LAZYFREE_INCREMENTAL_STEP))
+            return 0;
+    } else if (o->type == OBJ_ZSET) {
+        zset *zs = o->ptr;
+        /* The dict shares the elements with the skiplist, so it is released
+         * first, then the skiplist nodes free the elements. */
+        if (job->stage == 0) {
+            if (!dictReleaseStep(zs->dict,&job->cursor,
+                                 LAZYFREE_INCREMENTAL_STEP)) return 0;
+            job->next = zs->zsl->header->level[0].forward;
+            job->stage = 1;
+        }
+        for (j = 0; j < LAZYFREE_INCREMENTAL_STEP && job->next; j++) {
+            zskiplistNode *next = job->next->level[0].forward;
+            zslFreeNode(job->next);
+            job->next = next;
+        }
+        if (job->next) return 0;
+        zfree(zs->zsl->header);
+        zfree(zs->zsl);
+        zfree(zs);
+    } else {
+        serverPanic("Unexpected type for incremental freeing");
+    }
+    zfree(o);
+    return 1;
+}
+
+/* Release the values scheduled by lazyfreeIncrementalFree().
+ *
+ * If type is LAZYFREE_INCREMENTAL_CYCLE_SLOW, called by serverCron(), at
+ * most LAZYFREE_INCREMENTAL_CYCLE_PERC percent of the time between two
+ * calls is used.
+ *
+ * If type is LAZYFREE_INCREMENTAL_CYCLE_FAST, called by beforeSleep(), the
+ * cycle only runs if the previous one exited for the time limit, it takes
+ * no longer than LAZYFREE_INCREMENTAL_FAST_DURATION microseconds, and it is
+ * not repeated again before the same amount of time, like the fast cycles
+ * of activeExpireCycle(). */
+void lazyfreeIncrementalCycle(int type) {
+    static int timelimit_exit = 0;
+    static long long last_fast_cycle = 0;
+    long long start, timelimit;
+
+    if (lazyfree_incremental_jobs == NULL ||
+        listLength(lazyfree_incremental_jobs) == 0) return;
+
+    start = ustime();
+    if (type == LAZYFREE_INCREMENTAL_CYCLE_FAST) {
+        if (!timelimit_exit) return;
+        if (start < last_fast_cycle+LAZYFREE_INCREMENTAL_FAST_DURATION*2)
+            return;
+        last_fast_cycle = start;
+        timelimit = LAZYFREE_INCREMENTAL_FAST_DURATION;
+    } else {
+        timelimit = LAZYFREE_INCREMENTAL_CYCLE_PERC*1000000/server.hz/100;
+        if (timelimit <= 0) timelimit = 1;
+    }
+    timelimit_exit = 0;
+    while (listLength(lazyfree_incremental_jobs)) {
+        lazyfreeIncrementalStepFirst();
+        if (ustime()-start > timelimit) {
+            timelimit_exit = 1;
+            break;
+        }
+    }
 }
@@ -1146,7 +1146,12 @@ int RM_ReplyWithStringBuffer(RedisModuleCtx *ctx, const char *buf, size_t len) {
 int RM_ReplyWithString(RedisModuleCtx *ctx, RedisModuleString *str) {
     client *c = moduleGetReplyClient(ctx);
     if (c == NULL) return REDISMODULE_OK;
-    addReplyBulk(c,str);
+    /* Module strings may be modified in place once the reply is emitted
+     * (see RM_StringAppendBuffer()): never send them by reference. */
+    if (sdsEncodedObject(str))
+        addReplyBulkCBuffer(c,str->ptr,sdslen(str->ptr));
+    else
+        addReplyBulk(c,str);
     return REDISMODULE_OK;
 }
 
@@ -2682,14 +2687,7 @@ RedisModuleCallReply *RM_Call(RedisModuleCtx *ctx, const char *cmdname, const ch
     /* Convert the result of the Redis command into a suitable Lua type.
      * The first thing we need is to create a single string from the client
      * output buffers. */
-    sds proto = sdsnewlen(c->buf,c->bufpos);
-    c->bufpos = 0;
-    while(listLength(c->reply)) {
-        sds o = listNodeValue(listFirst(c->reply));
-
-        proto = sdscatsds(proto,o);
-        listDelNode(c->reply,listFirst(c->reply));
-    }
+    sds proto = catClientOutputBuffer(sdsempty(),c);
     reply = moduleCreateCallReplyFromProto(ctx,proto);
     autoMemoryAdd(ctx,REDISMODULE_AM_REPLY,reply);
 
@@ -28,12 +28,35 @@
  */
 
 #include "server.h"
+#include "respscan.h"
 #include "atomicvar.h"
 #include <sys/uio.h>
 #include <math.h>
 #include <ctype.h>
 
-static void setProtocolError(const char *errstr, client *c, long pos);
+static void setProtocolError(const char *errstr, client *c);
+static void freeClientFromIOContext(client *c);
+static int postponeClientRead(client *c);
+static void installClientWriteEvent(client *c);
+static void releaseReplyObject(robj *o);
+
+/* Max number of iovecs gathered by a single writev(2) call. */
+#ifdef IOV_MAX
+#define NET_MAX_WRITEV_IOV IOV_MAX
+#else
+#define NET_MAX_WRITEV_IOV 1024
+#endif
+
+/* Operation the I/O threads are currently performing. Only written by the
+ * main thread while the threads are not processing clients. */
+#define IO_THREADS_OP_IDLE 0
+#define IO_THREADS_OP_READ 1
+#define IO_THREADS_OP_WRITE 2
+static int io_threads_op = IO_THREADS_OP_IDLE;
+
+/* True while processEventsWhileBlocked() is running: reads can't be
+ * postponed since beforeSleep() is not going to be called. */
+static int processing_events_while_blocked = 0;
 
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
@@ -54,13 +77,45 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
     }
 }
 
-/* Client.reply list dup and free methods. */
+/* Create a reply list block owning the sds string 's'. */
+static clientReplyBlock *createReplyBlock(sds s) {
+    clientReplyBlock *b = zmalloc(sizeof(*b));
+    b->buf = s;
+    b->obj = NULL;
+    return b;
+}
+
+/* Create a reply list block referencing the string object 'o'. */
+static clientReplyBlock *createReplyBlockWithObject(robj *o) {
+    clientReplyBlock *b = zmalloc(sizeof(*b));
+    b->buf = NULL;
+    b->obj = o;
+    incrRefCount(o);
+    return b;
+}
+
+/* Return the protocol stored or referenced by the block. */
+static inline sds replyBlockData(clientReplyBlock *b) {
+    return b->obj ? b->obj->ptr : b->buf;
+}
+
+/* Client.reply list dup and free methods. Note that the value can be NULL
+ * when it is a placeholder created by addDeferredMultiBulkLength(). */
 void *dupClientReplyValue(void *o) {
-    return sdsdup(o);
+    clientReplyBlock *b = o;
+    if (b == NULL) return NULL;
+    return b->obj ? createReplyBlockWithObject(b->obj) :
+                    createReplyBlock(sdsdup(b->buf));
 }
 
 void freeClientReplyValue(void *o) {
-    sdsfree(o);
+    clientReplyBlock *b = o;
+    if (b == NULL) return;
+    if (b->obj)
+        releaseReplyObject(b->obj);
+    else
+        sdsfree(b->buf);
+    zfree(b);
 }
 
 int listMatchObjects(void *a, void *b) {
@@ -96,11 +151,16 @@ client *createClient(int fd) {
     c->name = NULL;
     c->bufpos = 0;
     c->querybuf = sdsempty();
+    c->qb_pos = 0;
     c->pending_querybuf = sdsempty();
     c->querybuf_peak = 0;
     c->reqtype = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->argv_len = 0;
+    c->argv_pool = NULL;
+    c->argv_created = 0;
+    c->argv_reused = 0;
     c->cmd = c->lastcmd = NULL;
     c->multibulklen = 0;
     c->bulklen = -1;
@@ -120,6 +180,9 @@ client *createClient(int fd) {
     c->reply = listCreate();
     c->reply_bytes = 0;
     c->obuf_soft_limit_reached_time = 0;
+    c->flush_deferred_since = 0;
+    c->commands = 0;
+    c->writes = 0;
     listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
     c->btype = BLOCKED_NONE;
@@ -178,26 +241,36 @@ int prepareClientToWrite(client *c) {
     if (c->fd <= 0) return C_ERR; /* Fake client for AOF loading. */
 
     /* Schedule the client to write the output buffers to the socket only
-     * if not already done (there were no pending writes already and the client
-     * was yet not flagged), and, for slaves, if the slave can actually
-     * receive writes at this stage. */
-    if (!clientHasPendingReplies(c) &&
-        !(c->flags & CLIENT_PENDING_WRITE) &&
+     * if not already done (there were no pending writes already).
+     *
+     * Clients flagged with CLIENT_PENDING_READ are being served by an
+     * I/O thread that can't touch the global list: the main thread will
+     * schedule them once the thread is done with them. */
+    if (!clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_READ))
+        clientInstallWriteHandler(c);
+
+    /* Authorize the caller to queue in the output buffer of this client. */
+    return C_OK;
+}
+
+/* Put the client in the list of clients that have something to write to
+ * the socket, if not already done (the client was yet not flagged), and,
+ * for slaves, if the slave can actually receive writes at this stage.
+ *
+ * Here instead of installing the write handler, we just flag the client
+ * and put it into a list of clients that have something to write to the
+ * socket. This way before re-entering the event loop, we can try to
+ * directly write to the client sockets avoiding a system call. We'll only
+ * really install the write handler if we'll not be able to write the whole
+ * reply at once. */
+void clientInstallWriteHandler(client *c) {
+    if (!(c->flags & CLIENT_PENDING_WRITE) &&
         (c->replstate == REPL_STATE_NONE ||
          (c->replstate == SLAVE_STATE_ONLINE && !c->repl_put_online_on_ack)))
     {
-        /* Here instead of installing the write handler, we just flag the
-         * client and put it into a list of clients that have something
-         * to write to the socket. This way before re-entering the event
-         * loop, we can try to directly write to the client sockets avoiding
-         * a system call. We'll only really install the write handler if
-         * we'll not be able to write the whole reply at once. */
         c->flags |= CLIENT_PENDING_WRITE;
         listAddNodeHead(server.clients_pending_write,c);
     }
-
-    /* Authorize the caller to queue in the output buffer of this client. */
-    return C_OK;
 }
 
 /* -----------------------------------------------------------------------------
@@ -221,85 +294,80 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
     return C_OK;
 }
 
+/* Return the block at the tail of the reply list if 'len' more bytes of
+ * protocol can be appended to it, otherwise NULL is returned: the list is
+ * empty, the tail is the placeholder set via addDeferredMultiBulkLength(),
+ * references an object, or would grow over PROTO_REPLY_CHUNK_BYTES. */
+static clientReplyBlock *_getAppendableReplyBlock(client *c, size_t len) {
+    clientReplyBlock *tail;
+
+    if (listLength(c->reply) == 0) return NULL;
+    tail = listNodeValue(listLast(c->reply));
+    if (tail == NULL || tail->obj) return NULL;
+    if (sdslen(tail->buf)+len > PROTO_REPLY_CHUNK_BYTES) return NULL;
+    return tail;
+}
+
 void _addReplyObjectToList(client *c, robj *o) {
+    clientReplyBlock *tail;
+
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
-        sds s = sdsdup(o->ptr);
-        listAddNodeTail(c->reply,s);
-        c->reply_bytes += sdslen(s);
-    } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(o->ptr) <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatsds(tail,o->ptr);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(o->ptr);
-        } else {
-            sds s = sdsdup(o->ptr);
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
-    }
+    /* Append to the tail block when possible. */
+    tail = _getAppendableReplyBlock(c,sdslen(o->ptr));
+    if (tail)
+        tail->buf = sdscatsds(tail->buf,o->ptr);
+    else
+        listAddNodeTail(c->reply,createReplyBlock(sdsdup(o->ptr)));
+    c->reply_bytes += sdslen(o->ptr);
+    asyncCloseClientOnOutputBufferLimitReached(c);
+}
+
+/* Queue a reference to the RAW encoded string object 'o' instead of copying
+ * its content: the object is sent as it is, and released once written. */
+void _addReplyObjectRefToList(client *c, robj *o) {
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+
+    listAddNodeTail(c->reply,createReplyBlockWithObject(o));
+    c->reply_bytes += sdslen(o->ptr);
+    server.stat_zero_copy_reply_bytes += sdslen(o->ptr);
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
 /* This method takes responsibility over the sds. When it is no longer
- * needed it will be free'd, otherwise it ends up in a robj. */
+ * needed it will be free'd, otherwise it ends up in a reply block. */
 void _addReplySdsToList(client *c, sds s) {
+    clientReplyBlock *tail;
+
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
         sdsfree(s);
         return;
     }
 
-    if (listLength(c->reply) == 0) {
-        listAddNodeTail(c->reply,s);
-        c->reply_bytes += sdslen(s);
+    /* Append to the tail block when possible. */
+    c->reply_bytes += sdslen(s);
+    tail = _getAppendableReplyBlock(c,sdslen(s));
+    if (tail) {
+        tail->buf = sdscatsds(tail->buf,s);
+        sdsfree(s);
     } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(s) <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatsds(tail,s);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(s);
-            sdsfree(s);
-        } else {
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
+        listAddNodeTail(c->reply,createReplyBlock(s));
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
 void _addReplyStringToList(client *c, const char *s, size_t len) {
+    clientReplyBlock *tail;
+
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
-        sds node = sdsnewlen(s,len);
-        listAddNodeTail(c->reply,node);
-        c->reply_bytes += len;
-    } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+len <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatlen(tail,s,len);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += len;
-        } else {
-            sds node = sdsnewlen(s,len);
-            listAddNodeTail(c->reply,node);
-            c->reply_bytes += len;
-        }
-    }
+    /* Append to the tail block when possible. */
+    tail = _getAppendableReplyBlock(c,len);
+    if (tail)
+        tail->buf = sdscatlen(tail->buf,s,len);
+    else
+        listAddNodeTail(c->reply,createReplyBlock(sdsnewlen(s,len)));
+    c->reply_bytes += len;
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
@@ -308,6 +376,19 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
  * The following functions are the ones that commands implementations will call.
  * -------------------------------------------------------------------------- */
 
+/* Return true if the string object 'obj' should be added to the reply
+ * list of 'c' by reference instead of copying it, that is, when it is
+ * RAW encoded and at least zero-copy-reply-threshold bytes. Since taking a
+ * reference touches the object, it's not done while there is a child
+ * saving the dataset, in order to avoid copy-on-write of its page. */
+static int _replyObjectByReference(client *c, robj *obj) {
+    if (server.zero_copy_reply_threshold == 0 ||
+        obj->encoding != OBJ_ENCODING_RAW ||
+        sdslen(obj->ptr) < server.zero_copy_reply_threshold) return 0;
+    if (server.rdb_child_pid != -1 || server.aof_child_pid != -1) return 0;
+    return !(c->flags & CLIENT_CLOSE_AFTER_REPLY);
+}
+
 void addReply(client *c, robj *obj) {
     if (prepareClientToWrite(c) != C_OK) return;
 
@@ -317,9 +398,14 @@ void addReply(client *c, robj *obj) {
      *
      * If the encoding is RAW and there is room in the static buffer
      * we'll be able to send the object to the client without
-     * messing with its page. */
+     * messing with its page.
+     *
+     * Otherwise large RAW strings are not copied at all: the reply list
+     * just takes a reference to the object. */
     if (sdsEncodedObject(obj)) {
-        if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
+        if (_replyObjectByReference(c,obj))
+            _addReplyObjectRefToList(c,obj);
+        else if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
             _addReplyObjectToList(c,obj);
     } else if (obj->encoding == OBJ_ENCODING_INT) {
         /* Optimization: if there is room in the static buffer for 32 bytes
@@ -437,26 +523,28 @@ void *addDeferredMultiBulkLength(client *c) {
 /* Populate the length object and try gluing it to the next chunk. */
 void setDeferredMultiBulkLength(client *c, void *node, long length) {
     listNode *ln = (listNode*)node;
-    sds len, next;
+    clientReplyBlock *next;
+    sds len;
 
     /* Abort when *node is NULL: when the client should not accept writes
      * we return NULL in addDeferredMultiBulkLength() */
     if (node == NULL) return;
 
     len = sdscatprintf(sdsnewlen("*",1),"%ld\r\n",length);
-    listNodeValue(ln) = len;
     c->reply_bytes += sdslen(len);
-    if (ln->next != NULL) {
-        next = listNodeValue(ln->next);
-
-        /* Only glue when the next node is non-NULL (an sds in this case) */
-        if (next != NULL) {
-            len = sdscatsds(len,next);
-            listDelNode(c->reply,ln->next);
-            listNodeValue(ln) = len;
-            /* No need to update c->reply_bytes: we are just moving the same
-             * amount of bytes from one node to another. */
-        }
+    next = ln->next ? listNodeValue(ln->next) : NULL;
+
+    /* Only glue when the next node is a block holding protocol (and not
+     * a placeholder or a referenced object). No need to update
+     * c->reply_bytes: we are just moving the same amount of bytes from one
+     * node to another. */
+    if (next != NULL && next->buf != NULL) {
+        len = sdscatsds(len,next->buf);
+        sdsfree(next->buf);
+        next->buf = len;
+        listDelNode(c->reply,ln);
+    } else {
+        listNodeValue(ln) = createReplyBlock(len);
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
@@ -551,6 +639,24 @@ void addReplyBulkLen(client *c, robj *obj) {
         addReplyLongLongWithPrefix(c,len,'$');
 }
 
+/* Add the protocol contained in the RAW encoded string object 'proto' to
+ * the client reply. This is used when the same reply is sent to many
+ * clients, like a message published to many subscribers: the protocol is
+ * serialized once, and unless it is small every client output buffer
+ * just references the object instead of getting a copy. The object is
+ * not part of the dataset, so unlike addReply() the reference is taken
+ * even while there is a child saving. Like for addReply(), setting
+ * zero-copy-reply-threshold to 0 disables the references. */
+void addReplySharedProto(client *c, robj *proto) {
+    if (prepareClientToWrite(c) != C_OK) return;
+
+    if (server.zero_copy_reply_threshold != 0 &&
+        sdslen(proto->ptr) >= PROTO_SHARED_REPLY_MIN_LEN)
+        _addReplyObjectRefToList(c,proto);
+    else if (_addReplyToBuffer(c,proto->ptr,sdslen(proto->ptr)) != C_OK)
+        _addReplyObjectToList(c,proto);
+}
+
 /* Add a Redis Object as a bulk reply */
 void addReplyBulk(client *c, robj *obj) {
     addReplyBulkLen(c,obj);
@@ -607,6 +713,46 @@ int clientHasPendingReplies(client *c) {
     return c->bufpos || listLength(c->reply);
 }
 
+/* Append the whole content of the output buffers of 'c' to the sds 's',
+ * emptying them. Used when the reply of a fake client needs to be
+ * processed as a single string. The new string is returned. */
+sds catClientOutputBuffer(sds s, client *c) {
+    s = sdscatlen(s,c->buf,c->bufpos);
+    c->bufpos = 0;
+    while(listLength(c->reply)) {
+        clientReplyBlock *b = listNodeValue(listFirst(c->reply));
+
+        if (b) s = sdscatsds(s,replyBlockData(b));
+        listDelNode(c->reply,listFirst(c->reply));
+    }
+    c->reply_bytes = 0;
+    return s;
+}
+
+/* Replace every reference to a string object held by the output buffers
+ * of the clients with a private copy of its content. This is needed before
+ * handing the objects of the keyspace to the lazyfree thread, that would
+ * otherwise race with the main thread when releasing the references. */
+void copyClientsReplyObjects(void) {
+    listIter li, bi;
+    listNode *ln, *bn;
+
+    listRewind(server.clients,&li);
+    while((ln = listNext(&li)) != NULL) {
+        client *c = listNodeValue(ln);
+
+        listRewind(c->reply,&bi);
+        while((bn = listNext(&bi)) != NULL) {
+            clientReplyBlock *b = listNodeValue(bn);
+
+            if (b == NULL || b->obj == NULL) continue;
+            b->buf = sdsdup(b->obj->ptr);
+            decrRefCount(b->obj);
+            b->obj = NULL;
+        }
+    }
+}
+
 #define MAX_ACCEPTS_PER_CALL 1000
 static void acceptCommonHandler(int fd, int flags, char *ip) {
     client *c;
@@ -678,20 +824,40 @@ static void acceptCommonHandler(int fd, int flags, char *ip) {
     c->flags |= flags;
 }
 
+/* Every call of an accept handler, that is, every listening socket in
+ * every event loop iteration, may spend up to server.accept_time_budget
+ * microseconds accepting connections. Then the handler stops, and since
+ * the listening socket is still readable it will resume in the next
+ * iteration, after the already connected clients had the chance to be
+ * served. The budget is not shared, so that one listener can't starve the
+ * others, and it needs no reset, so that it works as well when the events
+ * are processed by processEventsWhileBlocked().
+ *
+ * Returns non zero if the budget of the call started at 'start' is
+ * exhausted. */
+static int acceptTimeBudgetReached(long long start) {
+    if (server.accept_time_budget == 0) return 0;
+    if (ustime()-start < server.accept_time_budget) return 0;
+    server.stat_accept_time_budget_reached++;
+    return 1;
+}
+
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     int cport, cfd, max = MAX_ACCEPTS_PER_CALL;
+    long long start = ustime();
     char cip[NET_IP_STR_LEN];
     UNUSED(el);
     UNUSED(mask);
     UNUSED(privdata);
 
     while(max--) {
+        if (acceptTimeBudgetReached(start)) break;
         cfd = anetTcpAccept(server.neterr, fd, cip, sizeof(cip), &cport);
         if (cfd == ANET_ERR) {
             if (errno != EWOULDBLOCK)
                 serverLog(LL_WARNING,
                     "Accepting client connection: %s", server.neterr);
-            return;
+            break;
         }
         serverLog(LL_VERBOSE,"Accepted %s:%d", cip, cport);
         acceptCommonHandler(cfd,0,cip);
@@ -700,27 +866,112 @@ void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     int cfd, max = MAX_ACCEPTS_PER_CALL;
+    long long start = ustime();
     UNUSED(el);
     UNUSED(mask);
     UNUSED(privdata);
 
     while(max--) {
+        if (acceptTimeBudgetReached(start)) break;
         cfd = anetUnixAccept(server.neterr, fd);
         if (cfd == ANET_ERR) {
             if (errno != EWOULDBLOCK)
                 serverLog(LL_WARNING,
                     "Accepting client connection: %s", server.neterr);
-            return;
+            break;
         }
         serverLog(LL_VERBOSE,"Accepted connection to %s", server.unixsocket);
         acceptCommonHandler(cfd,CLIENT_UNIX_SOCKET,NULL);
     }
 }
 
+/* Create the string object for an argument of 'len' bytes parsed from
+ * the query buffer. Small arguments are EMBSTR encoded objects, like the
+ * ones createStringObject() returns, but their memory is taken from the
+ * client argv pool when possible. */
+static robj *createClientArgvObject(client *c, const char *ptr, size_t len) {
+    size_t size;
+    int class;
+    robj *o;
+
+    if (len > OBJ_ENCODING_EMBSTR_SIZE_LIMIT) {
+        c->argv_created++;
+        return createRawStringObject(ptr,len);
+    }
+
+    /* Round the allocation to the pool class size, so that the object can
+     * be reused for any argument of the same class later. */
+    size = sizeof(robj)+sizeof(struct sdshdr8)+len+1;
+    size = (size+CLIENT_ARGV_POOL_STEP-1) & ~(CLIENT_ARGV_POOL_STEP-1);
+    class = size/CLIENT_ARGV_POOL_STEP-CLIENT_ARGV_POOL_MIN;
+    if (class < 0) class = 0;
+    if (c->argv_pool && c->argv_pool->count[class]) {
+        o = c->argv_pool->objs[class][--c->argv_pool->count[class]];
+        c->argv_reused++;
+    } else {
+        o = zmalloc(size);
+        c->argv_created++;
+    }
+    return initEmbeddedStringObject(o,ptr,len);
+}
+
+/* Release an argument object of the client. If this is the last reference
+ * and the object is an EMBSTR string, its memory is kept in the client
+ * argv pool instead of being freed. Objects that commands retained, like
+ * values stored in the keyspace, have other references and are simply
+ * released as usual. */
+static void releaseClientArgvObject(client *c, robj *o) {
+    size_t usable;
+    int class;
+
+    if (o->refcount != 1 || o->type != OBJ_STRING ||
+        o->encoding != OBJ_ENCODING_EMBSTR)
+    {
+        decrRefCount(o);
+        return;
+    }
+
+    usable = zmalloc_usable(o);
+    class = usable/CLIENT_ARGV_POOL_STEP-CLIENT_ARGV_POOL_MIN;
+    if (class >= CLIENT_ARGV_POOL_CLASSES) class = CLIENT_ARGV_POOL_CLASSES-1;
+    if (class < 0) {
+        decrRefCount(o);
+        return;
+    }
+    if (c->argv_pool == NULL) c->argv_pool = zcalloc(sizeof(clientArgvPool));
+    if (c->argv_pool->count[class] == CLIENT_ARGV_POOL_DEPTH) {
+        decrRefCount(o);
+        return;
+    }
+    c->argv_pool->objs[class][c->argv_pool->count[class]++] = o;
+}
+
+/* Free the objects kept in the client argv pool, and the pool itself. */
+void freeClientArgvPool(client *c) {
+    int class, j;
+
+    if (c->argv_pool == NULL) return;
+    for (class = 0; class < CLIENT_ARGV_POOL_CLASSES; class++) {
+        for (j = 0; j < c->argv_pool->count[class]; j++)
+            zfree(c->argv_pool->objs[class][j]);
+    }
+    zfree(c->argv_pool);
+    c->argv_pool = NULL;
+}
+
+/* Make sure the client argv array can hold 'argc' arguments. The array is
+ * reused across commands, and is only reallocated when it is too small. */
+static void ensureClientArgvLen(client *c, int argc) {
+    if (c->argv && c->argv_len >= argc) return;
+    zfree(c->argv);
+    c->argv = zmalloc(sizeof(robj*)*argc);
+    c->argv_len = argc;
+}
+
 static void freeClientArgv(client *c) {
     int j;
     for (j = 0; j < c->argc; j++)
-        decrRefCount(c->argv[j]);
+        releaseClientArgvObject(c,c->argv[j]);
     c->argc = 0;
     c->cmd = NULL;
 }
@@ -768,6 +1019,14 @@ void unlinkClient(client *c) {
         c->flags &= ~CLIENT_PENDING_WRITE;
     }
 
+    /* Remove from the list of pending reads if needed. */
+    if (c->flags & CLIENT_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+    }
+
     /* When client was just unblocked because of a blocking operation,
      * remove it from the list of unblocked clients. */
     if (c->flags & CLIENT_UNBLOCKED) {
@@ -867,6 +1126,7 @@ void freeClient(client *c) {
      * and finally release the client structure itself. */
     if (c->name) decrRefCount(c->name);
     zfree(c->argv);
+    freeClientArgvPool(c);
     freeClientMultiState(c);
     sdsfree(c->peerid);
     zfree(c);
@@ -877,9 +1137,19 @@ void freeClient(client *c) {
  * a context where calling freeClient() is not possible, because the client
  * should be valid for the continuation of the flow of the program. */
 void freeClientAsync(client *c) {
+    /* The I/O threads may schedule clients for closing concurrently, so
+     * when threads are enabled the queue is protected by a mutex. */
+    static pthread_mutex_t async_free_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
     if (c->flags & CLIENT_CLOSE_ASAP || c->flags & CLIENT_LUA) return;
     c->flags |= CLIENT_CLOSE_ASAP;
+    if (server.io_threads_num == 1) {
+        listAddNodeTail(server.clients_to_close,c);
+        return;
+    }
+    pthread_mutex_lock(&async_free_queue_mutex);
     listAddNodeTail(server.clients_to_close,c);
+    pthread_mutex_unlock(&async_free_queue_mutex);
 }
 
 void freeClientsInAsyncFreeQueue(void) {
@@ -893,51 +1163,116 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
+/* Free the client 'c' from a context where it may be served by an I/O
+ * thread: in that case only the main thread can release the client, so
+ * it is scheduled for asynchronous freeing instead. */
+static void freeClientFromIOContext(client *c) {
+    if (io_threads_op != IO_THREADS_OP_IDLE)
+        freeClientAsync(c);
+    else
+        freeClient(c);
+}
+
+/* Send the pending output of the client with a single writev(2) call
+ * gathering the static buffer and as many reply list nodes as possible, up
+ * to IOV_MAX iovecs and, when 'maxbytes' is not zero, up to 'maxbytes'
+ * bytes (the last node may exceed the limit). The sent bytes are then
+ * consumed from the static buffer and the list, taking care of partial
+ * writes of the last iovec touched by the call.
+ *
+ * Returns the return value of writev(2). */
+static ssize_t _writevToClient(int fd, client *c, size_t maxbytes) {
+    struct iovec iov[NET_MAX_WRITEV_IOV];
+    int iovcnt = 0, nodes = 0, more;
+    size_t iovbytes = 0, sentlen = c->sentlen;
+    ssize_t nwritten, remaining;
+    listIter li;
+    listNode *ln;
+
+    /* Drop the empty objects on head, so that an empty batch means that
+     * there is nothing left to write. */
+    while(c->bufpos == 0 && listLength(c->reply) &&
+          sdslen(replyBlockData(listNodeValue(listFirst(c->reply)))) == 0)
+    {
+        listDelNode(c->reply,listFirst(c->reply));
+    }
+
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf+sentlen;
+        iov[iovcnt].iov_len = c->bufpos-sentlen;
+        iovbytes += iov[iovcnt].iov_len;
+        iovcnt++;
+        sentlen = 0; /* The list offset is zero if the buffer is pending. */
+    }
+    listRewind(c->reply,&li);
+    while((ln = listNext(&li)) && iovcnt < NET_MAX_WRITEV_IOV) {
+        sds o = replyBlockData(listNodeValue(ln));
+        size_t objlen = sdslen(o);
+
+        if (maxbytes && iovbytes >= maxbytes) break;
+        nodes++;
+        if (objlen == 0) continue; /* Consumed below with the others. */
+        iov[iovcnt].iov_base = o+sentlen;
+        iov[iovcnt].iov_len = objlen-sentlen;
+        iovbytes += iov[iovcnt].iov_len;
+        iovcnt++;
+        sentlen = 0;
+    }
+
+    if (iovcnt == 0) return 0;
+    /* When the batch was cut by the iovec limit the caller writes the rest
+     * right away: let the kernel merge the tail of this write with it. */
+    more = ln != NULL && !(maxbytes && iovbytes >= maxbytes) &&
+           !(c->flags & CLIENT_UNIX_SOCKET);
+    nwritten = anetWritev(fd,iov,iovcnt,more);
+    if (nwritten <= 0) return nwritten;
+    atomicIncr(server.stat_net_output_syscalls,1);
+    c->writes++;
+
+    /* Consume the bytes that were sent. */
+    remaining = nwritten;
+    if (c->bufpos > 0) {
+        size_t avail = c->bufpos-c->sentlen;
+
+        if ((size_t)remaining < avail) {
+            c->sentlen += remaining;
+            return nwritten;
+        }
+        remaining -= avail;
+        /* If the buffer was sent, set bufpos to zero to continue with
+         * the remainder of the reply. */
+        c->bufpos = 0;
+        c->sentlen = 0;
+    }
+    while(nodes--) {
+        sds o = replyBlockData(listNodeValue(listFirst(c->reply)));
+        size_t objlen = sdslen(o);
+        size_t avail = objlen-c->sentlen;
+
+        if ((size_t)remaining < avail) {
+            c->sentlen += remaining;
+            break;
+        }
+        /* If we fully sent the object on head go to the next one */
+        remaining -= avail;
+        listDelNode(c->reply,listFirst(c->reply));
+        c->sentlen = 0;
+        c->reply_bytes -= objlen;
+        /* If there are no longer objects in the list, we expect
+         * the count of reply bytes to be exactly zero. */
+        if (listLength(c->reply) == 0)
+            serverAssert(c->reply_bytes == 0);
+    }
+    return nwritten;
+}
+
 /* Write data in output buffers to client. Return C_OK if the client
- * is still valid after the call, C_ERR if it was freed. */
+ * is still valid after the call, C_ERR if it was freed (or, when called
+ * by an I/O thread, scheduled to be freed). */
 int writeToClient(int fd, client *c, int handler_installed) {
     ssize_t nwritten = 0, totwritten = 0;
-    size_t objlen;
-    sds o;
 
     while(clientHasPendingReplies(c)) {
-        if (c->bufpos > 0) {
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            if ((int)c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
-            }
-        } else {
-            o = listNodeValue(listFirst(c->reply));
-            objlen = sdslen(o);
-
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                continue;
-            }
-
-            nwritten = write(fd, o + c->sentlen, objlen - c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objlen;
-                /* If there are no longer objects in the list, we expect
-                 * the count of reply bytes to be exactly zero. */
-                if (listLength(c->reply) == 0)
-                    serverAssert(c->reply_bytes == 0);
-            }
-        }
         /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
          * other clients as well, even if a very large request comes from
@@ -950,19 +1285,24 @@ int writeToClient(int fd, client *c, int handler_installed) {
          * Moreover, we also send as much as possible if the client is
          * a slave (otherwise, on high-speed traffic, the replication
          * buffer will grow indefinitely) */
-        if (totwritten > NET_MAX_WRITES_PER_EVENT &&
-            (server.maxmemory == 0 ||
-             zmalloc_used_memory() < server.maxmemory) &&
-            !(c->flags & CLIENT_SLAVE)) break;
+        int limited = (server.maxmemory == 0 ||
+                       zmalloc_used_memory() < server.maxmemory) &&
+                      !(c->flags & CLIENT_SLAVE);
+
+        nwritten = _writevToClient(fd,c,
+            limited ? NET_MAX_WRITES_PER_EVENT-totwritten : 0);
+        if (nwritten <= 0) break;
+        totwritten += nwritten;
+        if (limited && totwritten >= NET_MAX_WRITES_PER_EVENT) break;
     }
-    server.stat_net_output_bytes += totwritten;
+    atomicIncr(server.stat_net_output_bytes,totwritten);
     if (nwritten == -1) {
         if (errno == EAGAIN) {
             nwritten = 0;
         } else {
             serverLog(LL_VERBOSE,
                 "Error writing to client: %s", strerror(errno));
-            freeClient(c);
+            freeClientFromIOContext(c);
             return C_ERR;
         }
     }
@@ -979,7 +1319,7 @@ int writeToClient(int fd, client *c, int handler_installed) {
 
         /* Close connection after entire reply has been sent. */
         if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-            freeClient(c);
+            freeClientFromIOContext(c);
             return C_ERR;
         }
     }
@@ -993,6 +1333,35 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     writeToClient(fd,privdata,1);
 }
 
+/* Return true if the replies of the client can be flushed in the next event
+ * loop iteration, together with the replies of the commands that are still
+ * on their way: this happens when the last read filled the read buffer and
+ * the query buffer ends with an incomplete command, so that the client is
+ * certainly still sending the pipeline. No syscall is needed to check it.
+ * While flushes are deferred the event loop does not block, see
+ * beforeSleep(), so they are never deferred by more than
+ * 'reply-flush-budget' microseconds. Nothing is deferred either when the
+ * pending replies are already big enough to fill a few segments. */
+static int clientCanDeferFlush(client *c) {
+    if (server.reply_flush_budget == 0 ||
+        processing_events_while_blocked ||
+        !(c->flags & CLIENT_MORE_INPUT) ||
+        sdslen(c->querybuf) == c->qb_pos ||
+        c->flags & (CLIENT_SLAVE|CLIENT_MASTER|CLIENT_CLOSE_AFTER_REPLY) ||
+        c->bufpos+c->reply_bytes >= NET_MAX_WRITES_PER_EVENT) goto flush;
+    if (c->flush_deferred_since == 0) {
+        c->flush_deferred_since = ustime();
+    } else if (ustime()-c->flush_deferred_since >= server.reply_flush_budget) {
+        goto flush;
+    }
+    server.stat_reply_flushes_deferred++;
+    return 1;
+
+flush:
+    c->flush_deferred_since = 0;
+    return 0;
+}
+
 /* This function is called just before entering the event loop, in the hope
  * we can just write the replies to the client output buffer without any
  * need to use a syscall in order to install the writable event handler,
@@ -1005,6 +1374,7 @@ int handleClientsWithPendingWrites(void) {
     listRewind(server.clients_pending_write,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
+        if (clientCanDeferFlush(c)) continue;
         c->flags &= ~CLIENT_PENDING_WRITE;
         listDelNode(server.clients_pending_write,ln);
 
@@ -1013,28 +1383,33 @@ int handleClientsWithPendingWrites(void) {
 
         /* If after the synchronous writes above we still have data to
          * output to the client, we need to install the writable handler. */
-        if (clientHasPendingReplies(c)) {
-            int ae_flags = AE_WRITABLE;
-            /* For the fsync=always policy, we want that a given FD is never
-             * served for reading and writing in the same event loop iteration,
-             * so that in the middle of receiving the query, and serving it
-             * to the client, we'll call beforeSleep() that will do the
-             * actual fsync of AOF to disk. AE_BARRIER ensures that. */
-            if (server.aof_state == AOF_ON &&
-                server.aof_fsync == AOF_FSYNC_ALWAYS)
-            {
-                ae_flags |= AE_BARRIER;
-            }
-            if (aeCreateFileEvent(server.el, c->fd, ae_flags,
-                sendReplyToClient, c) == AE_ERR)
-            {
-                    freeClientAsync(c);
-            }
-        }
+        if (clientHasPendingReplies(c)) installClientWriteEvent(c);
     }
     return processed;
 }
 
+/* Install the writable event handler for a client that still has data to
+ * output after the synchronous writes performed before re-entering the
+ * event loop. */
+static void installClientWriteEvent(client *c) {
+    int ae_flags = AE_WRITABLE;
+    /* For the fsync=always policy, we want that a given FD is never
+     * served for reading and writing in the same event loop iteration,
+     * so that in the middle of receiving the query, and serving it
+     * to the client, we'll call beforeSleep() that will do the
+     * actual fsync of AOF to disk. AE_BARRIER ensures that. */
+    if (server.aof_state == AOF_ON &&
+        server.aof_fsync == AOF_FSYNC_ALWAYS)
+    {
+        ae_flags |= AE_BARRIER;
+    }
+    if (aeCreateFileEvent(server.el, c->fd, ae_flags,
+        sendReplyToClient, c) == AE_ERR)
+    {
+            freeClientAsync(c);
+    }
+}
+
 /* resetClient prepare the client to process the next command */
 void resetClient(client *c) {
     redisCommandProc *prevcmd = c->cmd ? c->cmd->proc : NULL;
@@ -1071,31 +1446,32 @@ int processInlineBuffer(client *c) {
     int argc, j;
     sds *argv, aux;
     size_t querylen;
+    char *query = c->querybuf+c->qb_pos;
 
     /* Search for end of line */
-    newline = strchr(c->querybuf,'\n');
+    newline = memchr(query,'\n',sdslen(c->querybuf)-c->qb_pos);
 
     /* Nothing to do without a \r\n */
     if (newline == NULL) {
-        if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+        if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
             addReplyError(c,"Protocol error: too big inline request");
-            setProtocolError("too big inline request",c,0);
+            setProtocolError("too big inline request",c);
         }
         return C_ERR;
     }
 
     /* Handle the \r\n case. */
-    if (newline && newline != c->querybuf && *(newline-1) == '\r')
+    if (newline && newline != query && *(newline-1) == '\r')
         newline--;
 
     /* Split the input buffer up to the \r\n */
-    querylen = newline-(c->querybuf);
-    aux = sdsnewlen(c->querybuf,querylen);
+    querylen = newline-query;
+    aux = sdsnewlen(query,querylen);
     argv = sdssplitargs(aux,&argc);
     sdsfree(aux);
     if (argv == NULL) {
         addReplyError(c,"Protocol error: unbalanced quotes in request");
-        setProtocolError("unbalanced quotes in inline request",c,0);
+        setProtocolError("unbalanced quotes in inline request",c);
         return C_ERR;
     }
 
@@ -1105,14 +1481,11 @@ int processInlineBuffer(client *c) {
     if (querylen == 0 && c->flags & CLIENT_SLAVE)
         c->repl_ack_time = server.unixtime;
 
-    /* Leave data after the first line of the query in the buffer */
-    sdsrange(c->querybuf,querylen+2,-1);
+    /* Move querybuffer position to the next query in the buffer. */
+    c->qb_pos += querylen+2;
 
     /* Setup argv array on client structure */
-    if (argc) {
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*argc);
-    }
+    if (argc) ensureClientArgvLen(c,argc);
 
     /* Create redis objects for all arguments. */
     for (c->argc = 0, j = 0; j < argc; j++) {
@@ -1130,7 +1503,7 @@ int processInlineBuffer(client *c) {
 /* Helper function. Trims query buffer to make the function that processes
  * multi bulk requests idempotent. */
 #define PROTO_DUMP_LEN 128
-static void setProtocolError(const char *errstr, client *c, long pos) {
+static void setProtocolError(const char *errstr, client *c) {
     if (server.verbosity <= LL_VERBOSE) {
         sds client = catClientInfoString(sdsempty(),c);
 
@@ -1155,7 +1528,6 @@ static void setProtocolError(const char *errstr, client *c, long pos) {
         sdsfree(client);
     }
     c->flags |= CLIENT_CLOSE_AFTER_REPLY;
-    sdsrange(c->querybuf,pos,-1);
 }
 
 /* Process the query buffer for client 'c', setting up the client argument
@@ -1170,8 +1542,7 @@ static void setProtocolError(const char *errstr, client *c, long pos) {
  * command is in RESP format, so the first byte in the command is found
  * to be '*'. Otherwise for inline commands processInlineBuffer() is called. */
 int processMultibulkBuffer(client *c) {
-    char *newline = NULL;
-    long pos = 0;
+    const char *newline = NULL, *end = c->querybuf+sdslen(c->querybuf);
     int ok;
     long long ll;
 
@@ -1180,77 +1551,73 @@ int processMultibulkBuffer(client *c) {
         serverAssertWithInfo(c,NULL,c->argc == 0);
 
         /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf,'\r');
+        newline = respFindCR(c->querybuf+c->qb_pos,end);
         if (newline == NULL) {
-            if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+            if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                 addReplyError(c,"Protocol error: too big mbulk count string");
-                setProtocolError("too big mbulk count string",c,0);
+                setProtocolError("too big mbulk count string",c);
             }
             return C_ERR;
         }
 
         /* Buffer should also contain \n */
-        if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
-            return C_ERR;
+        if (newline+1 >= end) return C_ERR;
 
         /* We know for sure there is a whole line since newline != NULL,
          * so go ahead and find out the multi bulk length. */
-        serverAssertWithInfo(c,NULL,c->querybuf[0] == '*');
-        ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
+        serverAssertWithInfo(c,NULL,c->querybuf[c->qb_pos] == '*');
+        ok = respParseLength(c->querybuf+c->qb_pos+1,
+                             newline-(c->querybuf+c->qb_pos+1),&ll);
         if (!ok || ll > 1024*1024) {
             addReplyError(c,"Protocol error: invalid multibulk length");
-            setProtocolError("invalid mbulk count",c,pos);
+            setProtocolError("invalid mbulk count",c);
             return C_ERR;
         }
 
-        pos = (newline-c->querybuf)+2;
-        if (ll <= 0) {
-            sdsrange(c->querybuf,pos,-1);
-            return C_OK;
-        }
+        c->qb_pos = (newline-c->querybuf)+2;
+        if (ll <= 0) return C_OK;
 
         c->multibulklen = ll;
 
         /* Setup argv array on client structure */
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
+        ensureClientArgvLen(c,c->multibulklen);
     }
 
     serverAssertWithInfo(c,NULL,c->multibulklen > 0);
     while(c->multibulklen) {
         /* Read bulk length if unknown */
         if (c->bulklen == -1) {
-            newline = strchr(c->querybuf+pos,'\r');
+            newline = respFindCR(c->querybuf+c->qb_pos,end);
             if (newline == NULL) {
-                if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+                if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                     addReplyError(c,
                         "Protocol error: too big bulk count string");
-                    setProtocolError("too big bulk count string",c,0);
+                    setProtocolError("too big bulk count string",c);
                     return C_ERR;
                 }
                 break;
             }
 
             /* Buffer should also contain \n */
-            if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
-                break;
+            if (newline+1 >= end) break;
 
-            if (c->querybuf[pos] != '$') {
+            if (c->querybuf[c->qb_pos] != '$') {
                 addReplyErrorFormat(c,
                     "Protocol error: expected '$', got '%c'",
-                    c->querybuf[pos]);
-                setProtocolError("expected $ but got something else",c,pos);
+                    c->querybuf[c->qb_pos]);
+                setProtocolError("expected $ but got something else",c);
                 return C_ERR;
             }
 
-            ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
+            ok = respParseLength(c->querybuf+c->qb_pos+1,
+                                 newline-(c->querybuf+c->qb_pos+1),&ll);
             if (!ok || ll < 0 || ll > server.proto_max_bulk_len) {
                 addReplyError(c,"Protocol error: invalid bulk length");
-                setProtocolError("invalid bulk length",c,pos);
+                setProtocolError("invalid bulk length",c);
                 return C_ERR;
             }
 
-            pos += newline-(c->querybuf+pos)+2;
+            c->qb_pos = newline-c->querybuf+2;
             if (ll >= PROTO_MBULK_BIG_ARG) {
                 size_t qblen;
 
@@ -1258,26 +1625,27 @@ int processMultibulkBuffer(client *c) {
                  * try to make it likely that it will start at c->querybuf
                  * boundary so that we can optimize object creation
                  * avoiding a large copy of data. */
-                sdsrange(c->querybuf,pos,-1);
-                pos = 0;
+                sdsrange(c->querybuf,c->qb_pos,-1);
+                c->qb_pos = 0;
                 qblen = sdslen(c->querybuf);
                 /* Hint the sds library about the amount of bytes this string is
                  * going to contain. */
                 if (qblen < (size_t)ll+2)
                     c->querybuf = sdsMakeRoomFor(c->querybuf,ll+2-qblen);
+                end = c->querybuf+sdslen(c->querybuf);
             }
             c->bulklen = ll;
         }
 
         /* Read bulk argument */
-        if (sdslen(c->querybuf)-pos < (size_t)(c->bulklen+2)) {
+        if (sdslen(c->querybuf)-c->qb_pos < (size_t)(c->bulklen+2)) {
             /* Not enough data (+2 == trailing \r\n) */
             break;
         } else {
             /* Optimization: if the buffer contains JUST our bulk element
              * instead of creating a new object by *copying* the sds we
              * just use the current sds string. */
-            if (pos == 0 &&
+            if (c->qb_pos == 0 &&
                 c->bulklen >= PROTO_MBULK_BIG_ARG &&
                 sdslen(c->querybuf) == (size_t)(c->bulklen+2))
             {
@@ -1287,20 +1655,17 @@ int processMultibulkBuffer(client *c) {
                  * likely... */
                 c->querybuf = sdsnewlen(NULL,c->bulklen+2);
                 sdsclear(c->querybuf);
-                pos = 0;
+                end = c->querybuf;
             } else {
-                c->argv[c->argc++] =
-                    createStringObject(c->querybuf+pos,c->bulklen);
-                pos += c->bulklen+2;
+                c->argv[c->argc++] = createClientArgvObject(c,
+                    c->querybuf+c->qb_pos,c->bulklen);
+                c->qb_pos += c->bulklen+2;
             }
             c->bulklen = -1;
             c->multibulklen--;
         }
     }
 
-    /* Trim to pos */
-    if (pos) sdsrange(c->querybuf,pos,-1);
-
     /* We're done when c->multibulk == 0 */
     if (c->multibulklen == 0) return C_OK;
 
@@ -1312,12 +1677,55 @@ int processMultibulkBuffer(client *c) {
  * more query buffer to process, because we read more data from the socket
  * or because a client was blocked and later reactivated, so there could be
  * pending query buffer, already representing a full command, to process. */
+/* Keys longer than this end the batch of prefetchPipelinedGets(). */
+#define PIPELINE_PREFETCH_MAX_KEYLEN 128
+
+/* When the query buffer starts with a sequence of GET commands, like in a
+ * pipeline of reads, look up their keys at once with dbPrefetchKeys(), so
+ * that the GETs find the entries and the values in the CPU caches. Up to
+ * DICT_FIND_BATCH commands are considered. Returns the offset in the query
+ * buffer of the first command not prefetched. */
+static size_t prefetchPipelinedGets(client *c) {
+    char buf[DICT_FIND_BATCH*(PIPELINE_PREFETCH_MAX_KEYLEN+16)];
+    robj objs[DICT_FIND_BATCH], *keys[DICT_FIND_BATCH];
+    char *p = c->querybuf+c->qb_pos, *end = c->querybuf+sdslen(c->querybuf);
+    const char *nl;
+    size_t used = 0;
+    long long len;
+    int count = 0;
+
+    while(count < DICT_FIND_BATCH) {
+        if (end-p < 20 || memcmp(p,"*2\r\n$3\r\n",8) ||
+            strncasecmp(p+8,"get\r\n$",6)) break;
+        nl = respFindCR(p+14,end);
+        if (nl == NULL || end-nl < 2 ||
+            !respParseLength(p+14,nl-(p+14),&len) ||
+            len < 0 || len > PIPELINE_PREFETCH_MAX_KEYLEN ||
+            end-(nl+2) < len+2) break;
+        keys[count] = &objs[count];
+        initStaticStringObject(objs[count],
+            sdsnewinplace(buf+used,nl+2,len));
+        used += sdsInPlaceSize(len);
+        p = (char*)nl+2+len+2;
+        count++;
+    }
+    if (count > 1) dbPrefetchKeys(c->db,keys,count);
+    return p-c->querybuf;
+}
+
 void processInputBuffer(client *c) {
-    server.current_client = c;
-    /* Keep processing while there is something in the input buffer */
-    while(sdslen(c->querybuf)) {
-        /* Return if clients are paused. */
-        if (!(c->flags & CLIENT_SLAVE) && clientsArePaused()) break;
+    size_t prefetched = 0;
+
+    /* Keep processing while there is something in the input buffer. The
+     * parsed commands are not removed from the query buffer one by one:
+     * c->qb_pos just moves forward, and the buffer is trimmed once all the
+     * pipelined commands it contains were processed. */
+    while(c->qb_pos < sdslen(c->querybuf)) {
+        /* Return if clients are paused. I/O threads never get clients to
+         * read from while clients are paused, and can't call the function
+         * since it may unpause and touch other clients. */
+        if (!(c->flags & (CLIENT_SLAVE|CLIENT_PENDING_READ)) &&
+            clientsArePaused()) break;
 
         /* Immediately abort if the client is in the middle of something. */
         if (c->flags & CLIENT_BLOCKED) break;
@@ -1331,7 +1739,9 @@ void processInputBuffer(client *c) {
 
         /* Determine request type when unknown. */
         if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
+            if (!(c->flags & CLIENT_PENDING_READ) && c->qb_pos >= prefetched)
+                prefetched = prefetchPipelinedGets(c);
+            if (c->querybuf[c->qb_pos] == '*') {
                 c->reqtype = PROTO_REQ_MULTIBULK;
             } else {
                 c->reqtype = PROTO_REQ_INLINE;
@@ -1350,27 +1760,54 @@ void processInputBuffer(client *c) {
         if (c->argc == 0) {
             resetClient(c);
         } else {
-            /* Only reset the client when the command was executed. */
-            if (processCommand(c) == C_OK) {
-                if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
-                    /* Update the applied replication offset of our master. */
-                    c->reploff = c->read_reploff - sdslen(c->querybuf);
-                }
-
-                /* Don't reset the client structure for clients blocked in a
-                 * module blocking command, so that the reply callback will
-                 * still be able to access the client argv and argc field.
-                 * The client will be reset in unblockClientFromModule(). */
-                if (!(c->flags & CLIENT_BLOCKED) || c->btype != BLOCKED_MODULE)
-                    resetClient(c);
+            /* If we are in the context of an I/O thread we can't execute
+             * the command here: just flag the client so that the main
+             * thread will execute it once all the threads are done. */
+            if (c->flags & CLIENT_PENDING_READ) {
+                c->flags |= CLIENT_PENDING_COMMAND;
+                break;
             }
-            /* freeMemoryIfNeeded may flush slave output buffers. This may
-             * result into a slave, that may be the active client, to be
-             * freed. */
-            if (server.current_client == NULL) break;
+            if (processCommandAndResetClient(c) == C_ERR) return;
         }
     }
+
+    /* Trim the already processed commands. */
+    if (c->qb_pos) {
+        sdsrange(c->querybuf,c->qb_pos,-1);
+        c->qb_pos = 0;
+    }
+}
+
+/* Execute the command already parsed in the client argument vector and
+ * reset the client for the next command. Returns C_ERR if the client was
+ * freed as a side effect of the execution, otherwise C_OK. */
+int processCommandAndResetClient(client *c) {
+    int deadclient = 0;
+
+    server.current_client = c;
+    server.stat_argv_created += c->argv_created;
+    server.stat_argv_reused += c->argv_reused;
+    c->argv_created = c->argv_reused = 0;
+    /* Only reset the client when the command was executed. */
+    if (processCommand(c) == C_OK) {
+        if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
+            /* Update the applied replication offset of our master. */
+            c->reploff = c->read_reploff - sdslen(c->querybuf) + c->qb_pos;
+        }
+
+        /* Don't reset the client structure for clients blocked in a
+         * module blocking command, so that the reply callback will
+         * still be able to access the client argv and argc field.
+         * The client will be reset in unblockClientFromModule(). */
+        if (!(c->flags & CLIENT_BLOCKED) || c->btype != BLOCKED_MODULE)
+            resetClient(c);
+    }
+    /* freeMemoryIfNeeded may flush slave output buffers. This may
+     * result into a slave, that may be the active client, to be
+     * freed. */
+    if (server.current_client == NULL) deadclient = 1;
     server.current_client = NULL;
+    return deadclient ? C_ERR : C_OK;
 }
 
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -1380,6 +1817,11 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(el);
     UNUSED(mask);
 
+    /* Check if we want to read from the client later, when the I/O threads
+     * will be used to read and parse the query buffers of all the clients
+     * that became readable in this event loop iteration. */
+    if (postponeClientRead(c)) return;
+
     readlen = PROTO_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
@@ -1404,12 +1846,12 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
             return;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
-            freeClient(c);
+            freeClientFromIOContext(c);
             return;
         }
     } else if (nread == 0) {
         serverLog(LL_VERBOSE, "Client closed connection");
-        freeClient(c);
+        freeClientFromIOContext(c);
         return;
     } else if (c->flags & CLIENT_MASTER) {
         /* Append the query buffer to the pending (not applied) buffer
@@ -1420,9 +1862,13 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 
     sdsIncrLen(c->querybuf,nread);
+    if (nread == readlen)
+        c->flags |= CLIENT_MORE_INPUT;
+    else
+        c->flags &= ~CLIENT_MORE_INPUT;
     c->lastinteraction = server.unixtime;
     if (c->flags & CLIENT_MASTER) c->read_reploff += nread;
-    server.stat_net_input_bytes += nread;
+    atomicIncr(server.stat_net_input_bytes,nread);
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
         sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
 
@@ -1430,7 +1876,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         serverLog(LL_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
         sdsfree(ci);
         sdsfree(bytes);
-        freeClient(c);
+        freeClientFromIOContext(c);
         return;
     }
 
@@ -1539,7 +1985,7 @@ sds catClientInfoString(sds s, client *client) {
     if (emask & AE_WRITABLE) *p++ = 'w';
     *p = '\0';
     return sdscatfmt(s,
-        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U events=%s cmd=%s",
+        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U events=%s cmd=%s tot-cmds=%U tot-writes=%U",
         (unsigned long long) client->id,
         getClientPeerId(client),
         client->fd,
@@ -1551,13 +1997,15 @@ sds catClientInfoString(sds s, client *client) {
         (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
         (client->flags & CLIENT_MULTI) ? client->mstate.count : -1,
-        (unsigned long long) sdslen(client->querybuf),
+        (unsigned long long) (sdslen(client->querybuf)-client->qb_pos),
         (unsigned long long) sdsavail(client->querybuf),
         (unsigned long long) client->bufpos,
         (unsigned long long) listLength(client->reply),
         (unsigned long long) getClientOutputBufferMemoryUsage(client),
         events,
-        client->lastcmd ? client->lastcmd->name : "NULL");
+        client->lastcmd ? client->lastcmd->name : "NULL",
+        client->commands,
+        client->writes);
 }
 
 sds getAllClientsInfoString(void) {
@@ -1775,6 +2223,7 @@ void rewriteClientCommandVector(client *c, int argc, ...) {
     /* Replace argv and argc with our new versions. */
     c->argv = argv;
     c->argc = argc;
+    c->argv_len = argc;
     c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
     serverAssertWithInfo(c,NULL,c->cmd != NULL);
     va_end(ap);
@@ -1786,6 +2235,7 @@ void replaceClientCommandVector(client *c, int argc, robj **argv) {
     zfree(c->argv);
     c->argv = argv;
     c->argc = argc;
+    c->argv_len = argc;
     c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
     serverAssertWithInfo(c,NULL,c->cmd != NULL);
 }
@@ -1807,6 +2257,7 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
     if (i >= c->argc) {
         c->argv = zrealloc(c->argv,sizeof(robj*)*(i+1));
         c->argc = i+1;
+        c->argv_len = i+1;
         c->argv[i] = NULL;
     }
     oldval = c->argv[i];
@@ -1835,9 +2286,11 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
  * the caller wishes. The main usage of this function currently is
  * enforcing the client output length limits. */
 unsigned long getClientOutputBufferMemoryUsage(client *c) {
-    unsigned long list_item_size = sizeof(listNode)+5;
+    unsigned long list_item_size = sizeof(listNode)+sizeof(clientReplyBlock)+5;
     /* The +5 above means we assume an sds16 hdr, may not be true
-     * but is not going to be a problem. */
+     * but is not going to be a problem. Objects referenced by the blocks
+     * are accounted in c->reply_bytes like the copied protocol, so that
+     * the limits apply regardless of how the reply is stored. */
 
     return c->reply_bytes + (list_item_size*listLength(c->reply));
 }
@@ -2035,6 +2488,8 @@ int clientsArePaused(void) {
 int processEventsWhileBlocked(void) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
+
+    processing_events_while_blocked = 1;
     while (iterations--) {
         int events = 0;
         events += aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
@@ -2042,5 +2497,353 @@ int processEventsWhileBlocked(void) {
         if (!events) break;
         count += events;
     }
+    processing_events_while_blocked = 0;
     return count;
 }
+
+/* ==========================================================================
+ * Threaded I/O
+ * ========================================================================== */
+
+/* When 'io-threads' is greater than one, reading and parsing the query
+ * buffers of the clients, and writing their output buffers to the sockets,
+ * is performed in parallel by a set of I/O threads. The main thread still
+ * executes all the commands, so the dataset is never accessed concurrently.
+ *
+ * The main thread distributes the clients among the threads (taking itself
+ * a share of them) before entering the event loop, then busy waits for all
+ * the threads to finish their job. When there are just a few clients to
+ * serve the threads are parked, since spinning would just burn CPU. */
+typedef struct ioThread {
+    pthread_t tid;
+    pthread_mutex_t mutex;      /* Held by the main thread to park us. */
+    list *clients;              /* Clients to serve in the current batch. */
+    unsigned long pending;      /* Clients still to serve, 0 if idle. */
+    pthread_mutex_t pending_mutex;
+    /* Stats, only updated by the owner of the thread. */
+    unsigned long long batches; /* Batches of clients served. */
+    unsigned long long reads;   /* Clients read from. */
+    unsigned long long writes;  /* Clients written to. */
+} ioThread;
+
+static ioThread io_threads[IO_THREADS_MAX_NUM];
+static int io_threads_active = 0; /* True if the threads are not parked. */
+
+/* Objects referenced by reply blocks the I/O threads finished to write:
+ * the threads can't call decrRefCount() concurrently with each other, so
+ * the references are released by the main thread at the end of the batch. */
+static list *io_threads_released_objects;
+
+/* Clients set apart while a batch of threaded writes is running, because
+ * the flush of their replies was deferred to the next iteration. */
+static list *io_threads_deferred_writes;
+static pthread_mutex_t io_threads_released_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Release a reference held by a reply block, deferring it to the main
+ * thread when called in the context of a batch of threaded writes. */
+static void releaseReplyObject(robj *o) {
+    if (io_threads_op == IO_THREADS_OP_IDLE) {
+        decrRefCount(o);
+        return;
+    }
+    pthread_mutex_lock(&io_threads_released_mutex);
+    listAddNodeTail(io_threads_released_objects,o);
+    pthread_mutex_unlock(&io_threads_released_mutex);
+}
+
+/* Serve the clients assigned to the thread 'id' for the current batch. The
+ * main thread uses the slot 0, and calls this function itself. */
+static void ioThreadServeClients(int id) {
+    ioThread *t = &io_threads[id];
+    listIter li;
+    listNode *ln;
+
+    listRewind(t->clients,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        if (io_threads_op == IO_THREADS_OP_WRITE) {
+            writeToClient(c->fd,c,0);
+            t->writes++;
+        } else if (io_threads_op == IO_THREADS_OP_READ) {
+            readQueryFromClient(server.el,c->fd,c,AE_READABLE);
+            t->reads++;
+        } else {
+            serverPanic("io_threads_op value is unknown");
+        }
+    }
+    listEmpty(t->clients);
+    t->batches++;
+}
+
+void *IOThreadMain(void *myid) {
+    /* The ID is the thread number (from 0 to server.io_threads_num-1), and is
+     * used by the thread to just manipulate a single sub-array of clients. */
+    long id = (unsigned long)myid;
+    ioThread *t = &io_threads[id];
+
+    while(1) {
+        unsigned long pending = 0;
+
+        /* Wait for start. */
+        for (int j = 0; j < 1000000; j++) {
+            atomicGetWithSync(t->pending,pending);
+            if (pending != 0) break;
+        }
+
+        /* Give the main thread a chance to stop this thread. */
+        if (pending == 0) {
+            pthread_mutex_lock(&t->mutex);
+            pthread_mutex_unlock(&t->mutex);
+            continue;
+        }
+
+        /* Note that the main thread will never touch our list of clients
+         * before we drop the pending count to 0. */
+        ioThreadServeClients(id);
+        atomicSetWithSync(t->pending,0);
+    }
+}
+
+/* Initialize the data structures needed for threaded I/O. */
+void initThreadedIO(void) {
+    io_threads_active = 0; /* We start with threads not active. */
+    io_threads_released_objects = listCreate();
+    listSetFreeMethod(io_threads_released_objects,decrRefCountVoid);
+
+    for (int i = 0; i < server.io_threads_num; i++) {
+        ioThread *t = &io_threads[i];
+
+        /* Things we do for all the threads including the main thread. */
+        t->clients = listCreate();
+        t->pending = 0;
+        t->batches = t->reads = t->writes = 0;
+        pthread_mutex_init(&t->pending_mutex,NULL);
+        if (i == 0) continue; /* Thread 0 is the main thread. */
+
+        /* Things we do only for the additional threads. Threads start
+         * parked: the main thread holds their mutex. */
+        pthread_mutex_init(&t->mutex,NULL);
+        pthread_mutex_lock(&t->mutex);
+        if (pthread_create(&t->tid,NULL,IOThreadMain,(void*)(long)i) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize IO thread.");
+            exit(1);
+        }
+    }
+}
+
+static void startThreadedIO(void) {
+    serverAssert(io_threads_active == 0);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_unlock(&io_threads[j].mutex);
+    io_threads_active = 1;
+}
+
+static void stopThreadedIO(void) {
+    /* We may have still clients with pending reads when this function
+     * is called: handle them before stopping the threads. */
+    handleClientsWithPendingReadsUsingThreads();
+    serverAssert(io_threads_active == 1);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_lock(&io_threads[j].mutex);
+    io_threads_active = 0;
+}
+
+/* This function checks if there are not enough pending clients to justify
+ * taking the I/O threads active: in that case I/O threads are stopped if
+ * currently active. We track the pending writes as a measure of clients
+ * we need to handle in parallel, however the I/O threading is disabled
+ * globally for reads as well if we have too little pending clients.
+ *
+ * The function returns 0 if the I/O threading should be used because there
+ * are enough active threads, otherwise 1 is returned and the I/O threads
+ * could be possibly stopped (if already active) as a side effect. */
+int stopThreadedIOIfNeeded(void) {
+    int pending = listLength(server.clients_pending_write);
+
+    /* Return ASAP if I/O threads are disabled (single threaded mode). */
+    if (server.io_threads_num == 1) return 1;
+
+    if (pending < (server.io_threads_num*2)) {
+        if (io_threads_active) stopThreadedIO();
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Hand the clients of 'clients_list' to the I/O threads in a round robin
+ * fashion, serve the share of the main thread, and wait for all the other
+ * threads to complete the batch. The caller is responsible of removing the
+ * clients from 'clients_list' afterwards. */
+static void runThreadedIOBatch(list *clients_list, int op) {
+    listIter li;
+    listNode *ln;
+    int item_id = 0, j;
+
+    listRewind(clients_list,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads[target_id].clients,c);
+        item_id++;
+    }
+
+    /* Give the start condition to the waiting threads, by setting the
+     * start condition atomic var. */
+    io_threads_op = op;
+    for (j = 1; j < server.io_threads_num; j++) {
+        unsigned long count = listLength(io_threads[j].clients);
+        atomicSetWithSync(io_threads[j].pending,count);
+    }
+
+    /* Also use the main thread to process a slice of clients. */
+    ioThreadServeClients(0);
+
+    /* Wait for all the other threads to end their work. */
+    while(1) {
+        unsigned long pending = 0;
+        for (j = 1; j < server.io_threads_num; j++) {
+            unsigned long count;
+            atomicGetWithSync(io_threads[j].pending,count);
+            pending += count;
+        }
+        if (pending == 0) break;
+    }
+    io_threads_op = IO_THREADS_OP_IDLE;
+    listEmpty(io_threads_released_objects);
+}
+
+int handleClientsWithPendingWritesUsingThreads(void) {
+    listIter li;
+    listNode *ln;
+    int processed = listLength(server.clients_pending_write);
+    if (processed == 0) return 0; /* Return ASAP if there are no clients. */
+
+    /* If I/O threads are disabled or we have few clients to serve, don't
+     * use I/O threads, but the boring synchronous code. */
+    if (stopThreadedIOIfNeeded()) {
+        return handleClientsWithPendingWrites();
+    }
+
+    /* Start threads if needed. */
+    if (!io_threads_active) startThreadedIO();
+
+    /* Clients are removed from the pending list only after the batch is
+     * completed, but the flag is cleared now: the threads can't touch the
+     * global list in any way. The clients whose flush is deferred are set
+     * apart, and stay pending for the next iteration. */
+    if (io_threads_deferred_writes == NULL)
+        io_threads_deferred_writes = listCreate();
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        if (clientCanDeferFlush(c)) {
+            listAddNodeTail(io_threads_deferred_writes,c);
+            listDelNode(server.clients_pending_write,ln);
+            continue;
+        }
+        c->flags &= ~CLIENT_PENDING_WRITE;
+    }
+    processed = listLength(server.clients_pending_write);
+    runThreadedIOBatch(server.clients_pending_write,IO_THREADS_OP_WRITE);
+
+    /* Run the list of clients again to install the write handler where
+     * needed. */
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+        if (clientHasPendingReplies(c)) installClientWriteEvent(c);
+    }
+    listEmpty(server.clients_pending_write);
+    listJoin(server.clients_pending_write,io_threads_deferred_writes);
+    server.stat_io_writes_processed += processed;
+
+    /* Free the clients the threads failed to write to, now that nothing
+     * else references them. */
+    freeClientsInAsyncFreeQueue();
+    return processed;
+}
+
+/* Return 1 if we want to handle the client read later using threaded I/O.
+ * This is called by the readable handler of the event loop.
+ * As a side effect of calling this function the client is put in the
+ * pending read clients and flagged as such. */
+static int postponeClientRead(client *c) {
+    if (io_threads_active &&
+        server.io_threads_do_reads &&
+        io_threads_op == IO_THREADS_OP_IDLE &&
+        !processing_events_while_blocked &&
+        !clientsArePaused() &&
+        !(c->flags & (CLIENT_MASTER|CLIENT_SLAVE|CLIENT_PENDING_READ)))
+    {
+        c->flags |= CLIENT_PENDING_READ;
+        listAddNodeHead(server.clients_pending_read,c);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* When threaded I/O is also enabled for the reading + parsing side, the
+ * readable handler will just put normal clients into a queue of clients to
+ * process (instead of serving them synchronously). This function runs
+ * the queue using the I/O threads, and process them in order to accumulate
+ * the reads in the buffers, and also parse the first command available
+ * rendering it in the client structures. */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    if (!io_threads_active || !server.io_threads_do_reads) return 0;
+    int processed = listLength(server.clients_pending_read);
+    if (processed == 0) return 0;
+
+    runThreadedIOBatch(server.clients_pending_read,IO_THREADS_OP_READ);
+
+    /* Run the list of clients again to process the new buffers. Note that
+     * executing a command may free other clients of the list, which are
+     * removed from it by unlinkClient(), so we always pick the head. */
+    while(listLength(server.clients_pending_read)) {
+        listNode *ln = listFirst(server.clients_pending_read);
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+        if (c->flags & CLIENT_PENDING_COMMAND) {
+            c->flags &= ~CLIENT_PENDING_COMMAND;
+            if (processCommandAndResetClient(c) == C_ERR) {
+                /* If the client is no longer valid, we avoid
+                 * processing the client later. So we just go
+                 * to the next. */
+                continue;
+            }
+        }
+        processInputBuffer(c);
+
+        /* We may have pending replies if a thread produced replies, for
+         * instance a protocol error, but could not schedule the write. */
+        if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+    }
+    server.stat_io_reads_processed += processed;
+    freeClientsInAsyncFreeQueue();
+    return processed;
+}
+
+/* Append to 'info' one line per I/O thread reporting its load, and return
+ * the new string. */
+sds genIOThreadsInfoString(sds info) {
+    info = sdscatprintf(info,
+        "io_threads:%d\r\n"
+        "io_threads_active:%d\r\n"
+        "io_threads_do_reads:%d\r\n",
+        server.io_threads_num,
+        io_threads_active,
+        server.io_threads_do_reads);
+    for (int j = 0; j < server.io_threads_num; j++) {
+        ioThread *t = &io_threads[j];
+        info = sdscatprintf(info,
+            "io_thread_%d:batches=%llu,reads=%llu,writes=%llu\r\n",
+            j, t->batches, t->reads, t->writes);
+    }
+    return info;
+}
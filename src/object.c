@@ -83,6 +83,14 @@ robj *createRawStringObject(const char *ptr, size_t len) {
  * allocated in the same chunk as the object itself. */
 robj *createEmbeddedStringObject(const char *ptr, size_t len) {
     robj *o = zmalloc(sizeof(robj)+sizeof(struct sdshdr8)+len+1);
+    return initEmbeddedStringObject(o,ptr,len);
+}
+
+/* Initialize 'o', that must point to an allocation of at least
+ * sizeof(robj)+sizeof(struct sdshdr8)+len+1 bytes, as an EMBSTR encoded
+ * string object holding 'ptr'. This is used by createEmbeddedStringObject()
+ * and to recycle the memory of objects no longer referenced. */
+robj *initEmbeddedStringObject(robj *o, const char *ptr, size_t len) {
     struct sdshdr8 *sh = (void*)(o+1);
 
     o->type = OBJ_STRING;
@@ -109,11 +117,7 @@ robj *createEmbeddedStringObject(const char *ptr, size_t len) {
 
 /* Create a string object with EMBSTR encoding if it is smaller than
  * OBJ_ENCODING_EMBSTR_SIZE_LIMIT, otherwise the RAW encoding is
- * used.
- *
- * The current limit of 39 is chosen so that the biggest string object
- * we allocate as EMBSTR will still fit into the 64 byte arena of jemalloc. */
-#define OBJ_ENCODING_EMBSTR_SIZE_LIMIT 44
+ * used. */
 robj *createStringObject(const char *ptr, size_t len) {
     if (len <= OBJ_ENCODING_EMBSTR_SIZE_LIMIT)
         return createEmbeddedStringObject(ptr,len);
@@ -802,6 +806,71 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
     return asize;
 }
 
+/* Return a rough estimate of the memory used by the value, in constant
+ * time, for the eviction policies that weight keys by their size.
+ * Unlike objectComputeSize() no element is visited: strings and ziplist or
+ * intset encoded values report their exact size, quicklists are estimated
+ * from their first and last node, and hash table based encodings from the
+ * number of elements assuming OBJ_ESTIMATE_ELE_SIZE bytes per element. */
+size_t objectEstimateSize(robj *o) {
+    size_t asize = sizeof(*o);
+    dict *d;
+
+    switch(o->type) {
+    case OBJ_STRING:
+        if (o->encoding == OBJ_ENCODING_RAW)
+            asize += sdsAllocSize(o->ptr);
+        else if (o->encoding == OBJ_ENCODING_EMBSTR)
+            asize += sdslen(o->ptr)+2;
+        break;
+    case OBJ_LIST:
+        if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+            quicklist *ql = o->ptr;
+            asize += sizeof(quicklist);
+            if (ql->len) {
+                size_t nodesize = (ziplistBlobLen(ql->head->zl)+
+                                   ziplistBlobLen(ql->tail->zl))/2;
+                asize += (sizeof(quicklistNode)+nodesize)*ql->len;
+            }
+        } else {
+            asize += ziplistBlobLen(o->ptr);
+        }
+        break;
+    case OBJ_SET:
+        if (o->encoding == OBJ_ENCODING_INTSET) {
+            asize += intsetBlobLen(o->ptr);
+        } else {
+            d = o->ptr;
+            asize += sizeof(dict)+sizeof(dictEntry*)*dictSlots(d)+
+                     (sizeof(dictEntry)+OBJ_ESTIMATE_ELE_SIZE)*dictSize(d);
+        }
+        break;
+    case OBJ_ZSET:
+        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+            asize += ziplistBlobLen(o->ptr);
+        } else {
+            d = ((zset*)o->ptr)->dict;
+            asize += sizeof(zset)+sizeof(dictEntry*)*dictSlots(d)+
+                     (sizeof(dictEntry)+sizeof(zskiplistNode)+
+                      OBJ_ESTIMATE_ELE_SIZE)*dictSize(d);
+        }
+        break;
+    case OBJ_HASH:
+        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+            asize += ziplistBlobLen(o->ptr);
+        } else {
+            d = o->ptr;
+            asize += sizeof(dict)+sizeof(dictEntry*)*dictSlots(d)+
+                     (sizeof(dictEntry)+OBJ_ESTIMATE_ELE_SIZE*2)*dictSize(d);
+        }
+        break;
+    case OBJ_MODULE:
+        asize += sizeof(moduleValue);
+        break;
+    }
+    return asize;
+}
+
 /* Release data obtained with getMemoryOverheadData(). */
 void freeMemoryOverheadData(struct redisMemOverhead *mh) {
     zfree(mh->db);
@@ -875,24 +944,27 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
 
     for (j = 0; j < server.dbnum; j++) {
         redisDb *db = server.db+j;
-        long long keyscount = dictSize(db->dict);
+        long long keyscount = dbSize(db);
         if (keyscount==0) continue;
 
         mh->total_keys += keyscount;
         mh->db = zrealloc(mh->db,sizeof(mh->db[0])*(mh->num_dbs+1));
         mh->db[mh->num_dbs].dbid = j;
 
-        mem = dictSize(db->dict) * sizeof(dictEntry) +
-              dictSlots(db->dict) * sizeof(dictEntry*) +
-              dictSize(db->dict) * sizeof(robj);
+        mem = keyscount * dictEntryMemUsage(db->dicts[0]) +
+              dbTableMemUsage(db) +
+              keyscount * sizeof(robj);
         mh->db[mh->num_dbs].overhead_ht_main = mem;
         mem_total+=mem;
 
-        mem = dictSize(db->expires) * sizeof(dictEntry) +
-              dictSlots(db->expires) * sizeof(dictEntry*);
+        mem = dictSize(db->expires) * dictEntryMemUsage(db->expires) +
+              dictTableMemUsage(db->expires);
         mh->db[mh->num_dbs].overhead_ht_expires = mem;
         mem_total+=mem;
 
+        for (int type = 0; type < OBJ_TYPES; type++)
+            mh->db[mh->num_dbs].keys_by_type[type] = db->keysizes.keys[type];
+
         mh->num_dbs++;
     }
 
@@ -1000,7 +1072,7 @@ sds getMemoryDoctorReport(void) {
 robj *objectCommandLookup(client *c, robj *key) {
     dictEntry *de;
 
-    if ((de = dictFind(c->db->dict,key->ptr)) == NULL) return NULL;
+    if ((de = dbFind(c->db,key->ptr)) == NULL) return NULL;
     return (robj*) dictGetVal(de);
 }
 
@@ -1093,8 +1165,7 @@ void memoryCommand(client *c) {
         if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
                 == NULL) return;
         size_t usage = objectComputeSize(o,samples);
-        usage += sdsAllocSize(c->argv[2]->ptr);
-        usage += sizeof(dictEntry);
+        usage += dbEntryMemUsage(c->db,dbFind(c->db,c->argv[2]->ptr));
         addReplyLongLong(c,usage);
     } else if (!strcasecmp(c->argv[1]->ptr,"stats") && c->argc == 2) {
         struct redisMemOverhead *mh = getMemoryOverheadData();
@@ -1126,13 +1197,21 @@ void memoryCommand(client *c) {
             char dbname[32];
             snprintf(dbname,sizeof(dbname),"db.%zd",mh->db[j].dbid);
             addReplyBulkCString(c,dbname);
-            addReplyMultiBulkLen(c,4);
+            addReplyMultiBulkLen(c,(2+OBJ_TYPES)*2);
 
             addReplyBulkCString(c,"overhead.hashtable.main");
             addReplyLongLong(c,mh->db[j].overhead_ht_main);
 
             addReplyBulkCString(c,"overhead.hashtable.expires");
             addReplyLongLong(c,mh->db[j].overhead_ht_expires);
+
+            for (int type = 0; type < OBJ_TYPES; type++) {
+                char field[32];
+                snprintf(field,sizeof(field),"keys.%s",
+                    keysizesTypeNames[type]);
+                addReplyBulkCString(c,field);
+                addReplyLongLong(c,mh->db[j].keys_by_type[type]);
+            }
         }
 
         addReplyBulkCString(c,"overhead.total");
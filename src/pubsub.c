@@ -33,18 +33,60 @@
  * Pubsub low level API
  *----------------------------------------------------------------------------*/
 
-void freePubsubPattern(void *p) {
-    pubsubPattern *pat = p;
+/* Patterns are indexed by their literal prefix, that is, the bytes before
+ * the first glob special character, capped to PUBSUB_PATTERN_PREFIX_MAX.
+ * PUBLISH only needs to match the channel against the patterns whose
+ * prefix is a prefix of the channel name, instead of against every
+ * pattern. Every distinct pattern is in the index once, no matter how many
+ * clients are subscribed to it. */
+#define PUBSUB_PATTERN_PREFIX_MAX 64
+
+/* Number of indexed patterns for every prefix length, so that PUBLISH only
+ * looks up the prefix lengths that are actually used. */
+static unsigned long pattern_prefix_lens[PUBSUB_PATTERN_PREFIX_MAX+1];
+
+static size_t patternPrefixLen(sds pattern) {
+    size_t j, len = sdslen(pattern);
+
+    if (len > PUBSUB_PATTERN_PREFIX_MAX) len = PUBSUB_PATTERN_PREFIX_MAX;
+    for (j = 0; j < len; j++) {
+        char ch = pattern[j];
+        if (ch == '*' || ch == '?' || ch == '[' || ch == '\\') break;
+    }
+    return j;
+}
 
-    decrRefCount(pat->pattern);
-    zfree(pat);
+/* Add a pattern to the prefix index. The index does not own a reference:
+ * the pattern is the key of server.pubsub_patterns and is removed from the
+ * index before being deleted from there. */
+static void pubsubIndexPattern(robj *pattern) {
+    size_t plen = patternPrefixLen(pattern->ptr);
+    list *patterns;
+
+    patterns = raxFind(server.pubsub_patterns_index,pattern->ptr,plen);
+    if (patterns == raxNotFound) {
+        patterns = listCreate();
+        raxInsert(server.pubsub_patterns_index,pattern->ptr,plen,patterns,NULL);
+    }
+    listAddNodeTail(patterns,pattern);
+    pattern_prefix_lens[plen]++;
 }
 
-int listMatchPubsubPattern(void *a, void *b) {
-    pubsubPattern *pa = a, *pb = b;
+static void pubsubUnindexPattern(robj *pattern) {
+    size_t plen = patternPrefixLen(pattern->ptr);
+    list *patterns;
+    listNode *ln;
 
-    return (pa->client == pb->client) &&
-           (equalStringObjects(pa->pattern,pb->pattern));
+    patterns = raxFind(server.pubsub_patterns_index,pattern->ptr,plen);
+    serverAssert(patterns != raxNotFound);
+    ln = listSearchKey(patterns,pattern);
+    serverAssert(ln != NULL);
+    listDelNode(patterns,ln);
+    if (listLength(patterns) == 0) {
+        listRelease(patterns);
+        raxRemove(server.pubsub_patterns_index,pattern->ptr,plen,NULL);
+    }
+    pattern_prefix_lens[plen]--;
 }
 
 /* Return the number of channels + patterns a client is subscribed to. */
@@ -125,17 +167,27 @@ int pubsubUnsubscribeChannel(client *c, robj *channel, int notify) {
 
 /* Subscribe a client to a pattern. Returns 1 if the operation succeeded, or 0 if the client was already subscribed to that pattern. */
 int pubsubSubscribePattern(client *c, robj *pattern) {
+    dictEntry *de;
+    list *clients;
     int retval = 0;
 
     if (listSearchKey(c->pubsub_patterns,pattern) == NULL) {
         retval = 1;
-        pubsubPattern *pat;
         listAddNodeTail(c->pubsub_patterns,pattern);
         incrRefCount(pattern);
-        pat = zmalloc(sizeof(*pat));
-        pat->pattern = getDecodedObject(pattern);
-        pat->client = c;
-        listAddNodeTail(server.pubsub_patterns,pat);
+        /* Add the client to the pattern -> list of clients hash table */
+        de = dictFind(server.pubsub_patterns,pattern);
+        if (de == NULL) {
+            robj *decoded = getDecodedObject(pattern);
+
+            clients = listCreate();
+            dictAdd(server.pubsub_patterns,decoded,clients);
+            pubsubIndexPattern(decoded);
+        } else {
+            clients = dictGetVal(de);
+        }
+        listAddNodeTail(clients,c);
+        server.pubsub_patterns_subs++;
     }
     /* Notify the client */
     addReply(c,shared.mbulkhdr[3]);
@@ -148,18 +200,28 @@ int pubsubSubscribePattern(client *c, robj *pattern) {
 /* Unsubscribe a client from a channel. Returns 1 if the operation succeeded, or
  * 0 if the client was not subscribed to the specified channel. */
 int pubsubUnsubscribePattern(client *c, robj *pattern, int notify) {
+    dictEntry *de;
+    list *clients;
     listNode *ln;
-    pubsubPattern pat;
     int retval = 0;
 
     incrRefCount(pattern); /* Protect the object. May be the same we remove */
     if ((ln = listSearchKey(c->pubsub_patterns,pattern)) != NULL) {
         retval = 1;
         listDelNode(c->pubsub_patterns,ln);
-        pat.client = c;
-        pat.pattern = pattern;
-        ln = listSearchKey(server.pubsub_patterns,&pat);
-        listDelNode(server.pubsub_patterns,ln);
+        /* Remove the client from the pattern -> clients list hash table */
+        de = dictFind(server.pubsub_patterns,pattern);
+        serverAssertWithInfo(c,NULL,de != NULL);
+        clients = dictGetVal(de);
+        ln = listSearchKey(clients,c);
+        serverAssertWithInfo(c,NULL,ln != NULL);
+        listDelNode(clients,ln);
+        server.pubsub_patterns_subs--;
+        if (listLength(clients) == 0) {
+            /* Last subscriber: drop the pattern from the index as well. */
+            pubsubUnindexPattern(dictGetKey(de));
+            dictDelete(server.pubsub_patterns,pattern);
+        }
     }
     /* Notify the client */
     if (notify) {
@@ -221,51 +283,112 @@ int pubsubUnsubscribeAllPatterns(client *c, int notify) {
     return count;
 }
 
+/* Append to 's' the protocol of a bulk reply with the string 'o'. */
+static sds catBulkProto(sds s, robj *o) {
+    o = getDecodedObject(o);
+    s = sdscatfmt(s,"$%U\r\n",(unsigned long long)sdslen(o->ptr));
+    s = sdscatlen(s,o->ptr,sdslen(o->ptr));
+    s = sdscatlen(s,"\r\n",2);
+    decrRefCount(o);
+    return s;
+}
+
 /* Publish a message */
 int pubsubPublishMessage(robj *channel, robj *message) {
     int receivers = 0;
     dictEntry *de;
     listNode *ln;
     listIter li;
+    robj *msgbulk = NULL;
 
-    /* Send to clients listening for that channel */
+    /* Send to clients listening for that channel. The whole "message"
+     * frame is the same for all of them, so it is serialized once and
+     * shared by their output buffers. */
     de = dictFind(server.pubsub_channels,channel);
     if (de) {
         list *list = dictGetVal(de);
         listNode *ln;
         listIter li;
+        sds frame = sdsempty();
+        robj *o;
+
+        frame = sdscatlen(frame,shared.mbulkhdr[3]->ptr,
+                          sdslen(shared.mbulkhdr[3]->ptr));
+        frame = sdscatlen(frame,shared.messagebulk->ptr,
+                          sdslen(shared.messagebulk->ptr));
+        frame = catBulkProto(frame,channel);
+        frame = catBulkProto(frame,message);
+        o = createObject(OBJ_STRING,frame);
 
         listRewind(list,&li);
         while ((ln = listNext(&li)) != NULL) {
             client *c = ln->value;
 
-            addReply(c,shared.mbulkhdr[3]);
-            addReply(c,shared.messagebulk);
-            addReplyBulk(c,channel);
-            addReplyBulk(c,message);
+            addReplySharedProto(c,o);
             receivers++;
         }
+        decrRefCount(o);
     }
-    /* Send to clients listening to matching channels */
-    if (listLength(server.pubsub_patterns)) {
-        listRewind(server.pubsub_patterns,&li);
+    /* Send to clients listening to matching channels. Only the patterns
+     * whose literal prefix is a prefix of the channel can match it, so
+     * they are looked up in the index for every prefix length in use. */
+    if (dictSize(server.pubsub_patterns)) {
+        size_t plen, maxlen;
+
         channel = getDecodedObject(channel);
-        while ((ln = listNext(&li)) != NULL) {
-            pubsubPattern *pat = ln->value;
-
-            if (stringmatchlen((char*)pat->pattern->ptr,
-                                sdslen(pat->pattern->ptr),
-                                (char*)channel->ptr,
-                                sdslen(channel->ptr),0)) {
-                addReply(pat->client,shared.mbulkhdr[4]);
-                addReply(pat->client,shared.pmessagebulk);
-                addReplyBulk(pat->client,pat->pattern);
-                addReplyBulk(pat->client,channel);
-                addReplyBulk(pat->client,message);
-                receivers++;
+        maxlen = sdslen(channel->ptr);
+        if (maxlen > PUBSUB_PATTERN_PREFIX_MAX)
+            maxlen = PUBSUB_PATTERN_PREFIX_MAX;
+        for (plen = 0; plen <= maxlen; plen++) {
+            list *patterns;
+
+            if (pattern_prefix_lens[plen] == 0) continue;
+            patterns = raxFind(server.pubsub_patterns_index,
+                               channel->ptr,plen);
+            if (patterns == raxNotFound) continue;
+
+            listRewind(patterns,&li);
+            while ((ln = listNext(&li)) != NULL) {
+                robj *pattern = ln->value;
+                list *clients;
+                listNode *cln;
+                listIter cli;
+                robj *header;
+
+                if (!stringmatchlen((char*)pattern->ptr,
+                                    sdslen(pattern->ptr),
+                                    (char*)channel->ptr,
+                                    sdslen(channel->ptr),0)) continue;
+
+                /* The frame header is the same for all the clients of
+                 * this pattern, while the message bulk, that is usually
+                 * the biggest part of the frame, is shared by all the
+                 * clients of all the matching patterns. */
+                if (msgbulk == NULL)
+                    msgbulk = createObject(OBJ_STRING,
+                        catBulkProto(sdsempty(),message));
+                header = createObject(OBJ_STRING,sdsempty());
+                header->ptr = sdscatlen(header->ptr,shared.mbulkhdr[4]->ptr,
+                                        sdslen(shared.mbulkhdr[4]->ptr));
+                header->ptr = sdscatlen(header->ptr,shared.pmessagebulk->ptr,
+                                        sdslen(shared.pmessagebulk->ptr));
+                header->ptr = catBulkProto(header->ptr,pattern);
+                header->ptr = catBulkProto(header->ptr,channel);
+
+                clients = dictFetchValue(server.pubsub_patterns,pattern);
+                listRewind(clients,&cli);
+                while ((cln = listNext(&cli)) != NULL) {
+                    client *c = cln->value;
+
+                    addReplySharedProto(c,header);
+                    addReplySharedProto(c,msgbulk);
+                    receivers++;
+                }
+                decrRefCount(header);
             }
         }
         decrRefCount(channel);
+        if (msgbulk) decrRefCount(msgbulk);
     }
     return receivers;
 }
@@ -362,7 +485,7 @@ void pubsubCommand(client *c) {
         }
     } else if (!strcasecmp(c->argv[1]->ptr,"numpat") && c->argc == 2) {
         /* PUBSUB NUMPAT */
-        addReplyLongLong(c,listLength(server.pubsub_patterns));
+        addReplyLongLong(c,server.pubsub_patterns_subs);
     } else {
         addReplyErrorFormat(c,
             "Unknown PUBSUB subcommand or wrong number of arguments for '%s'",
@@ -79,6 +79,7 @@ static struct config {
     sds dbnumstr;
     char *tests;
     char *auth;
+    int patterns;
 } config;
 
 typedef struct _client {
@@ -546,6 +547,10 @@ int parseOptions(int argc, const char **argv) {
             if (lastarg) goto invalid;
             config.dbnum = atoi(argv[++i]);
             config.dbnumstr = sdsfromlonglong(config.dbnum);
+        } else if (!strcmp(argv[i],"--patterns")) {
+            if (lastarg) goto invalid;
+            config.patterns = atoi(argv[++i]);
+            if (config.patterns < 0) config.patterns = 0;
         } else if (!strcmp(argv[i],"--help")) {
             exit_status = 0;
             goto usage;
@@ -575,6 +580,8 @@ usage:
 " -d <size>          Data size of SET/GET value in bytes (default 3)\n"
 " --dbnum <db>       SELECT the specified db number (default 0)\n"
 " -k <boolean>       1=keep alive 0=reconnect (default 1)\n"
+" --patterns <num>   Number of non matching patterns an extra client is\n"
+"                    subscribed to during the PUBLISH test (default 0)\n"
 " -r <keyspacelen>   Use random keys for SET/GET/INCR, random values for SADD\n"
 "  Using this option the benchmark will expand the string __rand_int__\n"
 "  inside an argument with a 12 digits number in the specified range\n"
@@ -631,6 +638,43 @@ int showThroughput(struct aeEventLoop *eventLoop, long long id, void *clientData
     return 250; /* every 250ms */
 }
 
+/* Open a connection subscribed to 'count' patterns that never match the
+ * channels used by the PUBLISH test, so that its result shows the cost of
+ * pattern matching on the server side. Returns NULL if 'count' is zero. */
+static redisContext *createPatternSubscriber(int count) {
+    redisContext *ctx;
+    redisReply *reply;
+    int j;
+
+    if (count == 0) return NULL;
+    if (config.hostsocket == NULL)
+        ctx = redisConnect(config.hostip,config.hostport);
+    else
+        ctx = redisConnectUnix(config.hostsocket);
+    if (ctx->err) {
+        fprintf(stderr,"Could not connect to Redis at ");
+        if (config.hostsocket == NULL)
+            fprintf(stderr,"%s:%d: %s\n",config.hostip,config.hostport,ctx->errstr);
+        else
+            fprintf(stderr,"%s: %s\n",config.hostsocket,ctx->errstr);
+        exit(1);
+    }
+    if (config.auth) {
+        reply = redisCommand(ctx,"AUTH %s",config.auth);
+        if (reply) freeReplyObject(reply);
+    }
+    for (j = 0; j < count; j++)
+        redisAppendCommand(ctx,"PSUBSCRIBE channel:%d:*",j);
+    for (j = 0; j < count; j++) {
+        if (redisGetReply(ctx,(void**)&reply) != REDIS_OK) {
+            fprintf(stderr,"Error subscribing to patterns: %s\n",ctx->errstr);
+            exit(1);
+        }
+        freeReplyObject(reply);
+    }
+    return ctx;
+}
+
 /* Return true if the named test was selected using the -t command line
  * switch, or if all the tests are selected (no -t passed by user). */
 int test_is_selected(char *name) {
@@ -679,6 +723,7 @@ int main(int argc, const char **argv) {
     config.tests = NULL;
     config.dbnum = 0;
     config.auth = NULL;
+    config.patterns = 0;
 
     i = parseOptions(argc,argv);
     argc -= i;
@@ -839,6 +884,16 @@ int main(int argc, const char **argv) {
             free(cmd);
         }
 
+        if (test_is_selected("publish")) {
+            redisContext *sub = createPatternSubscriber(config.patterns);
+
+            len = redisFormatCommand(&cmd,"PUBLISH channel:__rand_int__ %s",
+                                     data);
+            benchmark("PUBLISH",cmd,len);
+            free(cmd);
+            if (sub) redisFree(sub);
+        }
+
         if (!config.csv) printf("\n");
     } while(config.loop);
 
@@ -0,0 +1,319 @@
+/* Vectorized scanning of the RESP protocol.
+ *
+ * The query parser spends most of its time looking for the "\r" that ends
+ * every header and inline line of the protocol. Short lines are scanned
+ * inline by respFindCR() in respscan.h; longer ones, like inline commands
+ * and the tail of big pipelines, land in respFindCRSlow() that compares 16
+ * (SSE2) or 32 (AVX2) bytes at a time.
+ *
+ * SSE2 is part of the x86-64 baseline so it is used whenever the compiler
+ * targets it. The AVX2 version is compiled in with a target attribute and
+ * selected at startup by respScanInit() only if the CPU supports it, so the
+ * same binary still runs on older hardware. On other architectures the
+ * scalar version is used.
+ *
+ * The scanners never read past the end of the range: the last partial
+ * block is always handled by the scalar loop.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdint.h>
+#include <string.h>
+
+#include "respscan.h"
+
+#if defined(__SSE2__)
+#define HAVE_RESPSCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__clang__) || \
+    (defined(__GNUC__) && __GNUC__ >= 5))
+#define HAVE_RESPSCAN_AVX2
+#include <immintrin.h>
+#endif
+
+static const char *findCRScalar(const char *p, const char *end) {
+    while (p < end) {
+        if (*p == '\r') return p;
+        p++;
+    }
+    return NULL;
+}
+
+#ifdef HAVE_RESPSCAN_SSE2
+static const char *findCRSSE2(const char *p, const char *end) {
+    const __m128i cr = _mm_set1_epi8('\r');
+
+    while (end-p >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block,cr));
+        if (mask) return p+__builtin_ctz(mask);
+        p += 16;
+    }
+    return findCRScalar(p,end);
+}
+#endif
+
+#ifdef HAVE_RESPSCAN_AVX2
+__attribute__((target("avx2")))
+static const char *findCRAVX2(const char *p, const char *end) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+
+    while (end-p >= 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)p);
+        unsigned int mask =
+            (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block,cr));
+        if (mask) return p+__builtin_ctz(mask);
+        p += 32;
+    }
+    return findCRScalar(p,end);
+}
+#endif
+
+struct respScanner {
+    const char *name;
+    const char *(*findcr)(const char *p, const char *end);
+};
+
+static struct respScanner scanners[] = {
+#ifdef HAVE_RESPSCAN_AVX2
+    {"avx2", findCRAVX2},
+#endif
+#ifdef HAVE_RESPSCAN_SSE2
+    {"sse2", findCRSSE2},
+#endif
+    {"scalar", findCRScalar}
+};
+
+#define RESPSCAN_SCANNERS (sizeof(scanners)/sizeof(scanners[0]))
+
+/* Until respScanInit() is called the most portable scanner that was
+ * compiled in is used, that is, any but AVX2. */
+#ifdef HAVE_RESPSCAN_SSE2
+static struct respScanner *scanner = &scanners[RESPSCAN_SCANNERS-2];
+#else
+static struct respScanner *scanner = &scanners[RESPSCAN_SCANNERS-1];
+#endif
+
+/* Select the fastest scanner the CPU supports. Must be called before
+ * other threads may use the scanner. */
+void respScanInit(void) {
+#ifdef HAVE_RESPSCAN_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) scanner = &scanners[0];
+#endif
+}
+
+const char *respScanImplementation(void) {
+    return scanner->name;
+}
+
+const char *respFindCRSlow(const char *p, const char *end) {
+    return scanner->findcr(p,end);
+}
+
+#if defined(REDIS_TEST) || defined(RESPSCAN_BENCHMARK_MAIN)
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#define UNUSED(x) (void)(x)
+
+/* Use the scanner with the given name, returns 0 if it is not available
+ * in this build or on this CPU. */
+static int useScanner(const char *name) {
+    unsigned int j;
+
+#ifdef HAVE_RESPSCAN_AVX2
+    __builtin_cpu_init();
+#endif
+    for (j = 0; j < RESPSCAN_SCANNERS; j++) {
+        if (strcmp(scanners[j].name,name)) continue;
+#ifdef HAVE_RESPSCAN_AVX2
+        if (scanners[j].findcr == findCRAVX2 &&
+            !__builtin_cpu_supports("avx2")) return 0;
+#endif
+        scanner = &scanners[j];
+        return 1;
+    }
+    return 0;
+}
+#endif
+
+#ifdef REDIS_TEST
+int respscanTest(int argc, char *argv[]) {
+    const char *names[] = {"scalar", "sse2", "avx2"};
+    char buf[256];
+    unsigned int j, i;
+    long long v;
+    UNUSED(argc);
+    UNUSED(argv);
+
+    for (j = 0; j < sizeof(names)/sizeof(names[0]); j++) {
+        if (!useScanner(names[j])) continue;
+        printf("Testing the %s scanner\n", names[j]);
+        for (i = 0; i < 100000; i++) {
+            size_t start = rand() % 64, len = rand() % (sizeof(buf)-start);
+            size_t k;
+
+            for (k = 0; k < sizeof(buf); k++) buf[k] = 'a'+rand()%26;
+            /* Put a CR outside the range, that must never be found. */
+            if (start+len < sizeof(buf)) buf[start+len] = '\r';
+            if (rand() % 4 && len) buf[start+rand()%len] = '\r';
+            if (rand() % 4 && len) buf[start+rand()%len] = '\r';
+            assert(respFindCR(buf+start,buf+start+len) ==
+                   memchr(buf+start,'\r',len));
+        }
+    }
+    respScanInit();
+
+    assert(respParseLength("3",1,&v) == 1 && v == 3);
+    assert(respParseLength("123456789012345678",18,&v) == 1 &&
+           v == 123456789012345678LL);
+    assert(respParseLength("9223372036854775807",19,&v) == 1 &&
+           v == 9223372036854775807LL);
+    assert(respParseLength("9223372036854775808",19,&v) == 0);
+    assert(respParseLength("-1",2,&v) == 1 && v == -1);
+    assert(respParseLength("0",1,&v) == 1 && v == 0);
+    assert(respParseLength("01",2,&v) == 0);
+    assert(respParseLength("1a",2,&v) == 0);
+    assert(respParseLength("+1",2,&v) == 0);
+    assert(respParseLength("",0,&v) == 0);
+    return 0;
+}
+#endif
+
+#ifdef RESPSCAN_BENCHMARK_MAIN
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Parse every header of the pipeline like processMultibulkBuffer() does,
+ * either with strchr() and string2ll() or with the RESP scanner. Returns
+ * the number of commands found. */
+static long parsePipeline(const char *buf, size_t len, int simd) {
+    const char *p = buf, *end = buf+len, *nl;
+    long commands = 0;
+    long long ll, args;
+
+    while (p < end) {
+        nl = simd ? respFindCR(p,end) : strchr(p,'\r');
+        assert(nl != NULL && *p == '*');
+        if (simd) assert(respParseLength(p+1,nl-(p+1),&args));
+        else assert(string2ll(p+1,nl-(p+1),&args));
+        p = nl+2;
+        while (args--) {
+            nl = simd ? respFindCR(p,end) : strchr(p,'\r');
+            assert(nl != NULL && *p == '$');
+            if (simd) assert(respParseLength(p+1,nl-(p+1),&ll));
+            else assert(string2ll(p+1,nl-(p+1),&ll));
+            p = nl+2+ll+2;
+        }
+        commands++;
+    }
+    return commands;
+}
+
+/* Scan lines of 'linelen' bytes, like big inline commands. */
+static long scanLines(const char *buf, size_t len, int simd) {
+    const char *p = buf, *end = buf+len, *nl;
+    long lines = 0;
+
+    while (p < end) {
+        nl = simd ? respFindCR(p,end) : strchr(p,'\r');
+        assert(nl != NULL);
+        p = nl+2;
+        lines++;
+    }
+    return lines;
+}
+
+#define BENCHMARK_RUNS 20
+
+static void benchmark(const char *title, const char *buf, size_t len,
+                      long (*func)(const char*, size_t, int)) {
+    const char *names[] = {"strchr", "scalar", "sse2", "avx2"};
+    unsigned int j, run;
+
+    for (j = 0; j < sizeof(names)/sizeof(names[0]); j++) {
+        long long start, elapsed;
+        long count = 0;
+
+        if (j > 0 && !useScanner(names[j])) continue;
+        start = ustime();
+        for (run = 0; run < BENCHMARK_RUNS; run++)
+            count += func(buf,len,j > 0);
+        elapsed = ustime()-start;
+        printf("%s, %-6s: %ld items in %lld us (%.2f MB/s)\n",
+            title, names[j], count, elapsed,
+            (double)len*BENCHMARK_RUNS/(elapsed ? elapsed : 1));
+    }
+}
+
+/* resp-benchmark [commands] */
+int main(int argc, char **argv) {
+    long count = argc == 2 ? strtol(argv[1],NULL,10) : 1000000, j;
+    char *buf;
+    size_t len = 0, size;
+
+    /* A pipeline of SET commands with small keys and values. */
+    size = count*64+1;
+    buf = malloc(size);
+    for (j = 0; j < count; j++) {
+        char key[32], val[32];
+        int klen = snprintf(key,sizeof(key),"key:%ld",j);
+        int vlen = snprintf(val,sizeof(val),"value:%ld",j*7);
+        len += snprintf(buf+len,size-len,
+            "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%d\r\n%s\r\n",
+            klen,key,vlen,val);
+    }
+    benchmark("Pipelined SET headers",buf,len,parsePipeline);
+    free(buf);
+
+    /* Long inline commands. */
+    count /= 10;
+    size = count*258+1;
+    buf = malloc(size);
+    for (len = 0, j = 0; j < count; j++) {
+        memset(buf+len,'x',256);
+        memcpy(buf+len+256,"\r\n",2);
+        len += 258;
+    }
+    buf[len] = '\0';
+    benchmark("256 bytes lines",buf,len,scanLines);
+    free(buf);
+    return 0;
+}
+#endif
@@ -0,0 +1,81 @@
+/* Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RESPSCAN_H
+#define __RESPSCAN_H
+
+#include <stddef.h>
+#include "util.h"
+
+/* Most of the lines the query parser looks at are bulk and multibulk
+ * headers like "$3\r\n", where the CR is only a few bytes away. Those are
+ * scanned inline, and only longer lines pay the call into the vectorized
+ * scanner. */
+#define RESPSCAN_INLINE_BYTES 8
+
+const char *respFindCRSlow(const char *p, const char *end);
+void respScanInit(void);
+const char *respScanImplementation(void);
+
+/* Return a pointer to the first '\r' in the range [p,end), or NULL if the
+ * range does not contain one. Unlike strchr() the scan never looks past
+ * 'end', so that it is not affected by the data that follows. */
+static inline const char *respFindCR(const char *p, const char *end) {
+    const char *stop = end-p > RESPSCAN_INLINE_BYTES ?
+                       p+RESPSCAN_INLINE_BYTES : end;
+    while (p < stop) {
+        if (*p == '\r') return p;
+        p++;
+    }
+    return p < end ? respFindCRSlow(p,end) : NULL;
+}
+
+/* Parse the length field of a bulk or multibulk header. Plain positive
+ * numbers, that are by far the most common, are handled here, anything
+ * else is left to string2ll() so that the accepted syntax is exactly the
+ * same. Returns 1 on success, 0 on error, like string2ll(). */
+static inline int respParseLength(const char *p, size_t len, long long *value) {
+    long long v;
+    size_t j;
+
+    if (len == 0 || len > 18 || p[0] < '1' || p[0] > '9')
+        return string2ll(p,len,value);
+    v = p[0]-'0';
+    for (j = 1; j < len; j++) {
+        if (p[j] < '0' || p[j] > '9') return 0;
+        v = v*10+(p[j]-'0');
+    }
+    *value = v;
+    return 1;
+}
+
+#ifdef REDIS_TEST
+int respscanTest(int argc, char *argv[]);
+#endif
+
+#endif
@@ -572,14 +572,7 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
         reply = c->buf;
         c->bufpos = 0;
     } else {
-        reply = sdsnewlen(c->buf,c->bufpos);
-        c->bufpos = 0;
-        while(listLength(c->reply)) {
-            sds o = listNodeValue(listFirst(c->reply));
-
-            reply = sdscatsds(reply,o);
-            listDelNode(c->reply,listFirst(c->reply));
-        }
+        reply = catClientOutputBuffer(sdsempty(),c);
     }
     if (raise_error && reply[0] != '-') raise_error = 0;
     redisProtocolToLuaType(lua,reply);
@@ -69,34 +69,12 @@ static inline char sdsReqType(size_t string_size) {
     return SDS_TYPE_64;
 }
 
-/* Create a new sds string with the content specified by the 'init' pointer
- * and 'initlen'.
- * If NULL is used for 'init' the string is initialized with zero bytes.
- *
- * The string is always null-termined (all the sds strings are, always) so
- * even if you create an sds string with:
- *
- * mystring = sdsnewlen("abc",3);
- *
- * You can print the string with printf() as there is an implicit \0 at the
- * end of the string. However the string is binary safe and can contain
- * \0 characters in the middle, as the length is stored in the sds header. *///创建个新的sds串
-sds sdsnewlen(const void *init, size_t initlen) {
-    void *sh;
-    sds s;
-    char type = sdsReqType(initlen); //长度获取类型
-    /* Empty strings are usually created in order to append. Use type 8
-     * since type 5 is not good at this. */ //如果是null字符串 类型为SDS_TYPE_8
-    if (type == SDS_TYPE_5 && initlen == 0) type = SDS_TYPE_8; 
-    int hdrlen = sdsHdrSize(type); //通过type获取hdr长度
-    unsigned char *fp; /* flags pointer. */
+/* Write the header of a string of the specified type at 'sh', copy 'init'
+ * after it, and return the string. */
+static sds sdsInitHeader(void *sh, char type, const void *init, size_t initlen) {
+    sds s = (char*)sh+sdsHdrSize(type); //s指向buf起始位置
+    unsigned char *fp = ((unsigned char*)s)-1; /* flags pointer. */
 
-    sh = s_malloc(hdrlen+initlen+1);//分配内存空间
-    if (!init)
-        memset(sh, 0, hdrlen+initlen+1); //初始化内存0
-    if (sh == NULL) return NULL;
-    s = (char*)sh+hdrlen; //s指向buf起始位置
-    fp = ((unsigned char*)s)-1;
     switch(type) {
         case SDS_TYPE_5: {
             *fp = type | (initlen << SDS_TYPE_BITS);
@@ -137,6 +115,51 @@ sds sdsnewlen(const void *init, size_t initlen) {
     return s;
 }
 
+/* Create a new sds string with the content specified by the 'init' pointer
+ * and 'initlen'.
+ * If NULL is used for 'init' the string is initialized with zero bytes.
+ *
+ * The string is always null-termined (all the sds strings are, always) so
+ * even if you create an sds string with:
+ *
+ * mystring = sdsnewlen("abc",3);
+ *
+ * You can print the string with printf() as there is an implicit \0 at the
+ * end of the string. However the string is binary safe and can contain
+ * \0 characters in the middle, as the length is stored in the sds header. *///创建个新的sds串
+sds sdsnewlen(const void *init, size_t initlen) {
+    void *sh;
+    char type = sdsReqType(initlen); //长度获取类型
+    /* Empty strings are usually created in order to append. Use type 8
+     * since type 5 is not good at this. */ //如果是null字符串 类型为SDS_TYPE_8
+    if (type == SDS_TYPE_5 && initlen == 0) type = SDS_TYPE_8; 
+    int hdrlen = sdsHdrSize(type); //通过type获取hdr长度
+
+    sh = s_malloc(hdrlen+initlen+1);//分配内存空间
+    if (sh == NULL) return NULL;
+    if (!init)
+        memset(sh, 0, hdrlen+initlen+1); //初始化内存0
+    return sdsInitHeader(sh, type, init, initlen);
+}
+
+/* Return the number of bytes sdsnewinplace() needs to create a string of
+ * 'initlen' bytes. */
+size_t sdsInPlaceSize(size_t initlen) {
+    char type = sdsReqType(initlen);
+    if (type == SDS_TYPE_5 && initlen == 0) type = SDS_TYPE_8;
+    return sdsHdrSize(type)+initlen+1;
+}
+
+/* Like sdsnewlen(), but the string is created inside 'buf', that must be at
+ * least sdsInPlaceSize(initlen) bytes, so that it can be part of a bigger
+ * allocation. Such strings can be read, but must never be freed nor resized
+ * with the sds API. */
+sds sdsnewinplace(void *buf, const void *init, size_t initlen) {
+    char type = sdsReqType(initlen);
+    if (type == SDS_TYPE_5 && initlen == 0) type = SDS_TYPE_8;
+    return sdsInitHeader(buf, type, init, initlen);
+}
+
 /* Create an empty (zero length) sds string. Even in this case the string
  * always has an implicit null term. */ //创建个null的sds string
 sds sdsempty(void) {
@@ -33,6 +33,8 @@
 #include "bio.h"
 #include "latency.h"
 #include "atomicvar.h"
+#include "respscan.h"
+#include "wyhash.h"
 
 #include <time.h>
 #include <signal.h>
@@ -479,6 +481,19 @@ void dictSdsDestructor(void *privdata, void *val)
     sdsfree(val);
 }
 
+/* Copy an sds key inside the dictionary entry. The key is followed by one
+ * byte where the keyspace stores the size bin of the value, see the
+ * "Keysizes" section of db.c. */
+size_t dictSdsEmbedLen(const void *key) {
+    return sdsInPlaceSize(sdslen((sds)key))+1;
+}
+
+void *dictSdsEmbed(void *buf, const void *key) {
+    sds s = sdsnewinplace(buf,key,sdslen((sds)key));
+    s[sdslen(s)+1] = 0;
+    return s;
+}
+
 int dictObjKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
@@ -571,14 +586,18 @@ dictType zsetDictType = {
     NULL                       /* val destructor */
 };
 
-/* Db->dict, keys are sds strings, vals are Redis objects. */
+/* Db->dicts, keys are sds strings embedded in the entries, vals are Redis
+ * objects. */
 dictType dbDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
-    dictSdsDestructor,          /* key destructor */
-    dictObjectDestructor   /* val destructor */
+    NULL,                       /* key destructor */
+    dictObjectDestructor,       /* val destructor */
+    DICT_LAYOUT_CHAINED,        /* layout, see initServer() */
+    dictSdsEmbedLen,            /* key embed len */
+    dictSdsEmbed                /* key embed */
 };
 
 /* server.lua_scripts sha (as sds string) -> scripts (as robj) cache. */
@@ -591,7 +610,8 @@ dictType shaScriptObjectDictType = {
     dictObjectDestructor        /* val destructor */
 };
 
-/* Db->expires */
+/* Db->expires, keys are the sds strings of the db->dicts entries, vals are
+ * the db->dicts entries. */
 dictType keyptrDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
@@ -700,33 +720,94 @@ int htNeedsResize(dict *dict) {
 }
 
 /* If the percentage of used slots in the HT reaches HASHTABLE_MIN_FILL
- * we resize the hash table to save memory */
+ * we resize the hash table to save memory. When the keyspace is partitioned
+ * only CRON_DICTS_PER_CALL dicts are checked at every call. */
 void tryResizeHashTables(int dbid) {
-    if (htNeedsResize(server.db[dbid].dict))
-        dictResize(server.db[dbid].dict);
+    redisDb *db = server.db+dbid;
+    int j;
+
+    for (j = 0; j < CRON_DICTS_PER_CALL && j < db->ndicts; j++) {
+        if (htNeedsResize(db->dicts[db->resize_cursor]))
+            dictResize(db->dicts[db->resize_cursor]);
+        db->resize_cursor = (db->resize_cursor+1) % db->ndicts;
+    }
     if (htNeedsResize(server.db[dbid].expires))
         dictResize(server.db[dbid].expires);
 }
 
 /* Our hash table implementation performs rehashing incrementally while
  * we write/read from the hash table. Still if the server is idle, the hash
- * table will use two tables for a long time. So we try to use 1 millisecond
- * of CPU time at every call of this function to perform some rehahsing.
+ * table will use two tables for a long time. So we try to use 'budget'
+ * microseconds of CPU time at every call of this function to perform some
+ * rehahsing. Paused rehashings (see dictRehashPaused()) are skipped.
  *
  * The function returns 1 if some rehashing was performed, otherwise 0
  * is returned. */
-int incrementallyRehash(int dbid) {
-    /* Keys dictionary */
-    if (dictIsRehashing(server.db[dbid].dict)) {
-        dictRehashMilliseconds(server.db[dbid].dict,1);
-        return 1; /* already used our millisecond for this loop... */
+int incrementallyRehash(int dbid, long long budget) {
+    redisDb *db = server.db+dbid;
+    long long start = ustime();
+    int j, work_done = 0;
+
+    /* Keys dictionaries: once a dict is rehashed go on with the next ones
+     * until the budget is used. The cursor stays on a dict that is still
+     * rehashing, so that the next call continues from it. */
+    for (j = 0; j < CRON_DICTS_PER_CALL && j < db->ndicts; j++) {
+        dict *d = db->dicts[db->rehash_cursor];
+
+        if (dictIsRehashing(d) && !dictRehashPaused(d)) {
+            dictRehashMicroseconds(d,budget-(ustime()-start));
+            work_done = 1;
+            if (ustime()-start >= budget) return 1;
+        }
+        db->rehash_cursor = (db->rehash_cursor+1) % db->ndicts;
     }
     /* Expires */
-    if (dictIsRehashing(server.db[dbid].expires)) {
-        dictRehashMilliseconds(server.db[dbid].expires,1);
-        return 1; /* already used our millisecond for this loop... */
+    if (dictIsRehashing(db->expires) && !dictRehashPaused(db->expires) &&
+        ustime()-start < budget)
+    {
+        dictRehashMicroseconds(db->expires,budget-(ustime()-start));
+        work_done = 1;
     }
-    return 0;
+    return work_done;
+}
+
+/* Return the time to spend rehashing in this cron call. The writes add
+ * entries to the tables being rehashed, and under a heavy write load the
+ * table may fill up to the point of needing another expansion before the
+ * rehashing is done, so the more writes since the previous call, the more
+ * time is used, up to ACTIVE_REHASH_MAX_US. */
+long long activeRehashBudget(void) {
+    static long long last_dirty = 0;
+    long long writes = server.dirty - last_dirty, budget;
+
+    last_dirty = server.dirty;
+    if (writes < 0) writes = 0;
+    budget = ACTIVE_REHASH_BASE_US + writes/ACTIVE_REHASH_WRITES_PER_US;
+    return budget > ACTIVE_REHASH_MAX_US ? ACTIVE_REHASH_MAX_US : budget;
+}
+
+/* Switch to the hash function selected by the configuration. The command
+ * table and the modules API table are populated before the configuration is
+ * loaded, so their entries are rehashed. Sentinel keeps the default, since
+ * parsing its configuration already populated its tables. */
+void setupHashFunction(void) {
+    if (server.sentinel_mode ||
+        server.hash_function == dictGetHashFunction()) return;
+    dictSetHashFunction(server.hash_function);
+    dictRehashEntries(server.commands);
+    dictRehashEntries(server.orig_commands);
+    dictRehashEntries(server.moduleapi);
+}
+
+/* Return true if a child is saving the dataset and the fork friendly mode is
+ * enabled. In this state the active deletion of the expired keys is
+ * suspended: every page the parent writes is copied by the kernel, and the
+ * child still holds the original, so reclaiming memory while the child runs
+ * makes the total memory usage grow instead. The LRU/LFU updates are
+ * suspended whenever a child exists, see touchValue(). */
+int forkFriendlyActive(void) {
+    return server.fork_friendly &&
+           (server.rdb_child_pid != -1 || server.aof_child_pid != -1);
 }
 
 /* This function is called once a background process of some kind terminates,
@@ -833,6 +914,19 @@ int clientsCronResizeQueryBuffer(client *c) {
     return 0;
 }
 
+/* Free the pool of argument objects of clients that are idle, since it is
+ * only useful while commands keep arriving.
+ *
+ * The function always returns 0 as it never terminates the client. */
+int clientsCronFreeArgvPool(client *c) {
+    if (c->argv_pool &&
+        server.unixtime - c->lastinteraction > CLIENT_ARGV_POOL_IDLE)
+    {
+        freeClientArgvPool(c);
+    }
+    return 0;
+}
+
 #define CLIENTS_CRON_MIN_ITERATIONS 5
 void clientsCron(void) {
     /* Make sure to process at least numclients/server.hz of clients
@@ -865,6 +959,7 @@ void clientsCron(void) {
          * terminated. */
         if (clientsCronHandleTimeout(c,now)) continue;
         if (clientsCronResizeQueryBuffer(c)) continue;
+        if (clientsCronFreeArgvPool(c)) continue;
     }
 }
 
@@ -907,8 +1002,15 @@ void databasesCron(void) {
 
         /* Rehash */
         if (server.activerehashing) {
+            long long budget = activeRehashBudget(), latency;
+
             for (j = 0; j < dbs_per_call; j++) {
-                int work_done = incrementallyRehash(rehash_db);
+                int work_done;
+
+                latencyStartMonitor(latency);
+                work_done = incrementallyRehash(rehash_db,budget);
+                latencyEndMonitor(latency);
+                latencyAddSampleIfNeeded("active-rehash",latency);
                 if (work_done) {
                     /* If the function did some work, stop here, we'll do
                      * more at the next cron loop. */
@@ -1007,8 +1109,8 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         for (j = 0; j < server.dbnum; j++) {
             long long size, used, vkeys;
 
-            size = dictSlots(server.db[j].dict);
-            used = dictSize(server.db[j].dict);
+            size = dbSlots(server.db+j);
+            used = dbSize(server.db+j);
             vkeys = dictSize(server.db[j].expires);
             if (used || vkeys) {
                 serverLog(LL_VERBOSE,"DB %d: %lld keys (%lld volatile) in %lld slots HT.",j,used,vkeys,size);
@@ -1034,6 +1136,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* Handle background operations on Redis databases. */
     databasesCron();
 
+    /* Release a chunk of the huge values scheduled for incremental
+     * freeing. */
+    lazyfreeIncrementalCycle(LAZYFREE_INCREMENTAL_CYCLE_SLOW);
+
     /* Start a scheduled AOF rewrite if this was requested by the user while
      * a BGSAVE was in progress. */
     if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
@@ -1076,6 +1182,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             }
             updateDictResizePolicy();
             closeChildInfoPipe();
+            server.stat_current_cow_bytes = 0;
+        } else {
+            /* Still running: read the progress reports of the child. */
+            receiveChildInfo();
         }
     } else {
         /* If there is not a background saving/rewrite in progress check if
@@ -1136,6 +1246,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* Close clients that need to be closed asynchronous */
     freeClientsInAsyncFreeQueue();
 
+    /* Stop the I/O threads if we don't have enough pending work. */
+    stopThreadedIOIfNeeded();
+
     /* Clear the paused clients flag if needed. */
     clientsArePaused(); /* Don't check return value, just use the side effect.*/
 
@@ -1186,6 +1299,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 void beforeSleep(struct aeEventLoop *eventLoop) {
     UNUSED(eventLoop);
 
+    /* Execute the commands of the clients whose query buffer was read and
+     * parsed by the I/O threads in the previous event loop iteration. */
+    handleClientsWithPendingReadsUsingThreads();
+
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
      * so it's a good idea to call it before serving the unblocked clients
@@ -1197,6 +1314,20 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     if (server.active_expire_enabled && server.masterhost == NULL)
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
 
+    /* Release more of the values scheduled for incremental freeing if the
+     * serverCron() cycle could not keep up. */
+    lazyfreeIncrementalCycle(LAZYFREE_INCREMENTAL_CYCLE_FAST);
+
+    /* Evict some key in advance if the used memory is above the high
+     * watermark, so that clients rarely need to wait for the eviction. Like
+     * the active expire, this is up to the master: slaves just receive the
+     * DELs. */
+    if (server.masterhost == NULL) evictionBackgroundCycle();
+
+    /* Submit the objects deleted asynchronously in this iteration to the
+     * lazyfree threads. */
+    lazyfreeFlush();
+
     /* Send all the slaves an ACK request if at least one client blocked
      * during the previous event loop iteration. */
     if (server.get_ack_from_slaves) {
@@ -1228,8 +1359,11 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
 
-    /* Handle writes with pending output buffers. */
-    handleClientsWithPendingWrites();
+    /* Handle writes with pending output buffers. The clients left in the
+     * list have their flush deferred: don't block in the next iteration,
+     * so that the flush is not delayed more than reply-flush-budget. */
+    handleClientsWithPendingWritesUsingThreads();
+    aeSetDontWait(server.el,listLength(server.clients_pending_write) != 0);
 
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
@@ -1345,6 +1479,9 @@ void initServerConfig(void) {
     pthread_mutex_init(&server.next_client_id_mutex,NULL);
     pthread_mutex_init(&server.lruclock_mutex,NULL);
     pthread_mutex_init(&server.unixtime_mutex,NULL);
+    pthread_mutex_init(&server.stat_net_input_bytes_mutex,NULL);
+    pthread_mutex_init(&server.stat_net_output_bytes_mutex,NULL);
+    pthread_mutex_init(&server.stat_net_output_syscalls_mutex,NULL);
 
     getRandomHexChars(server.runid,CONFIG_RUN_ID_SIZE);
     server.runid[CONFIG_RUN_ID_SIZE] = '\0';
@@ -1356,17 +1493,26 @@ void initServerConfig(void) {
     server.arch_bits = (sizeof(long) == 8) ? 64 : 32;
     server.port = CONFIG_DEFAULT_SERVER_PORT;
     server.tcp_backlog = CONFIG_DEFAULT_TCP_BACKLOG;
+    server.tcp_listeners = CONFIG_DEFAULT_TCP_LISTENERS;
+    server.accept_time_budget = CONFIG_DEFAULT_ACCEPT_TIME_BUDGET;
+    server.reply_flush_budget = CONFIG_DEFAULT_REPLY_FLUSH_BUDGET;
     server.bindaddr_count = 0;
     server.unixsocket = NULL;
     server.unixsocketperm = CONFIG_DEFAULT_UNIX_SOCKET_PERM;
     server.ipfd_count = 0;
     server.sofd = -1;
     server.protected_mode = CONFIG_DEFAULT_PROTECTED_MODE;
+    server.io_threads_num = CONFIG_DEFAULT_IO_THREADS_NUM;
+    server.io_threads_do_reads = CONFIG_DEFAULT_IO_THREADS_DO_READS;
+    server.keys_filter_threads = CONFIG_DEFAULT_KEYS_FILTER_THREADS;
+    server.io_uring = CONFIG_DEFAULT_IO_URING;
+    server.zero_copy_reply_threshold = CONFIG_DEFAULT_ZERO_COPY_REPLY_THRESHOLD;
     server.dbnum = CONFIG_DEFAULT_DBNUM;
     server.verbosity = CONFIG_DEFAULT_VERBOSITY;
     server.maxidletime = CONFIG_DEFAULT_CLIENT_TIMEOUT;
     server.tcpkeepalive = CONFIG_DEFAULT_TCP_KEEPALIVE;
     server.active_expire_enabled = 1;
+    server.active_expire_index = CONFIG_DEFAULT_ACTIVE_EXPIRE_INDEX;
     server.active_defrag_enabled = CONFIG_DEFAULT_ACTIVE_DEFRAG;
     server.active_defrag_ignore_bytes = CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES;
     server.active_defrag_threshold_lower = CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER;
@@ -1408,8 +1554,12 @@ void initServerConfig(void) {
     server.requirepass = NULL;
     server.rdb_compression = CONFIG_DEFAULT_RDB_COMPRESSION;
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
+    server.fork_friendly = CONFIG_DEFAULT_FORK_FRIENDLY;
+    server.rdb_key_save_delay = CONFIG_DEFAULT_RDB_KEY_SAVE_DELAY;
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
+    server.keyspace_open_addressing = CONFIG_DEFAULT_KEYSPACE_OPEN_ADDRESSING;
+    server.hash_function = CONFIG_DEFAULT_HASH_FUNCTION;
     server.active_defrag_running = 0;
     server.notify_keyspace_events = 0;
     server.maxclients = CONFIG_DEFAULT_MAX_CLIENTS;
@@ -1417,6 +1567,11 @@ void initServerConfig(void) {
     server.maxmemory = CONFIG_DEFAULT_MAXMEMORY;
     server.maxmemory_policy = CONFIG_DEFAULT_MAXMEMORY_POLICY;
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
+    server.maxmemory_eviction_pool_size =
+        CONFIG_DEFAULT_MAXMEMORY_EVICTION_POOL_SIZE;
+    server.maxmemory_background_eviction = CONFIG_DEFAULT_MAXMEMORY_BACKGROUND_EVICTION;
+    server.maxmemory_high_watermark = CONFIG_DEFAULT_MAXMEMORY_HIGH_WATERMARK;
+    server.maxmemory_low_watermark = CONFIG_DEFAULT_MAXMEMORY_LOW_WATERMARK;
     server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
     server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
     server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
@@ -1441,6 +1596,8 @@ void initServerConfig(void) {
     server.migrate_cached_sockets = dictCreate(&migrateCacheDictType,NULL);
     server.next_client_id = 1; /* Client IDs, start from 1 .*/
     server.loading_process_events_interval_bytes = (1024*1024*2);
+    server.lazyfree_threads = CONFIG_DEFAULT_LAZYFREE_THREADS;
+    server.lazyfree_incremental = CONFIG_DEFAULT_LAZYFREE_INCREMENTAL;
     server.lazyfree_lazy_eviction = CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION;
     server.lazyfree_lazy_expire = CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE;
     server.lazyfree_lazy_server_del = CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL;
@@ -1696,6 +1853,22 @@ void checkTcpBacklogSettings(void) {
 #endif
 }
 
+/* Create a single TCP listening socket for 'bindaddr' (NULL means any
+ * address). SO_REUSEPORT is only requested when more than one listener
+ * per address is configured, so that the default setup keeps refusing
+ * to share the port with other processes. */
+static int tcpListener(int port, char *bindaddr, int ipv6, int listeners) {
+    if (listeners > 1) {
+        return ipv6 ?
+            anetTcp6ReusePortServer(server.neterr,port,bindaddr,server.tcp_backlog) :
+            anetTcpReusePortServer(server.neterr,port,bindaddr,server.tcp_backlog);
+    } else {
+        return ipv6 ?
+            anetTcp6Server(server.neterr,port,bindaddr,server.tcp_backlog) :
+            anetTcpServer(server.neterr,port,bindaddr,server.tcp_backlog);
+    }
+}
+
 /* Initialize a set of file descriptors to listen to the specified 'port'
  * binding the addresses specified in the Redis server configuration.
  *
@@ -1709,66 +1882,68 @@ void checkTcpBacklogSettings(void) {
  *
  * On success the function returns C_OK.
  *
+ * When 'listeners' is greater than one, every address is bound that
+ * number of times using SO_REUSEPORT, so that the kernel can balance the
+ * incoming connections among several accept queues.
+ *
  * On error the function returns C_ERR. For the function to be on
  * error, at least one of the server.bindaddr addresses was
  * impossible to bind, or no bind addresses were specified in the server
  * configuration but the function is not able to bind * for at least
  * one of the IPv4 or IPv6 protocols. */
-int listenToPort(int port, int *fds, int *count) {
-    int j;
+int listenToPort(int port, int *fds, int *count, int listeners) {
+    int j, l;
 
     /* Force binding of 0.0.0.0 if no bind address is specified, always
      * entering the loop if j == 0. */
     if (server.bindaddr_count == 0) server.bindaddr[0] = NULL;
-    for (j = 0; j < server.bindaddr_count || j == 0; j++) {
-        if (server.bindaddr[j] == NULL) {
-            int unsupported = 0;
-            /* Bind * for both IPv6 and IPv4, we enter here only if
-             * server.bindaddr_count == 0. */
-            fds[*count] = anetTcp6Server(server.neterr,port,NULL,
-                server.tcp_backlog);
-            if (fds[*count] != ANET_ERR) {
-                anetNonBlock(NULL,fds[*count]);
-                (*count)++;
-            } else if (errno == EAFNOSUPPORT) {
-                unsupported++;
-                serverLog(LL_WARNING,"Not listening to IPv6: unsupproted");
-            }
-
-            if (*count == 1 || unsupported) {
-                /* Bind the IPv4 address as well. */
-                fds[*count] = anetTcpServer(server.neterr,port,NULL,
-                    server.tcp_backlog);
+    for (l = 0; l < listeners; l++) {
+        for (j = 0; j < server.bindaddr_count || j == 0; j++) {
+            if (server.bindaddr[j] == NULL) {
+                int unsupported = 0, bound = 0;
+                /* Bind * for both IPv6 and IPv4, we enter here only if
+                 * server.bindaddr_count == 0. */
+                fds[*count] = tcpListener(port,NULL,1,listeners);
                 if (fds[*count] != ANET_ERR) {
                     anetNonBlock(NULL,fds[*count]);
                     (*count)++;
+                    bound++;
                 } else if (errno == EAFNOSUPPORT) {
                     unsupported++;
-                    serverLog(LL_WARNING,"Not listening to IPv4: unsupproted");
+                    serverLog(LL_WARNING,"Not listening to IPv6: unsupproted");
+                }
+
+                if (bound == 1 || unsupported) {
+                    /* Bind the IPv4 address as well. */
+                    fds[*count] = tcpListener(port,NULL,0,listeners);
+                    if (fds[*count] != ANET_ERR) {
+                        anetNonBlock(NULL,fds[*count]);
+                        (*count)++;
+                        bound++;
+                    } else if (errno == EAFNOSUPPORT) {
+                        unsupported++;
+                        serverLog(LL_WARNING,"Not listening to IPv4: unsupproted");
+                    }
                 }
+                /* Exit the loop if we were able to bind * on IPv4 and IPv6,
+                 * otherwise fds[*count] will be ANET_ERR and we'll print an
+                 * error and return to the caller with an error. */
+                if (bound + unsupported == 2) break;
+            } else {
+                /* Bind the IPv6 or IPv4 address. */
+                fds[*count] = tcpListener(port,server.bindaddr[j],
+                    strchr(server.bindaddr[j],':') != NULL,listeners);
             }
-            /* Exit the loop if we were able to bind * on IPv4 and IPv6,
-             * otherwise fds[*count] will be ANET_ERR and we'll print an
-             * error and return to the caller with an error. */
-            if (*count + unsupported == 2) break;
-        } else if (strchr(server.bindaddr[j],':')) {
-            /* Bind IPv6 address. */
-            fds[*count] = anetTcp6Server(server.neterr,port,server.bindaddr[j],
-                server.tcp_backlog);
-        } else {
-            /* Bind IPv4 address. */
-            fds[*count] = anetTcpServer(server.neterr,port,server.bindaddr[j],
-                server.tcp_backlog);
-        }
-        if (fds[*count] == ANET_ERR) {
-            serverLog(LL_WARNING,
-                "Creating Server TCP listening socket %s:%d: %s",
-                server.bindaddr[j] ? server.bindaddr[j] : "*",
-                port, server.neterr);
-            return C_ERR;
+            if (fds[*count] == ANET_ERR) {
+                serverLog(LL_WARNING,
+                    "Creating Server TCP listening socket %s:%d: %s",
+                    server.bindaddr[j] ? server.bindaddr[j] : "*",
+                    port, server.neterr);
+                return C_ERR;
+            }
+            anetNonBlock(NULL,fds[*count]);
+            (*count)++;
         }
-        anetNonBlock(NULL,fds[*count]);
-        (*count)++;
     }
     return C_OK;
 }
@@ -1781,10 +1956,18 @@ void resetServerStats(void) {
 
     server.stat_numcommands = 0;
     server.stat_numconnections = 0;
+    server.stat_argv_created = 0;
+    server.stat_argv_reused = 0;
     server.stat_expiredkeys = 0;
     server.stat_expired_stale_perc = 0;
     server.stat_expired_time_cap_reached_count = 0;
     server.stat_evictedkeys = 0;
+    server.stat_evictedkeys_background = 0;
+    server.stat_eviction_idle_sum = 0;
+    server.stat_eviction_idle_keys = 0;
+    server.stat_eviction_checks = 0;
+    server.stat_eviction_check_idle_sum = 0;
+    server.stat_eviction_check_ideal_sum = 0;
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
     server.stat_active_defrag_hits = 0;
@@ -1794,6 +1977,8 @@ void resetServerStats(void) {
     server.stat_fork_time = 0;
     server.stat_fork_rate = 0;
     server.stat_rejected_conn = 0;
+    server.stat_accept_time_budget_reached = 0;
+    server.stat_reply_flushes_deferred = 0;
     server.stat_sync_full = 0;
     server.stat_sync_partial_ok = 0;
     server.stat_sync_partial_err = 0;
@@ -1806,6 +1991,10 @@ void resetServerStats(void) {
     }
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
+    server.stat_net_output_syscalls = 0;
+    server.stat_zero_copy_reply_bytes = 0;
+    server.stat_io_reads_processed = 0;
+    server.stat_io_writes_processed = 0;
     server.aof_delayed_fsync = 0;
 }
 
@@ -1828,6 +2017,7 @@ void initServer(void) {
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.clients_pending_write = listCreate();
+    server.clients_pending_read = listCreate();
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
     server.unblocked_clients = listCreate();
     server.ready_keys = listCreate();
@@ -1838,6 +2028,7 @@ void initServer(void) {
 
     createSharedObjects();
     adjustOpenFilesLimit();
+    aeSetIoUring(server.io_uring);
     server.el = aeCreateEventLoop(server.maxclients+CONFIG_FDSET_INCR);
     if (server.el == NULL) {
         serverLog(LL_WARNING,
@@ -1849,7 +2040,8 @@ void initServer(void) {
 
     /* Open the TCP listening socket for the user commands. */
     if (server.port != 0 &&
-        listenToPort(server.port,server.ipfd,&server.ipfd_count) == C_ERR)
+        listenToPort(server.port,server.ipfd,&server.ipfd_count,
+                     server.tcp_listeners) == C_ERR)
         exit(1);
 
     /* Open the listening Unix domain socket. */
@@ -1871,9 +2063,16 @@ void initServer(void) {
     }
 
     /* Create the Redis databases, and initialize other internal state. */
+    if (server.keyspace_open_addressing) {
+        dbDictType.layout = DICT_LAYOUT_BUCKETS;
+        keyptrDictType.layout = DICT_LAYOUT_BUCKETS;
+    }
     for (j = 0; j < server.dbnum; j++) {
-        server.db[j].dict = dictCreate(&dbDictType,NULL);
+        dbCreateKeyspace(&server.db[j],
+            (server.cluster_enabled && j == 0) ? CLUSTER_SLOTS : 1);
         server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        server.db[j].expires_index =
+            server.active_expire_index ? raxNew() : NULL;
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
@@ -1882,9 +2081,9 @@ void initServer(void) {
     }
     evictionPoolAlloc(); /* Initialize the LRU keys pool. */
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
-    server.pubsub_patterns = listCreate();
-    listSetFreeMethod(server.pubsub_patterns,freePubsubPattern);
-    listSetMatchMethod(server.pubsub_patterns,listMatchPubsubPattern);
+    server.pubsub_patterns = dictCreate(&keylistDictType,NULL);
+    server.pubsub_patterns_index = raxNew();
+    server.pubsub_patterns_subs = 0;
     server.cronloops = 0;
     server.rdb_child_pid = -1;
     server.aof_child_pid = -1;
@@ -1906,6 +2105,8 @@ void initServer(void) {
     server.stat_peak_memory = 0;
     server.stat_rdb_cow_bytes = 0;
     server.stat_aof_cow_bytes = 0;
+    server.stat_repl_cow_bytes = 0;
+    server.stat_current_cow_bytes = 0;
     server.resident_set_size = 0;
     server.lastbgsave_status = C_OK;
     server.aof_last_write_status = C_OK;
@@ -1971,6 +2172,8 @@ void initServer(void) {
     slowlogInit();
     latencyMonitorInit();
     bioInit();
+    initThreadedIO();
+    keysFilterInit();
     server.initial_memory_usage = zmalloc_used_memory();
 }
 
@@ -2319,6 +2522,7 @@ void call(client *c, int flags) {
     }
     server.also_propagate = prev_also_propagate;
     server.stat_numcommands++;
+    c->commands++;
 }
 
 /* If this function gets called we already read a whole
@@ -2873,6 +3077,8 @@ sds genRedisInfoString(char *section) {
             "arch_bits:%d\r\n"
             "multiplexing_api:%s\r\n"
             "atomicvar_api:%s\r\n"
+            "resp_scanner:%s\r\n"
+            "hash_function:%s\r\n"
             "gcc_version:%d.%d.%d\r\n"
             "process_id:%ld\r\n"
             "run_id:%s\r\n"
@@ -2892,6 +3098,8 @@ sds genRedisInfoString(char *section) {
             server.arch_bits,
             aeGetApiName(),
             REDIS_ATOMIC_API,
+            respScanImplementation(),
+            dictGetHashFunction() == DICT_HASH_WYHASH ? "wyhash" : "siphash",
 #ifdef __GNUC__
             __GNUC__,__GNUC_MINOR__,__GNUC_PATCHLEVEL__,
 #else
@@ -2974,7 +3182,8 @@ sds genRedisInfoString(char *section) {
             "mem_fragmentation_ratio:%.2f\r\n"
             "mem_allocator:%s\r\n"
             "active_defrag_running:%d\r\n"
-            "lazyfree_pending_objects:%zu\r\n",
+            "lazyfree_pending_objects:%zu\r\n"
+            "lazyfree_pending_bytes:%zu\r\n",
             zmalloc_used,
             hmem,
             server.resident_set_size,
@@ -2996,7 +3205,8 @@ sds genRedisInfoString(char *section) {
             mh->fragmentation,
             ZMALLOC_LIB,
             server.active_defrag_running,
-            lazyfreeGetPendingObjectsCount()
+            lazyfreeGetPendingObjectsCount(),
+            lazyfreeGetPendingBytes()
         );
         freeMemoryOverheadData(mh);
     }
@@ -3021,7 +3231,10 @@ sds genRedisInfoString(char *section) {
             "aof_current_rewrite_time_sec:%jd\r\n"
             "aof_last_bgrewrite_status:%s\r\n"
             "aof_last_write_status:%s\r\n"
-            "aof_last_cow_size:%zu\r\n",
+            "aof_last_cow_size:%zu\r\n"
+            "repl_last_cow_size:%zu\r\n"
+            "current_cow_size:%zu\r\n"
+            "fork_friendly_active:%d\r\n",
             server.loading,
             server.dirty,
             server.rdb_child_pid != -1,
@@ -3039,7 +3252,10 @@ sds genRedisInfoString(char *section) {
                 -1 : time(NULL)-server.aof_rewrite_time_start),
             (server.aof_lastbgrewrite_status == C_OK) ? "ok" : "err",
             (server.aof_last_write_status == C_OK) ? "ok" : "err",
-            server.stat_aof_cow_bytes);
+            server.stat_aof_cow_bytes,
+            server.stat_repl_cow_bytes,
+            server.stat_current_cow_bytes,
+            forkFriendlyActive());
 
         if (server.aof_state != AOF_OFF) {
             info = sdscatprintf(info,
@@ -3093,24 +3309,46 @@ sds genRedisInfoString(char *section) {
 
     /* Stats */
     if (allsections || defsections || !strcasecmp(section,"stats")) {
+        long long stale_lag;
+        unsigned long long stale_keys = getExpiredStaleKeys(&stale_lag);
+        unsigned long long evicted_idle = server.stat_eviction_idle_keys ?
+            server.stat_eviction_idle_sum/server.stat_eviction_idle_keys : 0;
+        unsigned long long ideal_idle = server.stat_eviction_checks ?
+            server.stat_eviction_check_ideal_sum/
+            server.stat_eviction_checks : 0;
+
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info,
             "# Stats\r\n"
             "total_connections_received:%lld\r\n"
             "total_commands_processed:%lld\r\n"
+            "argv_objects_allocated:%lld\r\n"
+            "argv_objects_reused:%lld\r\n"
             "instantaneous_ops_per_sec:%lld\r\n"
             "total_net_input_bytes:%lld\r\n"
             "total_net_output_bytes:%lld\r\n"
+            "total_net_output_syscalls:%lld\r\n"
+            "net_output_bytes_per_syscall:%.2f\r\n"
+            "total_zero_copy_reply_bytes:%lld\r\n"
+            "reply_flushes_deferred:%lld\r\n"
             "instantaneous_input_kbps:%.2f\r\n"
             "instantaneous_output_kbps:%.2f\r\n"
             "rejected_connections:%lld\r\n"
+            "accept_time_budget_reached:%lld\r\n"
             "sync_full:%lld\r\n"
             "sync_partial_ok:%lld\r\n"
             "sync_partial_err:%lld\r\n"
             "expired_keys:%lld\r\n"
             "expired_stale_perc:%.2f\r\n"
             "expired_time_cap_reached_count:%lld\r\n"
+            "expired_stale_keys:%llu\r\n"
+            "expired_stale_lag_ms:%lld\r\n"
             "evicted_keys:%lld\r\n"
+            "evicted_keys_background:%lld\r\n"
+            "eviction_background_active:%d\r\n"
+            "evicted_keys_avg_idle_ms:%llu\r\n"
+            "evicted_keys_ideal_idle_ms:%llu\r\n"
+            "eviction_lru_quality:%.2f\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
@@ -3121,33 +3359,63 @@ sds genRedisInfoString(char *section) {
             "active_defrag_hits:%lld\r\n"
             "active_defrag_misses:%lld\r\n"
             "active_defrag_key_hits:%lld\r\n"
-            "active_defrag_key_misses:%lld\r\n",
+            "active_defrag_key_misses:%lld\r\n"
+            "io_threaded_reads_processed:%lld\r\n"
+            "io_threaded_writes_processed:%lld\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
+            server.stat_argv_created,
+            server.stat_argv_reused,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
             server.stat_net_input_bytes,
             server.stat_net_output_bytes,
+            server.stat_net_output_syscalls,
+            server.stat_net_output_syscalls ?
+                (double)server.stat_net_output_bytes/
+                        server.stat_net_output_syscalls : 0,
+            server.stat_zero_copy_reply_bytes,
+            server.stat_reply_flushes_deferred,
             (float)getInstantaneousMetric(STATS_METRIC_NET_INPUT)/1024,
             (float)getInstantaneousMetric(STATS_METRIC_NET_OUTPUT)/1024,
             server.stat_rejected_conn,
+            server.stat_accept_time_budget_reached,
             server.stat_sync_full,
             server.stat_sync_partial_ok,
             server.stat_sync_partial_err,
             server.stat_expiredkeys,
             server.stat_expired_stale_perc*100,
             server.stat_expired_time_cap_reached_count,
+            stale_keys,
+            stale_lag,
             server.stat_evictedkeys,
+            server.stat_evictedkeys_background,
+            server.eviction_background_active,
+            evicted_idle,
+            ideal_idle,
+            !server.stat_eviction_checks ? 0 :
+            !server.stat_eviction_check_ideal_sum ? 1 :
+                (double)server.stat_eviction_check_idle_sum/
+                        server.stat_eviction_check_ideal_sum,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
-            listLength(server.pubsub_patterns),
+            server.pubsub_patterns_subs,
             server.stat_fork_time,
             dictSize(server.migrate_cached_sockets),
             getSlaveKeyWithExpireCount(),
             server.stat_active_defrag_hits,
             server.stat_active_defrag_misses,
             server.stat_active_defrag_key_hits,
-            server.stat_active_defrag_key_misses);
+            server.stat_active_defrag_key_misses,
+            server.stat_io_reads_processed,
+            server.stat_io_writes_processed);
+    }
+
+    /* Threads */
+    if (allsections || defsections || !strcasecmp(section,"threads")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info, "# Threads\r\n");
+        info = genIOThreadsInfoString(info);
     }
 
     /* Replication */
@@ -3329,7 +3597,7 @@ sds genRedisInfoString(char *section) {
         for (j = 0; j < server.dbnum; j++) {
             long long keys, vkeys;
 
-            keys = dictSize(server.db[j].dict);
+            keys = dbSize(server.db+j);
             vkeys = dictSize(server.db[j].expires);
             if (keys || vkeys) {
                 info = sdscatprintf(info,
@@ -3338,6 +3606,43 @@ sds genRedisInfoString(char *section) {
             }
         }
     }
+
+    /* Keys by type and size */
+    if (allsections || defsections || !strcasecmp(section,"keysizes")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info, "# Keysizes\r\n");
+        for (j = 0; j < server.dbnum; j++) {
+            keysizesStats *ks = &server.db[j].keysizes;
+            int type, bin;
+
+            if (dbSize(server.db+j) == 0) continue;
+            info = sdscatprintf(info,"db%d_keys_by_type:",j);
+            for (type = 0; type < OBJ_TYPES; type++) {
+                info = sdscatprintf(info,"%s%s=%llu", type ? "," : "",
+                    keysizesTypeNames[type], ks->keys[type]);
+            }
+            info = sdscat(info,"\r\n");
+
+            /* The histograms of the types with keys, listing only the
+             * bins that are not empty, labeled by the smallest size they
+             * count: the length of strings, the elements of aggregates. */
+            for (type = 0; type < OBJ_TYPES; type++) {
+                int first = 1;
+
+                if (ks->keys[type] == 0 || type == OBJ_MODULE) continue;
+                info = sdscatprintf(info,"db%d_distrib_%s_%s:",j,
+                    keysizesTypeNames[type],
+                    type == OBJ_STRING ? "sizes" : "items");
+                for (bin = 0; bin < KEYSIZES_BINS; bin++) {
+                    if (ks->bins[type][bin] == 0) continue;
+                    info = sdscatprintf(info,"%s%llu=%llu", first ? "" : ",",
+                        keysizesBinStart(bin), ks->bins[type][bin]);
+                    first = 0;
+                }
+                info = sdscat(info,"\r\n");
+            }
+        }
+    }
     return info;
 }
 
@@ -3725,6 +4030,12 @@ int main(int argc, char **argv) {
             return endianconvTest(argc, argv);
         } else if (!strcasecmp(argv[2], "crc64")) {
             return crc64Test(argc, argv);
+        } else if (!strcasecmp(argv[2], "respscan")) {
+            return respscanTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "wyhash")) {
+            return wyhashTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "dict")) {
+            return dictTest(argc, argv);
         }
 
         return -1; /* test not found */
@@ -3742,6 +4053,7 @@ int main(int argc, char **argv) {
     char hashseed[16];
     getRandomHexChars(hashseed,sizeof(hashseed));
     dictSetHashFunctionSeed((uint8_t*)hashseed);
+    respScanInit();
     server.sentinel_mode = checkForSentinelMode(argc,argv);
     initServerConfig();
     moduleInitModulesSystem();
@@ -3834,6 +4146,7 @@ int main(int argc, char **argv) {
         loadServerConfig(configfile,options);
         sdsfree(options);
     }
+    setupHashFunction();
 
     serverLog(LL_WARNING, "oO0OoO0OoO0Oo Redis is starting oO0OoO0OoO0Oo");
     serverLog(LL_WARNING,
@@ -83,6 +83,10 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_MAX_HZ            500
 #define CONFIG_DEFAULT_SERVER_PORT        6379    /* TCP port */
 #define CONFIG_DEFAULT_TCP_BACKLOG       511     /* TCP listen backlog */
+#define CONFIG_DEFAULT_TCP_LISTENERS 1
+#define CONFIG_TCP_LISTENERS_MAX 16     /* SO_REUSEPORT sockets per address */
+#define CONFIG_DEFAULT_ACCEPT_TIME_BUDGET 1000 /* Microseconds, 0 = no limit. */
+#define CONFIG_DEFAULT_REPLY_FLUSH_BUDGET 100 /* Microseconds, 0 = disabled. */
 #define CONFIG_DEFAULT_CLIENT_TIMEOUT       0       /* default client timeout: infinite */
 #define CONFIG_DEFAULT_DBNUM     16
 #define CONFIG_MAX_LINE    1024
@@ -124,6 +128,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
+#define CONFIG_DEFAULT_FORK_FRIENDLY 0
+#define CONFIG_DEFAULT_RDB_KEY_SAVE_DELAY 0
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
@@ -134,6 +140,12 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
 #define CONFIG_DEFAULT_MAXMEMORY 0
 #define CONFIG_DEFAULT_MAXMEMORY_SAMPLES 5
+#define CONFIG_DEFAULT_MAXMEMORY_EVICTION_POOL_SIZE 64
+#define CONFIG_MIN_MAXMEMORY_EVICTION_POOL_SIZE 16
+#define CONFIG_MAX_MAXMEMORY_EVICTION_POOL_SIZE 1024
+#define CONFIG_DEFAULT_MAXMEMORY_BACKGROUND_EVICTION 0
+#define CONFIG_DEFAULT_MAXMEMORY_HIGH_WATERMARK 95 /* % of maxmemory */
+#define CONFIG_DEFAULT_MAXMEMORY_LOW_WATERMARK 90 /* % of maxmemory */
 #define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
 #define CONFIG_DEFAULT_LFU_DECAY_TIME 1
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
@@ -141,6 +153,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
 #define CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE 0
 #define CONFIG_DEFAULT_ACTIVE_REHASHING 1
+#define CONFIG_DEFAULT_KEYSPACE_OPEN_ADDRESSING 1
+#define CONFIG_DEFAULT_HASH_FUNCTION DICT_HASH_SIPHASH
 #define CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
 #define CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE 0
 #define CONFIG_DEFAULT_MIN_SLAVES_MAX_LAG 10
@@ -151,6 +165,15 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD 0
 #define CONFIG_DEFAULT_SLAVE_LAZY_FLUSH 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION 0
+#define CONFIG_DEFAULT_LAZYFREE_THREADS 1
+#define CONFIG_DEFAULT_LAZYFREE_INCREMENTAL 0
+#define LAZYFREE_INCREMENTAL_CYCLE_PERC 10 /* CPU max % for incremental free */
+#define LAZYFREE_INCREMENTAL_FAST_DURATION 1000 /* Microseconds */
+#define LAZYFREE_INCREMENTAL_MAX_JOBS 1024 /* Values pending before the */
+#define LAZYFREE_INCREMENTAL_MAX_BYTES (64*1024*1024) /* writers free. */
+#define LAZYFREE_INCREMENTAL_CYCLE_SLOW 0
+#define LAZYFREE_INCREMENTAL_CYCLE_FAST 1
+#define LAZYFREE_MAX_THREADS 16
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL 0
 #define CONFIG_DEFAULT_ALWAYS_SHOW_LOGO 0
@@ -161,12 +184,30 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MIN 25 /* 25% CPU min (at lower threshold) */
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MAX 75 /* 75% CPU max (at upper threshold) */
 #define CONFIG_DEFAULT_PROTO_MAX_BULK_LEN (512ll*1024*1024) /* Bulk request max size */
+#define CONFIG_DEFAULT_IO_THREADS_NUM 1 /* Single threaded by default */
+#define CONFIG_DEFAULT_IO_THREADS_DO_READS 0 /* Read + parse from threads? */
+#define IO_THREADS_MAX_NUM 128
+#define CONFIG_DEFAULT_KEYS_FILTER_THREADS 0
+#define KEYS_FILTER_MAX_THREADS 16
+#define KEYS_FILTER_BATCH 8192      /* Keys matched in parallel at a time. */
+#define KEYS_FILTER_MIN_BATCH 1024  /* Smaller batches use no threads. */
+#define CONFIG_DEFAULT_IO_URING 1 /* Used only if compiled in. */
+#define CONFIG_DEFAULT_ZERO_COPY_REPLY_THRESHOLD (16*1024) /* 0 = disabled */
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
 #define ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC 25 /* CPU max % for keys collection */
 #define ACTIVE_EXPIRE_CYCLE_SLOW 0
+#define EVICTION_BACKGROUND_DURATION 1000 /* Microseconds */
 #define ACTIVE_EXPIRE_CYCLE_FAST 1
+#define ACTIVE_EXPIRE_INDEX_TTL_SAMPLES 3 /* Lookups for avg_ttl with index. */
+#define CONFIG_DEFAULT_ACTIVE_EXPIRE_INDEX 0
+
+#define CRON_DICTS_PER_CALL 1024 /* Partitioned keyspace dicts to visit. */
+#define ACTIVE_REHASH_BASE_US 1000 /* Rehashing time per cron call. */
+#define ACTIVE_REHASH_MAX_US 5000 /* Max time under heavy write load. */
+#define ACTIVE_REHASH_WRITES_PER_US 10 /* Writes since the last call that
+                                          add a microsecond of rehashing. */
 
 /* Instantaneous metrics tracking. */
 #define STATS_METRIC_SAMPLES 16     /* Number of samples per metric. */
@@ -181,6 +222,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_SHARED_REPLY_MIN_LEN 1024 /* See addReplySharedProto(). */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
@@ -249,6 +291,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_LUA_DEBUG (1<<25)  /* Run EVAL in debug mode. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
+#define CLIENT_PENDING_READ (1<<28) /* The client has pending reads and was put
+                                       in the list of clients we can read
+                                       from using the I/O threads. */
+#define CLIENT_PENDING_COMMAND (1<<29) /* An I/O thread parsed a command that
+                                          the main thread should execute. */
+#define CLIENT_MORE_INPUT (1<<30) /* The last read filled the read buffer, so
+                                     more pipelined commands may follow. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -367,6 +416,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define MAXMEMORY_FLAG_LRU (1<<0)
 #define MAXMEMORY_FLAG_LFU (1<<1)
 #define MAXMEMORY_FLAG_ALLKEYS (1<<2)
+#define MAXMEMORY_FLAG_SIZE (1<<3)
 #define MAXMEMORY_FLAG_NO_SHARED_INTEGERS \
     (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU)
 
@@ -378,6 +428,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define MAXMEMORY_ALLKEYS_LFU ((5<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_ALLKEYS_RANDOM ((6<<8)|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_NO_EVICTION (7<<8)
+#define MAXMEMORY_VOLATILE_GDSF ((8<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_SIZE)
+#define MAXMEMORY_ALLKEYS_GDSF ((9<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_SIZE|MAXMEMORY_FLAG_ALLKEYS)
 
 #define CONFIG_DEFAULT_MAXMEMORY_POLICY MAXMEMORY_NO_EVICTION
 
@@ -465,6 +517,7 @@ typedef long long mstime_t; /* millisecond time type. */
  * in order to dispatch the loading to the right module, plus a 10 bits
  * encoding version. */
 #define OBJ_MODULE 5
+#define OBJ_TYPES (OBJ_MODULE+1)
 
 /* Extract encver / signature from a module type ID. */
 #define REDISMODULE_TYPE_ENCVER_BITS 10
@@ -577,6 +630,10 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
 #define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
 
+/* The current limit of 44 is chosen so that the biggest string object
+ * we allocate as EMBSTR will still fit into the 64 byte arena of jemalloc. */
+#define OBJ_ENCODING_EMBSTR_SIZE_LIMIT 44
+
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
 #define LRU_CLOCK_RESOLUTION 1000 /* LRU clock resolution in ms */
@@ -605,17 +662,35 @@ typedef struct redisObject {
 
 struct evictionPoolEntry; /* Defined in evict.c */
 
+/* Number of keys of every type, and histograms of their sizes in power of
+ * two bins. See the "Keysizes" section of db.c. */
+#define KEYSIZES_BINS 65
+typedef struct keysizesStats {
+    unsigned long long keys[OBJ_TYPES];
+    unsigned long long bins[OBJ_TYPES][KEYSIZES_BINS];
+    unsigned long long bytes;   /* Values size estimated from the bins. */
+} keysizesStats;
+
 /* Redis database representation. There are multiple databases identified
  * by integers from 0 (the default database) up to the max configured
  * database. The database number is the 'id' field in the structure. */
 typedef struct redisDb {
-    dict *dict;                 /* The keyspace for this DB */
+    dict **dicts;               /* The keyspace for this DB, partitioned in
+                                   one dict per hash slot in cluster mode.
+                                   NULL terminated. See dbKeyDict(). */
+    int ndicts;                 /* Number of dicts in the keyspace. */
+    unsigned long long size;    /* Keys in all the dicts, see dbSize(). */
+    int resize_cursor;          /* Next dict checked for resizing. */
+    int rehash_cursor;          /* Next dict checked for rehashing. */
     dict *expires;              /* Timeout of keys with a timeout set */
+    rax *expires_index;         /* Volatile keys by expire time, NULL if
+                                   active-expire-index is disabled. */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
     dict *ready_keys;           /* Blocked keys that received a PUSH */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
     int id;                     /* Database ID */
     long long avg_ttl;          /* Average TTL, just for stats */
+    keysizesStats keysizes;     /* Keys by type and size, for INFO. */
 } redisDb;
 
 /* Client MULTI/EXEC state */
@@ -671,6 +746,31 @@ typedef struct readyList {
     robj *key;
 } readyList;
 
+/* Node of the client reply list. The protocol is normally accumulated in
+ * the 'buf' sds string, however large bulk values are not copied at all:
+ * the block just holds a reference to the RAW encoded string object, whose
+ * content is sent as it is. Exactly one of 'buf' and 'obj' is not NULL. */
+typedef struct clientReplyBlock {
+    sds buf;                /* Protocol to send. */
+    robj *obj;              /* Referenced string object to send. */
+} clientReplyBlock;
+
+/* Argument objects released after a command are not freed when no one
+ * else references them, but kept here and reused by the query parser for
+ * the next arguments, so that small SET / GET requests don't pay an
+ * allocation and a free per argument. Objects are grouped by the size of
+ * their allocation in steps of CLIENT_ARGV_POOL_STEP bytes, from 32 to 64
+ * bytes that is the biggest EMBSTR encoded object. */
+#define CLIENT_ARGV_POOL_STEP 16
+#define CLIENT_ARGV_POOL_MIN 2      /* Smallest class: 2*16 = 32 bytes. */
+#define CLIENT_ARGV_POOL_CLASSES 3  /* 32, 48 and 64 bytes. */
+#define CLIENT_ARGV_POOL_DEPTH 4    /* Objects per class. */
+#define CLIENT_ARGV_POOL_IDLE 2     /* Free the pool if idle for N seconds. */
+typedef struct clientArgvPool {
+    robj *objs[CLIENT_ARGV_POOL_CLASSES][CLIENT_ARGV_POOL_DEPTH];
+    int count[CLIENT_ARGV_POOL_CLASSES];
+} clientArgvPool;
+
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a linked list. */
 typedef struct client {
@@ -679,23 +779,32 @@ typedef struct client {
     redisDb *db;            /* Pointer to currently SELECTed DB. */
     robj *name;             /* As set by CLIENT SETNAME. */
     sds querybuf;           /* Buffer we use to accumulate client queries. */
+    size_t qb_pos;          /* The position we have read in querybuf. */
     sds pending_querybuf;   /* If this is a master, this buffer represents the
                                yet not applied replication stream that we
                                are receiving from the master. */
     size_t querybuf_peak;   /* Recent (100ms or more) peak of querybuf size. */
     int argc;               /* Num of arguments of current command. */
     robj **argv;            /* Arguments of current command. */
+    int argv_len;           /* Size of the argv array, may be > argc. */
+    clientArgvPool *argv_pool; /* Released argument objects to reuse. */
+    long long argv_created; /* Argument objects allocated and reused since */
+    long long argv_reused;  /* the last time the stats were collected. */
     struct redisCommand *cmd, *lastcmd;  /* Last command executed. */
     int reqtype;            /* Request protocol type: PROTO_REQ_* */
     int multibulklen;       /* Number of multi bulk arguments left to read. */
     long bulklen;           /* Length of bulk argument in multi bulk request. */
-    list *reply;            /* List of reply objects to send to the client. */
+    list *reply;            /* List of clientReplyBlock to send to the client. */
     unsigned long long reply_bytes; /* Tot bytes of objects in reply list. */
     size_t sentlen;         /* Amount of bytes already sent in the current
                                buffer or object being sent. */
     time_t ctime;           /* Client creation time. */
     time_t lastinteraction; /* Time of the last interaction, used for timeout */
     time_t obuf_soft_limit_reached_time;
+    long long flush_deferred_since; /* ustime() of the first deferred flush of
+                                       the pending replies, 0 if none. */
+    unsigned long long commands; /* Commands executed by the client. */
+    unsigned long long writes;   /* Write calls that sent the replies. */
     int flags;              /* Client flags: CLIENT_* macros. */
     int authenticated;      /* When requirepass is non-NULL. */
     int replstate;          /* Replication state if this is a slave. */
@@ -832,6 +941,7 @@ struct redisMemOverhead {
         size_t dbid;
         size_t overhead_ht_main;
         size_t overhead_ht_expires;
+        size_t keys_by_type[OBJ_TYPES];
     } *db;
 };
 
@@ -870,6 +980,8 @@ struct clusterState;
 #define CHILD_INFO_MAGIC 0xC17DDA7A12345678LL
 #define CHILD_INFO_TYPE_RDB 0
 #define CHILD_INFO_TYPE_AOF 1
+#define CHILD_INFO_TYPE_REPL 2  /* RDB sent to slaves by a diskless sync. */
+#define CHILD_INFO_PERIOD 1000  /* Ms between the reports of a running child. */
 
 struct redisServer {
     /* General */
@@ -885,6 +997,8 @@ struct redisServer {
     unsigned int lruclock;      /* Clock for LRU eviction */
     int shutdown_asap;          /* SHUTDOWN needed ASAP */
     int activerehashing;        /* Incremental rehash in serverCron() */
+    int keyspace_open_addressing; /* Bucketed layout for the keyspace. */
+    int hash_function;          /* DICT_HASH_* used by the hash tables. */
     int active_defrag_running;  /* Active defragmentation running (holds current scan aggressiveness) */
     char *requirepass;          /* Pass for AUTH command, or NULL */
     char *pidfile;              /* PID file path */
@@ -907,7 +1021,11 @@ struct redisServer {
     int bindaddr_count;         /* Number of addresses in server.bindaddr[] */
     char *unixsocket;           /* UNIX socket path */
     mode_t unixsocketperm;      /* UNIX socket permission */
-    int ipfd[CONFIG_BINDADDR_MAX]; /* TCP socket file descriptors */
+    int tcp_listeners;          /* Listening sockets per bind address. */
+    long long accept_time_budget; /* Max usec accepting per listener and
+                                     loop iteration. */
+    long long reply_flush_budget; /* Max usec to defer flushing replies. */
+    int ipfd[CONFIG_BINDADDR_MAX*CONFIG_TCP_LISTENERS_MAX]; /* TCP socket fds */
     int ipfd_count;             /* Used slots in ipfd[] */
     int sofd;                   /* Unix socket file descriptor */
     int cfd[CONFIG_BINDADDR_MAX];/* Cluster bus listening socket */
@@ -915,6 +1033,7 @@ struct redisServer {
     list *clients;              /* List of active clients */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
+    list *clients_pending_read;  /* Client has pending read socket buffers. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     client *current_client; /* Current client, only used on crash report */
     int clients_paused;         /* True if clients are currently paused */
@@ -923,6 +1042,13 @@ struct redisServer {
     dict *migrate_cached_sockets;/* MIGRATE cached sockets */
     uint64_t next_client_id;    /* Next client unique ID. Incremental. */
     int protected_mode;         /* Don't accept external connections. */
+    int io_threads_num;         /* Number of I/O threads to use. */
+    int io_threads_do_reads;    /* Read and parse from I/O threads? */
+    int keys_filter_threads;    /* Helper threads matching KEYS patterns. */
+    int io_uring;               /* Use the io_uring event loop if available. */
+    long long stat_io_reads_processed;  /* Reads handled by the I/O threads. */
+    long long stat_io_writes_processed; /* Writes handled by the I/O threads. */
+    size_t zero_copy_reply_threshold; /* Min bulk len sent by reference. */
     /* RDB / AOF loading information */
     int loading;                /* We are loading data from disk if true */
     off_t loading_total_bytes;
@@ -937,10 +1063,27 @@ struct redisServer {
     time_t stat_starttime;          /* Server start time */
     long long stat_numcommands;     /* Number of processed commands */
     long long stat_numconnections;  /* Number of connections received */
+    long long stat_argv_created;    /* Argument objects allocated. */
+    long long stat_argv_reused;     /* Argument objects reused from pools. */
+    long long stat_accept_time_budget_reached; /* Accepts deferred to next
+                                                  event loop iteration. */
+    long long stat_reply_flushes_deferred; /* Reply flushes deferred to merge
+                                              them with the next replies. */
     long long stat_expiredkeys;     /* Number of expired keys */
     double stat_expired_stale_perc; /* Percentage of keys probably expired */
     long long stat_expired_time_cap_reached_count; /* Early expire cylce stops.*/
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
+    long long stat_evictedkeys_background; /* Evicted by the background
+                                              eviction cycle. */
+    unsigned long long stat_eviction_idle_sum; /* Idle ms of evicted keys. */
+    long long stat_eviction_idle_keys;  /* Keys in stat_eviction_idle_sum. */
+    long long stat_eviction_checks;     /* Evictions compared with a perfect
+                                           LRU, see evictionQualityCheck(). */
+    unsigned long long stat_eviction_check_idle_sum;  /* Idle ms of the keys
+                                                         checked. */
+    unsigned long long stat_eviction_check_ideal_sum; /* Idle ms of the keys
+                                                         a perfect LRU would
+                                                         evict instead. */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
     long long stat_active_defrag_hits;      /* number of allocations moved */
@@ -961,8 +1104,12 @@ struct redisServer {
     size_t resident_set_size;       /* RSS sampled in serverCron(). */
     long long stat_net_input_bytes; /* Bytes read from network. */
     long long stat_net_output_bytes; /* Bytes written to network. */
+    long long stat_net_output_syscalls; /* Write syscalls to network. */
+    long long stat_zero_copy_reply_bytes; /* Reply bytes queued by reference. */
     size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
     size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
+    size_t stat_repl_cow_bytes;     /* Copy on write bytes during diskless sync. */
+    size_t stat_current_cow_bytes;  /* Copy on write bytes of the active child. */
     /* The following two are used to track instantaneous metrics, like
      * number of operations per second, network traffic. */
     struct {
@@ -976,6 +1123,7 @@ struct redisServer {
     int maxidletime;                /* Client timeout in seconds */
     int tcpkeepalive;               /* Set SO_KEEPALIVE if non-zero. */
     int active_expire_enabled;      /* Can be disabled for testing purposes. */
+    int active_expire_index;        /* Index the volatile keys by expire. */
     int active_defrag_enabled;
     size_t active_defrag_ignore_bytes; /* minimum amount of fragmentation waste to start active defrag */
     int active_defrag_threshold_lower; /* minimum percentage of fragmentation to start active defrag */
@@ -1033,6 +1181,8 @@ struct redisServer {
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
     int rdb_checksum;               /* Use RDB checksum? */
+    int fork_friendly;              /* Spare the pages shared with children. */
+    long long rdb_key_save_delay;   /* Child sleeps us per key, for tests. */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -1047,6 +1197,7 @@ struct redisServer {
     int child_info_pipe[2];         /* Pipe used to write the child_info_data. */
     struct {
         int process_type;           /* AOF or RDB child? */
+        int progress;               /* Sent while the child is running? */
         size_t cow_size;            /* Copy on write size. */
         unsigned long long magic;   /* Magic value to make sure data is valid. */
     } child_info_data;
@@ -1121,6 +1272,11 @@ struct redisServer {
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Pricision of random sampling */
+    int maxmemory_eviction_pool_size; /* Eviction candidates kept. */
+    int maxmemory_background_eviction; /* Evict before reaching maxmemory. */
+    int maxmemory_high_watermark;   /* Start background eviction, in %. */
+    int maxmemory_low_watermark;    /* Stop background eviction, in %. */
+    int eviction_background_active; /* Background eviction in progress. */
     int lfu_log_factor;             /* LFU logarithmic counter factor. */
     int lfu_decay_time;             /* LFU counter decay factor. */
     long long proto_max_bulk_len;   /* Protocol bulk length maximum size. */
@@ -1149,7 +1305,9 @@ struct redisServer {
     long long mstime;   /* Like 'unixtime' but with milliseconds resolution. */
     /* Pubsub */
     dict *pubsub_channels;  /* Map channels to list of subscribed clients */
-    list *pubsub_patterns;  /* A list of pubsub_patterns */
+    dict *pubsub_patterns;  /* Map patterns to list of subscribed clients */
+    rax *pubsub_patterns_index; /* Literal prefix -> list of patterns */
+    unsigned long pubsub_patterns_subs; /* Number of pattern subscriptions */
     int notify_keyspace_events; /* Events to propagate via Pub/Sub. This is an
                                    xor of NOTIFY_... flags. */
     /* Cluster */
@@ -1185,6 +1343,8 @@ struct redisServer {
     int lua_kill;         /* Kill the script if true. */
     int lua_always_replicate_commands; /* Default replication type. */
     /* Lazy free */
+    int lazyfree_threads;           /* Threads releasing lazyfree objects. */
+    int lazyfree_incremental;       /* Free huge values from serverCron(). */
     int lazyfree_lazy_eviction;
     int lazyfree_lazy_expire;
     int lazyfree_lazy_server_del;
@@ -1205,13 +1365,11 @@ struct redisServer {
     pthread_mutex_t lruclock_mutex;
     pthread_mutex_t next_client_id_mutex;
     pthread_mutex_t unixtime_mutex;
+    pthread_mutex_t stat_net_input_bytes_mutex;
+    pthread_mutex_t stat_net_output_bytes_mutex;
+    pthread_mutex_t stat_net_output_syscalls_mutex;
 };
 
-typedef struct pubsubPattern {
-    client *client;
-    robj *pattern;
-} pubsubPattern;
-
 typedef void redisCommandProc(client *c);
 typedef int *redisGetKeysProc(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 struct redisCommand {
@@ -1343,15 +1501,18 @@ void closeTimedoutClients(void);
 void freeClient(client *c);
 void freeClientAsync(client *c);
 void resetClient(client *c);
+void freeClientArgvPool(client *c);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void *addDeferredMultiBulkLength(client *c);
 void setDeferredMultiBulkLength(client *c, void *node, long length);
 void processInputBuffer(client *c);
+int processCommandAndResetClient(client *c);
 void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void addReplyString(client *c, const char *s, size_t len);
+void addReplySharedProto(client *c, robj *proto);
 void addReplyBulk(client *c, robj *obj);
 void addReplyBulkCString(client *c, const char *s);
 void addReplyBulkCBuffer(client *c, const void *p, size_t len);
@@ -1369,6 +1530,9 @@ void copyClientOutputBuffer(client *dst, client *src);
 size_t sdsZmallocSize(sds s);
 size_t getStringObjectSdsUsedMemory(robj *o);
 void *dupClientReplyValue(void *o);
+void freeClientReplyValue(void *o);
+sds catClientOutputBuffer(sds s, client *c);
+void copyClientsReplyObjects(void);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
 char *getClientPeerId(client *client);
@@ -1385,12 +1549,22 @@ int getClientTypeByName(char *name);
 char *getClientTypeName(int class);
 void flushSlavesOutputBuffers(void);
 void disconnectSlaves(void);
-int listenToPort(int port, int *fds, int *count);
+int listenToPort(int port, int *fds, int *count, int listeners);
 void pauseClients(mstime_t duration);
 int clientsArePaused(void);
 int processEventsWhileBlocked(void);
 int handleClientsWithPendingWrites(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+void initThreadedIO(void);
+
+/* keysfilter.c -- Parallel KEYS pattern matching */
+void keysFilterInit(void);
+void keysFilterMatch(const char *pattern, int patlen, sds *keys, size_t count, unsigned char *match);
+int stopThreadedIOIfNeeded(void);
+sds genIOThreadsInfoString(sds info);
 int clientHasPendingReplies(client *c);
+void clientInstallWriteHandler(client *c);
 void unlinkClient(client *c);
 int writeToClient(int fd, client *c, int handler_installed);
 
@@ -1448,12 +1622,15 @@ robj *createObject(int type, void *ptr);
 robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
 robj *createEmbeddedStringObject(const char *ptr, size_t len);
+robj *initEmbeddedStringObject(robj *o, const char *ptr, size_t len);
 robj *dupStringObject(const robj *o);
 int isSdsRepresentableAsLongLong(sds s, long long *llval);
 int isObjectRepresentableAsLongLong(robj *o, long long *llongval);
 robj *tryObjectEncoding(robj *o);
 robj *getDecodedObject(robj *o);
 size_t stringObjectLen(robj *o);
+#define OBJ_ESTIMATE_ELE_SIZE 16 /* Bytes per element, objectEstimateSize() */
+size_t objectEstimateSize(robj *o);
 robj *createStringObjectFromLongLong(long long value);
 robj *createStringObjectFromLongDouble(long double value, int humanfriendly);
 robj *createQuicklistObject(void);
@@ -1540,7 +1717,10 @@ ssize_t aofReadDiffFromParent(void);
 void openChildInfoPipe(void);
 void closeChildInfoPipe(void);
 void sendChildInfo(int process_type);
+void setChildInfoType(int ptype);
+void sendChildInfoProgress(void);
 void receiveChildInfo(void);
+int forkFriendlyActive(void);
 
 /* Sorted sets data type */
 
@@ -1572,6 +1752,7 @@ typedef struct {
 } zlexrangespec;
 
 zskiplist *zslCreate(void);
+void zslFreeNode(zskiplistNode *node);
 void zslFree(zskiplist *zsl);
 zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele);
 unsigned char *zzlInsert(unsigned char *zl, sds ele, double score);
@@ -1607,6 +1788,7 @@ int zslLexValueLteMax(sds value, zlexrangespec *spec);
 
 /* Core functions */
 int freeMemoryIfNeeded(void);
+void evictionBackgroundCycle(void);
 int processCommand(client *c);
 void setupSignalHandlers(void);
 struct redisCommand *lookupCommand(sds name);
@@ -1630,6 +1812,7 @@ void serverLogRaw(int level, const char *msg);
 void serverLogFromHandler(int level, const char *msg);
 void usage(void);
 void updateDictResizePolicy(void);
+void setupHashFunction(void);
 int htNeedsResize(dict *dict);
 void populateCommandTable(void);
 void resetCommandTableStats(void);
@@ -1691,8 +1874,6 @@ int hashTypeSet(robj *o, sds field, sds value, int flags);
 /* Pub / Sub */
 int pubsubUnsubscribeAllChannels(client *c, int notify);
 int pubsubUnsubscribeAllPatterns(client *c, int notify);
-void freePubsubPattern(void *p);
-int listMatchPubsubPattern(void *a, void *b);
 int pubsubPublishMessage(robj *channel, robj *message);
 
 /* Keyspace events notification */
@@ -1708,18 +1889,53 @@ struct rewriteConfigState; /* Forward declaration to export API. */
 void rewriteConfigRewriteLine(struct rewriteConfigState *state, const char *option, sds line, int force);
 int rewriteConfig(char *path);
 
+/* db.c -- Keyspace partitions */
+typedef struct dbIterator {
+    redisDb *db;
+    int didx;                   /* Index of the dict being iterated. */
+    int lastidx;                /* Index of the last dict to iterate. */
+    int safe;
+    dictIterator *di;
+} dbIterator;
+
+void dbCreateKeyspace(redisDb *db, int ndicts);
+dict *dbKeyDict(redisDb *db, sds key);
+dictEntry *dbFind(redisDb *db, sds key);
+unsigned long long dbSize(redisDb *db);
+unsigned long long dbSlots(redisDb *db);
+size_t dbTableMemUsage(redisDb *db);
+dict *dbRandomDict(redisDb *db);
+unsigned long dbScan(redisDb *db, unsigned long cursor, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata);
+unsigned long dbScanDict(redisDb *db, int didx, unsigned long cursor, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata);
+void dbIteratorInit(dbIterator *it, redisDb *db, int safe);
+void dbIteratorInitDict(dbIterator *it, redisDb *db, int didx, int safe);
+dictEntry *dbIteratorNext(dbIterator *it);
+void dbIteratorRelease(dbIterator *it);
+
 /* db.c -- Keyspace access API */
 int removeExpire(redisDb *db, robj *key);
 void propagateExpire(redisDb *db, robj *key, int lazy);
 int expireIfNeeded(redisDb *db, robj *key);
 long long getExpire(redisDb *db, robj *key);
 void setExpire(client *c, redisDb *db, robj *key, long long when);
+long long dbEntryGetExpire(redisDb *db, dictEntry *de);
+size_t dbEntryMemUsage(redisDb *db, dictEntry *de);
+char *getObjectTypeName(robj *o);
+extern const char *keysizesTypeNames[OBJ_TYPES];
+unsigned long long keysizesBinStart(int bin);
+void keysizesAdd(redisDb *db, dictEntry *de);
+void keysizesRemove(redisDb *db, dictEntry *de);
+void keysizesRememberEntry(redisDb *db, dictEntry *de);
+void keysizesForgetEntry(dictEntry *de);
+void keysizesUpdate(redisDb *db, robj *key);
 robj *lookupKey(redisDb *db, robj *key, int flags);
 robj *lookupKeyRead(redisDb *db, robj *key);
 robj *lookupKeyWrite(redisDb *db, robj *key);
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags);
+void lookupKeysReadBatch(redisDb *db, robj **keys, int count, robj **vals, int flags);
+void dbPrefetchKeys(redisDb *db, robj **keys, int count);
 robj *objectCommandLookup(client *c, robj *key);
 robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply);
 #define LOOKUP_NONE 0
@@ -1746,13 +1962,14 @@ unsigned int delKeysInSlot(unsigned int hashslot);
 int verifyClusterConfigWithData(void);
 void scanGenericCommand(client *c, robj *o, unsigned long cursor);
 int parseScanCursorOrReply(client *c, robj *o, unsigned long *cursor);
-void slotToKeyAdd(robj *key);
-void slotToKeyDel(robj *key);
-void slotToKeyFlush(void);
 int dbAsyncDelete(redisDb *db, robj *key);
 void emptyDbAsync(redisDb *db);
-void slotToKeyFlushAsync(void);
 size_t lazyfreeGetPendingObjectsCount(void);
+size_t lazyfreeGetPendingBytes(void);
+unsigned long long lazyfreeGetSubmittedBytes(void);
+void lazyfreeFlush(void);
+int lazyfreeIncrementalFree(robj *o);
+void lazyfreeIncrementalCycle(int type);
 
 /* API to get key arguments from commands */
 int *getKeysFromCommand(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
@@ -1767,6 +1984,7 @@ int *georadiusGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numk
 void clusterInit(void);
 unsigned short crc16(const char *buf, int len);
 unsigned int keyHashSlot(char *key, int keylen);
+int patternHashSlot(char *pattern, int length);
 void clusterCron(void);
 void clusterPropagatePublish(robj *channel, robj *message);
 void migrateCloseTimedoutSockets(void);
@@ -1801,6 +2019,12 @@ void disconnectAllBlockedClients(void);
 
 /* expire.c -- Handling of expired keys */
 void activeExpireCycle(int type);
+void expireIndexAdd(redisDb *db, sds key, long long when);
+void expireIndexRemove(redisDb *db, sds key, long long when);
+void expireIndexBuild(redisDb *db);
+void expireIndexRelease(redisDb *db);
+unsigned long long expireIndexDueKeys(redisDb *db, long long now, long long *oldest, unsigned long long max);
+unsigned long long getExpiredStaleKeys(long long *lag);
 void expireSlaveKeys(void);
 void rememberSlaveKeyWithExpire(redisDb *db, robj *key);
 void flushSlaveKeysWithExpireList(void);
@@ -1808,15 +2032,19 @@ size_t getSlaveKeyWithExpireCount(void);
 
 /* evict.c -- maxmemory handling and LRU eviction. */
 void evictionPoolAlloc(void);
+void evictionPoolEmpty(int dbid);
 #define LFU_INIT_VAL 5
 unsigned long LFUGetTimeInMinutes(void);
 uint8_t LFULogIncr(uint8_t value);
 unsigned long LFUDecrAndReturn(robj *o);
+double LFUEstimateAccesses(unsigned long counter);
 
 /* Keys hashing / comparison functions for dict.c hash tables. */
 uint64_t dictSdsHash(const void *key);
 int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
 void dictSdsDestructor(void *privdata, void *val);
+size_t dictSdsEmbedLen(const void *key);
+void *dictSdsEmbed(void *buf, const void *key);
 
 /* Git SHA1 */
 char *redisGitSHA1(void);
@@ -870,9 +870,12 @@ void handleClientsBlockedOnLists(void) {
 
                 if (listTypeLength(o) == 0) {
                     dbDelete(rl->db,rl->key); //删除key表
+                } else {
+                    keysizesUpdate(rl->db,rl->key);
                 }
                 /* We don't call signalModifiedKey() as it was already called
-                 * when an element was pushed on the list. */
+                 * when an element was pushed on the list, however the pops
+                 * changed the size of the list. */
             }
 
             /* Free this item. */
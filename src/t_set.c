@@ -802,6 +802,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
     unsigned long j, cardinality = 0;
     int encoding;
     //根据dstkey确定以读或写的方式查找key列表集合
+    dbPrefetchKeys(c->db,setkeys,setnum);
     for (j = 0; j < setnum; j++) {
         robj *setobj = dstkey ?
             lookupKeyWrite(c->db,setkeys[j]) :
@@ -284,11 +284,20 @@ void getrangeCommand(client *c) {
 }
 //MGET key [key ...] 返回所有(一个或多个)给定 key 的值。如果给定的 key 里面，有某个 key 不存在，那么这个 key 返回特殊值 nil 。因此，该命令永不失败。
 void mgetCommand(client *c) {
+    robj *vals[DICT_FIND_BATCH];
     int j;
 
     addReplyMultiBulkLen(c,c->argc-1);
     for (j = 1; j < c->argc; j++) {
-        robj *o = lookupKeyRead(c->db,c->argv[j]); //查找key的值
+        robj *o;
+
+        /* Look up the keys DICT_FIND_BATCH at a time. */
+        if ((j-1) % DICT_FIND_BATCH == 0) {
+            int count = c->argc-j < DICT_FIND_BATCH ? c->argc-j :
+                                                      DICT_FIND_BATCH;
+            lookupKeysReadBatch(c->db,c->argv+j,count,vals,LOOKUP_NONE);
+        }
+        o = vals[(j-1) % DICT_FIND_BATCH]; //查找key的值
         if (o == NULL) {
             addReply(c,shared.nullbulk);
         } else { //写应答消息
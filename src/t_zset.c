@@ -2166,6 +2166,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
 
     /* read keys to be used for input */
     src = zcalloc(sizeof(zsetopsrc) * setnum);
+    dbPrefetchKeys(c->db,c->argv+3,setnum);
     for (i = 0, j = 3; i < setnum; i++, j++) {
         robj *obj = lookupKeyWrite(c->db,c->argv[j]);
         if (obj != NULL) {
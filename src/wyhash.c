@@ -0,0 +1,371 @@
+/* Keyed hash function for hash tables, an alternative to SipHash.
+ *
+ * wyhash (final version 4) was written by Wang Yi and dedicated to the
+ * public domain under The Unlicense <http://unlicense.org/>:
+ *
+ *   This is free and unencumbered software released into the public domain.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * This version was modified for Redis in the following ways:
+ *
+ * 1. The prototype is the same of siphash() in siphash.c: the function
+ *    gets a 16 bytes key, the first 8 bytes are used as seed and the
+ *    others are mixed in the seed together with the first secret, at no
+ *    additional cost compared to the original seed scrambling.
+ * 2. A case insensitive variant is provided, like siphash_nocase(). The
+ *    words read from the input are lowercased 8 bytes at a time with the
+ *    usual SWAR trick, so unlike siphash_nocase() it does not need to look
+ *    at each byte separately. Only ASCII letters are considered.
+ * 3. Only the 64x64->128 bit multiplication with full mixing is used.
+ *
+ * The function is much faster than SipHash for short keys and scales well
+ * for long ones since it consumes 48 bytes per loop with three independent
+ * multiplications. It is keyed, but unlike SipHash it is not designed to be
+ * a PRF, so SipHash remains the default (see the hash-function option).
+ *
+ * Input words are read in the native byte order: the hash values are only
+ * used in memory and don't need to be the same across architectures.
+ *
+ * The copyright below covers only the changes 1 and 2, the rest of the
+ * code is the original public domain wyhash.
+ *
+ * Copyright (c) 2018, The Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "wyhash.h"
+
+static const uint64_t wysecret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+static inline void wymum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha*hb, rm0 = ha*lb, rm1 = hb*la, rl = la*lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl, lo, hi;
+
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static inline uint64_t wymix(uint64_t a, uint64_t b) {
+    wymum(&a,&b);
+    return a^b;
+}
+
+/* Turn the ASCII upper case letters of the 8 bytes of 'x' into lower case.
+ * For each byte the high bit of 'ge' is set if the low 7 bits are >= 'A',
+ * and the one of 'gt' if they are > 'Z'. Adding 0x20 is the same as setting
+ * that bit for upper case letters. */
+static inline uint64_t wylower(uint64_t x) {
+    uint64_t low7 = x & 0x7f7f7f7f7f7f7f7fULL;
+    uint64_t ge = low7 + 0x3f3f3f3f3f3f3f3fULL;
+    uint64_t gt = low7 + 0x2525252525252525ULL;
+    uint64_t upper = ge & ~gt & ~x & 0x8080808080808080ULL;
+    return x | (upper >> 2);
+}
+
+static inline uint64_t wyr8(const uint8_t *p, int nocase) {
+    uint64_t v;
+    memcpy(&v,p,8);
+    return nocase ? wylower(v) : v;
+}
+
+static inline uint64_t wyr4(const uint8_t *p, int nocase) {
+    uint32_t v;
+    memcpy(&v,p,4);
+    return nocase ? wylower(v) : v;
+}
+
+static inline uint64_t wyr3(const uint8_t *p, size_t k, int nocase) {
+    uint64_t v = (((uint64_t)p[0]) << 16) | (((uint64_t)p[k>>1]) << 8) |
+                 p[k-1];
+    return nocase ? wylower(v) : v;
+}
+
+/* The 'nocase' argument is always a constant, so the compiler generates two
+ * specialized versions of this function. */
+static inline uint64_t wyhashGeneric(const uint8_t *p, size_t len,
+                                     const uint8_t *k, int nocase)
+{
+    uint64_t seed, k0, k1, a, b;
+
+    memcpy(&k0,k,8);
+    memcpy(&k1,k+8,8);
+    seed = k0 ^ wymix(k0^wysecret[0],k1^wysecret[1]);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wyr4(p,nocase) << 32) | wyr4(p+((len>>3)<<2),nocase);
+            b = (wyr4(p+len-4,nocase) << 32) |
+                wyr4(p+len-4-((len>>3)<<2),nocase);
+        } else if (len > 0) {
+            a = wyr3(p,len,nocase);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p,nocase)^wysecret[1],
+                             wyr8(p+8,nocase)^seed);
+                see1 = wymix(wyr8(p+16,nocase)^wysecret[2],
+                             wyr8(p+24,nocase)^see1);
+                see2 = wymix(wyr8(p+32,nocase)^wysecret[3],
+                             wyr8(p+40,nocase)^see2);
+                p += 48;
+                i -= 48;
+            } while(i > 48);
+            seed ^= see1^see2;
+        }
+        while(i > 16) {
+            seed = wymix(wyr8(p,nocase)^wysecret[1],wyr8(p+8,nocase)^seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p+i-16,nocase);
+        b = wyr8(p+i-8,nocase);
+    }
+    a ^= wysecret[1];
+    b ^= seed;
+    wymum(&a,&b);
+    return wymix(a^wysecret[0]^len,b^wysecret[1]);
+}
+
+uint64_t wyhash(const uint8_t *in, const size_t inlen, const uint8_t *k) {
+    return wyhashGeneric(in,inlen,k,0);
+}
+
+uint64_t wyhash_nocase(const uint8_t *in, const size_t inlen, const uint8_t *k) {
+    return wyhashGeneric(in,inlen,k,1);
+}
+
+#ifdef REDIS_TEST
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <ctype.h>
+
+#define UNUSED(x) (void)(x)
+
+int wyhashTest(int argc, char *argv[]) {
+    uint8_t key[16], key2[16];
+    unsigned char buf[256], lower[256];
+    unsigned long flips = 0, samples = 0;
+    size_t len, j;
+    UNUSED(argc);
+    UNUSED(argv);
+
+    for (j = 0; j < sizeof(key); j++) key[j] = rand();
+    memcpy(key2,key,sizeof(key));
+    key2[15] ^= 1;
+
+    printf("Testing the case insensitive variant and the key\n");
+    for (len = 0; len < sizeof(buf); len++) {
+        for (j = 0; j < len; j++) {
+            /* Include letters and the bytes right around them. */
+            buf[j] = "@AZ[`az{"[rand()%8] + (rand()%2)*(rand()%26);
+            if (rand()%8 == 0) buf[j] = rand();
+            lower[j] = (buf[j] >= 'A' && buf[j] <= 'Z') ? buf[j]+32 : buf[j];
+        }
+        assert(wyhash_nocase(buf,len,key) == wyhash(lower,len,key));
+        assert(wyhash_nocase(lower,len,key) == wyhash(lower,len,key));
+        assert(wyhash(buf,len,key) != wyhash(buf,len,key2));
+    }
+
+    printf("Testing that every input bit affects half of the output\n");
+    for (len = 1; len < 100; len++) {
+        for (j = 0; j < len; j++) buf[j] = rand();
+        uint64_t h = wyhash(buf,len,key);
+        for (j = 0; j < len*8; j++) {
+            buf[j/8] ^= 1<<(j%8);
+            flips += __builtin_popcountll(h^wyhash(buf,len,key));
+            buf[j/8] ^= 1<<(j%8);
+            samples++;
+        }
+    }
+    double avg = (double)flips/samples;
+    printf("Average output bits flipped: %.2f\n", avg);
+    assert(avg > 31.5 && avg < 32.5);
+    return 0;
+}
+#endif
+
+#ifdef HASH_BENCHMARK_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/time.h>
+
+uint64_t siphash(const uint8_t *in, const size_t inlen, const uint8_t *k);
+uint64_t siphash_nocase(const uint8_t *in, const size_t inlen, const uint8_t *k);
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Keys are stored one after the other in 'buf', 'off' and 'len' tell
+ * where each key is. */
+struct keyset {
+    char *buf;
+    size_t *off, *len;
+    long count;
+};
+
+/* Append a key to the set, using one of the shapes below. */
+static void addKey(struct keyset *ks, size_t *used, int shape) {
+    char *p = ks->buf+*used;
+    int len, j;
+
+    switch(shape) {
+    case 0: /* Short counters and ids, like "user:1000" or "sess:42". */
+        len = sprintf(p,"%s:%ld",rand()%2 ? "user" : "s",
+                      (long)(rand()%10000000));
+        break;
+    case 1: /* Medium keys with an UUID-like part. */
+        len = sprintf(p,"session:%08x-%04x-%04x-%04x-%08x%04x",
+                      rand(),rand()&0xffff,rand()&0xffff,rand()&0xffff,
+                      rand(),rand()&0xffff);
+        break;
+    default: /* Long keys, like URLs or composite keys. */
+        len = 64+rand()%192;
+        memcpy(p,"cache:https://www.example.com/",30);
+        for (j = 30; j < len; j++) p[j] = 'a'+rand()%26;
+        break;
+    }
+    ks->off[ks->count] = *used;
+    ks->len[ks->count] = len;
+    ks->count++;
+    *used += len;
+}
+
+/* Create 'count' keys. 'mix' is the percentage of short, medium and long
+ * keys. */
+static void createKeyset(struct keyset *ks, long count, const int *mix) {
+    size_t used = 0;
+    long j;
+
+    ks->buf = malloc(count*256);
+    ks->off = malloc(sizeof(size_t)*count);
+    ks->len = malloc(sizeof(size_t)*count);
+    ks->count = 0;
+    for (j = 0; j < count; j++) {
+        int r = rand()%100;
+        addKey(ks,&used,r < mix[0] ? 0 : (r < mix[0]+mix[1] ? 1 : 2));
+    }
+}
+
+static void freeKeyset(struct keyset *ks) {
+    free(ks->buf);
+    free(ks->off);
+    free(ks->len);
+}
+
+#define BENCHMARK_RUNS 10
+
+static void benchmark(const char *title, struct keyset *ks) {
+    struct {
+        const char *name;
+        uint64_t (*hash)(const uint8_t*, const size_t, const uint8_t*);
+    } funcs[] = {
+        {"siphash", siphash},
+        {"wyhash", wyhash},
+        {"siphash_nocase", siphash_nocase},
+        {"wyhash_nocase", wyhash_nocase}
+    };
+    uint8_t key[16];
+    size_t bytes = 0;
+    unsigned int j, run;
+    long i;
+
+    for (j = 0; j < sizeof(key); j++) key[j] = rand();
+    for (i = 0; i < ks->count; i++) bytes += ks->len[i];
+    printf("%s: %ld keys, %.1f bytes on average\n", title, ks->count,
+        (double)bytes/ks->count);
+    for (j = 0; j < sizeof(funcs)/sizeof(funcs[0]); j++) {
+        long long start, elapsed;
+        uint64_t sum = 0;
+
+        start = ustime();
+        for (run = 0; run < BENCHMARK_RUNS; run++) {
+            for (i = 0; i < ks->count; i++)
+                sum += funcs[j].hash((uint8_t*)ks->buf+ks->off[i],
+                                     ks->len[i],key);
+        }
+        elapsed = ustime()-start;
+        printf("  %-15s %6.2f ns/key %8.2f MB/s (%llx)\n", funcs[j].name,
+            (double)elapsed*1000/(ks->count*BENCHMARK_RUNS),
+            (double)bytes*BENCHMARK_RUNS/(elapsed ? elapsed : 1),
+            (unsigned long long)(sum & 0xffff));
+    }
+}
+
+/* hash-benchmark [keys] */
+int main(int argc, char **argv) {
+    long count = argc == 2 ? strtol(argv[1],NULL,10) : 1000000;
+    static const int short_keys[] = {100,0,0}, medium_keys[] = {0,100,0},
+                     long_keys[] = {0,0,100}, mixed_keys[] = {70,25,5};
+    struct keyset ks;
+
+    srand(1234);
+    createKeyset(&ks,count,short_keys);
+    benchmark("Short keys",&ks);
+    freeKeyset(&ks);
+    createKeyset(&ks,count,medium_keys);
+    benchmark("Medium keys",&ks);
+    freeKeyset(&ks);
+    createKeyset(&ks,count/4,long_keys);
+    benchmark("Long keys",&ks);
+    freeKeyset(&ks);
+    createKeyset(&ks,count,mixed_keys);
+    benchmark("Mixed keys (70% short, 25% medium, 5% long)",&ks);
+    freeKeyset(&ks);
+    return 0;
+}
+#endif
@@ -183,6 +183,12 @@ size_t zmalloc_size(void *ptr) {
 }
 #endif
 
+/* Return the number of bytes of the allocation that the caller can use,
+ * that unlike zmalloc_size() does not include the size header. */
+size_t zmalloc_usable(void *ptr) {
+    return zmalloc_size(ptr)-PREFIX_SIZE;
+}
+
 void zfree(void *ptr) {
 #ifndef HAVE_MALLOC_SIZE
     void *realptr;
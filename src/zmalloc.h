@@ -94,5 +94,6 @@ void *zmalloc_no_tcache(size_t size);
 #ifndef HAVE_MALLOC_SIZE
 size_t zmalloc_size(void *ptr);
 #endif
+size_t zmalloc_usable(void *ptr);
 
 #endif /* __ZMALLOC_H */
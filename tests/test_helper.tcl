@@ -31,6 +31,7 @@ set ::all_tests {
     unit/other
     unit/multi
     unit/quit
+    unit/networking
     unit/aofrw
     integration/replication
     integration/replication-2
@@ -136,8 +137,11 @@ proc reconnect {args} {
     set client [redis $host $port]
     dict set srv "client" $client
 
-    # select the right db when we don't have to authenticate
-    if {![dict exists $config "requirepass"]} {
+    # select the right db when we don't have to authenticate, cluster
+    # nodes only have DB 0.
+    if {![dict exists $config "requirepass"] &&
+        !([dict exists $config "cluster-enabled"] &&
+          [dict get $config "cluster-enabled"] eq {yes})} {
         $client select 9
     }
 
@@ -219,4 +219,181 @@ start_server {tags {"expire"}} {
         set ttl [r ttl foo]
         assert {$ttl <= 98 && $ttl > 90}
     }
+
+    test {The expire is stored in the key entry once set} {
+        r config set appendonly no
+        r flushall
+        r set foo bar
+        set persistent [r memory usage foo]
+        r expire foo 100
+        set volatile [r memory usage foo]
+        # PERSIST keeps the room for the expire: setting it again must not
+        # change the key size.
+        r persist foo
+        assert_equal -1 [r ttl foo]
+        assert_equal $volatile [r memory usage foo]
+        r expire foo 200
+        assert_equal $volatile [r memory usage foo]
+        list [expr {$volatile-$persistent}] [r ttl foo] [r get foo]
+    } {8 200 bar}
+
+    test {Volatile keys keep their expire after DEBUG RELOAD and SWAPDB} {
+        r flushall
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key:$j $j
+            if {$j % 3 == 0} {r pexpire key:$j [expr {1000000+$j}]}
+        }
+        r debug reload
+        r select 10
+        r swapdb 9 10
+        r select 10
+        set err {}
+        for {set j 0} {$j < 1000} {incr j} {
+            set pttl [r pttl key:$j]
+            set expected [expr {$j % 3 == 0}]
+            if {($pttl > 0) != $expected || [r get key:$j] ne $j} {
+                set err "key:$j pttl $pttl"
+                break
+            }
+        }
+        r select 9
+        list $err [r dbsize]
+    } {{} 0}
+
+    foreach mode {yes no} {
+        test "Expired keys while a child is saving (fork-friendly $mode)" {
+            r flushall
+            r config set fork-friendly $mode
+            r debug populate 100
+            # Keep the child running for about a second.
+            r config set rdb-key-save-delay 10000
+            r bgsave
+            r config set rdb-key-save-delay 0
+            for {set j 0} {$j < 10} {incr j} {r psetex volatile:$j 1 v}
+            after 500
+            assert_equal 1 [status r rdb_bgsave_in_progress]
+            assert_equal [expr {$mode eq {yes}}] \
+                [status r fork_friendly_active]
+            set during [r dbsize]
+            waitForBgsave r
+            wait_for_condition 50 100 {
+                [r dbsize] == 100
+            } else {
+                fail "The expired keys were not reclaimed"
+            }
+            assert_equal 0 [status r current_cow_size]
+            set during
+        } [expr {$mode eq {yes} ? 110 : 100}]
+    }
+    r config set fork-friendly no
+
+    test "Accessed keys are not touched while a child is saving" {
+        r flushall
+        set policy [lindex [r config get maxmemory-policy] 1]
+        r config set maxmemory-policy allkeys-lfu
+        r config set lfu-log-factor 0
+        r set foo bar
+        set freq [r object freq foo]
+        r debug populate 100
+        r config set rdb-key-save-delay 10000
+        r bgsave
+        r config set rdb-key-save-delay 0
+        for {set j 0} {$j < 10} {incr j} {r get foo}
+        assert_equal 1 [status r rdb_bgsave_in_progress]
+        assert_equal $freq [r object freq foo]
+        waitForBgsave r
+        r get foo
+        assert {[r object freq foo] > $freq}
+        r config set lfu-log-factor 10
+        r config set maxmemory-policy $policy
+    }
+}
+
+start_server {tags {"expire"} overrides {active-expire-index yes}} {
+    test {The expires index reclaims exactly the expired keys} {
+        r debug set-active-expire 0
+        r debug populate 1000
+        for {set j 0} {$j < 100} {incr j} {r pexpire key:$j 1}
+        # Keys whose expire was changed, removed or overwritten. The TTL
+        # must not elapse before the change, or the key is expired lazily.
+        for {set j 100} {$j < 200} {incr j} {
+            r pexpire key:$j 100
+            switch [expr {$j % 4}] {
+                0 {r persist key:$j}
+                1 {r expire key:$j 1000}
+                2 {r set key:$j value}
+                3 {r rename key:$j renamed:$j}
+            }
+        }
+        after 150
+        assert_equal 125 [status r expired_stale_keys]
+        assert {[status r expired_stale_lag_ms] > 0}
+        r debug set-active-expire 1
+        wait_for_condition 50 100 {
+            [r dbsize] == 875
+        } else {
+            fail "The expired keys were not reclaimed"
+        }
+        list [status r expired_stale_keys] [r exists renamed:103] \
+             [r ttl key:101] [r ttl key:100]
+    } {0 0 1000 -1}
+
+    test {The expired stale keys count is bounded} {
+        r flushall
+        r debug set-active-expire 0
+        r debug populate 15000
+        r eval {for j=0,14999 do redis.call('pexpire','key:'..j,1) end} 0
+        after 10
+        assert_equal 10000 [status r expired_stale_keys]
+        assert {[status r expired_stale_lag_ms] > 0}
+        r debug set-active-expire 1
+        wait_for_condition 50 100 {
+            [r dbsize] == 0
+        } else {
+            fail "The expired keys were not reclaimed"
+        }
+        status r expired_stale_keys
+    } {0}
+
+    test {The expires index after DEBUG RELOAD, SWAPDB and FLUSHALL} {
+        r flushall
+        r debug set-active-expire 0
+        r debug populate 100
+        for {set j 0} {$j < 10} {incr j} {r pexpire key:$j 100}
+        r debug reload
+        r swapdb 9 10
+        r select 10
+        after 150
+        assert_equal 10 [status r expired_stale_keys]
+        r debug set-active-expire 1
+        wait_for_condition 50 100 {
+            [r dbsize] == 90
+        } else {
+            fail "The expired keys were not reclaimed"
+        }
+        r flushall async
+        r debug set-active-expire 0
+        r set foo bar px 1
+        after 10
+        r select 9
+        status r expired_stale_keys
+    } {1}
+
+    test {The expires index can be enabled and disabled at runtime} {
+        r flushall
+        r config set active-expire-index no
+        r debug set-active-expire 0
+        r debug populate 100
+        for {set j 0} {$j < 20} {incr j} {r pexpire key:$j 1}
+        r config set active-expire-index yes
+        after 10
+        assert_equal 20 [status r expired_stale_keys]
+        r debug set-active-expire 1
+        wait_for_condition 50 100 {
+            [r dbsize] == 80
+        } else {
+            fail "The expired keys were not reclaimed"
+        }
+        r config get active-expire-index
+    } {active-expire-index yes}
 }
@@ -272,4 +272,290 @@ start_server {tags {"keyspace"}} {
         r keys *
         r keys *
     } {dlskeriewrioeuwqoirueioqwrueoqwrueqw}
+
+    test {INFO keysizes tracks the keys by type} {
+        r flushdb
+        r set s1 a
+        r set s2 b
+        r rpush l1 a b c
+        r sadd set1 a
+        r hset h1 f v
+        list [s db9_keys_by_type] [s db9_distrib_zsets_items]
+    } {strings=2,lists=1,sets=1,zsets=0,hashes=1,modules=0 {}}
+
+    test {INFO keysizes histograms follow the size of the values} {
+        r flushdb
+        r set s1 a
+        r set s2 [string repeat x 100]
+        r append s1 bcd
+        r incr counter
+        r rpush l1 a b c
+        r rpush l2 a
+        r rpush l1 d e
+        r lpop l2
+        r rpush l2 a
+        r zadd z1 1 a 2 b
+        r zrem z1 a
+        list [s db9_distrib_strings_sizes] [s db9_distrib_lists_items] \
+             [s db9_distrib_zsets_items]
+    } {1=1,4=1,64=1 1=1,4=1 1=1}
+
+    test {INFO keysizes after overwrites and deletions} {
+        r flushdb
+        r set k1 abc
+        r rpush k2 a b
+        r set k2 value
+        r set k1 [string repeat x 10]
+        r rename k1 k3
+        r del k2
+        list [s db9_keys_by_type] [s db9_distrib_strings_sizes]
+    } {strings=1,lists=0,sets=0,zsets=0,hashes=0,modules=0 8=1}
+
+    test {INFO keysizes with writes to more keys and expires} {
+        r flushdb
+        r sadd src a b c d
+        r sadd dst a
+        r smove src dst b
+        r smove src dst c
+        r append s1 abc
+        r expire s1 100
+        r append s1 defgh
+        r set s2 [string repeat x 20] ex 100
+        r append s2 x
+        r multi
+        r sadd dst e f
+        r append s1 i
+        r exec
+        list [s db9_distrib_sets_items] [s db9_distrib_strings_sizes]
+    } {2=1,4=1 8=1,16=1}
+
+    test {INFO keysizes is preserved across DEBUG RELOAD} {
+        r flushdb
+        r sadd myset a b c d e f g h
+        r hmset myhash a 1 b 2
+        r set mystring [string repeat x 1000]
+        r expire mystring 100
+        set before [r info keysizes]
+        r debug reload
+        assert_equal $before [r info keysizes]
+        list [s db9_distrib_sets_items] [s db9_distrib_hashes_items] \
+             [s db9_distrib_strings_sizes]
+    } {8=1 2=1 512=1}
+
+    test {MEMORY STATS reports the keys by type} {
+        r flushdb
+        r set a b
+        r lpush b c
+        r lpush c d
+        array set memstats [r memory stats]
+        array set dbstats $memstats(db.9)
+        list $dbstats(keys.strings) $dbstats(keys.lists) $dbstats(keys.sets)
+    } {1 2 0}
+
+    test {INFO keysizes is reset by FLUSHDB ASYNC} {
+        r flushdb
+        r set a b
+        r flushdb async
+        r set c [string repeat x 20]
+        list [s db9_keys_by_type] [s db9_distrib_strings_sizes]
+    } {strings=1,lists=0,sets=0,zsets=0,hashes=0,modules=0 16=1}
+}
+
+foreach layout {yes no} {
+    start_server [list overrides [list keyspace-open-addressing $layout] \
+                  tags {"keyspace"}] {
+        test "Keyspace add, lookup and delete (open addressing: $layout)" {
+            r flushdb
+            for {set j 0} {$j < 10000} {incr j} {
+                r set key:$j $j
+            }
+            for {set j 0} {$j < 10000} {incr j 2} {
+                r del key:$j
+            }
+            set err {}
+            for {set j 0} {$j < 10000} {incr j} {
+                set expected [expr {$j % 2 ? $j : {}}]
+                if {[r get key:$j] ne $expected} {
+                    set err "key:$j is wrong"
+                    break
+                }
+            }
+            list $err [r dbsize] [llength [r keys *]]
+        } {{} 5000 5000}
+
+        test "SCAN returns every key while deleting (open addressing: $layout)" {
+            set cur 0
+            set keys {}
+            set j 1
+            while 1 {
+                set res [r scan $cur count 100]
+                set cur [lindex $res 0]
+                lappend keys {*}[lindex $res 1]
+                # Delete keys not seen yet, so that the table shrinks and
+                # the chains of buckets get compacted during the scan.
+                if {$j < 1000} {
+                    r del key:$j
+                    incr j 2
+                }
+                if {$cur == 0} break
+            }
+            set keys [lsort -unique $keys]
+            set missing 0
+            for {set k 1001} {$k < 10000} {incr k 2} {
+                if {[lsearch -sorted $keys key:$k] == -1} {incr missing}
+            }
+            set missing
+        } {0}
+
+        test "RANDOMKEY and DEBUG HTSTATS (open addressing: $layout)" {
+            assert {[r exists [r randomkey]]}
+            set stats [r debug htstats 9]
+            if {$layout} {
+                assert_match {*bucket slots:*} $stats
+            } else {
+                assert {![string match {*bucket slots:*} $stats]}
+            }
+            r flushdb
+            r dbsize
+        } {0}
+
+        test "Big tables are allocated in segments (open addressing: $layout)" {
+            r debug populate 200000
+            wait_for_condition 50 100 {
+                ![string match {*rehashing target*} [r debug htstats 9]]
+            } else {
+                fail "The rehashing of the keyspace did not complete"
+            }
+            set stats [r debug htstats 9]
+            assert {[regexp {allocated segments: (\d+) of (\d+)} $stats \
+                     -> allocated segments]}
+            assert {$segments > 1 && $allocated == $segments}
+            list [r get key:0] [r get key:199999] [r dbsize]
+        } {value:0 value:199999 200000}
+
+        test "Keys added while a child exists keep short chains (open addressing: $layout)" {
+            r flushdb
+            # Stop adding keys while a rehashing is in progress, so that
+            # the child is created in the middle of it. Every addition
+            # performs a rehashing step, and the cron performs none.
+            r config set activerehashing no
+            set j 0
+            while {![string match {*rehashing target*} [r debug htstats 9]]} {
+                r set pre:[incr j] x
+            }
+            # Keep the child running for about two seconds.
+            r config set rdb-key-save-delay [expr {2000000/$j}]
+            r bgsave
+            r config set rdb-key-save-delay 0
+            r config set activerehashing yes
+            r debug populate 200000
+            assert_equal 1 [status r rdb_bgsave_in_progress]
+            set maxchain 0
+            foreach {- len} [regexp -all -inline {max chain length: (\d+)} \
+                             [r debug htstats 9]] {
+                if {$len > $maxchain} {set maxchain $len}
+            }
+            assert {$maxchain < 100}
+            set res [list [r get key:0] [r get key:199999] [r get pre:1] \
+                          [expr {[r dbsize]-$j}]]
+            waitForBgsave r
+            set res
+        } {value:0 value:199999 x 200000}
+    }
+}
+
+start_server {tags {"keyspace"} overrides {keys-filter-threads 2}} {
+    test {KEYS with the pattern matched by helper threads} {
+        r debug populate 100000
+        r set key:1x value px 1
+        r expire key:1 100
+        after 10
+        set keys [r keys key:1*]
+        assert_equal 0 [r exists key:1x]
+        assert {[lsearch $keys key:1] != -1}
+        list [llength $keys] [llength [lsort -unique $keys]] \
+             [llength [r keys *]] [r config get keys-filter-threads]
+    } {11111 11111 100000 {keys-filter-threads 2}}
+}
+
+start_server {tags {"keyspace"} overrides {hash-function wyhash}} {
+    test {The hash function can be selected at startup} {
+        assert_match {*hash_function:wyhash*} [r info server]
+        r config get hash-function
+    } {hash-function wyhash}
+
+    test {Keys, commands and aggregate types with wyhash} {
+        r debug populate 10000
+        r hset myhash Field value
+        r sadd myset a b c
+        # Commands are looked up with the case insensitive hash.
+        list [r GeT key:9999] [r hGET myhash Field] [r scard myset] [r dbsize]
+    } {value:9999 value 3 10002}
+
+    test {The keyspace is preserved by DEBUG RELOAD with wyhash} {
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        r get key:0
+    } {value:0}
+}
+
+start_server {tags {"keyspace"} overrides {cluster-enabled yes}} {
+    set slots {}
+    for {set j 0} {$j < 16384} {incr j} {lappend slots $j}
+    r cluster addslots {*}$slots
+    wait_for_condition 50 100 {
+        [string match {*cluster_state:ok*} [r cluster info]]
+    } else {
+        fail "The cluster did not become available"
+    }
+
+    test {Cluster keyspace is partitioned by hash slot} {
+        r debug populate 10000
+        r set foo bar
+        set slot [r cluster keyslot foo]
+        set keys [r cluster getkeysinslot $slot 1000]
+        assert {[lsearch $keys foo] != -1}
+        assert_equal [llength $keys] [r cluster countkeysinslot $slot]
+        assert_match {*partitioned in 16384 dicts*} [r debug htstats 0]
+        assert {[r exists [r randomkey]]}
+        list [r dbsize] [llength [r keys *]] [r get foo]
+    } {10001 10001 bar}
+
+    test {SCAN visits the keys of every slot of a cluster node} {
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r scan $cur count 100]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        llength [lsort -unique $keys]
+    } {10001}
+
+    test {Cluster keyspace is preserved by DEBUG RELOAD} {
+        set digest [r debug digest]
+        set count [r cluster countkeysinslot [r cluster keyslot foo]]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal $count [r cluster countkeysinslot [r cluster keyslot foo]]
+        r dbsize
+    } {10001}
+
+    test {KEYS and SCAN with a hash tag pattern only visit its slot} {
+        foreach k {a b c d e} {r set "{user1}:$k" $k}
+        r set "{user2}:a" a
+        set res [r scan 0 match "{user1}*" count 1000]
+        assert_equal 0 [lindex $res 0]
+        assert_equal [lsort [lindex $res 1]] [lsort [r keys "{user1}*"]]
+        assert_equal [list "{user2}:a"] [r keys "{user2}*"]
+        llength [lindex $res 1]
+    } {5}
+
+    test {FLUSHALL ASYNC empties every slot of a cluster node} {
+        set slot [r cluster keyslot foo]
+        r flushall async
+        list [r dbsize] [r cluster countkeysinslot $slot] [r randomkey]
+    } {0 0 {}}
 }
@@ -37,3 +37,134 @@ start_server {tags {"lazyfree"}} {
         }
     }
 }
+
+start_server {tags {"lazyfree"} overrides {lazyfree-threads 4}} {
+    test "UNLINK of many big values with multiple lazyfree threads" {
+        set orig_mem [s used_memory]
+        set args {}
+        for {set i 0} {$i < 10000} {incr i} {
+            lappend args $i
+        }
+        for {set j 0} {$j < 20} {incr j} {
+            r sadd "myset:$j" {*}$args
+        }
+        set peak_mem [s used_memory]
+        assert {$peak_mem > $orig_mem+1000000}
+        set keys {}
+        for {set j 0} {$j < 20} {incr j} {
+            lappend keys "myset:$j"
+        }
+        assert_equal 20 [r unlink {*}$keys]
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0 &&
+            [s lazyfree_pending_bytes] == 0 &&
+            [s used_memory] < $orig_mem*2
+        } else {
+            fail "Memory is not reclaimed by the lazyfree threads"
+        }
+    }
+
+    test "FLUSHALL ASYNC with multiple lazyfree threads" {
+        for {set db 9} {$db < 12} {incr db} {
+            r select $db
+            r debug populate 10000
+        }
+        r select 9
+        r flushall async
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0 &&
+            [s lazyfree_pending_bytes] == 0
+        } else {
+            fail "FLUSHALL ASYNC was not completed by the lazyfree threads"
+        }
+        assert_equal 0 [r dbsize]
+    }
+
+    test "FLUSHALL ASYNC does not overestimate the pending bytes" {
+        for {set db 9} {$db < 13} {incr db} {
+            r select $db
+            r debug populate 100000
+        }
+        r select 9
+        # Read the stats right after the databases are handed off, before
+        # the threads release them. FLUSHALL saves the empty dataset when
+        # save points are set, so they are removed: the threads could
+        # complete while the RDB file is synced.
+        set save [lindex [r config get save] 1]
+        r config set save ""
+        r multi
+        r flushall async
+        r info memory
+        set info [lindex [r exec] 1]
+        regexp {\r\nlazyfree_pending_bytes:(\d+)} $info _ pending
+        regexp {\r\nused_memory:(\d+)} $info _ used
+        r config set save $save
+        assert {$pending > 0}
+        assert {$pending <= $used}
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_bytes] == 0
+        } else {
+            fail "FLUSHALL ASYNC was not completed by the lazyfree threads"
+        }
+    }
+}
+
+start_server {tags {"lazyfree"} overrides {lazyfree-incremental yes}} {
+    test "Huge values are freed incrementally by DEL and overwrites" {
+        set orig_mem [s used_memory]
+        r config set hz 1
+        for {set j 0} {$j < 50} {incr j} {
+            set args {}
+            for {set i 0} {$i < 1000} {incr i} {
+                lappend args [expr {$j*1000+$i}] "member:$j:$i"
+            }
+            r zadd myzset {*}$args
+            r hset myhash {*}$args
+            r rpush mylist {*}$args
+            r sadd myset {*}$args
+        }
+        set peak_mem [s used_memory]
+        assert {$peak_mem > $orig_mem+1000000}
+        r del myzset myhash myset
+        r set mylist foo
+        assert_equal 4 [s lazyfree_pending_objects]
+        assert {[s lazyfree_pending_bytes] > 1000000}
+        assert_equal {} [r zrange myzset 0 -1]
+        assert_equal foo [r get mylist]
+        r config set hz 100
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0 &&
+            [s lazyfree_pending_bytes] == 0 &&
+            [s used_memory] < $orig_mem+500000
+        } else {
+            fail "Huge values were not freed incrementally"
+        }
+        r config set hz 10
+    }
+
+    test "Incremental freeing releases the oldest values over the limit" {
+        r config set hz 1
+        set args {}
+        for {set i 0} {$i < 100} {incr i} {lappend args m$i}
+        set keys {}
+        for {set j 0} {$j < 1100} {incr j} {
+            r sadd set:$j {*}$args
+            lappend keys set:$j
+        }
+        # Read the stats in the same transaction, before the event loop
+        # gets a chance to free anything.
+        r multi
+        r del {*}$keys
+        r info memory
+        set info [lindex [r exec] 1]
+        regexp {\r\nlazyfree_pending_objects:(\d+)} $info _ pending
+        assert {$pending > 0 && $pending <= 1024}
+        r config set hz 100
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0
+        } else {
+            fail "Huge values were not freed incrementally"
+        }
+        r config set hz 10
+    }
+}
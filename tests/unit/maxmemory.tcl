@@ -24,7 +24,7 @@ start_server {tags {"maxmemory"}} {
     }
 
     foreach policy {
-        allkeys-random allkeys-lru allkeys-lfu volatile-lru volatile-lfu volatile-random volatile-ttl
+        allkeys-random allkeys-lru allkeys-lfu allkeys-gdsf volatile-lru volatile-lfu volatile-gdsf volatile-random volatile-ttl
     } {
         test "maxmemory - is the memory limit honoured? (policy $policy)" {
             # make sure to start with a blank instance
@@ -98,7 +98,7 @@ start_server {tags {"maxmemory"}} {
     }
 
     foreach policy {
-        volatile-lru volatile-lfu volatile-random volatile-ttl
+        volatile-lru volatile-lfu volatile-gdsf volatile-random volatile-ttl
     } {
         test "maxmemory - policy $policy should only remove volatile keys." {
             # make sure to start with a blank instance
@@ -141,4 +141,131 @@ start_server {tags {"maxmemory"}} {
             }
         }
     }
+
+    test "maxmemory - allkeys-gdsf evicts big values before small ones" {
+        r flushall
+        r config set maxmemory 0
+        r config set maxmemory-policy allkeys-gdsf
+        r config set maxmemory-samples 10
+        for {set j 0} {$j < 200} {incr j} {
+            r set "small:$j" x
+        }
+        for {set j 0} {$j < 20} {incr j} {
+            r set "big:$j" [string repeat x 20000]
+        }
+        # Go 100k under the used memory: a few big values are enough
+        # to get back under the limit.
+        r config set maxmemory [expr {[s used_memory]-100*1024}]
+        r set foo bar
+        set big 0
+        set small 0
+        for {set j 0} {$j < 20} {incr j} {
+            incr big [r exists "big:$j"]
+        }
+        for {set j 0} {$j < 200} {incr j} {
+            incr small [r exists "small:$j"]
+        }
+        r config set maxmemory 0
+        r config set maxmemory-samples 5
+        # Eviction is approximated, so an unlucky sample may still pick
+        # a small key from time to time.
+        assert {$big < 20}
+        assert {$small >= 190}
+    }
+
+    test "maxmemory - background eviction down to the low watermark" {
+        r flushall
+        r config set maxmemory 0
+        r config set maxmemory-policy allkeys-lru
+        for {set j 0} {$j < 1000} {incr j} {
+            r set "key:$j" [string repeat x 2000]
+        }
+        set used [s used_memory]
+        set limit [expr {$used*100/90}]
+        r config set maxmemory-high-watermark 80
+        r config set maxmemory-low-watermark 70
+        r config set maxmemory $limit
+        # Nothing happens until background eviction is enabled.
+        after 200
+        assert_equal 1000 [r dbsize]
+        r config set maxmemory-background-eviction yes
+        # The eviction stops just under the low watermark, so allow for the
+        # memory allocated by the clients after that.
+        wait_for_condition 50 100 {
+            [s eviction_background_active] == 0 &&
+            [s used_memory] <= $limit*70/100+16*1024
+        } else {
+            fail "Background eviction did not reach the low watermark"
+        }
+        assert {[s evicted_keys_background] > 0}
+        assert {[r dbsize] < 1000}
+        # Under the low watermark and with no new writes nothing more is
+        # evicted.
+        set keys [r dbsize]
+        after 200
+        assert_equal $keys [r dbsize]
+        r config set maxmemory-background-eviction no
+        r config set maxmemory 0
+    }
+
+    test "maxmemory - sampling is weighted by the memory of every DB" {
+        r flushall
+        r config set maxmemory 0
+        r config set maxmemory-policy allkeys-lru
+        assert_error {*maxmemory-eviction-pool-size*} \
+            {r config set maxmemory-eviction-pool-size 8}
+        r config set maxmemory-eviction-pool-size 128
+        r select 10
+        for {set j 0} {$j < 500} {incr j} {
+            r set "big:$j" [string repeat x 2000]
+        }
+        r select 9
+        for {set j 0} {$j < 20} {incr j} {
+            r set "small:$j" x
+        }
+        r config set maxmemory [expr {[s used_memory]-200*1024}]
+        r set foo bar
+        set small 0
+        for {set j 0} {$j < 20} {incr j} {
+            incr small [r exists "small:$j"]
+        }
+        r select 10
+        set big [r dbsize]
+        r select 9
+        r config set maxmemory 0
+        r config set maxmemory-eviction-pool-size 64
+        # The keys of DB 9 are a tiny fraction of the memory, so they are
+        # rarely sampled, while the keys of DB 10 are evicted.
+        assert {$big < 500}
+        assert {$small >= 18}
+    }
+
+    test "maxmemory - eviction quality compared with a perfect LRU" {
+        r flushall
+        r config set maxmemory 0
+        r config set maxmemory-policy allkeys-lru
+        r config resetstat
+        for {set j 0} {$j < 200} {incr j} {
+            r set "old:$j" [string repeat x 2000]
+        }
+        # The LRU clock resolution is one second.
+        after 2100
+        for {set j 0} {$j < 200} {incr j} {
+            r set "new:$j" [string repeat x 2000]
+        }
+        r config set maxmemory [expr {[s used_memory]-100*1024}]
+        r set foo bar
+        set new 0
+        for {set j 0} {$j < 200} {incr j} {
+            incr new [r exists "new:$j"]
+        }
+        r config set maxmemory 0
+        # Only old keys should have been evicted, that is, the ones a
+        # perfect LRU would pick.
+        assert {$new >= 195}
+        assert {[s evicted_keys] > 0}
+        assert {[s evicted_keys_avg_idle_ms] >= 2000}
+        assert {[s evicted_keys_ideal_idle_ms] >= 2000}
+        assert {[s eviction_lru_quality] > 0.9}
+    }
 }
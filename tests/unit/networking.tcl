@@ -0,0 +1,342 @@
+start_server {tags {"network"} overrides {io-threads 2 io-threads-do-reads yes}} {
+    test {Threaded I/O: pipelined commands from many clients} {
+        set clients {}
+        for {set j 0} {$j < 10} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        for {set i 0} {$i < 100} {incr i} {
+            foreach rd $clients {
+                $rd incr counter
+                $rd rpush mylist $i
+            }
+        }
+        foreach rd $clients {
+            for {set i 0} {$i < 200} {incr i} {
+                $rd read
+            }
+            $rd close
+        }
+        list [r get counter] [r llen mylist]
+    } {1000 1000}
+
+    test {Threaded I/O: large replies are fully transferred} {
+        set payload [string repeat x 100000]
+        r set bigkey $payload
+        set clients {}
+        for {set j 0} {$j < 10} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        foreach rd $clients {
+            $rd get bigkey
+        }
+        foreach rd $clients {
+            assert_equal $payload [$rd read]
+            $rd close
+        }
+    }
+
+    test {Threaded I/O: protocol errors are reported} {
+        set rd [redis_deferring_client]
+        $rd write "*1\r\n\$x\r\n"
+        $rd flush
+        catch {$rd read} e
+        $rd close
+        set e
+    } {*Protocol error*}
+
+    test {Threaded I/O: INFO reports the load of each thread} {
+        set info [r info threads]
+        assert_match {*io_threads:2*} $info
+        assert_match {*io_thread_0:batches=*} $info
+        assert_match {*io_thread_1:batches=*} $info
+        assert_match {*io_threaded_writes_processed:*} [r info stats]
+    }
+}
+
+start_server {tags {"network"}} {
+    test {Replies spanning many reply list nodes are sent in order} {
+        r del mylist
+        set elements {}
+        for {set i 0} {$i < 5000} {incr i} {
+            lappend elements "element:$i:[string repeat x [expr {$i % 100}]]"
+        }
+        r rpush mylist {*}$elements
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 5} {incr j} {
+            $rd lrange mylist 0 -1
+        }
+        for {set j 0} {$j < 5} {incr j} {
+            assert_equal $elements [$rd read]
+        }
+        $rd close
+    }
+
+    test {INFO reports the bytes written per syscall} {
+        set syscalls [s total_net_output_syscalls]
+        assert {$syscalls > 0}
+        assert {[s net_output_bytes_per_syscall] > 0}
+        r ping
+        assert {[s total_net_output_syscalls] > $syscalls}
+    }
+
+    test {Argument objects are reused across commands} {
+        set reused [s argv_objects_reused]
+        r set foo bar
+        for {set j 0} {$j < 10} {incr j} {
+            r get foo
+        }
+        assert {[s argv_objects_reused] >= $reused+20}
+    }
+
+    test {Values retained by commands are not affected by argument reuse} {
+        r flushdb
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 200} {incr j} {
+            $rd set key:$j [string repeat v [expr {$j % 45}]]:$j
+            $rd rpush list:[expr {$j % 3}] element:$j
+            $rd sadd set element:$j
+            $rd get key:[expr {$j / 2}]
+        }
+        for {set j 0} {$j < 200} {incr j} {
+            $rd read; $rd read; $rd read; $rd read
+        }
+        $rd close
+        r multi
+        r set queued [string repeat q 20]
+        r get key:0
+        assert_equal [list OK :0] [r exec]
+        for {set j 0} {$j < 200} {incr j} {
+            assert_equal [string repeat v [expr {$j % 45}]]:$j [r get key:$j]
+        }
+        assert_equal [string repeat q 20] [r get queued]
+        assert_equal 200 [r scard set]
+        assert_equal element:2 [r lindex list:2 0]
+    }
+}
+
+start_server {tags {"network"} overrides {zero-copy-reply-threshold 1024}} {
+    test {Large values are replied by reference} {
+        set payload [string repeat abc 1000]
+        r set bigval $payload
+        set bytes [s total_zero_copy_reply_bytes]
+        assert_equal $payload [r get bigval]
+        assert_equal [list $payload {} $payload] [r mget bigval nokey bigval]
+        assert_equal [expr {$bytes+3*3000}] [s total_zero_copy_reply_bytes]
+    }
+
+    test {Values replied by reference are not modified by later writes} {
+        set rd [redis_deferring_client]
+        $rd get bigval
+        $rd append bigval xyz
+        $rd setrange bigval 0 zzz
+        $rd get bigval
+        assert_equal [string repeat abc 1000] [$rd read]
+        assert_equal 3003 [$rd read]
+        assert_equal 3003 [$rd read]
+        assert_equal "zzz[string repeat abc 999]xyz" [$rd read]
+        $rd close
+    }
+
+    test {Values replied by reference survive FLUSHALL ASYNC} {
+        set rd [redis_deferring_client]
+        $rd get bigval
+        $rd flushall async
+        $rd get bigval
+        assert_equal "zzz[string repeat abc 999]xyz" [$rd read]
+        assert_equal OK [$rd read]
+        assert_equal {} [$rd read]
+        $rd close
+    }
+
+    test {Values replied by reference count in the output buffer limits} {
+        r config set client-output-buffer-limit {normal 1mb 0 0}
+        r set bigval [string repeat x 100000]
+        set rd [redis_deferring_client]
+        $rd client setname obuf-test
+        for {set j 0} {$j < 200} {incr j} {
+            $rd get bigval
+        }
+        $rd flush
+        wait_for_condition 50 100 {
+            ![string match {*name=obuf-test*} [r client list]]
+        } else {
+            fail "Client not closed on output buffer limit"
+        }
+        $rd close
+        r config set client-output-buffer-limit {normal 0 0 0}
+    }
+}
+
+start_server {tags {"network"} overrides {io-uring yes}} {
+    # Only builds with USE_IOURING=yes on kernels supporting io_uring use
+    # it: the epoll fallback is already covered by the other tests.
+    if {[s multiplexing_api] eq {io_uring}} {
+        test {The io_uring event loop serves pipelines and big replies} {
+            r set foo bar
+            r set big [string repeat x 1000000]
+            set clients {}
+            for {set j 0} {$j < 50} {incr j} {
+                set rd [redis_deferring_client]
+                for {set k 0} {$k < 10} {incr k} {$rd get foo}
+                # Replies that don't fit the socket buffer need the
+                # writable event to be armed and re-armed.
+                $rd get big
+                $rd flush
+                lappend clients $rd
+            }
+            foreach rd $clients {
+                for {set k 0} {$k < 10} {incr k} {
+                    assert_equal bar [$rd read]
+                }
+                assert_equal 1000000 [string length [$rd read]]
+                $rd close
+            }
+            r ping
+        } {PONG}
+
+        test {The io_uring event loop survives clients killed while armed} {
+            set clients {}
+            for {set j 0} {$j < 20} {incr j} {
+                set rd [redis_deferring_client]
+                $rd client setname armed-$j
+                $rd read
+                lappend clients $rd
+            }
+            # The killed clients have a poll request armed for reading,
+            # that must be removed before their file descriptor is reused.
+            assert_equal 20 [r client kill type normal skipme yes]
+            foreach rd $clients {$rd close}
+            for {set j 0} {$j < 20} {incr j} {
+                set rd [redis_deferring_client]
+                $rd ping
+                assert_equal PONG [$rd read]
+                $rd close
+            }
+            r dbsize
+        } {2}
+    }
+}
+
+start_server {tags {"network"} overrides {io-uring no}} {
+    test {The io_uring event loop can be disabled at startup} {
+        assert {[s multiplexing_api] ne {io_uring}}
+        r set foo bar
+        r get foo
+    } {bar}
+}
+
+start_server {tags {"network"} overrides {tcp-listeners 4 accept-time-budget 1}} {
+    test {Clients connect to multiple SO_REUSEPORT listeners} {
+        assert_equal {tcp-listeners 4} [r config get tcp-listeners]
+        set clients {}
+        for {set j 0} {$j < 20} {incr j} {
+            set c [redis [srv 0 host] [srv 0 port] 0]
+            $c select 9
+            $c set key:$j $j
+            lappend clients $c
+        }
+        for {set j 0} {$j < 20} {incr j} {
+            assert_equal $j [r get key:$j]
+            [lindex $clients $j] close
+        }
+    }
+
+    test {Pending connections are accepted across event loop iterations} {
+        set rd [redis_deferring_client]
+        $rd debug sleep 0.5
+        $rd flush
+        after 100
+        # The kernel completes these handshakes while the server sleeps,
+        # so they all wait in the accept queues at the same time.
+        set socks {}
+        for {set j 0} {$j < 30} {incr j} {
+            lappend socks [socket [srv 0 host] [srv 0 port]]
+        }
+        assert_equal OK [$rd read]
+        foreach s $socks {
+            fconfigure $s -translation binary
+            puts -nonewline $s "PING\r\n"
+            flush $s
+        }
+        foreach s $socks {
+            assert_equal "+PONG" [string trim [gets $s]]
+            close $s
+        }
+        $rd close
+        assert {[s accept_time_budget_reached] > 0}
+    }
+
+    test {Connections are accepted while a script is busy} {
+        r config set lua-time-limit 10
+        set rd [redis_deferring_client]
+        $rd eval {while true do end} 0
+        $rd flush
+        after 200
+        # Events are processed by processEventsWhileBlocked() without ever
+        # calling beforeSleep(), so every accept must get a fresh budget.
+        for {set j 0} {$j < 100} {incr j} {
+            set c [redis [srv 0 host] [srv 0 port] 0]
+            catch {$c ping} e
+            assert_match {BUSY*} $e
+            $c close
+        }
+        set c [redis [srv 0 host] [srv 0 port] 0]
+        assert_equal OK [$c script kill]
+        $c close
+        catch {$rd read} e
+        assert_match {*killed*} $e
+        $rd close
+        r ping
+    } {PONG}
+
+    test {accept-time-budget can be changed at runtime} {
+        r config set accept-time-budget 0
+        assert_equal {accept-time-budget 0} [r config get accept-time-budget]
+        r ping
+    } {PONG}
+}
+
+start_server {tags {"network"}} {
+    test {Replies of long pipelines are flushed together} {
+        r config resetstat
+        set s [socket [srv 0 host] [srv 0 port]]
+        fconfigure $s -translation binary
+        puts -nonewline $s "SELECT 9\r\n[string repeat "PING\r\n" 20000]"
+        flush $s
+        assert_equal "+OK" [string trim [gets $s]]
+        for {set j 0} {$j < 20000} {incr j} {
+            assert_equal "+PONG" [string trim [gets $s]]
+        }
+        close $s
+        assert {[s reply_flushes_deferred] > 0}
+    }
+
+    test {CLIENT LIST reports commands and writes of the client} {
+        set rd [redis_deferring_client]
+        $rd client setname counted
+        $rd read
+        for {set j 0} {$j < 10} {incr j} {$rd ping}
+        for {set j 0} {$j < 10} {incr j} {$rd read}
+        regexp {name=counted [^\n]* tot-cmds=(\d+) tot-writes=(\d+)} \
+            [r client list] - cmds writes
+        $rd close
+        # SELECT, CLIENT SETNAME, 10 PINGs.
+        assert_equal 12 $cmds
+        assert {$writes >= 1 && $writes <= $cmds}
+    }
+
+    test {reply-flush-budget 0 disables deferred flushes} {
+        r config set reply-flush-budget 0
+        r config resetstat
+        set s [socket [srv 0 host] [srv 0 port]]
+        fconfigure $s -translation binary
+        puts -nonewline $s [string repeat "PING\r\n" 20000]
+        flush $s
+        for {set j 0} {$j < 20000} {incr j} {
+            assert_equal "+PONG" [string trim [gets $s]]
+        }
+        close $s
+        r config set reply-flush-budget 100
+        s reply_flushes_deferred
+    } {0}
+}
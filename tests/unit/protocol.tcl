@@ -68,6 +68,85 @@ start_server {tags {"protocol"}} {
         assert_error "*unbalanced*" {r read}
     }
 
+    test "Pipelined mix of inline and multibulk commands" {
+        reconnect
+        set val [string repeat x 100]
+        set proto {}
+        for {set j 0} {$j < 100} {incr j} {
+            append proto "*3\r\n\$3\r\nSET\r\n"
+            append proto "\$[string length key:$j]\r\nkey:$j\r\n"
+            append proto "\$[string length $val$j]\r\n$val$j\r\n"
+            append proto "get key:$j\r\n"
+        }
+        r write $proto
+        r flush
+        for {set j 0} {$j < 100} {incr j} {
+            assert_equal OK [r read]
+            assert_equal $val$j [r read]
+        }
+    }
+
+    test "Pipelined GETs are looked up in batches" {
+        reconnect
+        r flushdb
+        for {set j 0} {$j < 100} {incr j 2} {
+            r set key:$j $j
+        }
+        set proto {}
+        for {set j 0} {$j < 100} {incr j} {
+            append proto "*2\r\n\$3\r\nGET\r\n"
+            append proto "\$[string length key:$j]\r\nkey:$j\r\n"
+            # A write in the middle of the batch must be seen.
+            if {$j == 50} {
+                append proto "*3\r\n\$3\r\nSET\r\n\$6\r\nkey:51\r\n"
+                append proto "\$3\r\nnew\r\n"
+            }
+        }
+        r write $proto
+        r flush
+        set err {}
+        for {set j 0} {$j < 100} {incr j} {
+            set expected [expr {$j % 2 ? {} : $j}]
+            if {$j == 51} {set expected new}
+            set reply [r read]
+            if {$reply ne $expected} {
+                set err "GET key:$j returned '$reply'"
+                break
+            }
+            if {$j == 50} {assert_equal OK [r read]}
+        }
+        set err
+    } {}
+
+    test "Commands split at every byte are parsed" {
+        reconnect
+        set proto "*3\r\n\$3\r\nSET\r\n\$3\r\nfoo\r\n\$12\r\n0123456789ab\r\n"
+        append proto "get [string repeat f 40]\r\n"
+        set fd [r channel]
+        foreach char [split $proto {}] {
+            puts -nonewline $fd $char
+            flush $fd
+            after 1
+        }
+        assert_equal OK [r read]
+        assert_equal {} [r read]
+        r get foo
+    } {0123456789ab}
+
+    test "Protocol error after pipelined commands" {
+        reconnect
+        r write "*1\r\n\$4\r\nPING\r\n*1\r\n\$4\r\nPING\r\n*1\r\nfoo\r\n"
+        r flush
+        assert_equal PONG [r read]
+        assert_equal PONG [r read]
+        assert_error "*expected '$', got 'f'*" {r read}
+    }
+
+    test "INFO reports the RESP scanner in use" {
+        reconnect
+        assert_match {*resp_scanner:*} [r info server]
+    }
+
     set c 0
     foreach seq [list "\x00" "*\x00" "$\x00"] {
         incr c
@@ -223,6 +223,117 @@ start_server {tags {"pubsub"}} {
         concat $reply1 $reply2
     } {punsubscribe {} 0 unsubscribe {} 0}
 
+    test "PUBLISH/PSUBSCRIBE with patterns sharing a literal prefix" {
+        set rd1 [redis_deferring_client]
+        set long [string repeat x 100]
+        set patterns [list * news.* news.sports.* news.s?orts.x \
+                           {news.[st]*} {news\.sports.x} news.weather.* \
+                           ${long}.* ${long}.y]
+        assert_equal {1 2 3 4 5 6 7 8 9} [psubscribe $rd1 $patterns]
+
+        assert_equal 6 [r publish news.sports.x hello]
+        set matched {}
+        for {set j 0} {$j < 6} {incr j} {
+            lappend matched [lindex [$rd1 read] 1]
+        }
+        assert_equal [lsort {* news.* news.sports.* news.s?orts.x
+                             {news.[st]*} {news\.sports.x}}] [lsort $matched]
+
+        assert_equal 1 [r publish news weather]
+        assert_equal {pmessage * news weather} [$rd1 read]
+        assert_equal 3 [r publish ${long}.y hello]
+        for {set j 0} {$j < 3} {incr j} {$rd1 read}
+
+        # Removing patterns from the index leaves the others in place.
+        punsubscribe $rd1 [list * news.* news.sports.* ${long}.*]
+        assert_equal 3 [r publish news.sports.x hello]
+        assert_equal 1 [r publish ${long}.y hello]
+        assert_equal 0 [r publish ${long}.z hello]
+
+        $rd1 close
+    }
+
+    test "Identical patterns of different clients" {
+        set rd1 [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+        assert_equal {1} [psubscribe $rd1 {foo.*}]
+        assert_equal {1 2} [psubscribe $rd2 {foo.* bar.*}]
+        assert_equal 3 [r pubsub numpat]
+        assert_equal 2 [r publish foo.1 hello]
+        assert_equal {pmessage foo.* foo.1 hello} [$rd1 read]
+        assert_equal {pmessage foo.* foo.1 hello} [$rd2 read]
+
+        assert_equal {0} [punsubscribe $rd1 {foo.*}]
+        assert_equal 2 [r pubsub numpat]
+        assert_equal 1 [r publish foo.1 hello]
+        assert_equal {pmessage foo.* foo.1 hello} [$rd2 read]
+
+        $rd2 close
+        wait_for_condition 50 100 {
+            [r pubsub numpat] == 0
+        } else {
+            fail "Patterns of the closed client still subscribed"
+        }
+        assert_equal 0 [r publish foo.1 hello]
+        $rd1 close
+    }
+
+    test "Large messages are shared by all the subscribers" {
+        set clients {}
+        for {set j 0} {$j < 10} {incr j} {
+            set rd [redis_deferring_client]
+            subscribe $rd {bigchan}
+            lappend clients $rd
+        }
+        set prd [redis_deferring_client]
+        psubscribe $prd {big*}
+        set msg [string repeat "4kb!" 1024]
+        set shared [s total_zero_copy_reply_bytes]
+        assert_equal 11 [r publish bigchan $msg]
+        assert_equal 11 [r publish bigchan small]
+        foreach rd $clients {
+            assert_equal [list message bigchan $msg] [$rd read]
+            assert_equal {message bigchan small} [$rd read]
+            $rd close
+        }
+        assert_equal [list pmessage big* bigchan $msg] [$prd read]
+        assert_equal {pmessage big* bigchan small} [$prd read]
+        $prd close
+        assert {[s total_zero_copy_reply_bytes] >= $shared+11*4096}
+    }
+
+    test "zero-copy-reply-threshold 0 disables shared messages" {
+        r config set zero-copy-reply-threshold 0
+        set rd [redis_deferring_client]
+        subscribe $rd {bigchan}
+        set msg [string repeat "4kb!" 1024]
+        set shared [s total_zero_copy_reply_bytes]
+        assert_equal 1 [r publish bigchan $msg]
+        assert_equal [list message bigchan $msg] [$rd read]
+        $rd close
+        r config set zero-copy-reply-threshold 16kb
+        assert_equal $shared [s total_zero_copy_reply_bytes]
+    }
+
+    test "Shared messages count in the pubsub output buffer limits" {
+        r config set client-output-buffer-limit {pubsub 64k 0 0}
+        set rd [redis_deferring_client]
+        $rd client setname slow-subscriber
+        $rd read
+        subscribe $rd {bigchan}
+        set msg [string repeat x 8192]
+        for {set j 0} {$j < 100} {incr j} {
+            r publish bigchan $msg
+        }
+        wait_for_condition 50 100 {
+            ![string match {*name=slow-subscriber*} [r client list]]
+        } else {
+            fail "Subscriber not closed on output buffer limit"
+        }
+        $rd close
+        r config set client-output-buffer-limit {pubsub 32mb 8mb 60}
+    }
+
     ### Keyspace events notification tests
 
     test "Keyspace notifications: we receive keyspace notifications" {
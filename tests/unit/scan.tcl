@@ -53,6 +53,49 @@ start_server {tags {"scan"}} {
         assert_equal 100 [llength $keys]
     }
 
+    test "SCAN TYPE" {
+        r flushdb
+        r debug populate 1000
+        for {set j 0} {$j < 10} {incr j} {r rpush list:$j a}
+
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r scan $cur type list]
+            set cur [lindex $res 0]
+            set k [lindex $res 1]
+            lappend keys {*}$k
+            if {$cur == 0} break
+        }
+
+        set keys [lsort -unique $keys]
+        assert_equal 10 [llength $keys]
+        r sadd myset a
+        assert_error "*syntax*" {r sscan myset 0 type set}
+    }
+
+    test "SCAN MATCH with a BUDGET returns COUNT matching keys" {
+        r flushdb
+        r debug populate 10000
+
+        # A generous budget: the first call finds all the ten keys.
+        set res [r scan 0 match "key:1?" count 10 budget 5000000]
+        assert_equal 10 [llength [lsort -unique [lindex $res 1]]]
+
+        # A tiny budget: the calls return early, but still cover the
+        # whole keyspace.
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r scan $cur match "key:2?" count 10 budget 1]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        assert_error "*syntax*" {r scan 0 budget 0}
+        llength [lsort -unique $keys]
+    } {10}
+
     foreach enc {intset hashtable} {
         test "SSCAN with encoding $enc" {
             # Create the Set
@@ -263,6 +263,15 @@ start_server {
         r sinter set1 set2 set3
     } {}
 
+    test "SINTER does not look up the keys after a non existing one" {
+        r del set1 set2 set3
+        r sadd set1 a b c
+        r sadd set3 b c d
+        r config resetstat
+        r sinter set1 set2 set3
+        list [s keyspace_hits] [s keyspace_misses]
+    } {1 1}
+
     test "SINTER with same integer elements but different encoding" {
         r del set1 set2
         r sadd set1 1 2 3
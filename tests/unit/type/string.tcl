@@ -119,6 +119,30 @@ start_server {tags {"string"}} {
         r mget foo baazz bar myset
     } {BAR {} FOO {}}
 
+    test {MGET with more keys than a lookup batch} {
+        r flushdb
+        set args {}
+        set expected {}
+        for {set j 0} {$j < 50} {incr j} {
+            if {$j % 3 == 0} {
+                r set key:$j $j
+                lappend expected $j
+            } elseif {$j % 3 == 1} {
+                r set key:$j $j px 1
+                lappend expected {}
+            } else {
+                lappend expected {}
+            }
+            lappend args key:$j
+        }
+        # Repeat a key with an expire after it, so that the batch needs to
+        # look it up again once the first occurrence expired it.
+        lappend args key:1 key:0
+        lappend expected {} 0
+        after 5
+        list [expr {[r mget {*}$args] eq $expected}] [r dbsize]
+    } {1 17}
+
     test {GETSET (set new value)} {
         r del foo
         list [r getset foo xyz] [r get foo]
@@ -0,0 +1,351 @@
+/* Replay an access trace against a cache of fixed size and report the hit
+ * ratio obtained by the different Redis eviction policies.
+ *
+ * The eviction is simulated the way evict.c does it: every time memory is
+ * needed a few random keys are sampled and ranked inside a small pool, and
+ * the best candidate of the pool is evicted. The LFU counter is the same
+ * logarithmic counter of lfu-simulation.c, and the GDSF score is the one of
+ * the allkeys-gdsf policy: the key size divided by the number of accesses
+ * estimated from the counter.
+ *
+ * The trace is a text file with one access per line, in the form:
+ *
+ *     <key> <size in bytes>
+ *
+ * Without a trace a synthetic one is generated, with a power law access
+ * pattern and key sizes ranging from a few bytes to tens of kilobytes.
+ *
+ * Usage: eviction-simulation [--trace <file>] [--maxmemory <bytes>]
+ *                            [--samples <count>] [--decay <accesses>]
+ *                            [--keys <count>] [--requests <count>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define COUNTER_INIT_VAL 5
+#define LOG_FACTOR 10
+#define EVPOOL_SIZE 16
+
+enum policy {
+    POLICY_RANDOM,
+    POLICY_LRU,
+    POLICY_LFU,
+    POLICY_GDSF,
+    POLICY_COUNT
+};
+
+static const char *policy_names[] = {"random", "lru", "lfu", "gdsf"};
+
+struct entry {
+    char *name;             /* Key name, only used to load the trace. */
+    long next;              /* Next entry in the same hash bucket, or -1. */
+    uint64_t size;          /* Size of the value, from the trace. */
+    uint64_t atime;         /* Time of the last access. */
+    uint64_t decrtime;      /* Time of the last LFU counter decrement. */
+    uint8_t counter;        /* Logarithmic counter. */
+    long pos;               /* Position in the resident array, or -1. */
+};
+
+struct access {
+    long idx;               /* Index of the key in the entries array. */
+    uint64_t size;
+};
+
+struct poolEntry {
+    double score;
+    struct entry *e;
+};
+
+struct entry *entries;          /* All the keys of the trace. */
+long numentries, entries_size;
+struct access *trace;           /* The accesses to replay. */
+long tracelen, trace_size;
+long *buckets;                  /* Hash table used to load the trace. */
+long numbuckets = 1<<20;
+
+struct entry **resident;        /* Keys currently in memory. */
+long numresident;
+uint64_t used_memory;
+
+uint64_t maxmemory = 0;
+int samples = 5;
+uint64_t decay = 100000;        /* Decrement the LFU counters every N accesses. */
+long keys = 100000;
+long requests = 5000000;
+
+/* ------------------------------ LFU counter ------------------------------ */
+
+/* Increment a counter logarithmically, like LFULogIncr() does. */
+uint8_t log_incr(uint8_t counter) {
+    if (counter == 255) return counter;
+    double r = (double)rand()/RAND_MAX;
+    double baseval = counter-COUNTER_INIT_VAL;
+    if (baseval < 0) baseval = 0;
+    double limit = 1.0/(baseval*LOG_FACTOR+1);
+    if (r < limit) counter++;
+    return counter;
+}
+
+/* Return the counter of the entry, decremented by one for every decay
+ * period elapsed since the last decrement, like LFUDecrAndReturn(). */
+uint8_t scan_entry(struct entry *e, uint64_t now) {
+    uint64_t periods = (now-e->decrtime)/decay;
+
+    if (periods) {
+        e->counter = (periods > e->counter) ? 0 : e->counter-periods;
+        e->decrtime += periods*decay;
+    }
+    return e->counter;
+}
+
+/* Estimate the accesses from the counter, like LFUEstimateAccesses(). */
+double estimate_accesses(uint8_t counter) {
+    double n;
+
+    if (counter < COUNTER_INIT_VAL)
+        return (double)(counter+1)/(COUNTER_INIT_VAL+1);
+    n = counter-COUNTER_INIT_VAL;
+    return 1+n+LOG_FACTOR*n*(n-1)/2;
+}
+
+/* ------------------------------ The cache ------------------------------- */
+
+void cache_add(struct entry *e, uint64_t size, uint64_t now) {
+    e->size = size;
+    e->atime = now;
+    e->decrtime = now;
+    e->counter = COUNTER_INIT_VAL;
+    e->pos = numresident;
+    resident[numresident++] = e;
+    used_memory += size;
+}
+
+void cache_remove(struct entry *e) {
+    resident[e->pos] = resident[--numresident];
+    resident[e->pos]->pos = e->pos;
+    e->pos = -1;
+    used_memory -= e->size;
+}
+
+/* Score of an eviction candidate: the higher the better. */
+double score(struct entry *e, enum policy p, uint64_t now) {
+    switch(p) {
+    case POLICY_LRU: return now-e->atime;
+    case POLICY_LFU: return 255-scan_entry(e,now);
+    case POLICY_GDSF: return e->size/estimate_accesses(scan_entry(e,now));
+    default: return 0;
+    }
+}
+
+/* Sample a few resident keys and add them to the pool, that is sorted by
+ * ascending score like the pool of evict.c. */
+void pool_populate(struct poolEntry *pool, enum policy p, uint64_t now) {
+    int j, k;
+
+    for (j = 0; j < samples; j++) {
+        struct entry *e = resident[rand() % numresident];
+        double s = score(e,p,now);
+
+        for (k = 0; k < EVPOOL_SIZE; k++)
+            if (pool[k].e == e) break;
+        if (k != EVPOOL_SIZE) continue;
+
+        k = 0;
+        while (k < EVPOOL_SIZE && pool[k].e && pool[k].score < s) k++;
+        if (k == 0 && pool[EVPOOL_SIZE-1].e != NULL) {
+            continue;
+        } else if (k < EVPOOL_SIZE && pool[k].e == NULL) {
+            /* Empty slot. */
+        } else if (pool[EVPOOL_SIZE-1].e == NULL) {
+            memmove(pool+k+1,pool+k,sizeof(pool[0])*(EVPOOL_SIZE-k-1));
+        } else {
+            k--;
+            memmove(pool,pool+1,sizeof(pool[0])*k);
+        }
+        pool[k].score = s;
+        pool[k].e = e;
+    }
+}
+
+/* Evict keys until the cache fits in maxmemory. */
+void cache_evict(struct poolEntry *pool, enum policy p, uint64_t now) {
+    int k;
+
+    while (used_memory > maxmemory && numresident) {
+        struct entry *best = NULL;
+
+        if (p == POLICY_RANDOM) {
+            best = resident[rand() % numresident];
+        } else {
+            while (best == NULL) {
+                pool_populate(pool,p,now);
+                for (k = EVPOOL_SIZE-1; k >= 0; k--) {
+                    if (pool[k].e == NULL) continue;
+                    if (pool[k].e->pos != -1) best = pool[k].e;
+                    pool[k].e = NULL;
+                    if (best) break;
+                }
+            }
+        }
+        cache_remove(best);
+    }
+}
+
+/* Replay the trace with the specified policy, and report the ratio of
+ * accesses and bytes served from memory. */
+void simulate(enum policy p) {
+    struct poolEntry pool[EVPOOL_SIZE];
+    uint64_t hits = 0, hit_bytes = 0, total_bytes = 0;
+    long j;
+
+    memset(pool,0,sizeof(pool));
+    for (j = 0; j < numentries; j++) entries[j].pos = -1;
+    numresident = 0;
+    used_memory = 0;
+    srand(1234);
+
+    for (j = 0; j < tracelen; j++) {
+        struct entry *e = entries+trace[j].idx;
+        uint64_t now = j;
+
+        total_bytes += trace[j].size;
+        if (e->pos != -1 && e->size == trace[j].size) {
+            hits++;
+            hit_bytes += e->size;
+            scan_entry(e,now);
+            e->counter = log_incr(e->counter);
+            e->atime = now;
+            continue;
+        }
+        /* Miss, or the value changed size: store the new value. */
+        if (e->pos != -1) cache_remove(e);
+        if (trace[j].size > maxmemory) continue;
+        cache_add(e,trace[j].size,now);
+        cache_evict(pool,p,now);
+    }
+    printf("%-8s hit ratio: %6.2f%%  byte hit ratio: %6.2f%%\n",
+        policy_names[p],
+        (double)hits*100/tracelen,
+        total_bytes ? (double)hit_bytes*100/total_bytes : 0);
+}
+
+/* ----------------------------- Trace loading ----------------------------- */
+
+uint64_t hash_name(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    while (*s) h = (h ^ (unsigned char)*s++) * 1099511628211ULL;
+    return h;
+}
+
+long lookup_or_create(const char *name) {
+    long bucket = hash_name(name) & (numbuckets-1), idx;
+
+    for (idx = buckets[bucket]; idx != -1; idx = entries[idx].next)
+        if (!strcmp(entries[idx].name,name)) return idx;
+    if (numentries == entries_size) {
+        entries_size = entries_size ? entries_size*2 : 1024;
+        entries = realloc(entries,sizeof(*entries)*entries_size);
+    }
+    idx = numentries++;
+    memset(entries+idx,0,sizeof(*entries));
+    entries[idx].name = strdup(name);
+    entries[idx].next = buckets[bucket];
+    buckets[bucket] = idx;
+    return idx;
+}
+
+void add_access(long idx, uint64_t size) {
+    if (tracelen == trace_size) {
+        trace_size = trace_size ? trace_size*2 : 1024;
+        trace = realloc(trace,sizeof(*trace)*trace_size);
+    }
+    trace[tracelen].idx = idx;
+    trace[tracelen].size = size;
+    tracelen++;
+}
+
+void load_trace(const char *filename) {
+    FILE *fp = fopen(filename,"r");
+    char name[1024];
+    unsigned long long size;
+    long j;
+
+    if (fp == NULL) {
+        perror("Opening the trace");
+        exit(1);
+    }
+    buckets = malloc(sizeof(*buckets)*numbuckets);
+    for (j = 0; j < numbuckets; j++) buckets[j] = -1;
+    while (fscanf(fp,"%1023s %llu",name,&size) == 2) {
+        long idx = lookup_or_create(name);
+        /* The data set size is computed with the last size seen. */
+        entries[idx].size = size;
+        add_access(idx,size);
+    }
+    fclose(fp);
+}
+
+/* Power law access pattern as in lfu-simulation.c. The size of every key
+ * is fixed and log-uniformly distributed between 16 bytes and 64k. */
+void generate_trace(void) {
+    long j;
+
+    entries_size = numentries = keys;
+    entries = calloc(entries_size,sizeof(*entries));
+    for (j = 0; j < keys; j++)
+        entries[j].size = 16 << (rand() % 13);
+    for (j = 0; j < requests; j++) {
+        long idx = 1;
+        while ((rand() % 21) != 0 && idx < keys) idx *= 2;
+        if (idx > keys) idx = keys;
+        idx = rand() % idx;
+        add_access(idx,entries[idx].size);
+    }
+}
+
+int main(int argc, char **argv) {
+    char *filename = NULL;
+    uint64_t total = 0;
+    int j;
+
+    for (j = 1; j < argc; j++) {
+        int lastarg = j == argc-1;
+        if (!strcmp(argv[j],"--trace") && !lastarg) {
+            filename = argv[++j];
+        } else if (!strcmp(argv[j],"--maxmemory") && !lastarg) {
+            maxmemory = strtoull(argv[++j],NULL,10);
+        } else if (!strcmp(argv[j],"--samples") && !lastarg) {
+            samples = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--decay") && !lastarg) {
+            decay = strtoull(argv[++j],NULL,10);
+        } else if (!strcmp(argv[j],"--keys") && !lastarg) {
+            keys = atol(argv[++j]);
+        } else if (!strcmp(argv[j],"--requests") && !lastarg) {
+            requests = atol(argv[++j]);
+        } else {
+            fprintf(stderr,"Unknown or incomplete option '%s'\n",argv[j]);
+            exit(1);
+        }
+    }
+    if (samples < 1 || decay == 0 || keys < 1) {
+        fprintf(stderr,"Invalid options\n");
+        exit(1);
+    }
+
+    if (filename) load_trace(filename);
+    else generate_trace();
+    resident = malloc(sizeof(*resident)*(numentries ? numentries : 1));
+
+    /* Size the cache to 10% of the data set if not specified. */
+    for (j = 0; j < numentries; j++) total += entries[j].size;
+    if (maxmemory == 0) maxmemory = total/10;
+
+    printf("%ld keys, %ld accesses, %llu bytes of data, maxmemory %llu\n",
+        numentries, tracelen, (unsigned long long)total,
+        (unsigned long long)maxmemory);
+    for (j = 0; j < POLICY_COUNT; j++) simulate(j);
+    return 0;
+}